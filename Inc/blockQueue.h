@@ -0,0 +1,58 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Block queue
+ * ===========
+ *
+ * Bounded single producer/single consumer queue of data blocks. Released blocks are
+ * reused and memory is only allocated when none are free, so the footprint grows with how
+ * far the consumer falls behind rather than with the maximum depth. When the queue is full the
+ * producer waits, which pushes back on whatever it is reading from.
+ */
+
+#ifndef _BLOCK_QUEUE_
+#define _BLOCK_QUEUE_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "generics.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================================================================================================
+
+struct blockqueueStats
+{
+    uint32_t maxDepth;                        /* Highest number of blocks waiting to be consumed */
+    uint32_t blocksAllocated;                 /* Number of blocks that have had memory allocated */
+    uint32_t stalls;                          /* Number of times the producer had to wait for space */
+    uint64_t stallTimeuS;                     /* Total time the producer spent waiting for space */
+};
+
+struct blockqueueHandle;
+
+// ====================================================================================================
+
+/* Producer side */
+uint8_t *blockqueueGetWriteBlock( struct blockqueueHandle *q );
+void blockqueueCommit( struct blockqueueHandle *q, size_t len );
+
+/* Consumer side */
+uint8_t *blockqueueGetReadBlock( struct blockqueueHandle *q, size_t *len );
+void blockqueueRelease( struct blockqueueHandle *q );
+
+struct blockqueueStats *blockqueueGetStats( struct blockqueueHandle *q );
+uint32_t blockqueueGetDepth( struct blockqueueHandle *q );
+
+void blockqueueDelete( struct blockqueueHandle *q );
+struct blockqueueHandle *blockqueueCreate( size_t blockSize, uint32_t numBlocks );
+
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+#endif
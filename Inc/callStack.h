@@ -0,0 +1,96 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Shadow call stack
+ * =================
+ *
+ * Stack of the calls currently in progress, as reconstructed from trace. Frames are held in
+ * a single array which doubles in size as the stack deepens (up to a configurable limit) and
+ * is never shrunk, so pushing and popping are O(1) with no allocation in the steady state.
+ * Each frame carries the call record resolved when the call was made, so a return never has
+ * to look it up again.
+ */
+
+#ifndef _CALL_STACK_
+#define _CALL_STACK_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ext_fileformats.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================================================================================================
+
+#define CALLSTACK_DEFAULT_MAX_DEPTH (1024)      /* Default limit for depth of a call stack */
+
+struct callFrame
+{
+    struct subcall *s;                          /* Call record for this call */
+    uint64_t inTicks;                           /* Time (or instruction count) when the call was made */
+    uint32_t node;                              /* Calling context the call is running in */
+};
+
+struct callStack
+{
+    struct callFrame *frame;                    /* The frames, bottom of stack first */
+    uint32_t depth;                             /* Number of frames in use */
+    uint32_t allocated;                         /* Number of frames allocated */
+    uint32_t maxDepth;                          /* Depth beyond which the stack is assumed to be bogus */
+    uint32_t highWater;                         /* Deepest the stack has been */
+    uint64_t resyncs;                           /* Number of times the stack had to be abandoned */
+};
+
+// ====================================================================================================
+
+void callStackGrow( struct callStack *c );
+void callStackResync( struct callStack *c );
+
+// ====================================================================================================
+static inline struct callFrame *callStackPush( struct callStack *c )
+
+/* Return a new frame on the top of the stack. If the stack is too deep then it's lost track */
+/* (most likely because of missing trace) so it's abandoned and started again.              */
+
+{
+    if ( c->depth == c->allocated )
+    {
+        callStackGrow( c );
+    }
+
+    if ( ++c->depth > c->highWater )
+    {
+        c->highWater = c->depth;
+    }
+
+    return &c->frame[c->depth - 1];
+}
+// ====================================================================================================
+static inline struct callFrame *callStackPop( struct callStack *c )
+
+/* Remove and return the frame on the top of the stack, or NULL if it's empty */
+
+{
+    return ( c->depth ) ? &c->frame[--c->depth] : NULL;
+}
+// ====================================================================================================
+static inline struct callFrame *callStackTop( struct callStack *c )
+
+/* Return the frame on the top of the stack, or NULL if it's empty */
+
+{
+    return ( c->depth ) ? &c->frame[c->depth - 1] : NULL;
+}
+// ====================================================================================================
+
+void callStackDelete( struct callStack *c );
+bool callStackInit( struct callStack *c, uint32_t maxDepth );
+
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,78 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Calling context tree
+ * ====================
+ *
+ * Prefix tree of the call paths seen, so time can be attributed to a function in the context of
+ * everything that called it (e.g. for flame graphs). Each node is keyed by the address of the
+ * function called and holds the count and inclusive time of calls reaching it by that path.
+ *
+ * Nodes are allocated from an arena of fixed size blocks and referred to by index, so nodes are
+ * small, never move and are all freed together. Direct recursion is folded into the node that
+ * recursed, so recursive code doesn't grow the tree without limit. The total number of nodes is
+ * capped; once the cap is reached, calls along paths not already in the tree are charged to the
+ * deepest context that is.
+ */
+
+#ifndef _CCT_
+#define _CCT_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================================================================================================
+
+#define CCT_ROOT              (0)                  /* Index of the root (caller unknown) node */
+#define CCT_DEFAULT_MAX_NODES (1024*1024)          /* Default limit on number of nodes */
+
+#define CCT_BLOCK_SHIFT       (12)                 /* Nodes are allocated 1<<CCT_BLOCK_SHIFT at a time */
+#define CCT_BLOCK_NODES       (1<<CCT_BLOCK_SHIFT)
+
+struct cctNode
+{
+    uint32_t key;                               /* Address of the function called */
+    uint32_t parent;                            /* Context it was called from */
+    uint32_t child;                             /* First context it called into */
+    uint32_t sibling;                           /* Next context called from the same parent */
+    uint64_t count;                             /* Number of calls in this context */
+    uint64_t inclusive;                         /* Time spent in them, including everything they called */
+};
+
+struct cct
+{
+    struct cctNode **block;                     /* The arena */
+    uint32_t blocks;                            /* Number of blocks in use */
+    uint32_t blocksAllocated;                   /* ...and that there's space to record */
+    uint32_t nodes;                             /* Number of nodes in use */
+    uint32_t maxNodes;                          /* Limit on number of nodes */
+    uint64_t truncated;                         /* Calls which had to be charged to a shorter path */
+};
+
+// ====================================================================================================
+static inline struct cctNode *cctNode( struct cct *t, uint32_t n )
+
+/* Return node n */
+
+{
+    return &t->block[n >> CCT_BLOCK_SHIFT][n & ( CCT_BLOCK_NODES - 1 )];
+}
+// ====================================================================================================
+
+uint32_t cctCall( struct cct *t, uint32_t parent, uint32_t key );
+void cctReturn( struct cct *t, uint32_t node, uint32_t parent, uint64_t ticks );
+size_t cctMemory( struct cct *t );
+
+void cctDelete( struct cct *t );
+bool cctInit( struct cct *t, uint32_t maxNodes );
+
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+#endif
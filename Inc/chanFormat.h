@@ -0,0 +1,62 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Channel format programs
+ * =======================
+ *
+ * A printf-style channel format (as given with -c) compiled once into a list of literal spans
+ * and typed conversions, so that formatting a software message is a walk down the list with
+ * hand-written integer and fixed point conversion rather than a trip through printf. How the
+ * message feeds the conversions follows the long standing rules for channel formats; a format
+ * with a floating point conversion gets the value as a float, one with %c is run for each byte
+ * of the message, and anything else gets the value as a 32 bit integer.
+ */
+
+#ifndef _CHAN_FORMAT_
+#define _CHAN_FORMAT_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "msgDecoder.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================================================================================================
+
+enum chanFormatMode { CF_MODE_INT, CF_MODE_CHAR, CF_MODE_FLOAT };
+
+struct chanFormatOp
+{
+    uint8_t type;                               /* Literal or conversion to perform */
+    uint8_t flags;                              /* Conversion flags (-+ #0) */
+    uint8_t length;                             /* Length modifier (only h and hh change anything) */
+    int16_t width;                              /* Minimum field width */
+    int16_t precision;                          /* Precision, -1 if none given */
+    uint16_t litOffset;                         /* For a literal, where it is in the text... */
+    uint16_t litLen;                            /* ...and how long it is */
+    char *spec;                                 /* Conversion as written, for those handed to snprintf */
+};
+
+struct chanFormat
+{
+    enum chanFormatMode mode;                   /* How the message is fed to the conversions */
+    uint32_t numOps;                            /* Number of operations in the program */
+    struct chanFormatOp *op;                    /* ...and the operations */
+    char *text;                                 /* Literal text of the format, with %% reduced to % */
+};
+
+// ====================================================================================================
+
+int chanFormatRun( struct chanFormat *f, struct swMsg *m, char *op, int len );
+
+void chanFormatDelete( struct chanFormat *f );
+struct chanFormat *chanFormatCompile( const char *fmt );
+
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+#endif
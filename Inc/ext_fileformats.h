@@ -81,11 +81,24 @@ struct subcall
     UT_hash_handle hh;
 };
 
+/* Handle for a trace-event stream */
+struct ext_ff_trace;
+
+/* Calling context tree, from cct.h */
+struct cct;
 
 // ====================================================================================================
 bool ext_ff_outputDot( char *dotfile, struct subcall *subcallList, struct SymbolSet *ss );
 bool ext_ff_outputProfile( char *profile, char *elffile, char *deleteMaterial, bool includeVisits, uint64_t timelen,
                            struct execEntryHash *insthead, struct subcall *subcallList, struct SymbolSet *ss );
+bool ext_ff_outputPprof( char *pproffile, char *elffile, char *deleteMaterial, uint64_t timelen,
+                         struct execEntryHash *insthead, struct subcall *subcallList, struct cct *t, struct SymbolSet *ss );
+bool ext_ff_outputFolded( char *foldedfile, struct cct *t, struct execEntryHash *insthead, struct SymbolSet *ss );
+
+struct ext_ff_trace *ext_ff_traceOpen( char *tracefile );
+void ext_ff_traceBegin( struct ext_ff_trace *t, uint32_t depth, const char *name, bool isException, uint64_t tstamp );
+void ext_ff_traceEnd( struct ext_ff_trace *t, uint32_t depth, uint64_t tstamp );
+bool ext_ff_traceClose( struct ext_ff_trace *t );
 // ====================================================================================================
 
 #ifdef __cplusplus
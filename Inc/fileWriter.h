@@ -15,9 +15,10 @@
 #include "generics.h"
 #include "fileWriterProtocol.h"
 #include "msgDecoder.h"
+#include "msgBus.h"
 
 // ====================================================================================================
-bool filewriterProcess( struct swMsg *m );
-bool filewriterInit( char *basedir );
+bool filewriterInit( char *basedir, struct msgBus *b );
+void filewriterShutdown( void );
 // ====================================================================================================
 #endif
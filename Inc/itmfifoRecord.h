@@ -0,0 +1,45 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * orbfifo Binary Record Format
+ * ============================
+ *
+ */
+
+#ifndef _ITMFIFO_RECORD_H_
+#define _ITMFIFO_RECORD_H_
+
+#include <stdint.h>
+
+// A channel set up for records (with -r) carries a stream header followed by fixed size records,
+// one for each software message received on the channel. Both are 16 bytes and naturally aligned,
+// so record n of a permafile is at offset 16 * ( n + 1 ) and a reader can mmap the file and index
+// it directly. All fields are in host byte order. A fifo starts a fresh stream, with its own
+// header, each time a reader opens it.
+//
+// The timestamp is reconstructed from the ITM local timestamp packets, so it is in target
+// timestamp ticks since the stream started, and is zero until the first one arrives.
+
+#define ITMFIFO_RECORD_MAGIC   "ORBR"       // Magic at the start of the stream header
+#define ITMFIFO_RECORD_VERSION (1)
+
+struct itmfifoStreamHeader
+{
+    char magic[4];                          // ITMFIFO_RECORD_MAGIC
+    uint16_t version;                       // ITMFIFO_RECORD_VERSION
+    uint16_t recordLen;                     // Size of each record that follows
+    uint32_t channel;                       // ITM channel the records came from
+    uint32_t reserved;
+};
+
+struct itmfifoRecord
+{
+    uint64_t ts;                            // Target time of the message
+    uint8_t channel;                        // ITM channel it arrived on
+    uint8_t len;                            // Number of bytes of value that are valid (1, 2 or 4)
+    uint8_t timeStatus;                     // Accuracy of ts (as enum timeDelay in itmDecoder.h)
+    uint8_t reserved;
+    uint32_t value;                         // The message itself
+};
+
+#endif
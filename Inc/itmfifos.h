@@ -23,21 +23,28 @@ extern "C" {
 #define HW_CHANNEL    (NUM_CHANNELS)         /* Make the hardware fifo on the end of the software ones */
 #define HWFIFO_NAME "hwevent"                /* Name for the hardware channel */
 
+#define ITMFIFO_DEFAULT_BATCH    (64)        /* Messages queued before they're written out */
+#define ITMFIFO_DEFAULT_FLUSH_MS (10)        /* ...or longest they wait before being written out */
+
 struct Channel;
 struct itmfifosHandle;
+struct msgBus;
 
 /* Fifos running */
 void itmfifoForceSync( struct itmfifosHandle *f, bool synced );                  /* Force sync status */
 void itmfifoProtocolPump( struct itmfifosHandle *f, uint8_t c );                 /* Send undecoded data to the fifo */
 
 /* Getters and setters */
-void itmfifoSetChannel( struct itmfifosHandle *f, int chan, char *n, char *s );
+bool itmfifoSetChannel( struct itmfifosHandle *f, int chan, char *n, char *s );
+void itmfifoSetChannelRecords( struct itmfifosHandle *f, int chan, char *n );
 void itmfifoSetChanPath( struct itmfifosHandle *f, char *s );
+void itmfifoSetBatch( struct itmfifosHandle *f, int batch, int flushInterval );
 void itmfifoSetUseTPIU( struct itmfifosHandle *f, bool s );
 void itmfifoSetForceITMSync( struct itmfifosHandle *f, bool s );
 void itmfifoSettpiuITMChannel( struct itmfifosHandle *f, int channel );
 char *itmfifoGetChannelName( struct itmfifosHandle *f, int chan );
 char *itmfifoGetChannelFormat( struct itmfifosHandle *f, int chan );
+bool itmfifoGetChannelRecords( struct itmfifosHandle *f, int chan );
 char *itmfifoGetChanPath( struct itmfifosHandle *f );
 bool itmfifoGetUseTPIU( struct itmfifosHandle *f );
 struct TPIUCommsStats *itmfifoGetCommsStats( struct itmfifosHandle *f );
@@ -45,9 +52,10 @@ struct ITMDecoderStats *itmfifoGetITMDecoderStats( struct itmfifosHandle *f );
 bool itmfifoGetForceITMSync( struct itmfifosHandle *f );
 int itmfifoGettpiuITMChannel( struct itmfifosHandle *f );
 void itmfifoUsePermafiles( struct itmfifosHandle *f, bool usePermafilesSet );
+struct msgBus *itmfifoGetBus( struct itmfifosHandle *f );                        /* For further subscribers, once created */
 
 /* Filewriting */
-void itmfifoFilewriter( struct itmfifosHandle *f, bool useFilewriter, char *workingPath );
+void itmfifoFilewriter( struct itmfifosHandle *f, bool useFilewriter, char *workingPath ); /* After itmfifoCreate */
 
 /* Fifos management */
 bool itmfifoCreate( struct itmfifosHandle *f );                                  /* Create the fifo set */
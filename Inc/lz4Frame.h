@@ -0,0 +1,62 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * LZ4 frame compression
+ * =====================
+ *
+ * Enough of the LZ4 frame format (independent blocks, no checksums) to write trace captures
+ * that the standard lz4 tools understand, and to read them back along with anything those
+ * tools produce without linked blocks or a dictionary. There's no compression library to hand,
+ * so the block codec is here too; it's the simple single pass hash matcher, which does very
+ * well on trace with its repeating syncs and addresses.
+ *
+ * The writer hands each block to a separate thread to be compressed and written, so the
+ * capture never waits on either.
+ */
+
+#ifndef _LZ4_FRAME_
+#define _LZ4_FRAME_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LZ4FRAME_MAGIC          (0x184D2204)    /* Start of an LZ4 frame */
+#define LZ4FRAME_MAX_HEADER     (19)            /* Longest frame header there can be */
+#define LZ4FRAME_BLOCK_SIZE     (4 * 1024 * 1024) /* Block size we write */
+#define LZ4FRAME_UNCOMPRESSED   (0x80000000)    /* Flag in a block size for a stored block */
+
+struct lz4FrameInfo
+{
+    size_t headerLen;                           /* Length of the frame header */
+    size_t blockMax;                            /* Largest block there'll be */
+    bool blockChecksum;                         /* Blocks are followed by a checksum */
+};
+
+struct lz4FrameWriter;
+
+// ====================================================================================================
+
+/* Block codec */
+size_t lz4FrameBound( size_t len );
+size_t lz4FrameCompressBlock( uint32_t *hashTable, const uint8_t *src, size_t len, uint8_t *dst );
+ssize_t lz4FrameDecompressBlock( const uint8_t *src, size_t len, uint8_t *dst, size_t dstLen );
+
+/* Frame reading */
+bool lz4FrameReadHeader( const uint8_t *b, size_t len, struct lz4FrameInfo *i );
+
+/* Frame writing, compressed on a thread of its own */
+bool lz4FrameWriterWrite( struct lz4FrameWriter *w, const uint8_t *b, size_t len );
+bool lz4FrameWriterClose( struct lz4FrameWriter *w, uint64_t *written );
+struct lz4FrameWriter *lz4FrameWriterCreate( int fd );
+
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+#endif
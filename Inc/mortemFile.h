@@ -0,0 +1,84 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Post mortem monitor for parallel trace : Saved capture file format
+ * ===================================================================
+ *
+ * A saved capture is a single self-describing file laid out as;
+ *
+ *   struct mortemFileHeader
+ *   raw trace                 (traceLen bytes, TPIU already stripped)
+ *   struct mortemCheckpoint[] (numCheckpoints entries)
+ *   struct mortemEvent[]      (numEvents entries)
+ *   event text                (eventTextLen bytes of zero terminated strings)
+ *
+ * Every section starts on an 8 byte boundary and all values are in host byte order, so the
+ * whole thing can be mmapped and used in place. Line numbers in the indexes are for the
+ * rendering at the time of the save, folded or not as MFF_FOLDED says.
+ */
+
+#ifndef _MORTEM_FILE_
+#define _MORTEM_FILE_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MORTEM_FILE_MAGIC       "ORBMORT"       /* 7 chars + terminator */
+#define MORTEM_FILE_VERSION     (3)
+#define MORTEM_FILE_EXT         ".mortem"       /* Extension used for saved captures */
+#define MORTEM_FILE_NAMELEN     (256)           /* Space for the elf file name */
+#define MORTEM_FILE_ALIGN(x)    ( ( ( x ) + 7 ) & ~7ULL )
+
+/* Flags for decoder configuration at time of capture */
+#define MFF_ALT_ADDR            ( 1 << 0 )      /* Alternate address encoding was in use */
+#define MFF_TPIU                ( 1 << 1 )      /* Trace was extracted from TPIU (channel is valid) */
+#define MFF_FOLDED              ( 1 << 2 )      /* Line numbers in the indexes are for the folded rendering */
+
+struct mortemFileHeader
+{
+    char     magic[8];                          /* MORTEM_FILE_MAGIC */
+    uint32_t version;                           /* MORTEM_FILE_VERSION */
+    uint32_t headerLen;                         /* Length of this header, for compatibility */
+    uint32_t flags;                             /* MFF_xxx flags */
+    uint32_t channel;                           /* TPIU channel the trace was taken from */
+    uint32_t buflen;                            /* Length of the post-mortem buffer at capture */
+    uint32_t numCheckpoints;                    /* Number of entries in checkpoint index */
+    uint32_t numEvents;                         /* Number of entries in event index */
+    uint32_t numLines;                          /* Number of lines in the rendering the indexes refer to */
+
+    uint64_t traceOffset;                       /* Location of the raw trace */
+    uint64_t traceLen;                          /* ...and its length */
+    uint64_t checkpointOffset;                  /* Location of the checkpoint index */
+    uint64_t eventOffset;                       /* Location of the event index */
+    uint64_t eventTextOffset;                   /* Location of the event text */
+    uint64_t eventTextLen;                      /* ...and its length */
+    uint64_t saveTimeuS;                        /* Host time when this was saved */
+
+    /* Identity of the elf file the trace was decoded against */
+    uint64_t elfSize;                           /* Size of the elf file */
+    int64_t  elfMtime;                          /* Modification time of the elf file */
+    uint64_t elfHash;                           /* FNV-1a hash of the contents of the elf file */
+    char     elfName[MORTEM_FILE_NAMELEN];      /* Name of the elf file */
+};
+
+/* A point in the trace where decode can be restarted (an A-sync) and the rendered line it led to */
+struct mortemCheckpoint
+{
+    uint32_t traceOffset;                       /* Offset of the A-sync in the raw trace */
+    uint32_t line;                              /* Rendered line number at that point */
+};
+
+/* A pre-rendered event line */
+struct mortemEvent
+{
+    uint32_t line;                              /* Rendered line number of this event */
+    uint32_t textOffset;                        /* Offset of its text in the event text */
+};
+
+#ifdef __cplusplus
+}
+#endif
+#endif
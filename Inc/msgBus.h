@@ -0,0 +1,92 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Decoded message bus
+ * ===================
+ *
+ * A single producer, multiple consumer ring of decoded messages. The decoder publishes each
+ * message once, stamped with the target time it arrived at, and every subscriber reads the same
+ * copy at its own pace from its own thread, taking whatever has built up as one batch. The
+ * producer only has to copy the message in and, for each subscriber interested in that type of
+ * message, count it towards waking the subscriber, so adding another subscriber costs the
+ * decoder almost nothing.
+ *
+ * When the ring is full the slowest subscriber is holding things up. A lossless bus waits for
+ * it, as does any bus for a message that a lossless subscriber wants, otherwise the new message
+ * is dropped and counted. Subscribers that can't afford to miss anything (e.g. the filewriter,
+ * where a gap corrupts the file) subscribe as lossless, and everything else can still be shed.
+ */
+
+#ifndef _MSG_BUS_
+#define _MSG_BUS_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "msgDecoder.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MSGBUS_MAX_SUBS     (8)                 /* Most subscribers a bus can have */
+#define MSGBUS_TYPE(x)      (1U<<(x))           /* Bit for message type x in a subscriber type mask */
+#define MSGBUS_ALL_TYPES    (0xffffffffU)
+
+// ====================================================================================================
+
+struct msgBusEntry
+{
+    struct msg m;                               /* The decoded message */
+    uint64_t targetTs;                          /* Target time it arrived at, from the local timestamps */
+    uint8_t timeStatus;                         /* ...and how good that is (as enum timeDelay) */
+};
+
+typedef void ( *msgBusWakeFn )( void *ctx );
+
+struct msgBusSub
+{
+    struct msgBus *b;                           /* Bus this subscription is to */
+    uint32_t rp;                                /* Next entry to be read, only moved by the subscriber */
+    uint32_t types;                             /* Message types that count towards waking it */
+    bool lossless;                              /* None of those types may be dropped */
+    uint32_t batch;                             /* ...how many to wait for before doing so */
+    uint32_t pending;                           /* ...and how many have been published since */
+    msgBusWakeFn wake;                          /* How to wake it */
+    void *ctx;                                  /* ...and what to tell it */
+};
+
+struct msgBus
+{
+    struct msgBusEntry *e;                      /* The ring itself */
+    uint32_t len;                               /* ...its length (a power of 2) */
+    uint32_t wp;                                /* Next entry to be written */
+    uint32_t minrp;                             /* Slowest subscriber, as last seen by the producer */
+    uint32_t types;                             /* Message types anyone subscribes to */
+    uint32_t losslessTypes;                     /* ...and ones a lossless subscriber does */
+    bool lossless;                              /* Wait for room rather than dropping any messages */
+    uint64_t dropped;                           /* Messages dropped for want of room */
+    int numSubs;
+    struct msgBusSub sub[MSGBUS_MAX_SUBS];
+};
+
+// ====================================================================================================
+
+/* Producer side */
+bool msgBusPublish( struct msgBus *b, struct msg *m, uint64_t targetTs, uint8_t timeStatus );
+void msgBusWakeAll( struct msgBus *b );
+
+/* Subscriber side */
+uint32_t msgBusPull( struct msgBusSub *s, struct msgBusEntry **e );
+void msgBusRelease( struct msgBusSub *s, uint32_t n );
+
+/* Set up, before anything is published */
+struct msgBusSub *msgBusSubscribe( struct msgBus *b, uint32_t types, uint32_t batch, bool lossless, msgBusWakeFn wake, void *ctx );
+bool msgBusInit( struct msgBus *b, uint32_t len, bool lossless );
+void msgBusDelete( struct msgBus *b );
+
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+#endif
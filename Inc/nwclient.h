@@ -24,6 +24,8 @@ struct nwclientsHandle;
 // ====================================================================================================
 
 void nwclientSend( struct nwclientsHandle *h, uint32_t len, uint8_t *buffer );
+bool nwclientConnected( struct nwclientsHandle *h );
+bool nwclientPending( struct nwclientsHandle *h );
 
 void nwclientShutdown( struct nwclientsHandle *h );
 bool nwclientShutdownComplete( struct nwclientsHandle *h );
@@ -0,0 +1,68 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * orbstat Record Format
+ * =====================
+ *
+ */
+
+#ifndef _ORBSTAT_PROT_H_
+#define _ORBSTAT_PROT_H_
+
+// Each event is a record of back to back writes to one ITM channel, starting with a header. The size
+// of each write matters;
+//
+// 32 bit, top two bits clear - A code address (code addresses are below 0x40000000)
+// 32 bit, either top bit set - A record header, RRRR followed by 28 bits of type specific content
+// 16 bit                     - A complete Short Return record, tttttttttttttttt
+//
+// t - Low bits of the target cycle counter when the event happened. A receiver extends these to the
+//     full count, so a short time field can only be used when it's closer to the previous record
+//     than the field can hold.
+//
+// Record types;
+// Call            - RRRR tttttttttttttttttttttttttttt, followed by the call site and the called
+//                   function (12 bytes in total)
+// Exception       - As Call, from exception entry, where the call site (an EXC_RETURN value) is
+//                   sent with its top nibble cleared (12 bytes)
+// Return          - RRRR tttttttttttttttttttttttttttt, with nothing following (4 bytes)
+// Short Call      - RRRR tttttttttttt oooooooooooooooo, followed by the called function. o is the
+//                   signed distance of the call site from the function, in halfwords (8 bytes)
+// Short Exception - RRRR tttttttttttt eeeeeeeeeeeeeeee, followed by the called function. e is the
+//                   bottom of the EXC_RETURN value, the rest of which is all ones (8 bytes)
+// Short Return    - A 16 bit write of the time (2 bytes)
+//
+// A return doesn't say what it's returning from; that's whatever the matching call went to.
+// Every word following a header is a code address, so anything that can't be one is always a header,
+// and a receiver that has lost part of a record picks up again at the next one.
+//
+// The original In/Out records (0x4 and 0x5 with a 24 bit time, each followed by the call site and
+// the called function) are still understood, but don't resynchronise.
+
+#define OS_CHANNEL          (30)          // ITM Channel to be used
+
+#define OS_REC_MASK         (0xF0000000)
+#define OS_REC_IN           (0x40000000)  // Original format call
+#define OS_REC_OUT          (0x50000000)  // Original format return
+#define OS_REC_RETURN       (0x80000000)
+#define OS_REC_SHORT_CALL   (0x90000000)
+#define OS_REC_SHORT_EXC    (0xA0000000)
+#define OS_REC_CALL         (0xC0000000)
+#define OS_REC_EXCEPTION    (0xD0000000)
+
+#define OS_IS_HEADER(x)     (((x)&0xC0000000)!=0)
+
+#define OS_TIME_MASK        (0x0FFFFFFF)
+#define OS_TIME_BITS        (28)
+#define OS_IN_OUT_TIME_MASK (0x00FFFFFF)
+#define OS_IN_OUT_TIME_BITS (24)
+#define OS_SHORT_TIME_MASK  (0x0FFF0000)  // Time in a Short Call or Short Exception header
+#define OS_SHORT_TIME_SHIFT (16)
+#define OS_SHORT_TIME_BITS  (12)
+#define OS_SHORT_ARG_MASK   (0x0000FFFF)  // Call site offset or EXC_RETURN in a short header
+#define OS_SHORT_RET_BITS   (16)          // Time in a Short Return
+
+#define OS_EXC_RETURN_BITS  (0xF0000000)  // Top nibble removed from an exception call site
+#define OS_SHORT_EXC_BITS   (0xFFFF0000)  // Part of an EXC_RETURN left out of a Short Exception
+
+#endif
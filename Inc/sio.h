@@ -24,18 +24,21 @@ extern "C" {
 struct SIOInstance;
 
 /* Events that can be returned by the handler */
-enum SIOEvent { SIO_EV_NONE, SIO_EV_HOLD, SIO_EV_QUIT, SIO_EV_SAVE, SIO_EV_CONSUMED, SIO_EV_SURFACE, SIO_EV_DIVE, SIO_EV_FOPEN };
+enum SIOEvent { SIO_EV_NONE, SIO_EV_HOLD, SIO_EV_QUIT, SIO_EV_SAVE, SIO_EV_CONSUMED, SIO_EV_SURFACE, SIO_EV_DIVE, SIO_EV_FOPEN, SIO_EV_FOLD };
 
 /* Types of line (each with their own display mechanism & colours */
-enum LineType { LT_SOURCE, LT_ASSEMBLY, LT_NASSEMBLY, LT_MU_SOURCE, LT_EVENT, LT_LABEL, LT_FILE, LT_DEBUG  };
+/* (For LT_LOOP the line field carries the number of folded iterations rather than a line number) */
+enum LineType { LT_SOURCE, LT_ASSEMBLY, LT_NASSEMBLY, LT_MU_SOURCE, LT_EVENT, LT_LABEL, LT_FILE, LT_DEBUG, LT_LOOP };
+
+/* How a folded loop is presented */
+#define LOOP_FOLD_FMT       "        ...previous iteration repeated %d more time%s..."
 
 /* Definition for a single line...collections of these are what get displayed */
 struct line
 {
-    enum LineType lt;
-    bool isRef;
     char *buffer;
     int32_t line;
+    enum LineType lt;
 };
 
 // ====================================================================================================
@@ -0,0 +1,113 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Segmented, indexed trace capture files
+ * ======================================
+ *
+ * A capture is the raw stream from the probe, cut into segments as it arrives and laid out as;
+ *
+ *   struct traceFileHeader
+ *   struct traceFileSegment + payload    (repeated for each segment)
+ *   struct traceFileIndex
+ *   struct traceFileIndexEntry[]         (numSegments entries)
+ *   struct traceFileIndex                (same again, so it can be found from the end of the file)
+ *
+ * Each segment records when its first byte reached the host, where it sits in the stream and
+ * where the first sync in it is, so a reader can start anywhere in a long capture without
+ * decoding everything before it. A capture that was cut short has no index, but the segments
+ * can still be walked from the front. All values are in host byte order.
+ *
+ * The reader takes plain flat captures too, in which case only byte offsets can be used to
+ * pick where to replay from, and either kind can be LZ4 compressed (see lz4Frame.h).
+ */
+
+#ifndef _TRACE_FILE_
+#define _TRACE_FILE_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TRACEFILE_MAGIC         "ORBCAP1"       /* 7 chars + terminator */
+#define TRACEFILE_VERSION       (1)
+#define TRACEFILE_SEG_MAGIC     (0x4d474553)    /* 'SEGM' */
+#define TRACEFILE_INDEX_MAGIC   (0x58444e49)    /* 'INDX' */
+#define TRACEFILE_NO_SYNC       (UINT64_MAX)    /* No sync was found in a segment */
+#define TRACEFILE_NO_END        (UINT64_MAX)    /* Replay until there's nothing left */
+
+/* Flags for decoder configuration at time of capture */
+#define TFF_TPIU                ( 1 << 0 )      /* Stream is TPIU framed (channel is valid) */
+
+struct traceFileHeader
+{
+    char     magic[8];                          /* TRACEFILE_MAGIC */
+    uint32_t version;                           /* TRACEFILE_VERSION */
+    uint32_t headerLen;                         /* Length of this header, for compatibility */
+    uint32_t flags;                             /* TFF_xxx flags */
+    uint32_t channel;                           /* TPIU channel ITM was on */
+    uint64_t startTimeuS;                       /* Host time the capture was started */
+};
+
+struct traceFileSegment
+{
+    uint32_t magic;                             /* TRACEFILE_SEG_MAGIC */
+    uint32_t len;                               /* Length of the payload that follows */
+    uint64_t timeuS;                            /* Host time the first byte of it was received */
+    uint64_t offset;                            /* Offset of the first byte in the stream */
+    uint64_t syncOffset;                        /* Stream offset of the first sync completed in it */
+};
+
+struct traceFileIndex
+{
+    uint32_t magic;                             /* TRACEFILE_INDEX_MAGIC */
+    uint32_t numSegments;                       /* Number of entries in the index */
+    uint64_t indexOffset;                       /* File offset of the leading copy of this */
+};
+
+struct traceFileIndexEntry
+{
+    uint64_t timeuS;                            /* As the segment header */
+    uint64_t offset;                            /* ... */
+    uint64_t syncOffset;                        /* ... */
+    uint64_t fileOffset;                        /* File offset of the segment header */
+    uint32_t len;                               /* Length of the payload */
+    uint32_t spare;
+};
+
+/* Called by the writer to put completed parts of the file wherever they're going */
+typedef bool ( *traceFileWriteFn )( void *param, const uint8_t *buffer, size_t len );
+
+struct traceFileWriter;
+struct traceFileReader;
+
+// ====================================================================================================
+
+/* Writing a capture; data are read straight into the space the writer offers, then committed */
+uint8_t *traceFileWriterSpace( struct traceFileWriter *w, size_t *len );
+bool traceFileWriterCommit( struct traceFileWriter *w, size_t len, uint64_t timeuS );
+bool traceFileWriterClose( struct traceFileWriter *w );
+struct traceFileWriter *traceFileWriterCreate( uint32_t flags, uint32_t channel, uint32_t segSize, uint32_t segTimemS,
+        traceFileWriteFn fn, void *param );
+
+/* Reading either a capture or a flat file */
+ssize_t traceFileRead( struct traceFileReader *r, uint8_t *buffer, size_t len );
+bool traceFileDone( struct traceFileReader *r );
+bool traceFileIsIndexed( struct traceFileReader *r );
+bool traceFileIsCompressed( struct traceFileReader *r );
+bool traceFileTimed( struct traceFileReader *r );
+uint64_t traceFileReadTimeuS( struct traceFileReader *r );
+bool traceFileSetRange( struct traceFileReader *r, const char *range );
+int traceFileFd( struct traceFileReader *r );
+void traceFileClose( struct traceFileReader *r );
+struct traceFileReader *traceFileOpen( const char *name );
+
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,90 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Synthetic trace generator
+ * =========================
+ *
+ * Makes endless, repeatable trace streams for exercising the decoders and the network
+ * pipeline without a target. The ITM source mixes software packets across a set of channels
+ * with PC samples, exception trace and local timestamps, in proportions that are set by
+ * weights. The ETM source follows a made up program; a control flow graph of Thumb basic
+ * blocks is built from the seed, and walking it gives ETMv3.5 atom P-headers, branch
+ * address packets for indirect branches and branch addresses with exception information
+ * when an 'interrupt' is taken. Either or both can be carried in TPIU frames, with the
+ * streams interleaved in bursts of random length so stream changes land everywhere in the
+ * frame. Each source puts out its own syncs at regular intervals.
+ *
+ * The same configuration always gives the same stream.
+ */
+
+#ifndef _TRACE_GEN_
+#define _TRACE_GEN_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TRACEGEN_DEFAULT_SEED      (1)
+#define TRACEGEN_DEFAULT_CHANNELS  (8)           /* Software channels used by the ITM source */
+#define TRACEGEN_DEFAULT_BLOCKS    (4096)        /* Basic blocks in the synthetic program */
+#define TRACEGEN_DEFAULT_SYNC      (8192)        /* Bytes between syncs from each source */
+#define TRACEGEN_DEFAULT_BURST     (32)          /* Longest run from one source in a TPIU stream */
+#define TRACEGEN_CODE_BASE         (0x08000000)  /* Where the synthetic program lives */
+
+struct traceGenConfig
+{
+    uint64_t seed;                               /* Everything follows from this */
+
+    /* ITM source */
+    bool itm;                                    /* Generate ITM */
+    uint32_t swWeight;                           /* Relative proportions of packet types */
+    uint32_t pcWeight;                           /* ... */
+    uint32_t excWeight;                          /* ... */
+    uint32_t tsWeight;                           /* ... */
+    uint32_t swChannels;                         /* Number of software channels used (1..32) */
+
+    /* ETM source */
+    bool etm;                                    /* Generate ETM */
+    uint32_t blocks;                             /* Basic blocks in the synthetic program */
+    uint32_t excEvery;                           /* Average branches between exceptions, 0 for none */
+
+    /* Framing */
+    bool tpiu;                                   /* Put the output in TPIU frames */
+    uint8_t itmStream;                           /* TPIU stream for ITM */
+    uint8_t etmStream;                           /* TPIU stream for ETM */
+    uint32_t burst;                              /* Longest run from one stream before switching */
+
+    uint32_t syncEvery;                          /* Bytes between syncs */
+};
+
+struct traceGenStats
+{
+    uint64_t bytes;                              /* Bytes handed out */
+    uint64_t itmPackets;                         /* ITM packets generated, including syncs */
+    uint64_t itmSW;                              /* ...of which software packets */
+    uint64_t etmPackets;                         /* ETM packets generated, including syncs */
+    uint64_t etmAtoms;                           /* ...with this many atoms in their P-headers */
+    uint64_t tpiuFrames;                         /* TPIU frames generated */
+};
+
+struct traceGen;
+
+// ====================================================================================================
+
+void traceGenDefaultConfig( struct traceGenConfig *c );
+bool traceGenSetMix( struct traceGenConfig *c, const char *mix );
+
+void traceGenFill( struct traceGen *g, uint8_t *b, size_t len );
+const struct traceGenStats *traceGenGetStats( struct traceGen *g );
+void traceGenDelete( struct traceGen *g );
+struct traceGen *traceGenCreate( const struct traceGenConfig *c );
+
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,41 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Trace level instrumentation
+ * ===========================
+ *
+ * Hot path tracing for the decoders. In DEBUG builds each event is recorded as a small binary
+ * record in a ring, which is only formatted (using a table of format strings supplied by the
+ * application) when it is dumped. In release builds the macros compile to nothing at all.
+ *
+ * The ring is not locked. Several threads may log to it, but their records are interleaved and one
+ * may be overwritten if the ring wraps while it is being written.
+ */
+
+#ifndef _TRACE_LOG_
+#define _TRACE_LOG_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================================================================================================
+
+#ifdef DEBUG
+#define TRACE_LOG(ev,a,b,c)   traceLogAdd( ( ev ), ( a ), ( b ), ( c ) )
+#define TRACE_DUMP(fmts,n)    traceLogDump( ( fmts ), ( n ) )
+
+void traceLogAdd( uint32_t ev, uint32_t a, uint32_t b, uint32_t c );
+void traceLogDump( const char *const *fmts, uint32_t numFmts );
+#else
+#define TRACE_LOG(ev,a,b,c)   do {} while (0)
+#define TRACE_DUMP(fmts,n)    do {} while (0)
+#endif
+
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+#endif
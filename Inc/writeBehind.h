@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Write-behind buffering
+ * ======================
+ *
+ * Data are batched into large blocks which are handed to a separate thread for writing,
+ * so the producer never waits on the disk.
+ */
+
+#ifndef _WRITE_BEHIND_
+#define _WRITE_BEHIND_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "generics.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================================================================================================
+
+/* Called on the writer thread to dispose of each completed block */
+typedef bool ( *writebehindCB )( void *param, const uint8_t *buffer, size_t len );
+
+struct writebehindStats
+{
+    uint64_t bytesWritten;                    /* Bytes passed to the output callback */
+    uint64_t bytesDropped;                    /* Bytes discarded because the queue was full (lossy mode only) */
+    uint32_t blocksWritten;                   /* Number of blocks passed to the output callback */
+    uint32_t maxQueueDepth;                   /* Highest number of blocks waiting to be written */
+    bool     writeFailed;                     /* The output callback reported a failure */
+};
+
+struct writebehindHandle;
+
+// ====================================================================================================
+
+bool writebehindWrite( struct writebehindHandle *h, const uint8_t *buffer, size_t len );
+void writebehindFlush( struct writebehindHandle *h );
+void writebehindGetStats( struct writebehindHandle *h, struct writebehindStats *s );
+
+void writebehindShutdown( struct writebehindHandle *h );
+struct writebehindHandle *writebehindCreate( size_t blockSize, uint32_t numBlocks, bool lossless, writebehindCB cb, void *param );
+
+// ====================================================================================================
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,270 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Block queue
+ * ===========
+ *
+ * The producer owns wp and the consumer owns rp, each is only ever written by its owner and
+ * is published to the other side with release/acquire ordering, so no lock is needed for the
+ * hand-off itself. Semaphores are only used to sleep when there is nothing to do; the
+ * consumer gets one post per block, the producer is only posted when it has flagged that it
+ * is waiting for space.
+ *
+ * Buffers are not tied to ring slots. The consumer hands each released buffer back through
+ * a free ring (which it owns the write side of) and the producer takes from there before it
+ * will allocate, so only as many buffers as are ever in use at once get created.
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <semaphore.h>
+#include <assert.h>
+
+#include "generics.h"
+#include "blockQueue.h"
+
+struct bqBlock
+{
+    size_t fillLevel;                         /* How much of this block is occupied */
+    uint8_t *buffer;                          /* The data in this block, NULL when none is attached */
+};
+
+struct blockqueueHandle
+{
+    struct bqBlock *block;                    /* Ring of blocks */
+    uint32_t numBlocks;                       /* ...and how many of them there are */
+    size_t blockSize;                         /* Size of each block */
+
+    uint32_t wp;                              /* Next block to be filled (written by producer only) */
+    uint32_t rp;                              /* Next block to be consumed (written by consumer only) */
+    bool producerWaiting;                     /* Producer is (about to be) asleep waiting for space */
+
+    uint8_t **freeList;                       /* Ring of released buffers, ready for reuse */
+    uint32_t freeWp;                          /* Next free entry to be filled (written by consumer only) */
+    uint32_t freeRp;                          /* Next free entry to be reused (written by producer only) */
+
+    sem_t dataAvailable;                      /* Posted once for each committed block */
+    sem_t spaceAvailable;                     /* Posted when a block is released to a waiting producer */
+
+    struct blockqueueStats stats;             /* Record of activity (updated by producer only) */
+};
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internal routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static bool _isFull( struct blockqueueHandle *q )
+
+{
+    return ( ( ( q->wp + 1 ) % q->numBlocks ) == __atomic_load_n( &q->rp, __ATOMIC_SEQ_CST ) );
+}
+// ====================================================================================================
+static void _semWait( sem_t *s )
+
+/* Wait on a semaphore, riding over any signals that arrive meanwhile */
+
+{
+    while ( ( sem_wait( s ) < 0 ) && ( errno == EINTR ) );
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+uint8_t *blockqueueGetWriteBlock( struct blockqueueHandle *q )
+
+/* Return the block to be filled next, waiting for the consumer if the queue is full */
+
+{
+    struct bqBlock *b;
+    uint64_t stallStart = 0;
+
+    while ( _isFull( q ) )
+    {
+        if ( !stallStart )
+        {
+            stallStart = genericsTimestampuS();
+            q->stats.stalls++;
+        }
+
+        /* Flag we're waiting, then check again in case the consumer made space meanwhile */
+        __atomic_store_n( &q->producerWaiting, true, __ATOMIC_SEQ_CST );
+
+        if ( _isFull( q ) )
+        {
+            _semWait( &q->spaceAvailable );
+        }
+
+        __atomic_store_n( &q->producerWaiting, false, __ATOMIC_SEQ_CST );
+    }
+
+    if ( stallStart )
+    {
+        q->stats.stallTimeuS += genericsTimestampuS() - stallStart;
+    }
+
+    b = &q->block[q->wp];
+
+    if ( !b->buffer )
+    {
+        if ( q->freeRp != __atomic_load_n( &q->freeWp, __ATOMIC_ACQUIRE ) )
+        {
+            /* Reuse a buffer the consumer has finished with */
+            b->buffer = q->freeList[q->freeRp];
+            __atomic_store_n( &q->freeRp, ( q->freeRp + 1 ) % q->numBlocks, __ATOMIC_RELEASE );
+        }
+        else
+        {
+            /* ...all of them are in use, so this is a new high water mark */
+            if ( !( b->buffer = ( uint8_t * )malloc( q->blockSize ) ) )
+            {
+                return NULL;
+            }
+
+            q->stats.blocksAllocated++;
+        }
+    }
+
+    return b->buffer;
+}
+// ====================================================================================================
+void blockqueueCommit( struct blockqueueHandle *q, size_t len )
+
+/* Pass the block returned by blockqueueGetWriteBlock over to the consumer */
+
+{
+    uint32_t depth;
+
+    assert( len <= q->blockSize );
+
+    q->block[q->wp].fillLevel = len;
+    __atomic_store_n( &q->wp, ( q->wp + 1 ) % q->numBlocks, __ATOMIC_RELEASE );
+
+    depth = blockqueueGetDepth( q );
+
+    if ( depth > q->stats.maxDepth )
+    {
+        q->stats.maxDepth = depth;
+    }
+
+    sem_post( &q->dataAvailable );
+}
+// ====================================================================================================
+uint8_t *blockqueueGetReadBlock( struct blockqueueHandle *q, size_t *len )
+
+/* Wait for the next committed block and return it. It stays valid until blockqueueRelease */
+
+{
+    struct bqBlock *b;
+
+    _semWait( &q->dataAvailable );
+
+    /* Make sure we see what the producer put in the block before it moved wp */
+    ( void )__atomic_load_n( &q->wp, __ATOMIC_ACQUIRE );
+
+    b = &q->block[q->rp];
+    *len = b->fillLevel;
+    return b->buffer;
+}
+// ====================================================================================================
+void blockqueueRelease( struct blockqueueHandle *q )
+
+/* Return the block from blockqueueGetReadBlock to the producer */
+
+{
+    /* The buffer goes onto the free ring, it can never be full since it has a place for every slot */
+    q->freeList[q->freeWp] = q->block[q->rp].buffer;
+    q->block[q->rp].buffer = NULL;
+    __atomic_store_n( &q->freeWp, ( q->freeWp + 1 ) % q->numBlocks, __ATOMIC_RELEASE );
+
+    __atomic_store_n( &q->rp, ( q->rp + 1 ) % q->numBlocks, __ATOMIC_SEQ_CST );
+
+    if ( __atomic_exchange_n( &q->producerWaiting, false, __ATOMIC_SEQ_CST ) )
+    {
+        sem_post( &q->spaceAvailable );
+    }
+}
+// ====================================================================================================
+struct blockqueueStats *blockqueueGetStats( struct blockqueueHandle *q )
+
+{
+    return &q->stats;
+}
+// ====================================================================================================
+uint32_t blockqueueGetDepth( struct blockqueueHandle *q )
+
+/* Number of committed blocks not yet released by the consumer */
+
+{
+    return ( __atomic_load_n( &q->wp, __ATOMIC_ACQUIRE ) + q->numBlocks - __atomic_load_n( &q->rp, __ATOMIC_ACQUIRE ) ) % q->numBlocks;
+}
+// ====================================================================================================
+void blockqueueDelete( struct blockqueueHandle *q )
+
+/* Release all resources. Neither side may be using the queue any more */
+
+{
+    if ( !q )
+    {
+        return;
+    }
+
+    for ( uint32_t t = 0; t < q->numBlocks; t++ )
+    {
+        free( q->block[t].buffer );
+    }
+
+    for ( uint32_t t = q->freeRp; t != q->freeWp; t = ( t + 1 ) % q->numBlocks )
+    {
+        free( q->freeList[t] );
+    }
+
+    sem_destroy( &q->dataAvailable );
+    sem_destroy( &q->spaceAvailable );
+    free( q->freeList );
+    free( q->block );
+    free( q );
+}
+// ====================================================================================================
+struct blockqueueHandle *blockqueueCreate( size_t blockSize, uint32_t numBlocks )
+
+/* Create a queue which can hold up to numBlocks blocks waiting to be consumed */
+
+{
+    struct blockqueueHandle *q;
+
+    assert( blockSize );
+    assert( numBlocks );
+
+    q = ( struct blockqueueHandle * )calloc( 1, sizeof( struct blockqueueHandle ) );
+
+    if ( !q )
+    {
+        return NULL;
+    }
+
+    /* One extra slot, since the block being filled can't also be waiting */
+    q->numBlocks = numBlocks + 1;
+    q->blockSize = blockSize;
+    q->block = ( struct bqBlock * )calloc( q->numBlocks, sizeof( struct bqBlock ) );
+    q->freeList = ( uint8_t ** )calloc( q->numBlocks, sizeof( uint8_t * ) );
+
+    if ( ( !q->block ) || ( !q->freeList ) )
+    {
+        free( q->freeList );
+        free( q->block );
+        free( q );
+        return NULL;
+    }
+
+    sem_init( &q->dataAvailable, 0, 0 );
+    sem_init( &q->spaceAvailable, 0, 0 );
+
+    return q;
+}
+// ====================================================================================================
@@ -0,0 +1,81 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Shadow call stack
+ * =================
+ *
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "generics.h"
+#include "callStack.h"
+
+#define CALLSTACK_INITIAL_DEPTH (64)            /* Number of frames allocated to start with */
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+void callStackResync( struct callStack *c )
+
+/* Throw away the stack contents since they can no longer be trusted */
+
+{
+    c->depth = 0;
+    c->resyncs++;
+}
+// ====================================================================================================
+void callStackGrow( struct callStack *c )
+
+/* Make space for at least one more frame, or resync if the stack has reached its limit */
+
+{
+    struct callFrame *f;
+    uint32_t n = ( c->allocated * 2 < c->maxDepth ) ? c->allocated * 2 : c->maxDepth;
+
+    if ( n > c->allocated )
+    {
+        if ( ( f = ( struct callFrame * )realloc( c->frame, n * sizeof( struct callFrame ) ) ) )
+        {
+            c->frame = f;
+            c->allocated = n;
+            return;
+        }
+
+        genericsReport( V_WARN, "Failed to grow call stack beyond %d frames" EOL, c->allocated );
+    }
+
+    genericsReport( V_DEBUG, "Call stack overflow at depth %d" EOL, c->depth );
+    callStackResync( c );
+}
+// ====================================================================================================
+void callStackDelete( struct callStack *c )
+
+{
+    free( c->frame );
+    c->frame = NULL;
+    c->depth = c->allocated = 0;
+}
+// ====================================================================================================
+bool callStackInit( struct callStack *c, uint32_t maxDepth )
+
+/* Set up an empty stack which may grow to maxDepth frames */
+
+{
+    assert( maxDepth );
+
+    c->maxDepth  = maxDepth;
+    c->allocated = ( maxDepth < CALLSTACK_INITIAL_DEPTH ) ? maxDepth : CALLSTACK_INITIAL_DEPTH;
+    c->depth     = 0;
+    c->highWater = 0;
+    c->resyncs   = 0;
+    c->frame     = ( struct callFrame * )malloc( c->allocated * sizeof( struct callFrame ) );
+
+    return ( c->frame != NULL );
+}
+// ====================================================================================================
@@ -0,0 +1,167 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Calling context tree
+ * ====================
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "generics.h"
+#include "cct.h"
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static uint32_t _newNode( struct cct *t )
+
+/* Return the index of a fresh node, or CCT_ROOT if there's no room for one */
+
+{
+    struct cctNode **b;
+    uint32_t n;
+
+    if ( t->nodes == t->maxNodes )
+    {
+        return CCT_ROOT;
+    }
+
+    if ( t->nodes == t->blocks * CCT_BLOCK_NODES )
+    {
+        if ( t->blocks == t->blocksAllocated )
+        {
+            n = t->blocksAllocated ? t->blocksAllocated * 2 : 16;
+
+            if ( !( b = ( struct cctNode ** )realloc( t->block, n * sizeof( struct cctNode * ) ) ) )
+            {
+                return CCT_ROOT;
+            }
+
+            t->block = b;
+            t->blocksAllocated = n;
+        }
+
+        if ( !( t->block[t->blocks] = ( struct cctNode * )malloc( CCT_BLOCK_NODES * sizeof( struct cctNode ) ) ) )
+        {
+            return CCT_ROOT;
+        }
+
+        t->blocks++;
+    }
+
+    memset( cctNode( t, t->nodes ), 0, sizeof( struct cctNode ) );
+    return t->nodes++;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+uint32_t cctCall( struct cct *t, uint32_t parent, uint32_t key )
+
+/* Return the context for a call to key from the context parent, creating it if needed */
+
+{
+    struct cctNode *p = cctNode( t, parent );
+    struct cctNode *c;
+    uint32_t prev = CCT_ROOT;
+    uint32_t n;
+
+    /* Direct recursion stays in the same context */
+    if ( ( parent != CCT_ROOT ) && ( p->key == key ) )
+    {
+        return parent;
+    }
+
+    for ( n = p->child; n != CCT_ROOT; prev = n, n = c->sibling )
+    {
+        c = cctNode( t, n );
+
+        if ( c->key == key )
+        {
+            /* Move it to the front, since the same call is likely to be made again soon */
+            if ( prev != CCT_ROOT )
+            {
+                cctNode( t, prev )->sibling = c->sibling;
+                c->sibling = p->child;
+                p->child = n;
+            }
+
+            return n;
+        }
+    }
+
+    if ( ( n = _newNode( t ) ) == CCT_ROOT )
+    {
+        t->truncated++;
+        return parent;
+    }
+
+    /* Nodes never move, so p is still good */
+    c = cctNode( t, n );
+    c->key     = key;
+    c->parent  = parent;
+    c->sibling = p->child;
+    p->child   = n;
+    return n;
+}
+// ====================================================================================================
+void cctReturn( struct cct *t, uint32_t node, uint32_t parent, uint64_t ticks )
+
+/* Record the return from a call that ran in context node, called from context parent. If they */
+/* are the same the call was folded into its caller, which will account for the time itself.  */
+
+{
+    struct cctNode *c;
+
+    if ( node != parent )
+    {
+        c = cctNode( t, node );
+        c->count++;
+        c->inclusive += ticks;
+    }
+}
+// ====================================================================================================
+size_t cctMemory( struct cct *t )
+
+/* Return the amount of memory used by the tree */
+
+{
+    return t->blocks * CCT_BLOCK_NODES * sizeof( struct cctNode ) + t->blocksAllocated * sizeof( struct cctNode * );
+}
+// ====================================================================================================
+void cctDelete( struct cct *t )
+
+{
+    for ( uint32_t i = 0; i < t->blocks; i++ )
+    {
+        free( t->block[i] );
+    }
+
+    free( t->block );
+    memset( t, 0, sizeof( struct cct ) );
+}
+// ====================================================================================================
+bool cctInit( struct cct *t, uint32_t maxNodes )
+
+/* Set up a tree containing only the root, which may grow to maxNodes nodes */
+
+{
+    assert( maxNodes );
+
+    memset( t, 0, sizeof( struct cct ) );
+    t->maxNodes = maxNodes;
+
+    /* The root is always the first node */
+    return ( _newNode( t ) == CCT_ROOT ) && ( t->nodes == 1 );
+}
+// ====================================================================================================
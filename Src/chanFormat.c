@@ -0,0 +1,606 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Channel format programs
+ * =======================
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "generics.h"
+#include "chanFormat.h"
+
+/* Operations in a program */
+enum { CF_LITERAL, CF_SIGNED, CF_UNSIGNED, CF_OCTAL, CF_HEX, CF_HEXUPPER, CF_CHAR, CF_FIXED, CF_FLOAT };
+
+/* Conversion flags */
+#define CF_LEFT     (1 << 0)
+#define CF_PLUS     (1 << 1)
+#define CF_SPACE    (1 << 2)
+#define CF_ALT      (1 << 3)
+#define CF_ZERO     (1 << 4)
+
+/* Length modifiers that matter for a 32 bit value */
+#define CF_LEN_NONE (0)
+#define CF_LEN_H    (1)
+#define CF_LEN_HH   (2)
+#define CF_LEN_LONG (3)                /* Value is widened without sign extension, so is never negative */
+
+#define CF_MAX_FIXED_PRECISION (9)     /* Largest precision converted without snprintf */
+#define CF_MAX_FIXED_VALUE     (1e9)   /* ...and largest magnitude */
+#define CF_FIELD_LEN           (128)   /* Longest single conversion produced */
+
+static const uint64_t _pow10[CF_MAX_FIXED_PRECISION + 1] =
+{
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL
+};
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static struct chanFormatOp *_newOp( struct chanFormat *f, int type )
+
+/* Add an operation to the end of the program */
+
+{
+    struct chanFormatOp *o;
+
+    if ( !( o = ( struct chanFormatOp * )realloc( f->op, ( f->numOps + 1 ) * sizeof( struct chanFormatOp ) ) ) )
+    {
+        return NULL;
+    }
+
+    f->op = o;
+    o = &f->op[f->numOps++];
+    memset( o, 0, sizeof( struct chanFormatOp ) );
+    o->type = type;
+    o->precision = -1;
+    return o;
+}
+// ====================================================================================================
+static void _put( char *op, int len, int *n, const char *s, int l )
+
+/* Append to the output, dropping whatever doesn't fit */
+
+{
+    if ( l > len - *n )
+    {
+        l = len - *n;
+    }
+
+    if ( l > 0 )
+    {
+        memcpy( &op[*n], s, l );
+        *n += l;
+    }
+}
+// ====================================================================================================
+static void _pad( char *op, int len, int *n, char c, int l )
+
+/* Append l copies of c to the output, dropping whatever doesn't fit */
+
+{
+    if ( l > len - *n )
+    {
+        l = len - *n;
+    }
+
+    while ( l-- > 0 )
+    {
+        op[( *n )++] = c;
+    }
+}
+// ====================================================================================================
+static void _field( char *op, int len, int *n, struct chanFormatOp *o,
+                    const char *prefix, int prefixLen, int zeros, const char *digits, int digitsLen )
+
+/* Lay out a converted value in its field; prefix (sign, 0x) then zeros, then the digits */
+
+{
+    int pad = o->width - ( prefixLen + zeros + digitsLen );
+
+    if ( ( pad > 0 ) && ( !( o->flags & CF_LEFT ) ) )
+    {
+        if ( o->flags & CF_ZERO )
+        {
+            zeros += pad;
+        }
+        else
+        {
+            _pad( op, len, n, ' ', pad );
+        }
+    }
+
+    _put( op, len, n, prefix, prefixLen );
+    _pad( op, len, n, '0', zeros );
+    _put( op, len, n, digits, digitsLen );
+
+    if ( ( pad > 0 ) && ( o->flags & CF_LEFT ) )
+    {
+        _pad( op, len, n, ' ', pad );
+    }
+}
+// ====================================================================================================
+static int _digits( char *d, uint64_t v, uint32_t base, bool upper )
+
+/* Convert v to digits at the end of d (which must hold 20), returning how many there are */
+
+{
+    const char *set = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    int l = 0;
+
+    /* Separate loops so the divisions are by constants, which the compiler turns into shifts and multiplies */
+    switch ( base )
+    {
+        case 16:
+            do
+            {
+                d[19 - l++] = set[v & 15];
+                v >>= 4;
+            }
+            while ( v );
+
+            break;
+
+        case 8:
+            do
+            {
+                d[19 - l++] = set[v & 7];
+                v >>= 3;
+            }
+            while ( v );
+
+            break;
+
+        default:
+            do
+            {
+                d[19 - l++] = set[v % 10];
+                v /= 10;
+            }
+            while ( v );
+
+            break;
+    }
+
+    return l;
+}
+// ====================================================================================================
+static void _emitInt( char *op, int len, int *n, struct chanFormatOp *o, uint32_t v )
+
+/* Integer conversions, following the printf rules for flags, width and precision */
+
+{
+    char d[20];
+    char prefix[2];
+    int prefixLen = 0;
+    int digitsLen;
+    int zeros = 0;
+    uint32_t mag = v;
+    bool neg = false;
+
+    if ( o->type == CF_SIGNED )
+    {
+        int32_t s = ( o->length == CF_LEN_HH ) ? ( int8_t )v : ( o->length == CF_LEN_H ) ? ( int16_t )v : ( int32_t )v;
+        neg = ( s < 0 ) && ( o->length != CF_LEN_LONG );
+        mag = neg ? -( uint32_t )s : ( o->length == CF_LEN_LONG ) ? v : ( uint32_t )s;
+
+        if ( neg )
+        {
+            prefix[prefixLen++] = '-';
+        }
+        else if ( o->flags & CF_PLUS )
+        {
+            prefix[prefixLen++] = '+';
+        }
+        else if ( o->flags & CF_SPACE )
+        {
+            prefix[prefixLen++] = ' ';
+        }
+    }
+    else
+    {
+        mag = ( o->length == CF_LEN_HH ) ? ( uint8_t )v : ( o->length == CF_LEN_H ) ? ( uint16_t )v : v;
+    }
+
+    if ( ( !mag ) && ( !o->precision ) )
+    {
+        /* Explicit zero precision prints nothing for a zero */
+        digitsLen = 0;
+    }
+    else
+    {
+        digitsLen = _digits( d, mag, ( o->type == CF_OCTAL ) ? 8 : ( o->type >= CF_HEX ) ? 16 : 10, ( o->type == CF_HEXUPPER ) );
+    }
+
+    if ( o->precision > digitsLen )
+    {
+        zeros = o->precision - digitsLen;
+    }
+
+    if ( o->flags & CF_ALT )
+    {
+        if ( ( o->type == CF_OCTAL ) && ( !zeros ) && ( ( !digitsLen ) || ( d[20 - digitsLen] != '0' ) ) )
+        {
+            zeros = 1;
+        }
+        else if ( ( o->type >= CF_HEX ) && ( mag ) )
+        {
+            prefix[prefixLen++] = '0';
+            prefix[prefixLen++] = ( o->type == CF_HEXUPPER ) ? 'X' : 'x';
+        }
+    }
+
+    _field( op, len, n, o, prefix, prefixLen, zeros, &d[20 - digitsLen], digitsLen );
+}
+// ====================================================================================================
+static void _emitFloat( char *op, int len, int *n, struct chanFormatOp *o, float f )
+
+/* Floating point conversions. Fixed point ones are done here when the result is certain to  */
+/* match printf. The value is always a float, so for precisions up to 9 the scaling is exact */
+/* in a double and the rounding (half to even, as printf) can be done on the integer.        */
+
+{
+    char s[CF_FIELD_LEN];
+    char d[20];
+    char prefix[1];
+    int prefixLen = 0;
+    int p = ( o->precision < 0 ) ? 6 : o->precision;
+    double v = f;
+    double a, frac;
+    uint64_t scaled, ip;
+    int l;
+
+    if ( ( o->type != CF_FIXED ) || ( !isfinite( v ) ) || ( fabs( v ) >= CF_MAX_FIXED_VALUE ) || ( p > CF_MAX_FIXED_PRECISION ) )
+    {
+        l = snprintf( s, CF_FIELD_LEN, o->spec, v );
+        _put( op, len, n, s, ( l < CF_FIELD_LEN ) ? l : CF_FIELD_LEN - 1 );
+        return;
+    }
+
+    if ( signbit( v ) )
+    {
+        prefix[prefixLen++] = '-';
+    }
+    else if ( o->flags & CF_PLUS )
+    {
+        prefix[prefixLen++] = '+';
+    }
+    else if ( o->flags & CF_SPACE )
+    {
+        prefix[prefixLen++] = ' ';
+    }
+
+    a = fabs( v ) * _pow10[p];
+    scaled = ( uint64_t )a;
+    frac = a - scaled;
+
+    if ( ( frac > 0.5 ) || ( ( frac == 0.5 ) && ( scaled & 1 ) ) )
+    {
+        scaled++;
+    }
+
+    /* Build the digits; integer part, point, then the fraction padded out to the precision */
+    ip = scaled / _pow10[p];
+    l = _digits( d, ip, 10, false );
+    memcpy( s, &d[20 - l], l );
+
+    if ( ( p ) || ( o->flags & CF_ALT ) )
+    {
+        s[l++] = '.';
+    }
+
+    if ( p )
+    {
+        _digits( d, scaled % _pow10[p] + _pow10[p], 10, false );
+        memcpy( &s[l], &d[20 - p], p );
+        l += p;
+    }
+
+    _field( op, len, n, o, prefix, prefixLen, 0, s, l );
+}
+// ====================================================================================================
+static void _emitChar( char *op, int len, int *n, struct chanFormatOp *o, uint32_t v )
+
+{
+    char c = v & 0xff;
+    int pad = o->width - 1;
+
+    if ( ( pad > 0 ) && ( !( o->flags & CF_LEFT ) ) )
+    {
+        _pad( op, len, n, ' ', pad );
+    }
+
+    _put( op, len, n, &c, 1 );
+
+    if ( ( pad > 0 ) && ( o->flags & CF_LEFT ) )
+    {
+        _pad( op, len, n, ' ', pad );
+    }
+}
+// ====================================================================================================
+static void _run( struct chanFormat *f, uint32_t v, float fv, char *op, int len, int *n )
+
+/* Run the program once with the given value */
+
+{
+    for ( struct chanFormatOp *o = f->op; o < &f->op[f->numOps]; o++ )
+    {
+        switch ( o->type )
+        {
+            case CF_LITERAL:
+                _put( op, len, n, &f->text[o->litOffset], o->litLen );
+                break;
+
+            case CF_CHAR:
+                _emitChar( op, len, n, o, v );
+                break;
+
+            case CF_FIXED:
+            case CF_FLOAT:
+                _emitFloat( op, len, n, o, fv );
+                break;
+
+            default:
+                _emitInt( op, len, n, o, v );
+                break;
+        }
+    }
+}
+// ====================================================================================================
+static struct chanFormatOp *_compileConversion( struct chanFormat *f, const char **sp, const char *fmt )
+
+/* Compile the conversion at *sp, which is %[flags][width][.precision][length]type, and step past it */
+
+{
+    const char *s = *sp + 1;
+    struct chanFormatOp *o;
+
+    if ( !( o = _newOp( f, CF_SIGNED ) ) )
+    {
+        return NULL;
+    }
+
+    while ( ( *s ) && ( strchr( "-+ #0", *s ) ) )
+    {
+        o->flags |= ( *s == '-' ) ? CF_LEFT : ( *s == '+' ) ? CF_PLUS : ( *s == ' ' ) ? CF_SPACE : ( *s == '#' ) ? CF_ALT : CF_ZERO;
+        s++;
+    }
+
+    while ( ( *s >= '0' ) && ( *s <= '9' ) && ( o->width < CF_FIELD_LEN ) )
+    {
+        o->width = ( o->width * 10 ) + ( *s++ - '0' );
+    }
+
+    if ( *s == '.' )
+    {
+        o->precision = 0;
+        s++;
+
+        while ( ( *s >= '0' ) && ( *s <= '9' ) && ( o->precision < CF_FIELD_LEN ) )
+        {
+            o->precision = ( o->precision * 10 ) + ( *s++ - '0' );
+        }
+    }
+
+    if ( ( o->width >= CF_FIELD_LEN ) || ( o->precision >= CF_FIELD_LEN ) )
+    {
+        genericsReport( V_ERROR, "Field too wide in format \"%s\"" EOL, genericsEscape( ( char * )fmt ) );
+        return NULL;
+    }
+
+    if ( *s == 'h' )
+    {
+        o->length = ( s[1] == 'h' ) ? CF_LEN_HH : CF_LEN_H;
+        s += o->length;
+    }
+    else
+    {
+        while ( ( *s ) && ( strchr( "lLjzt", *s ) ) )
+        {
+            o->length = CF_LEN_LONG;
+            s++;
+        }
+    }
+
+    switch ( *s )
+    {
+        case 'd':
+        case 'i':
+            o->type = CF_SIGNED;
+            break;
+
+        case 'u':
+            o->type = CF_UNSIGNED;
+            break;
+
+        case 'o':
+            o->type = CF_OCTAL;
+            break;
+
+        case 'x':
+            o->type = CF_HEX;
+            break;
+
+        case 'X':
+            o->type = CF_HEXUPPER;
+            break;
+
+        case 'c':
+            o->type = CF_CHAR;
+            break;
+
+        case 'f':
+        case 'F':
+            o->type = CF_FIXED;
+            break;
+
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            o->type = CF_FLOAT;
+            break;
+
+        default:
+            genericsReport( V_ERROR, "Unsupported conversion in format \"%s\"" EOL, genericsEscape( ( char * )fmt ) );
+            return NULL;
+    }
+
+    /* Precision overrides zero padding for integers, as does left justification for anything */
+    if ( ( ( o->type < CF_CHAR ) && ( o->precision >= 0 ) ) || ( o->flags & CF_LEFT ) )
+    {
+        o->flags &= ~CF_ZERO;
+    }
+
+    /* Floating point conversions keep their text, in case they need to go through snprintf */
+    if ( ( o->type >= CF_FIXED ) && ( !( o->spec = strndup( *sp, s - *sp + 1 ) ) ) )
+    {
+        return NULL;
+    }
+
+    *sp = s + 1;
+    return o;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+int chanFormatRun( struct chanFormat *f, struct swMsg *m, char *op, int len )
+
+/* Format the message into op (not terminated), returning the length used */
+
+{
+    float fv;
+    int n = 0;
+    uint32_t l = 0;
+
+    switch ( f->mode )
+    {
+        case CF_MODE_FLOAT:
+            /* Same host, so the 32 bit value is already in the byte order a float expects */
+            memcpy( &fv, &m->value, sizeof( fv ) );
+            _run( f, m->value, fv, op, len, &n );
+            break;
+
+        case CF_MODE_CHAR:
+            /* Run the whole format for each character in the message */
+            do
+            {
+                _run( f, ( m->value >> ( 8 * l ) ) & 0xff, 0, op, len, &n );
+            }
+            while ( ++l < m->len );
+
+            break;
+
+        default:
+            _run( f, m->value, 0, op, len, &n );
+            break;
+    }
+
+    return n;
+}
+// ====================================================================================================
+void chanFormatDelete( struct chanFormat *f )
+
+{
+    if ( !f )
+    {
+        return;
+    }
+
+    for ( uint32_t i = 0; i < f->numOps; i++ )
+    {
+        free( f->op[i].spec );
+    }
+
+    free( f->op );
+    free( f->text );
+    free( f );
+}
+// ====================================================================================================
+struct chanFormat *chanFormatCompile( const char *fmt )
+
+/* Compile a channel format, returning NULL (with the problem reported) if it can't be used */
+
+{
+    struct chanFormat *f;
+    struct chanFormatOp *o = NULL;
+    const char *s = fmt;
+    uint32_t textLen = 0;
+
+    if ( !( f = ( struct chanFormat * )calloc( 1, sizeof( struct chanFormat ) ) ) )
+    {
+        return NULL;
+    }
+
+    /* Literal text can't be longer than the format itself */
+    if ( !( f->text = ( char * )malloc( strlen( fmt ) + 1 ) ) )
+    {
+        chanFormatDelete( f );
+        return NULL;
+    }
+
+    while ( *s )
+    {
+        if ( ( *s == '%' ) && ( s[1] != '%' ) )
+        {
+            if ( !( o = _compileConversion( f, &s, fmt ) ) )
+            {
+                chanFormatDelete( f );
+                return NULL;
+            }
+
+            continue;
+        }
+
+        /* Literal, extending the one before if there is one */
+        if ( ( !o ) || ( o->type != CF_LITERAL ) )
+        {
+            if ( !( o = _newOp( f, CF_LITERAL ) ) )
+            {
+                chanFormatDelete( f );
+                return NULL;
+            }
+
+            o->litOffset = textLen;
+        }
+
+        f->text[textLen++] = *s;
+        o->litLen++;
+        s += ( *s == '%' ) ? 2 : 1;
+    }
+
+    /* The conversions present decide how the message is fed to them */
+    f->mode = CF_MODE_INT;
+
+    for ( uint32_t i = 0; i < f->numOps; i++ )
+    {
+        if ( f->op[i].type >= CF_FIXED )
+        {
+            f->mode = CF_MODE_FLOAT;
+            break;
+        }
+
+        if ( f->op[i].type == CF_CHAR )
+        {
+            f->mode = CF_MODE_CHAR;
+        }
+    }
+
+    return f;
+}
+// ====================================================================================================
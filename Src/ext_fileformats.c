@@ -7,56 +7,905 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
 #include "ext_fileformats.h"
+#include "cct.h"
 
 #define HANDLE_MASK         (0xFFFFFF)   /* cachegrind cannot cope with large file handle numbers */
 
+#define WRITE_BUFLEN        (256*1024)   /* Size of output buffer */
+#define WRITE_MARGIN        (256)        /* Space guaranteed to be available for each field written */
+#define SIGNED_BIAS         (0x80000000) /* Makes unsigned keys sort in the same order as signed ones */
+
+#define GZ_BLOCK_MAX        (65535)      /* Largest stored deflate block */
+#define PB_MSG_LEN          (128)        /* Space for the largest (small) protobuf message we construct */
+
+/* Field numbers from pprof's profile.proto */
+#define PP_SAMPLE_TYPE      (1)
+#define PP_SAMPLE           (2)
+#define PP_MAPPING          (3)
+#define PP_LOCATION         (4)
+#define PP_FUNCTION         (5)
+#define PP_STRING_TABLE     (6)
+#define PP_PERIOD_TYPE      (11)
+#define PP_PERIOD           (12)
+#define PP_COMMENT          (13)
+#define PP_DEFAULT_TYPE     (14)
+
+/* Fixed entries at the start of the pprof string table */
+enum ppStrings { PS_EMPTY, PS_INSTRUCTIONS, PS_COUNT, PS_CALLS, PS_INCLUSIVE, PS_TIME, PS_TICKS, PS_NUM_STRINGS };
+
+/* Output file, written through a large buffer with routines specialised for the fields we write */
+struct writer
+{
+    FILE *f;
+    char *buf;
+    size_t used;
+    bool failed;
+
+    /* When gzipping, the material is sent as stored (uncompressed) deflate blocks */
+    bool gzip;
+    uint32_t crc;
+    uint32_t isize;
+};
+
+/* A small protobuf message under construction */
+struct pbMsg
+{
+    uint8_t b[PB_MSG_LEN];
+    uint32_t len;
+};
+
+/* State of a Chrome trace-event stream */
+struct ext_ff_trace
+{
+    struct writer w;
+    uint32_t depth;                      /* Number of slices currently open */
+    uint64_t lastTstamp;                 /* Latest time written */
+    bool any;                            /* Has any event been written yet? */
+};
+
+/* Entry in an array to be sorted */
+struct sortEntry
+{
+    uint64_t key;
+    void *item;
+};
+
+/* Record of a file or function name that has been written, so later uses can just refer to it */
+struct nameUsed
+{
+    uint32_t id;
+    uint32_t ref;                        /* What it was written as, for formats that refer back by number */
+    UT_hash_handle hh;
+};
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static void _raw( struct writer *w, const void *d, size_t l )
+
+{
+    if ( ( l ) && ( fwrite( d, 1, l, w->f ) != l ) )
+    {
+        w->failed = true;
+    }
+}
+// ====================================================================================================
+static uint32_t _crc32( uint32_t crc, const uint8_t *d, size_t l )
+
+/* Continue the gzip (IEEE 802.3) CRC over l more bytes */
+
+{
+    static uint32_t table[256];
+    static bool tableValid;
+    uint32_t c;
+
+    /* Building the table twice is harmless, the result is the same */
+    if ( !__atomic_load_n( &tableValid, __ATOMIC_ACQUIRE ) )
+    {
+        for ( uint32_t n = 0; n < 256; n++ )
+        {
+            c = n;
+
+            for ( int k = 0; k < 8; k++ )
+            {
+                c = ( c & 1 ) ? 0xedb88320 ^ ( c >> 1 ) : c >> 1;
+            }
+
+            table[n] = c;
+        }
+
+        __atomic_store_n( &tableValid, true, __ATOMIC_RELEASE );
+    }
+
+    crc = ~crc;
+
+    while ( l-- )
+    {
+        crc = table[( crc ^ *d++ ) & 0xff] ^ ( crc >> 8 );
+    }
+
+    return ~crc;
+}
+// ====================================================================================================
+static void _out( struct writer *w, const void *d, size_t l )
+
+/* Send material to the file, wrapping it in stored deflate blocks if we're gzipping */
+
+{
+    const uint8_t *p = ( const uint8_t * )d;
+    uint8_t h[5];
+    size_t n;
+
+    if ( !w->gzip )
+    {
+        _raw( w, d, l );
+        return;
+    }
+
+    w->crc = _crc32( w->crc, p, l );
+    w->isize += l;
+
+    while ( l )
+    {
+        n = ( l > GZ_BLOCK_MAX ) ? GZ_BLOCK_MAX : l;
+        h[0] = 0;
+        h[1] = n & 0xff;
+        h[2] = n >> 8;
+        h[3] = ~n & 0xff;
+        h[4] = ( ~n >> 8 ) & 0xff;
+        _raw( w, h, sizeof( h ) );
+        _raw( w, p, n );
+        p += n;
+        l -= n;
+    }
+}
+// ====================================================================================================
+static void _flush( struct writer *w )
+
+{
+    _out( w, w->buf, w->used );
+    w->used = 0;
+}
+// ====================================================================================================
+static inline void _ensure( struct writer *w )
+
+/* Make sure there's room for the next field */
+
+{
+    if ( w->used > WRITE_BUFLEN - WRITE_MARGIN )
+    {
+        _flush( w );
+    }
+}
+// ====================================================================================================
+static bool _open( struct writer *w, const char *name )
+
+{
+    memset( w, 0, sizeof( struct writer ) );
+
+    if ( !( w->f = fopen( name, "w" ) ) )
+    {
+        return false;
+    }
+
+    if ( !( w->buf = ( char * )malloc( WRITE_BUFLEN ) ) )
+    {
+        fclose( w->f );
+        return false;
+    }
+
+    return true;
+}
+// ====================================================================================================
+static bool _openGzip( struct writer *w, const char *name )
+
+/* Open an output that is gzipped as it's written. There's no compression library to hand, so */
+/* the deflate stream is stored blocks, but it's a valid gzip file for tools that insist on it */
+
+{
+    static const uint8_t header[] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff };
+
+    if ( !_open( w, name ) )
+    {
+        return false;
+    }
+
+    _raw( w, header, sizeof( header ) );
+    w->gzip = true;
+    return true;
+}
+// ====================================================================================================
+static bool _close( struct writer *w )
+
+/* Flush and close the output, returning false if anything went wrong writing it */
+
+{
+    uint8_t t[8];
+
+    _flush( w );
+    free( w->buf );
+
+    if ( w->gzip )
+    {
+        /* Final (empty) block, then the trailer */
+        static const uint8_t last[] = { 1, 0, 0, 0xff, 0xff };
+        _raw( w, last, sizeof( last ) );
+
+        for ( int i = 0; i < 4; i++ )
+        {
+            t[i]     = ( w->crc >> ( 8 * i ) ) & 0xff;
+            t[i + 4] = ( w->isize >> ( 8 * i ) ) & 0xff;
+        }
+
+        _raw( w, t, sizeof( t ) );
+    }
+
+    if ( fclose( w->f ) )
+    {
+        w->failed = true;
+    }
+
+    return !w->failed;
+}
+// ====================================================================================================
+static void _str( struct writer *w, const char *s )
+
+{
+    size_t l = strlen( s );
+
+    if ( l > WRITE_BUFLEN - w->used )
+    {
+        /* Too big for what's left in the buffer, so it goes straight out */
+        _flush( w );
+        _out( w, s, l );
+        return;
+    }
+
+    memcpy( &w->buf[w->used], s, l );
+    w->used += l;
+    _ensure( w );
+}
+// ====================================================================================================
+static void _printf( struct writer *w, const char *fmt, ... )
+
+/* General formatted output, for the material that isn't written very often */
+
+{
+    va_list va;
+    int l;
+
+    va_start( va, fmt );
+    l = vsnprintf( &w->buf[w->used], WRITE_BUFLEN - w->used, fmt, va );
+    va_end( va );
+
+    if ( ( l < 0 ) || ( l >= ( int )( WRITE_BUFLEN - w->used ) ) )
+    {
+        /* Didn't fit, so send it directly */
+        _flush( w );
+        va_start( va, fmt );
+
+        if ( vfprintf( w->f, fmt, va ) < 0 )
+        {
+            w->failed = true;
+        }
+
+        va_end( va );
+        return;
+    }
+
+    w->used += l;
+    _ensure( w );
+}
+// ====================================================================================================
+static void _char( struct writer *w, char c )
+
+{
+    w->buf[w->used++] = c;
+    _ensure( w );
+}
+// ====================================================================================================
+static void _unsigned( struct writer *w, uint64_t v )
+
+{
+    char t[20];
+    int i = 0;
+
+    do
+    {
+        t[i++] = '0' + ( v % 10 );
+        v /= 10;
+    }
+    while ( v );
+
+    while ( i )
+    {
+        w->buf[w->used++] = t[--i];
+    }
+
+    _ensure( w );
+}
+// ====================================================================================================
+static void _delta( struct writer *w, int64_t v )
+
+/* Write a relative position, which always carries its sign */
+
+{
+    _char( w, ( v < 0 ) ? '-' : '+' );
+    _unsigned( w, ( v < 0 ) ? -v : v );
+}
+// ====================================================================================================
+static void _hex8( struct writer *w, uint32_t v )
+
+/* Write a full address, as 0x followed by 8 digits */
+
+{
+    static const char digits[] = "0123456789abcdef";
+
+    w->buf[w->used++] = '0';
+    w->buf[w->used++] = 'x';
+
+    for ( int i = 28; i >= 0; i -= 4 )
+    {
+        w->buf[w->used++] = digits[( v >> i ) & 0xf];
+    }
+
+    _ensure( w );
+}
+// ====================================================================================================
+static struct sortEntry *_sort( struct sortEntry *a, uint32_t n, uint32_t keyBytes )
+
+/* Stable LSD radix sort of n entries on the low keyBytes of their keys. a has room for 2n entries,  */
+/* the second half being used as workspace. Returns whichever half the sorted entries ended up in.  */
+
+{
+    struct sortEntry *t = &a[n];
+    struct sortEntry *x;
+    uint32_t pos[256];
+    uint32_t sum;
+    uint32_t digit;
+
+    for ( uint32_t shift = 0; shift < keyBytes * 8; shift += 8 )
+    {
+        memset( pos, 0, sizeof( pos ) );
+
+        for ( uint32_t i = 0; i < n; i++ )
+        {
+            pos[( a[i].key >> shift ) & 0xff]++;
+        }
+
+        /* If every entry has the same digit then this pass won't change anything */
+        if ( ( !n ) || ( pos[( a[0].key >> shift ) & 0xff] == n ) )
+        {
+            continue;
+        }
+
+        for ( sum = 0, digit = 0; digit < 256; digit++ )
+        {
+            sum += pos[digit];
+            pos[digit] = sum - pos[digit];
+        }
+
+        for ( uint32_t i = 0; i < n; i++ )
+        {
+            t[pos[( a[i].key >> shift ) & 0xff]++] = a[i];
+        }
+
+        x = a;
+        a = t;
+        t = x;
+    }
+
+    return a;
+}
+// ====================================================================================================
+static struct sortEntry *_sortInsts( struct execEntryHash *insthead, uint32_t *n, struct sortEntry **mem )
+
+/* Return instructions sorted by address. Exception pseudo addresses (0xfffffffx) come first */
+
+{
+    struct execEntryHash *f;
+    uint32_t i = 0;
+
+    *n = HASH_COUNT( insthead );
+
+    if ( !( *mem = ( struct sortEntry * )malloc( ( 2 * *n + 1 ) * sizeof( struct sortEntry ) ) ) )
+    {
+        return NULL;
+    }
+
+    for ( f = insthead; f; f = f->hh.next )
+    {
+        ( *mem )[i].key    = f->addr ^ SIGNED_BIAS;
+        ( *mem )[i++].item = f;
+    }
+
+    return _sort( *mem, *n, 4 );
+}
+// ====================================================================================================
+static struct sortEntry *_sortCalls( struct subcall *subcallList, uint32_t *n, struct sortEntry **mem )
+
+/* Return calls sorted by calling function, then by called function */
+
+{
+    struct subcall *s;
+    uint32_t i = 0;
+
+    *n = HASH_COUNT( subcallList );
+
+    if ( !( *mem = ( struct sortEntry * )malloc( ( 2 * *n + 1 ) * sizeof( struct sortEntry ) ) ) )
+    {
+        return NULL;
+    }
+
+    for ( s = subcallList; s; s = s->hh.next )
+    {
+        ( *mem )[i].key    = ( ( uint64_t )( s->srch->functionindex ^ SIGNED_BIAS ) << 32 ) | ( s->dsth->functionindex ^ SIGNED_BIAS );
+        ( *mem )[i++].item = s;
+    }
+
+    return _sort( *mem, *n, 8 );
+}
+// ====================================================================================================
+static bool _firstUse( struct nameUsed **set, uint32_t id )
+
+/* Return true if this is the first time id has been written, remembering it if so */
+
+{
+    struct nameUsed *u;
+
+    HASH_FIND_INT( *set, &id, u );
+
+    if ( u )
+    {
+        return false;
+    }
+
+    u = ( struct nameUsed * )calloc( 1, sizeof( struct nameUsed ) );
+    u->id = id;
+    HASH_ADD_INT( *set, id, u );
+    return true;
+}
+// ====================================================================================================
+static void _forgetNames( struct nameUsed **set )
+
+{
+    struct nameUsed *u;
+    struct nameUsed *t;
+
+    HASH_ITER( hh, *set, u, t )
+    {
+        HASH_DEL( *set, u );
+        free( u );
+    }
+}
+// ====================================================================================================
+static void _fileName( struct writer *w, const char *tag, uint32_t index, struct nameUsed **used, const char *deleteMaterial, struct SymbolSet *ss )
+
+/* Write a file reference, with its name only the first time it's used */
+
+{
+    _str( w, tag );
+    _str( w, "=(" );
+    _unsigned( w, index & HANDLE_MASK );
+    _char( w, ')' );
+
+    if ( _firstUse( used, index & HANDLE_MASK ) )
+    {
+        _char( w, ' ' );
+        _str( w, deleteMaterial ? deleteMaterial : "" );
+        _str( w, SymbolFilename( ss, index ) );
+    }
+
+    _char( w, '\n' );
+}
+// ====================================================================================================
+static void _functionName( struct writer *w, const char *tag, uint32_t index, struct nameUsed **used, struct SymbolSet *ss )
+
+/* Write a function reference, with its name only the first time it's used */
+
+{
+    _str( w, tag );
+    _str( w, "=(" );
+    _unsigned( w, index & HANDLE_MASK );
+    _char( w, ')' );
+
+    if ( _firstUse( used, index & HANDLE_MASK ) )
+    {
+        _char( w, ' ' );
+        _str( w, SymbolFunction( ss, index ) );
+    }
+
+    _char( w, '\n' );
+}
+// ====================================================================================================
+static uint32_t _nameRef( struct nameUsed **set, uint32_t id, uint32_t *next, bool *isNew )
+
+/* Return the number id was written as, allocating it the next one if this is its first use */
+
+{
+    struct nameUsed *u;
+
+    HASH_FIND_INT( *set, &id, u );
+    *isNew = !u;
+
+    if ( !u )
+    {
+        u = ( struct nameUsed * )calloc( 1, sizeof( struct nameUsed ) );
+        u->id  = id;
+        u->ref = ( *next )++;
+        HASH_ADD_INT( *set, id, u );
+    }
+
+    return u->ref;
+}
+// ====================================================================================================
+static void _varint( struct writer *w, uint64_t v )
+
+{
+    while ( v > 0x7f )
+    {
+        w->buf[w->used++] = ( v & 0x7f ) | 0x80;
+        v >>= 7;
+    }
+
+    w->buf[w->used++] = v;
+    _ensure( w );
+}
+// ====================================================================================================
+static void _msgRawVarint( struct pbMsg *m, uint64_t v )
+
+{
+    while ( v > 0x7f )
+    {
+        m->b[m->len++] = ( v & 0x7f ) | 0x80;
+        v >>= 7;
+    }
+
+    m->b[m->len++] = v;
+}
+// ====================================================================================================
+static void _msgVarint( struct pbMsg *m, uint32_t field, uint64_t v )
+
+/* Add a varint field to a message. Zero is the default so it needn't be sent */
+
+{
+    if ( v )
+    {
+        _msgRawVarint( m, field << 3 );
+        _msgRawVarint( m, v );
+    }
+}
+// ====================================================================================================
+static void _msgMsg( struct pbMsg *m, uint32_t field, struct pbMsg *sub )
+
+/* Embed one (small) message in another */
+
+{
+    _msgRawVarint( m, ( field << 3 ) | 2 );
+    _msgRawVarint( m, sub->len );
+    memcpy( &m->b[m->len], sub->b, sub->len );
+    m->len += sub->len;
+}
+// ====================================================================================================
+static void _msgPacked( struct pbMsg *m, uint32_t field, const uint64_t *v, uint32_t n )
+
+/* Add a packed repeated varint field to a message */
+
+{
+    struct pbMsg p = { .len = 0 };
+
+    for ( uint32_t i = 0; i < n; i++ )
+    {
+        _msgRawVarint( &p, v[i] );
+    }
+
+    _msgMsg( m, field, &p );
+}
+// ====================================================================================================
+static void _pbMsg( struct writer *w, uint32_t field, struct pbMsg *m )
+
+/* Write a complete message as a field of the top level message */
+
+{
+    _varint( w, ( field << 3 ) | 2 );
+    _varint( w, m->len );
+    memcpy( &w->buf[w->used], m->b, m->len );
+    w->used += m->len;
+    _ensure( w );
+}
 // ====================================================================================================
+static uint32_t _pbString( struct writer *w, uint32_t *strings, const char *prefix, const char *s )
+
+/* Append prefix and s, as one string, to the string table. Returns its index */
+
+{
+    _varint( w, ( PP_STRING_TABLE << 3 ) | 2 );
+    _varint( w, ( prefix ? strlen( prefix ) : 0 ) + strlen( s ) );
+    _str( w, prefix ? prefix : "" );
+    _str( w, s );
+    return ( *strings )++;
+}
 // ====================================================================================================
+static uint32_t _pbFileString( struct writer *w, uint32_t *strings, struct nameUsed **files, uint32_t index,
+                               const char *deleteMaterial, struct SymbolSet *ss )
+
+/* Return the string table index of a filename, adding it to the table the first time it's used */
+
+{
+    struct nameUsed *u;
+
+    HASH_FIND_INT( *files, &index, u );
+
+    if ( !u )
+    {
+        u = ( struct nameUsed * )calloc( 1, sizeof( struct nameUsed ) );
+        u->id  = index;
+        u->ref = _pbString( w, strings, deleteMaterial, ( index & SPECIALS_MASK ) == SPECIALS_MASK ? "" : SymbolFilename( ss, index ) );
+        HASH_ADD_INT( *files, id, u );
+    }
+
+    return u->ref;
+}
 // ====================================================================================================
-// Internally available routines
+static uint64_t _pbLocation( struct writer *w, struct execEntryHash *h, uint32_t *strings, struct nameUsed **files,
+                             struct nameUsed **locations, uint32_t *nextLocation,
+                             struct nameUsed **functions, uint32_t *nextFunction,
+                             const char *deleteMaterial, struct SymbolSet *ss )
+
+/* Return the location id for h, writing the location (and its function, and their strings) if */
+/* this is the first time it has been referred to                                               */
+
+{
+    struct pbMsg m = { .len = 0 };
+    struct pbMsg l = { .len = 0 };
+    uint32_t loc, fn, name, file;
+    bool isNew;
+
+    loc = _nameRef( locations, h->addr, nextLocation, &isNew );
+
+    if ( !isNew )
+    {
+        return loc;
+    }
+
+    fn = _nameRef( functions, h->functionindex, nextFunction, &isNew );
+
+    if ( isNew )
+    {
+        name = _pbString( w, strings, NULL, SymbolFunction( ss, h->functionindex ) );
+        file = _pbFileString( w, strings, files, h->fileindex, deleteMaterial, ss );
+
+        _msgVarint( &m, 1, fn );
+        _msgVarint( &m, 2, name );
+        _msgVarint( &m, 3, name );
+        _msgVarint( &m, 4, file );
+        _pbMsg( w, PP_FUNCTION, &m );
+        m.len = 0;
+    }
+
+    _msgVarint( &l, 1, fn );
+    _msgVarint( &l, 2, ( h->line == NO_LINE ) ? 0 : h->line );
+
+    _msgVarint( &m, 1, loc );
+    _msgVarint( &m, 2, 1 );
+    _msgVarint( &m, 3, h->addr );
+    _msgMsg( &m, 4, &l );
+    _pbMsg( w, PP_LOCATION, &m );
+
+    return loc;
+}
 // ====================================================================================================
+static uint32_t _varintLen( uint64_t v )
+
+{
+    uint32_t l = 1;
+
+    while ( v > 0x7f )
+    {
+        v >>= 7;
+        l++;
+    }
+
+    return l;
+}
 // ====================================================================================================
+static uint64_t *_cctSelf( struct cct *t )
+
+/* Return the self time of each context (its inclusive time less that of the contexts it called) */
+
+{
+    uint64_t *self = ( uint64_t * )calloc( t->nodes, sizeof( uint64_t ) );
+    struct cctNode *c;
+
+    if ( !self )
+    {
+        return NULL;
+    }
+
+    for ( uint32_t n = 1; n < t->nodes; n++ )
+    {
+        c = cctNode( t, n );
+        self[n] += c->inclusive;
+        self[c->parent] -= c->inclusive;
+    }
+
+    /* Calls that were cut short by a resync can leave a parent with less time than its children */
+    for ( uint32_t n = 0; n < t->nodes; n++ )
+    {
+        if ( ( int64_t )self[n] < 0 )
+        {
+            self[n] = 0;
+        }
+    }
+
+    return self;
+}
 // ====================================================================================================
-static int _inst_sort_fn( const void *a, const void *b )
+static uint32_t _cctPath( struct cct *t, uint32_t n, uint32_t **path, uint32_t *allocated )
 
-/* Sort instructions by address */
+/* Fill path with the contexts from n up to (but not including) the root, returning how many */
 
 {
-    return ( int )( ( ( struct execEntryHash * )a )->addr ) - ( int )( ( ( struct execEntryHash * )b )->addr );
+    uint32_t len = 0;
+    uint32_t *p;
+
+    for ( ; n != CCT_ROOT; n = cctNode( t, n )->parent )
+    {
+        if ( len == *allocated )
+        {
+            if ( !( p = ( uint32_t * )realloc( *path, ( *allocated ? *allocated * 2 : 64 ) * sizeof( uint32_t ) ) ) )
+            {
+                return 0;
+            }
+
+            *path = p;
+            *allocated = *allocated ? *allocated * 2 : 64;
+        }
+
+        ( *path )[len++] = n;
+    }
+
+    return len;
 }
 // ====================================================================================================
-static int _calls_src_sort_fn( const void *a, const void *b )
+static bool _pbContexts( struct writer *w, struct cct *t, struct execEntryHash *insthead, uint32_t *strings,
+                         struct nameUsed **files, struct nameUsed **locations, uint32_t *nextLocation,
+                         struct nameUsed **functions, uint32_t *nextFunction,
+                         const char *deleteMaterial, struct SymbolSet *ss )
 
-/* Sort instructions by called from address */
+/* Write a sample for every context in the tree. Paths can be long, so these go straight to the writer */
 
 {
-    int i;
+    struct execEntryHash *h = NULL;
+    uint64_t *self;
+    uint32_t *path = NULL;
+    uint32_t allocated = 0;
+    uint32_t len;
+    uint32_t locLen;
+    uint32_t valLen;
+    struct cctNode *c;
 
-    if ( ( i = ( int )( ( ( struct subcall * )a )->srch->functionindex ) - ( int )( ( ( struct subcall * )b )->srch->functionindex ) ) )
+    if ( !( self = _cctSelf( t ) ) )
     {
-        return i;
+        return false;
+    }
+
+    for ( uint32_t n = 1; n < t->nodes; n++ )
+    {
+        c = cctNode( t, n );
+
+        if ( ( !c->count ) && ( !self[n] ) )
+        {
+            continue;
+        }
+
+        if ( !( len = _cctPath( t, n, &path, &allocated ) ) )
+        {
+            free( self );
+            return false;
+        }
+
+        /* Turn the path into locations, leaf first, and find out how long they'll be */
+        for ( uint32_t i = 0; i < len; i++ )
+        {
+            HASH_FIND_INT( insthead, &cctNode( t, path[i] )->key, h );
+
+            if ( !h )
+            {
+                break;
+            }
+
+            path[i] = _pbLocation( w, h, strings, files, locations, nextLocation, functions, nextFunction, deleteMaterial, ss );
+        }
+
+        if ( !h )
+        {
+            continue;
+        }
+
+        for ( uint32_t i = locLen = 0; i < len; i++ )
+        {
+            locLen += _varintLen( path[i] );
+        }
+
+        /* Values are instructions (none), count and self time */
+        valLen = 1 + _varintLen( c->count ) + _varintLen( self[n] );
+
+        _varint( w, ( PP_SAMPLE << 3 ) | 2 );
+        _varint( w, 1 + _varintLen( locLen ) + locLen + 1 + _varintLen( valLen ) + valLen );
+        _varint( w, ( 1 << 3 ) | 2 );
+        _varint( w, locLen );
+
+        for ( uint32_t i = 0; i < len; i++ )
+        {
+            _varint( w, path[i] );
+        }
+
+        _varint( w, ( 2 << 3 ) | 2 );
+        _varint( w, valLen );
+        _varint( w, 0 );
+        _varint( w, c->count );
+        _varint( w, self[n] );
     }
 
-    return ( int )( ( ( struct subcall * )a )->dsth->functionindex ) - ( int )( ( ( struct subcall * )b )->dsth->functionindex );
+    free( path );
+    free( self );
+    return true;
 }
 // ====================================================================================================
-#if 0 // Not used for now, but left here in case its useful later...
-static int _calls_dst_sort_fn( const void *a, const void *b )
+static void _jsonStr( struct writer *w, const char *s )
 
-/* Sort instructions by called to address */
+/* Write a string as a JSON string, escaping anything that needs it */
 
 {
-    int i;
+    static const char digits[] = "0123456789abcdef";
 
-    if ( ( i = ( int )( ( ( struct subcall * )a )->dsth->functionindex ) - ( int )( ( ( struct subcall * )b )->dsth->functionindex ) ) )
+    _char( w, '"' );
+
+    while ( *s )
     {
-        return i;
+        if ( ( *s == '"' ) || ( *s == '\\' ) )
+        {
+            _char( w, '\\' );
+            _char( w, *s );
+        }
+        else if ( ( uint8_t )*s < ' ' )
+        {
+            _str( w, "\\u00" );
+            _char( w, digits[( *s >> 4 ) & 0xf] );
+            _char( w, digits[*s & 0xf] );
+        }
+        else
+        {
+            _char( w, *s );
+        }
+
+        s++;
     }
 
-    return ( int )( ( ( struct subcall * )a )->srch->functionindex ) - ( int )( ( ( struct subcall * )b )->srch->functionindex );
+    _char( w, '"' );
+}
+// ====================================================================================================
+static void _traceEvent( struct ext_ff_trace *t, char ph, uint64_t tstamp )
+
+/* Start a trace event record, leaving it open for more fields */
+
+{
+    _str( &t->w, t->any ? ",\n{\"ph\":\"" : "\n{\"ph\":\"" );
+    _char( &t->w, ph );
+    _str( &t->w, "\",\"pid\":1,\"tid\":1,\"ts\":" );
+    _unsigned( &t->w, tstamp );
+    t->any = true;
+    t->lastTstamp = tstamp;
 }
-#endif
 // ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
@@ -75,50 +924,59 @@ bool ext_ff_outputDot( char *dotfile, struct subcall *subcallList, struct Symbol
 /* Output call graph to dot file */
 
 {
-    FILE *c;
+    struct writer w;
     uint32_t functionidx, dfunctionidx, fileidx;
     uint64_t cnt;
     struct subcall *s;
+    struct sortEntry *mem;
+    struct sortEntry *sorted;
+    uint32_t n;
+    uint32_t i = 0;
 
     if ( !dotfile )
     {
         return false;
     }
 
-    /* Sort according to addresses visited. */
+    if ( !_open( &w, dotfile ) )
+    {
+        return false;
+    }
 
-    c = fopen( dotfile, "w" );
-    fprintf( c, "graph calls\n{\n  overlap=true; splines=true; size=\"7.75,10.25\"; orientation=portrait; sep=0.1; nodesep=1;\n" );
+    /* Sort according to calling and called functions, so the calls between them can be totalled */
+    if ( !( sorted = _sortCalls( subcallList, &n, &mem ) ) )
+    {
+        _close( &w );
+        return false;
+    }
 
-    HASH_SORT( subcallList, _calls_src_sort_fn );
-    s = subcallList;
+    _printf( &w, "graph calls\n{\n  overlap=true; splines=true; size=\"7.75,10.25\"; orientation=portrait; sep=0.1; nodesep=1;\n" );
 
     /* Now go through and label the arrows... */
 
-    s = subcallList;
-
-    while ( s )
+    while ( i < n )
     {
+        s = ( struct subcall * )sorted[i++].item;
         functionidx = s->srch->functionindex;
         fileidx = s->srch->fileindex;
 
         dfunctionidx = s->dsth->functionindex;
         cnt = s->count;
-        s = s->hh.next;
 
-        while ( ( s ) && ( functionidx == s->srch->functionindex ) && ( dfunctionidx == s->dsth->functionindex ) )
+        while ( ( i < n ) &&
+                ( functionidx == ( ( struct subcall * )sorted[i].item )->srch->functionindex ) &&
+                ( dfunctionidx == ( ( struct subcall * )sorted[i].item )->dsth->functionindex ) )
         {
-            cnt += s->count;
-            s = s->hh.next;
+            cnt += ( ( struct subcall * )sorted[i++].item )->count;
         }
 
-        fprintf( c, "    \"\n(%s)\n%s\n\n\" -- ", SymbolFilename( ss, fileidx ), SymbolFunction( ss, functionidx ) );
-        fprintf( c, "\"\n(%s)\n%s\n\n\" [label=%" PRIu64 ", weight=0.1 ];\n", SymbolFilename( ss, fileidx ), SymbolFunction( ss, dfunctionidx ), cnt );
+        _printf( &w, "    \"\n(%s)\n%s\n\n\" -- ", SymbolFilename( ss, fileidx ), SymbolFunction( ss, functionidx ) );
+        _printf( &w, "\"\n(%s)\n%s\n\n\" [label=%" PRIu64 ", weight=0.1 ];\n", SymbolFilename( ss, fileidx ), SymbolFunction( ss, dfunctionidx ), cnt );
     }
 
-    fprintf( c, "}\n" );
-    fclose( c );
-    return true;
+    _printf( &w, "}\n" );
+    free( mem );
+    return _close( &w );
 }
 // ====================================================================================================
 // ====================================================================================================
@@ -128,38 +986,49 @@ bool ext_ff_outputDot( char *dotfile, struct subcall *subcallList, struct Symbol
 bool ext_ff_outputProfile( char *profile, char *elffile, char *deleteMaterial, bool includeVisits, uint64_t timelen,
                            struct execEntryHash *insthead, struct subcall *subcallList, struct SymbolSet *ss )
 
-/* Output a KCacheGrind compatible profile, with instruction coverage in insthead, calls in subcallList */
+/* Output a KCacheGrind compatible profile, with instruction coverage in insthead, calls in subcallList. */
+/* The file, function and line of each entry are the ones already recorded in it by the caller.         */
 
 {
-    struct nameEntry n;
     uint32_t prevfile = NO_FILE;
     uint32_t prevfn   = NO_FUNCTION;
     uint32_t prevaddr = NO_FUNCTION;
     uint32_t prevline = NO_LINE;
+    uint32_t line;
     char *e = elffile;
     char *d = deleteMaterial;
-    FILE *c;
+    struct writer w;
+    struct nameUsed *files = NULL;
+    struct nameUsed *functions = NULL;
+    struct sortEntry *mem;
+    struct sortEntry *sorted;
+    struct execEntryHash *f;
+    struct subcall *s;
+    uint32_t n;
 
     if ( !profile )
     {
         return false;
     }
 
+    if ( !_open( &w, profile ) )
+    {
+        return false;
+    }
 
-    c = fopen( profile, "w" );
-    fprintf( c, "# callgrind format\n" );
+    _printf( &w, "# callgrind format\n" );
 
     if ( includeVisits )
     {
-        fprintf( c, "creator: orbprofile\npositions: instr line\nevent: Inst : CPU Instructions\nevent: Visits : Visits to source line\nevents: Inst Visits\n" );
+        _printf( &w, "creator: orbprofile\npositions: instr line\nevent: Inst : CPU Instructions\nevent: Visits : Visits to source line\nevents: Inst Visits\n" );
     }
     else
     {
-        fprintf( c, "creator: orbprofile\npositions: instr line\nevent: Inst : CPU Instructions\nevents: Inst\n" );
+        _printf( &w, "creator: orbprofile\npositions: instr line\nevent: Inst : CPU Instructions\nevents: Inst\n" );
     }
 
     /* Samples are in time order, so we can determine the extent of time.... */
-    fprintf( c, "summary: %" PRIu64 "\n", timelen );
+    _printf( &w, "summary: %" PRIu64 "\n", timelen );
 
     /* Try to remove frontmatter off the elfile if nessessary and possible */
     if ( deleteMaterial )
@@ -178,103 +1047,420 @@ bool ext_ff_outputProfile( char *profile, char *elffile, char *deleteMaterial, b
     }
 
     /* ...and record whatever elffilename we ended up with */
-    fprintf( c, "ob=%s\n", e );
+    _printf( &w, "ob=%s\n", e );
 
-    HASH_SORT( insthead, _inst_sort_fn );
-    struct execEntryHash *f = insthead;
+    if ( !( sorted = _sortInsts( insthead, &n, &mem ) ) )
+    {
+        _close( &w );
+        return false;
+    }
 
-    while ( f )
+    for ( uint32_t i = 0; i < n; i++ )
     {
-        SymbolLookup( ss, f->addr, &n );
+        f = ( struct execEntryHash * )sorted[i].item;
+
+        /* Entries without a line (e.g. the interrupt source) are reported against line 0 */
+        line = ( f->line == NO_LINE ) ? 0 : f->line;
 
-        if ( prevfile != n.fileindex )
+        if ( prevfile != f->fileindex )
         {
-            fprintf( c, "fl=(%u) %s%s\n", n.fileindex & HANDLE_MASK, deleteMaterial  ? deleteMaterial : "", SymbolFilename( ss, n.fileindex ) );
+            _fileName( &w, "fl", f->fileindex, &files, deleteMaterial, ss );
         }
 
-        if ( prevfn != n.functionindex )
+        if ( prevfn != f->functionindex )
         {
-            fprintf( c, "fn=(%u) %s\n", n.functionindex & HANDLE_MASK, SymbolFunction( ss, n.functionindex ) );
+            _functionName( &w, "fn", f->functionindex, &functions, ss );
         }
 
         if ( ( prevline == NO_LINE ) || ( prevaddr == NO_FUNCTION ) )
         {
-            fprintf( c, "0x%08x %d ", f->addr, n.line );
+            _hex8( &w, f->addr );
+            _char( &w, ' ' );
+            _unsigned( &w, line );
+            _char( &w, ' ' );
         }
         else
         {
             if ( prevaddr == f->addr )
             {
-                fprintf( c, "* " );
+                _str( &w, "* " );
+            }
+            else if ( llabs( ( int64_t )f->addr - prevaddr ) > INT32_MAX )
+            {
+                /* Too far away (e.g. from an exception pseudo address) to be written relative */
+                _hex8( &w, f->addr );
+                _char( &w, ' ' );
             }
             else
             {
-                fprintf( c, "%s%d ", f->addr > prevaddr ? "+" : "", ( int )f->addr - prevaddr );
+                _delta( &w, ( int64_t )f->addr - prevaddr );
+                _char( &w, ' ' );
             }
 
-            if ( prevline == n.line )
+            if ( prevline == line )
             {
-                fprintf( c, "* " );
+                _str( &w, "* " );
             }
             else
             {
-                fprintf( c, "%s%d ", n.line > prevline ? "+" : "", ( int )n.line - prevline );
+                _delta( &w, ( int64_t )line - prevline );
+                _char( &w, ' ' );
             }
         }
 
+        _unsigned( &w, f->count );
+
         if ( includeVisits )
         {
-            fprintf( c, "%" PRIu64 " %" PRIu64 "\n", f->count, f->scount );
-        }
-        else
-        {
-            fprintf( c, "%" PRIu64 "\n", f->count );
+            _char( &w, ' ' );
+            _unsigned( &w, f->scount );
         }
 
+        _char( &w, '\n' );
 
-        prevline = n.line;
+        prevline = line;
         prevaddr = f->addr;
-        prevfile = n.fileindex;
-        prevfn = n.functionindex;
-        f = f->hh.next;
+        prevfile = f->fileindex;
+        prevfn = f->functionindex;
     }
 
-    fprintf( c, "\n\n## ------------------- Calls Follow ------------------------\n" );
-    HASH_SORT( subcallList, _calls_src_sort_fn );
-    struct subcall *s = subcallList;
+    free( mem );
+
+    _printf( &w, "\n\n## ------------------- Calls Follow ------------------------\n" );
+
+    if ( !( sorted = _sortCalls( subcallList, &n, &mem ) ) )
+    {
+        _forgetNames( &files );
+        _forgetNames( &functions );
+        _close( &w );
+        return false;
+    }
 
-    while ( s )
+    for ( uint32_t i = 0; i < n; i++ )
     {
+        s = ( struct subcall * )sorted[i].item;
+
         /* Now publish the call destination. By definition is is known, so can be shortformed */
         if ( prevfile != s->srch->fileindex )
         {
-            fprintf( c, "fl=(%u)\n", s->srch->fileindex & HANDLE_MASK );
+            _fileName( &w, "fl", s->srch->fileindex, &files, deleteMaterial, ss );
             prevfile = s->srch->fileindex;
         }
 
         if ( prevfn != s->srch->functionindex )
         {
-            fprintf( c, "fn=(%u)\n", s->srch->functionindex & HANDLE_MASK );
+            _functionName( &w, "fn", s->srch->functionindex, &functions, ss );
             prevfn = s->srch->functionindex;
         }
 
-        fprintf( c, "cfl=(%d)\ncfn=(%d)\n", s->dsth->fileindex, s->dsth->functionindex );
-        fprintf( c, "calls=%" PRIu64 " 0x%08x %d\n", s->count, s->sig.dst, s->dsth->line );
+        _fileName( &w, "cfl", s->dsth->fileindex, &files, deleteMaterial, ss );
+        _functionName( &w, "cfn", s->dsth->functionindex, &functions, ss );
+
+        _str( &w, "calls=" );
+        _unsigned( &w, s->count );
+        _char( &w, ' ' );
+        _hex8( &w, s->sig.dst );
+        _char( &w, ' ' );
+        _unsigned( &w, ( s->dsth->line == NO_LINE ) ? 0 : s->dsth->line );
+        _char( &w, '\n' );
+
+        _hex8( &w, s->sig.src );
+        _char( &w, ' ' );
+        _unsigned( &w, ( s->srch->line == NO_LINE ) ? 0 : s->srch->line );
+        _char( &w, ' ' );
+        _unsigned( &w, s->myCost );
 
         if ( includeVisits )
         {
-            fprintf( c, "0x%08x %d %" PRIu64 " %" PRIu64 "\n", s->sig.src, s->srch->line, s->myCost, s->count );
+            _char( &w, ' ' );
+            _unsigned( &w, s->count );
         }
-        else
+
+        _char( &w, '\n' );
+    }
+
+    free( mem );
+    _forgetNames( &files );
+    _forgetNames( &functions );
+    return _close( &w );
+}
+// ====================================================================================================
+// ====================================================================================================
+// pprof support
+// ====================================================================================================
+// ====================================================================================================
+bool ext_ff_outputPprof( char *pproffile, char *elffile, char *deleteMaterial, uint64_t timelen,
+                         struct execEntryHash *insthead, struct subcall *subcallList, struct cct *t, struct SymbolSet *ss )
+
+/* Output a gzipped pprof profile.proto. Every executed instruction is a sample of instructions */
+/* executed there. If there's a calling context tree every context is a sample, with its whole */
+/* call path, of its count and self time. Otherwise every call is a two frame sample of its    */
+/* count and inclusive cost. Strings, functions and locations are written as they're first     */
+/* needed, so nothing is built in memory.                                                      */
+
+{
+    static const char *fixedStrings[PS_NUM_STRINGS] = { "", "instructions", "count", "calls", "inclusive", "time", "ticks" };
+    char comment[64];
+    struct writer w;
+    struct pbMsg m;
+    struct nameUsed *files = NULL;
+    struct nameUsed *locations = NULL;
+    struct nameUsed *functions = NULL;
+    uint32_t nextLocation = 1;
+    uint32_t nextFunction = 1;
+    uint32_t strings = 0;
+    struct sortEntry *mem;
+    struct sortEntry *sorted;
+    struct execEntryHash *f;
+    struct subcall *s;
+    uint64_t loc[2];
+    uint64_t val[3];
+    uint32_t n;
+    bool ok = true;
+
+    if ( !pproffile )
+    {
+        return false;
+    }
+
+    if ( !_openGzip( &w, pproffile ) )
+    {
+        return false;
+    }
+
+    for ( uint32_t i = 0; i < PS_NUM_STRINGS; i++ )
+    {
+        _pbString( &w, &strings, NULL, fixedStrings[i] );
+    }
+
+    /* Sample types, matching the order of values in each sample */
+    m.len = 0;
+    _msgVarint( &m, 1, PS_INSTRUCTIONS );
+    _msgVarint( &m, 2, PS_COUNT );
+    _pbMsg( &w, PP_SAMPLE_TYPE, &m );
+    _pbMsg( &w, PP_PERIOD_TYPE, &m );
+    m.len = 0;
+    _msgVarint( &m, 1, PS_CALLS );
+    _msgVarint( &m, 2, PS_COUNT );
+    _pbMsg( &w, PP_SAMPLE_TYPE, &m );
+    m.len = 0;
+    _msgVarint( &m, 1, t ? PS_TIME : PS_INCLUSIVE );
+    _msgVarint( &m, 2, PS_TICKS );
+    _pbMsg( &w, PP_SAMPLE_TYPE, &m );
+
+    _varint( &w, PP_PERIOD << 3 );
+    _varint( &w, 1 );
+    _varint( &w, PP_DEFAULT_TYPE << 3 );
+    _varint( &w, PS_INSTRUCTIONS );
+
+    /* Time isn't in nanoseconds, so it goes in a comment rather than the duration */
+    snprintf( comment, sizeof( comment ), "Duration %" PRIu64 " ticks", timelen );
+    n = _pbString( &w, &strings, NULL, comment );
+    _varint( &w, PP_COMMENT << 3 );
+    _varint( &w, n );
+
+    /* Everything is in the one image */
+    m.len = 0;
+    _msgVarint( &m, 1, 1 );
+    _msgVarint( &m, 3, 0x100000000ULL );
+    _msgVarint( &m, 5, _pbString( &w, &strings, NULL, elffile ? elffile : "" ) );
+    _msgVarint( &m, 7, 1 );
+    _msgVarint( &m, 8, 1 );
+    _msgVarint( &m, 9, 1 );
+    _pbMsg( &w, PP_MAPPING, &m );
+
+    if ( !( sorted = _sortInsts( insthead, &n, &mem ) ) )
+    {
+        _close( &w );
+        return false;
+    }
+
+    for ( uint32_t i = 0; i < n; i++ )
+    {
+        f = ( struct execEntryHash * )sorted[i].item;
+
+        /* Exception pseudo addresses are only there as the source of calls */
+        if ( ( ( f->addr & SPECIALS_MASK ) == SPECIALS_MASK ) || ( !f->count ) )
         {
-            fprintf( c, "0x%08x %d %" PRIu64 "\n", s->sig.src, s->srch->line, s->myCost );
+            continue;
         }
 
-        s = s->hh.next;
+        loc[0] = _pbLocation( &w, f, &strings, &files, &locations, &nextLocation, &functions, &nextFunction, deleteMaterial, ss );
+        val[0] = f->count;
+        val[1] = val[2] = 0;
+
+        m.len = 0;
+        _msgPacked( &m, 1, loc, 1 );
+        _msgPacked( &m, 2, val, 3 );
+        _pbMsg( &w, PP_SAMPLE, &m );
     }
 
-    fclose( c );
+    free( mem );
 
-    return true;
+    if ( t )
+    {
+        ok = _pbContexts( &w, t, insthead, &strings, &files, &locations, &nextLocation, &functions, &nextFunction, deleteMaterial, ss );
+    }
+    else if ( ( sorted = _sortCalls( subcallList, &n, &mem ) ) )
+    {
+        for ( uint32_t i = 0; i < n; i++ )
+        {
+            s = ( struct subcall * )sorted[i].item;
+
+            /* Leaf first */
+            loc[0] = _pbLocation( &w, s->dsth, &strings, &files, &locations, &nextLocation, &functions, &nextFunction, deleteMaterial, ss );
+            loc[1] = _pbLocation( &w, s->srch, &strings, &files, &locations, &nextLocation, &functions, &nextFunction, deleteMaterial, ss );
+            val[0] = 0;
+            val[1] = s->count;
+            val[2] = s->myCost;
+
+            m.len = 0;
+            _msgPacked( &m, 1, loc, 2 );
+            _msgPacked( &m, 2, val, 3 );
+            _pbMsg( &w, PP_SAMPLE, &m );
+        }
+
+        free( mem );
+    }
+    else
+    {
+        ok = false;
+    }
+
+    _forgetNames( &files );
+    _forgetNames( &locations );
+    _forgetNames( &functions );
+    return _close( &w ) && ok;
+}
+// ====================================================================================================
+// ====================================================================================================
+// Folded stack (flame graph) support
+// ====================================================================================================
+// ====================================================================================================
+bool ext_ff_outputFolded( char *foldedfile, struct cct *t, struct execEntryHash *insthead, struct SymbolSet *ss )
+
+/* Output the calling context tree as folded stacks, one line per context giving its call path */
+/* (outermost first) and its self time, as used by flame graph tools.                          */
+
+{
+    struct writer w;
+    struct execEntryHash *h;
+    uint64_t *self;
+    uint32_t *path = NULL;
+    uint32_t allocated = 0;
+    uint32_t len;
+
+    if ( !foldedfile )
+    {
+        return false;
+    }
+
+    if ( !_open( &w, foldedfile ) )
+    {
+        return false;
+    }
+
+    if ( !( self = _cctSelf( t ) ) )
+    {
+        _close( &w );
+        return false;
+    }
+
+    for ( uint32_t n = 1; n < t->nodes; n++ )
+    {
+        if ( !self[n] )
+        {
+            continue;
+        }
+
+        len = _cctPath( t, n, &path, &allocated );
+
+        while ( len-- )
+        {
+            HASH_FIND_INT( insthead, &cctNode( t, path[len] )->key, h );
+            _str( &w, h ? SymbolFunction( ss, h->functionindex ) : "??" );
+            _char( &w, len ? ';' : ' ' );
+        }
+
+        _unsigned( &w, self[n] );
+        _char( &w, '\n' );
+    }
+
+    free( path );
+    free( self );
+    return _close( &w );
+}
+// ====================================================================================================
+// ====================================================================================================
+// Chrome trace-event support
+// ====================================================================================================
+// ====================================================================================================
+struct ext_ff_trace *ext_ff_traceOpen( char *tracefile )
+
+/* Start a Chrome/Perfetto trace-event stream of call slices. Timestamps are in trace ticks */
+
+{
+    struct ext_ff_trace *t;
+
+    if ( !tracefile )
+    {
+        return NULL;
+    }
+
+    if ( !( t = ( struct ext_ff_trace * )calloc( 1, sizeof( struct ext_ff_trace ) ) ) )
+    {
+        return NULL;
+    }
+
+    if ( !_open( &t->w, tracefile ) )
+    {
+        free( t );
+        return NULL;
+    }
+
+    _str( &t->w, "{\"otherData\":{\"timestamps\":\"trace ticks\"},\"traceEvents\":[" );
+    return t;
+}
+// ====================================================================================================
+void ext_ff_traceEnd( struct ext_ff_trace *t, uint32_t depth, uint64_t tstamp )
+
+/* End slices until there are only depth of them open */
+
+{
+    while ( t->depth > depth )
+    {
+        _traceEvent( t, 'E', tstamp );
+        _char( &t->w, '}' );
+        t->depth--;
+    }
+}
+// ====================================================================================================
+void ext_ff_traceBegin( struct ext_ff_trace *t, uint32_t depth, const char *name, bool isException, uint64_t tstamp )
+
+/* Start a slice for a call, which leaves depth slices open. Any that were deeper than that are */
+/* ended first, since the caller must have lost track of them.                                  */
+
+{
+    ext_ff_traceEnd( t, depth - 1, tstamp );
+
+    _traceEvent( t, 'B', tstamp );
+    _str( &t->w, isException ? ",\"cat\":\"exception\",\"name\":" : ",\"cat\":\"call\",\"name\":" );
+    _jsonStr( &t->w, name );
+    _char( &t->w, '}' );
+    t->depth = depth;
+}
+// ====================================================================================================
+bool ext_ff_traceClose( struct ext_ff_trace *t )
+
+/* End any slices still open and finish the stream. Returns false if anything went wrong writing it */
+
+{
+    bool ok;
+
+    ext_ff_traceEnd( t, 0, t->lastTstamp );
+    _str( &t->w, "\n]}\n" );
+    ok = _close( &t->w );
+    free( t );
+    return ok;
 }
 // ====================================================================================================
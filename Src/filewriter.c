@@ -11,25 +11,59 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <libgen.h>
+#include <pthread.h>
+#include <time.h>
+#include <inttypes.h>
 
 #include "itmDecoder.h"
 #include "generics.h"
 #include "fileWriter.h"
 
 enum fwState { FW_STATE_CLOSED, FW_STATE_GETNAMEA, FW_STATE_GETNAMEE, FW_STATE_UNLINK, FW_STATE_OPEN };
+enum fwOpType { FW_OP_OPENA, FW_OP_OPENE, FW_OP_ERASE, FW_OP_CLOSE };
 
 #define MAX_FILENAMELEN 1024
 #define MAX_STRLEN 4096
 #define MAX_CONCAT_FILENAMELEN (MAX_STRLEN)
 
+#define FW_BATCH        (256)            /* Messages for the filewriter before it's woken early */
+#define FW_FLUSH_MS     (50)             /* Longest data waits before it is written */
+#define FW_FILE_BUFLEN  (256 * 1024)     /* Host side buffer for each open file */
+
 static struct
 {
+    /* Decoder state */
     struct
     {
         enum fwState s;                     /* Current state of the handle */
-        FILE        *f;                     /* Handle for the handle */
         char         name[MAX_FILENAMELEN]; /* Filename */
-    } file[FW_MAX_FILES];
+    } file[FW2_MAX_FILES];
+
+    bool     bursting;                   /* Client uses bursts, so single frame commands other than opens are ignored */
+    bool     inBurst;                    /* Burst being received... */
+    uint32_t burstCmd;
+    uint32_t burstId;
+    uint32_t burstLen;                   /* ...its length */
+    uint32_t burstGot;                   /* ...how much of it has arrived */
+    uint32_t burstSum;                   /* ...and the check of what has, to compare with its trailer */
+    uint8_t  burst[FW2_MAX_BURST + 4];
+    uint64_t badHeaders;                 /* Burst headers that didn't check */
+    uint64_t badBursts;                  /* Bursts dropped because their trailer didn't match */
+
+    /* Files */
+    FILE *f[FW2_MAX_FILES];              /* Handle for each file */
+    char *buf[FW2_MAX_FILES];            /* ...its buffer, kept for the next file on the same descriptor */
+    bool dirty[FW2_MAX_FILES];           /* ...and if it's been written since it was flushed */
+    uint64_t bytesWritten;
+
+    /* Writer thread, and what wakes it, protected by lock */
+    struct msgBusSub *sub;               /* Our subscription to the decoded messages */
+    pthread_t writer;
+    bool writerRunning;
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+    bool kicked;                         /* There's a batch waiting */
+    bool ending;
 
     char            *basedir;     /* Where we are going to put everything */
     bool             initialised; /* Have we been initialised? */
@@ -42,30 +76,33 @@ static struct
 // ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
-void _processCompleteName( uint32_t n )
+static bool _resolveName( const char *name, char *workingName )
 
-/* We got the whole name from the remote end, so process it */
+/* Make the full name of the file and check it's somewhere we're allowed to touch */
 
 {
-    char workingName[MAX_CONCAT_FILENAMELEN] = { 0 };
+    char dirName[MAX_CONCAT_FILENAMELEN];
     char *resolvedName;
     char *compareName;
 
     /* Concat strings */
+    memset( workingName, 0, MAX_CONCAT_FILENAMELEN );
+
     if ( _f.basedir )
     {
         strncpy( workingName, _f.basedir, MAX_CONCAT_FILENAMELEN - 1 );
-        strncat( workingName, _f.file[n].name, MAX_CONCAT_FILENAMELEN - 1 );
+        strncat( workingName, name, MAX_CONCAT_FILENAMELEN - 1 - strlen( workingName ) );
     }
     else
     {
-        strncpy( workingName, _f.file[n].name, MAX_CONCAT_FILENAMELEN - 1 );
+        strncpy( workingName, name, MAX_CONCAT_FILENAMELEN - 1 );
     }
 
     /* Make sure we haven't broken out of the current directory          */
     /* Start by getting both the real path of the requested file and the */
     /* real path of the current directory.                               */
-    resolvedName = realpath( dirname( workingName ), NULL );
+    strcpy( dirName, workingName );
+    resolvedName = realpath( dirname( dirName ), NULL );
 
     if ( _f.basedir )
     {
@@ -73,73 +110,132 @@ void _processCompleteName( uint32_t n )
     }
     else
     {
-        compareName = realpath( dirname( "" ), NULL );
+        compareName = realpath( ".", NULL );
     }
 
     /* Now check that the first part matches, up to the length of the comparison Name */
-    bool goodDirectory = ( ( compareName != NULL ) && ( 0 == strncmp( resolvedName, compareName, strlen( compareName ) ) ) );
+    bool goodDirectory = ( ( compareName != NULL ) && ( resolvedName != NULL ) && ( 0 == strncmp( resolvedName, compareName, strlen( compareName ) ) ) );
     free( resolvedName );
     free( compareName );
 
     if ( !goodDirectory )
     {
         genericsReport( V_WARN, "Path to [%s] is not in or below current directory" EOL, workingName );
-        return;
+        return false;
     }
 
     genericsReport( V_DEBUG, "Complete name to work with is [%s]" EOL, workingName );
+    return true;
+}
+// ====================================================================================================
+static void _execute( enum fwOpType type, uint32_t id, const char *name )
 
-    /* OK, now decide what to do... */
-    switch ( _f.file[n].s )
+/* Carry out a file operation */
+
+{
+    char workingName[MAX_CONCAT_FILENAMELEN];
+
+    switch ( type )
     {
         // -----------------------
-        case FW_STATE_GETNAMEA:     // This is a file append operation
-            _f.file[n].f = fopen( workingName, "ab+" );
-
-            if ( _f.file[n].f )
+        case FW_OP_OPENA:
+        case FW_OP_OPENE:
+            if ( _f.f[id] )
             {
-                genericsReport( V_INFO, "File [%s] opened for append" EOL, workingName, n );
-                _f.file[n].s = FW_STATE_OPEN;
+                fclose( _f.f[id] );
+                _f.f[id] = NULL;
+                _f.dirty[id] = false;
             }
-            else
+
+            if ( _resolveName( name, workingName ) )
             {
-                genericsReport( V_WARN, "Failed to open [%s] for append" EOL, workingName );
-                memset( _f.file[n].name, 0, MAX_FILENAMELEN );
-                _f.file[n].s = FW_STATE_CLOSED;
+                if ( ( _f.f[id] = fopen( workingName, ( type == FW_OP_OPENA ) ? "ab+" : "wb+" ) ) )
+                {
+                    /* Writes arrive a burst or frame at a time, so gather them into large ones */
+                    if ( ( _f.buf[id] ) || ( _f.buf[id] = ( char * )malloc( FW_FILE_BUFLEN ) ) )
+                    {
+                        setvbuf( _f.f[id], _f.buf[id], _IOFBF, FW_FILE_BUFLEN );
+                    }
+
+                    genericsReport( V_INFO, "File [%s] opened for %s on descriptor %d" EOL, workingName, ( type == FW_OP_OPENA ) ? "append" : "write", id );
+                }
+                else
+                {
+                    genericsReport( V_WARN, "Failed to open [%s] for %s" EOL, workingName, ( type == FW_OP_OPENA ) ? "append" : "write" );
+                }
             }
 
             break;
 
         // -----------------------
-        case FW_STATE_GETNAMEE:     // This is a file replacement operation
-            _f.file[n].f = fopen( workingName, "wb+" );
-
-            if ( _f.file[n].f )
-            {
-                genericsReport( V_INFO, "File [%s] opened for write" EOL, workingName, n );
-                _f.file[n].s = FW_STATE_OPEN;
-            }
-            else
+        case FW_OP_ERASE:
+            if ( _resolveName( name, workingName ) )
             {
-                genericsReport( V_WARN, "Failed to open [%s] for write" EOL, workingName );
-                memset( _f.file[n].name, 0, MAX_FILENAMELEN );
-                _f.file[n].s = FW_STATE_CLOSED;
+                if ( !unlink( workingName ) )
+                {
+                    genericsReport( V_INFO, "Removed file [%s]" EOL, workingName );
+                }
+                else
+                {
+                    genericsReport( V_WARN, "Failed to remove file [%s]" EOL, workingName );
+                }
             }
 
             break;
 
         // -----------------------
-        case FW_STATE_UNLINK:     // this is a file delete operation
-            if ( !unlink( workingName ) )
-            {
-                genericsReport( V_INFO, "Removed file [%s]" EOL, workingName );
-            }
-            else
+        case FW_OP_CLOSE:
+            if ( _f.f[id] )
             {
-                genericsReport( V_WARN, "Failed to remove file [%s]" EOL, workingName );
+                genericsReport( V_INFO, "Close descriptor %d" EOL, id );
+                fclose( _f.f[id] );
+                _f.f[id] = NULL;
+                _f.dirty[id] = false;
             }
 
-            memset( _f.file[n].name, 0, MAX_FILENAMELEN );
+            break;
+            // -----------------------
+    }
+}
+// ====================================================================================================
+static void _write( uint32_t id, const uint8_t *d, size_t len )
+
+/* Write to an open file. It's flushed once the batch it came in is done with */
+
+{
+    if ( _f.f[id] )
+    {
+        fwrite( d, 1, len, _f.f[id] );
+        _f.dirty[id] = true;
+        _f.bytesWritten += len;
+    }
+}
+// ====================================================================================================
+static void _processCompleteName( uint32_t n )
+
+/* We got the whole name from the remote end, so pass it on to be dealt with */
+
+{
+    genericsReport( V_DEBUG, "Got complete name [%s]" EOL, _f.file[n].name );
+
+    /* OK, now decide what to do... */
+    switch ( _f.file[n].s )
+    {
+        // -----------------------
+        case FW_STATE_GETNAMEA:     // This is a file append operation
+            _execute( FW_OP_OPENA, n, _f.file[n].name );
+            _f.file[n].s = FW_STATE_OPEN;
+            break;
+
+        // -----------------------
+        case FW_STATE_GETNAMEE:     // This is a file replacement operation
+            _execute( FW_OP_OPENE, n, _f.file[n].name );
+            _f.file[n].s = FW_STATE_OPEN;
+            break;
+
+        // -----------------------
+        case FW_STATE_UNLINK:     // this is a file delete operation
+            _execute( FW_OP_ERASE, n, _f.file[n].name );
             _f.file[n].s = FW_STATE_CLOSED;
             break;
 
@@ -149,9 +245,11 @@ void _processCompleteName( uint32_t n )
             break;
             // -----------------------
     }
+
+    memset( _f.file[n].name, 0, MAX_FILENAMELEN );
 }
 // ====================================================================================================
-void _handleNameBytes( uint32_t n, uint8_t h, uint8_t *d )
+static void _handleNameBytes( uint32_t n, uint8_t h, uint8_t *d )
 
 /* Collect the name of the file we're going to do something with */
 
@@ -174,27 +272,157 @@ void _handleNameBytes( uint32_t n, uint8_t h, uint8_t *d )
         }
         else
         {
-            genericsReport( V_DEBUG, "Got complete name [%s]" EOL, _f.file[n].name );
             _processCompleteName( n );
             break;
         }
     }
 }
 // ====================================================================================================
+static void _closeIfOpen( uint32_t n )
+
+/* A new command has arrived for a descriptor that may still be open, close it first */
+
+{
+    if ( _f.file[n].s == FW_STATE_OPEN )
+    {
+        genericsReport( V_WARN, "Attempt to reuse descriptor %d while still open" EOL, n );
+        _execute( FW_OP_CLOSE, n, NULL );
+    }
+
+    memset( _f.file[n].name, 0, MAX_FILENAMELEN );
+    _f.file[n].s = FW_STATE_CLOSED;
+}
 // ====================================================================================================
+static void _burstComplete( void )
+
+/* All of a burst has arrived, so act on it */
+
+{
+    uint32_t n = _f.burstId;
+
+    switch ( _f.burstCmd )
+    {
+        // -----------------------
+        case FW_CMD_OPENA:
+        case FW_CMD_OPENE:
+        case FW_CMD_ERASE:
+            _closeIfOpen( n );
+
+            /* The payload is the name, which may or may not have been terminated */
+            memset( _f.file[n].name, 0, MAX_FILENAMELEN );
+            memcpy( _f.file[n].name, _f.burst, ( _f.burstLen < MAX_FILENAMELEN - 1 ) ? _f.burstLen : MAX_FILENAMELEN - 1 );
+            _f.file[n].s = ( _f.burstCmd == FW_CMD_OPENA ) ? FW_STATE_GETNAMEA : ( _f.burstCmd == FW_CMD_OPENE ) ? FW_STATE_GETNAMEE : FW_STATE_UNLINK;
+            _processCompleteName( n );
+            break;
+
+        // -----------------------
+        case FW_CMD_CLOSE:
+            if ( _f.file[n].s == FW_STATE_OPEN )
+            {
+                _execute( FW_OP_CLOSE, n, NULL );
+            }
+
+            _f.file[n].s = FW_STATE_CLOSED;
+            break;
+
+        // -----------------------
+        case FW_CMD_WRITE:
+            if ( _f.file[n].s == FW_STATE_OPEN )
+            {
+                _write( n, _f.burst, _f.burstLen );
+            }
+            else
+            {
+                genericsReport( V_WARN, "Request for write on descriptor %d while file closed" EOL, n );
+            }
+
+            break;
+
+        // -----------------------
+        default:
+            break;
+            // -----------------------
+    }
+}
 // ====================================================================================================
-// Externally available routines
-// ====================================================================================================
-// ====================================================================================================
+static void _handleBurst( uint32_t v )
+
+/* Handle a word that is part of a burst, or might start one */
+
+{
+    if ( _f.inBurst )
+    {
+        if ( _f.burstGot < _f.burstLen )
+        {
+            /* Payload for the burst that's in progress */
+            _f.burst[_f.burstGot++] = v & 0xff;
+            _f.burst[_f.burstGot++] = ( v >> 8 ) & 0xff;
+            _f.burst[_f.burstGot++] = ( v >> 16 ) & 0xff;
+            _f.burst[_f.burstGot++] = ( v >> 24 ) & 0xff;
+            _f.burstSum = FW2_SUM( _f.burstSum, v );
+            return;
+        }
+
+        /* This is the trailer, and only if it matches do we know we've got the whole burst */
+        _f.inBurst = false;
+
+        if ( v == _f.burstSum )
+        {
+            _burstComplete();
+        }
+        else
+        {
+            _f.badBursts++;
+        }
+
+        return;
+    }
+
+    /* Otherwise this should be a new header */
+    if ( ( FW2_GET_CHECK( v ) != FW2_CALC_CHECK( v & ~FW2_CHECK( 0xf ) ) ) ||
+            ( FW2_GET_FILEID( v ) >= FW2_MAX_FILES ) ||
+            ( FW2_GET_COMMAND( v ) == FW_CMD_NULL ) || ( FW2_GET_COMMAND( v ) > FW_CMD_WRITE ) )
+    {
+        _f.badHeaders++;
+        return;
+    }
+
+    _f.inBurst  = true;
+    _f.burstCmd = FW2_GET_COMMAND( v );
+    _f.burstId  = FW2_GET_FILEID( v );
+    _f.burstLen = FW2_GET_LEN( v );
+    _f.burstGot = 0;
+    _f.burstSum = FW2_SUM_INIT( v );
+}
 // ====================================================================================================
-bool filewriterProcess( struct swMsg *m )
+static void _process( struct swMsg *m )
 
 /* Handle an ITM software frame targetted at the filewriter */
 
 {
+    /* Bursts take every word until they're complete, and are started by a header word */
+    if ( ( _f.inBurst ) || ( FW_IS_BURST( m->value ) ) )
+    {
+        _f.bursting = true;
+        _handleBurst( m->value );
+        return;
+    }
+
+    /* A client using bursts doesn't send anything else, so this is left over from a broken one...  */
+    /* unless it's an open, which means the target has started again without using bursts.          */
+    if ( _f.bursting )
+    {
+        if ( ( FW_MASK_COMMAND( m->value & 0xff ) != FW_CMD_OPENA ) && ( FW_MASK_COMMAND( m->value & 0xff ) != FW_CMD_OPENE ) )
+        {
+            return;
+        }
+
+        _f.bursting = false;
+    }
+
     /* Split 32-bit word back into its compoenent parts without punning issues */
 
-    uint8_t d[4] = { m->value & 0xff,  ( m->value >> 8 ) & 0xff,  ( m->value >> 16 ) & 0xff,  ( m->value > 24 ) & 0xff};
+    uint8_t d[4] = { m->value & 0xff,  ( m->value >> 8 ) & 0xff,  ( m->value >> 16 ) & 0xff,  ( m->value >> 24 ) & 0xff};
 
     uint8_t c = d[0]; /* Extract the control word for convinience */
 
@@ -205,17 +433,8 @@ bool filewriterProcess( struct swMsg *m )
         case FW_CMD_OPENE:     // Open file for empty write (i.e. flush and write)
             genericsReport( V_DEBUG, "Attempt to open or create file" EOL );
 
-            if ( _f.file[FW_GET_FILEID( c )].f )
-            {
-                /* There was a file open, close it */
-                genericsReport( V_WARN, "Attempt to write to descriptor %d while open writing %s" EOL, FW_GET_FILEID( c ),
-                                _f.file[FW_GET_FILEID( c )].name );
-                fclose( _f.file[FW_GET_FILEID( c )].f );
-                _f.file[FW_GET_FILEID( c )].f = NULL;
-                _f.file[FW_GET_FILEID( c )].f = NULL;
-            }
-
-            memset( _f.file[FW_GET_FILEID( c )].name, 0, MAX_FILENAMELEN );
+            /* If there was a file open, close it */
+            _closeIfOpen( FW_GET_FILEID( c ) );
 
             /* Start collecting the name */
             if ( FW_MASK_COMMAND( c ) == FW_CMD_OPENA )
@@ -233,20 +452,18 @@ bool filewriterProcess( struct swMsg *m )
         // -----------------------
 
         case FW_CMD_CLOSE:     // Close file
-            if ( !_f.file[FW_GET_FILEID( c )].f )
+            if ( _f.file[FW_GET_FILEID( c )].s != FW_STATE_OPEN )
             {
                 /* There was no file open, complain */
                 genericsReport( V_DEBUG, "Attempt to close descriptor %d while not open" EOL, FW_GET_FILEID( c ) );
             }
             else
             {
-                genericsReport( V_INFO, "Close %s" EOL,  _f.file[FW_GET_FILEID( c )].name );
-                fclose( _f.file[FW_GET_FILEID( c )].f );
-                _f.file[FW_GET_FILEID( c )].f = NULL;
-                memset( _f.file[FW_GET_FILEID( c )].name, 0, MAX_FILENAMELEN );
-                _f.file[FW_GET_FILEID( c )].s = FW_STATE_CLOSED;
+                _execute( FW_OP_CLOSE, FW_GET_FILEID( c ), NULL );
             }
 
+            memset( _f.file[FW_GET_FILEID( c )].name, 0, MAX_FILENAMELEN );
+            _f.file[FW_GET_FILEID( c )].s = FW_STATE_CLOSED;
             break;
 
         // -----------------------
@@ -280,8 +497,7 @@ bool filewriterProcess( struct swMsg *m )
                 }
                 else
                 {
-                    genericsReport( V_DEBUG, "Wrote %d bytes on descriptor %d" EOL, FW_GET_BYTES( c ), FW_GET_FILEID( c ) );
-                    fwrite( &d[1], 1, FW_GET_BYTES( c ), _f.file[FW_GET_FILEID( c )].f );
+                    _write( FW_GET_FILEID( c ), &d[1], FW_GET_BYTES( c ) );
                 }
             }
 
@@ -293,17 +509,151 @@ bool filewriterProcess( struct swMsg *m )
         case FW_CMD_NULL:
             break;
     }
+}
+// ====================================================================================================
+// ====================================================================================================
+static void _busWake( void *ctx )
 
-    return true;
+/* Called by the decoder when there's a batch for us */
+
+{
+    pthread_mutex_lock( &_f.lock );
+    _f.kicked = true;
+    pthread_cond_signal( &_f.wake );
+    pthread_mutex_unlock( &_f.lock );
+}
+// ====================================================================================================
+static void *_runWriter( void *arg )
+
+/* Writer thread. Takes whatever has been decoded for the filewriter channel in one go and      */
+/* carries it out. Waits for up to FW_FLUSH_MS for the decoder to wake it. The files are flushed */
+/* when things go quiet, or FW_FLUSH_MS after the last flush, so they fill their buffers first.  */
+
+{
+    struct msgBusEntry *e;
+    struct timespec ts;
+    uint32_t lastFlushmS = genericsTimestampmS();
+    uint32_t taken;
+    uint32_t n;
+    bool ending;
+
+    do
+    {
+        pthread_mutex_lock( &_f.lock );
+
+        if ( ( !_f.kicked ) && ( !_f.ending ) )
+        {
+            clock_gettime( CLOCK_REALTIME, &ts );
+            ts.tv_nsec += FW_FLUSH_MS * 1000000L;
+            ts.tv_sec += ts.tv_nsec / 1000000000L;
+            ts.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait( &_f.wake, &_f.lock, &ts );
+        }
+
+        _f.kicked = false;
+        ending = _f.ending;
+        pthread_mutex_unlock( &_f.lock );
+
+        /* Two runs take everything that was there, even if it wraps round the end of the bus */
+        taken = 0;
+
+        for ( int run = 0; ( run < 2 ) && ( n = msgBusPull( _f.sub, &e ) ); run++ )
+        {
+            taken += n;
+
+            for ( uint32_t i = 0; i < n; i++ )
+            {
+                if ( ( e[i].m.genericMsg.msgtype == MSG_SOFTWARE ) && ( e[i].m.swMsg.srcAddr == FW_CHANNEL ) )
+                {
+                    _process( &e[i].m.swMsg );
+                }
+            }
+
+            msgBusRelease( _f.sub, n );
+        }
+
+        if ( ( !taken ) || ( ending ) || ( genericsTimestampmS() - lastFlushmS >= FW_FLUSH_MS ) )
+        {
+            for ( uint32_t t = 0; t < FW2_MAX_FILES; t++ )
+            {
+                if ( _f.dirty[t] )
+                {
+                    fflush( _f.f[t] );
+                    _f.dirty[t] = false;
+                }
+            }
+
+            lastFlushmS = genericsTimestampmS();
+        }
+    }
+    while ( !ending );
+
+    for ( uint32_t t = 0; t < FW2_MAX_FILES; t++ )
+    {
+        if ( _f.f[t] )
+        {
+            fclose( _f.f[t] );
+            _f.f[t] = NULL;
+        }
+
+        free( _f.buf[t] );
+        _f.buf[t] = NULL;
+    }
+
+    return NULL;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+void filewriterShutdown( void )
+
+/* Write out everything still queued, then close all of the files */
+
+{
+    if ( !_f.writerRunning )
+    {
+        return;
+    }
+
+    pthread_mutex_lock( &_f.lock );
+    _f.ending = true;
+    pthread_cond_signal( &_f.wake );
+    pthread_mutex_unlock( &_f.lock );
+    pthread_join( _f.writer, NULL );
+    _f.writerRunning = false;
+
+    genericsReport( V_INFO, "Filewriter wrote %" PRIu64 " bytes, %" PRIu64 " bad burst headers, %" PRIu64 " bursts dropped" EOL,
+                    _f.bytesWritten, _f.badHeaders, _f.badBursts );
 }
 // ====================================================================================================
-bool filewriterInit( char *basedir )
+bool filewriterInit( char *basedir, struct msgBus *b )
 
-/* Initialise the filewriter */
+/* Initialise the filewriter, taking its messages from the bus the decoder publishes to */
 
 {
     _f.initialised = true;
     _f.basedir     = basedir;
+
+    pthread_mutex_init( &_f.lock, NULL );
+    pthread_cond_init( &_f.wake, NULL );
+
+    /* A gap in what reaches us corrupts files, or turns data into commands, so nothing is dropped */
+    if ( !( _f.sub = msgBusSubscribe( b, MSGBUS_TYPE( MSG_SOFTWARE ), FW_BATCH, true, _busWake, NULL ) ) )
+    {
+        return false;
+    }
+
+    if ( pthread_create( &_f.writer, NULL, &_runWriter, NULL ) )
+    {
+        genericsReport( V_ERROR, "Failed to start filewriter" EOL );
+        return false;
+    }
+
+    _f.writerRunning = true;
     genericsReport( V_DEBUG, "Filewriter initialised" EOL );
     return true;
 }
@@ -16,7 +16,9 @@
 #include <stdint.h>
 #include <inttypes.h>
 #include <pthread.h>
-#include <signal.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/uio.h>
 
 #include "git_version_info.h"
 #include "generics.h"
@@ -25,27 +27,34 @@
 #include "fileWriter.h"
 #include "itmfifos.h"
 #include "msgDecoder.h"
+#include "chanFormat.h"
+#include "itmfifoRecord.h"
+#include "msgBus.h"
 
 #define MAX_STRING_LENGTH (100)              /* Maximum length that will be output from a fifo for a single event */
-
-struct runThreadParams                       /* Structure for parameters passed to a software task thread */
-{
-    int portNo;
-    int listenHandle;
-    bool permafile;
-    struct Channel *c;
-};
+#define BUS_LEN           (65536)            /* Decoded messages waiting to be output (must be power of 2) */
+#define OP_RING_LEN       (65536)            /* Formatted bytes queued per channel (must be power of 2) */
+#define REOPEN_INTERVAL   (100)              /* mS between attempts to open a fifo nobody is reading */
 
 struct Channel                               /* Information for an individual channel */
 {
     char *chanName;                          /* Filename to be used for the fifo */
     char *presFormat;                        /* Format of data presentation to be used */
+    struct chanFormat *chanFormat;           /* ...compiled ready for use */
+    bool records;                            /* Output binary records rather than text or raw values */
 
     /* Runtime state */
-    int handle;                              /* Handle to the fifo */
-    pthread_t thread;                        /* Thread on which it's running */
-    struct runThreadParams params;           /* Parameters for running thread */
+    int handle;                              /* Handle to the fifo (-1 when nobody is listening) */
     char *fifoName;                          /* Constructed fifo name (from chanPath and name) */
+    bool enabled;                            /* Is this channel in use? */
+    bool blocked;                            /* Did the last write to the fifo come up short? */
+    uint32_t nextOpen;                       /* When to try opening the fifo again */
+    uint64_t dropped;                        /* Messages lost because the channel was full */
+
+    /* Formatted output waiting to go to the fifo */
+    char *op;
+    uint32_t opwp;
+    uint32_t oprp;
 };
 
 struct itmfifosHandle
@@ -59,6 +68,10 @@ struct itmfifosHandle
     enum timeDelay timeStatus;                    /* Indicator of if this time is exact */
     uint64_t timeStamp;                           /* Latest received time */
 
+    /* Decoded messages, for the fifos and anything else that wants them */
+    struct msgBus bus;
+    struct msgBusSub *sub;                        /* The fifos' subscription */
+
     /* Timestamp info */
     uint64_t lastHWExceptionTS;
 
@@ -69,6 +82,15 @@ struct itmfifosHandle
     bool forceITMSync;                            /* Is ITM to be forced into sync? */
     bool permafile;                               /* Use permanent files rather than fifos */
     int tpiuITMChannel;                           /* TPIU channel on which ITM appears */
+    int batch;                                    /* Messages to publish before waking the output thread */
+    int flushInterval;                            /* Longest a message waits to be output (in mS) */
+
+    /* Output thread */
+    pthread_t outputThread;                       /* Thread writing all of the fifos */
+    bool outputRunning;                           /* ...and if it was started */
+    int wake[2];                                  /* Pipe to wake it when a batch is ready */
+    bool woken;                                   /* Has it already been woken for this batch? */
+    bool ending;                                  /* Is it time for it to go? */
 
     struct Channel c[NUM_CHANNELS + 1];           /* Output for each channel */
 };
@@ -83,164 +105,193 @@ struct itmfifosHandle
 // ====================================================================================================
 
 // ====================================================================================================
-// Handlers for the fifos
+// Output to the fifos
 // ====================================================================================================
-static void *_runFifo( void *arg )
+static void _wake( void *ctx )
 
-/* This is the control loop for the channel fifos (for each software port) */
+/* Kick the output thread, unless it has already been kicked and not yet got round to it */
 
 {
-    struct runThreadParams *params = ( struct runThreadParams * )arg;
-    struct Channel *c = params->c;
-    struct swMsg m;
-    uint32_t w;
+    struct itmfifosHandle *f = ( struct itmfifosHandle * )ctx;
 
-    char constructString[MAX_STRING_LENGTH];
-    int opfile;
-    size_t readDataLen, writeDataLen, written = 0;
+    if ( !__atomic_exchange_n( &f->woken, true, __ATOMIC_ACQ_REL ) )
+    {
+        write( f->wake[1], "", 1 );
+    }
+}
+// ====================================================================================================
+static bool _opPut( struct Channel *c, const char *s, uint32_t len )
 
-    assert( &params->c->params == params );
+/* Add formatted output to the channel, if there's room for it */
 
-    /* Remove the file if it exists */
-    unlink( c->fifoName );
+{
+    uint32_t wp = c->opwp;
+    uint32_t first;
 
-    if ( !params->permafile )
+    if ( OP_RING_LEN - ( wp - c->oprp ) < len )
     {
-        /* This is a 'conventional' fifo, so it must be created */
-        if ( mkfifo( c->fifoName, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH ) < 0 )
-        {
-            pthread_exit( NULL );
-        }
+        return false;
     }
 
-    do
+    first = OP_RING_LEN - ( wp & ( OP_RING_LEN - 1 ) );
+
+    if ( first > len )
     {
-        /* Keep on opening the file (in case the fifo is opened/closed multiple times */
-        if ( !params->permafile )
-        {
-            opfile = open( c->fifoName, O_WRONLY );
-        }
-        else
-        {
-            opfile = open( c->fifoName, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH );
-        }
+        first = len;
+    }
 
-        do
-        {
-            /* ....get the packet */
-            readDataLen = read( params->listenHandle, &m, sizeof( struct swMsg ) );
+    memcpy( &c->op[wp & ( OP_RING_LEN - 1 )], s, first );
+    memcpy( c->op, &s[first], len - first );
+    c->opwp = wp + len;
+    return true;
+}
+// ====================================================================================================
+static int _formatSW( struct Channel *c, struct msgBusEntry *e, char *constructString )
 
-            if ( readDataLen <= 0 )
-            {
-                continue;
-            }
+/* Format a software message for output, returning its length */
 
-            if ( c->presFormat )
-            {
-                // formatted output....start with specials
-                if ( strstr( c->presFormat, "%f" ) )
-                {
-                    /* type punning on same host, after correctly building 32bit val
-                     * only unsafe on systems where u32/float have diff byte order */
-                    float *nastycast = ( float * )&m.value;
-                    writeDataLen = snprintf( constructString, MAX_STRING_LENGTH, c->presFormat, *nastycast, *nastycast, *nastycast, *nastycast );
-                }
-                else if ( strstr( c->presFormat, "%c" ) )
-                {
-                    /* Format contains %c, so execute repeatedly for all characters in sent data */
-                    writeDataLen = 0;
-                    uint8_t op[4] = {m.value & 0xff, ( m.value >> 8 ) & 0xff, ( m.value >> 16 ) & 0xff, ( m.value >> 24 ) & 0xff};
+{
+    struct itmfifoRecord r;
 
-                    uint32_t l = 0;
+    if ( c->records )
+    {
+        r.ts         = e->targetTs;
+        r.channel    = e->m.swMsg.srcAddr;
+        r.len        = e->m.swMsg.len;
+        r.timeStatus = e->timeStatus;
+        r.reserved   = 0;
+        r.value      = e->m.swMsg.value;
+        memcpy( constructString, &r, sizeof( struct itmfifoRecord ) );
+        return sizeof( struct itmfifoRecord );
+    }
 
-                    do
-                    {
-                        writeDataLen += snprintf( &constructString[writeDataLen], MAX_STRING_LENGTH - writeDataLen, c->presFormat, op[l], op[l], op[l], op[l] );
-                    }
-                    while ( ++l < m.len );
-                }
-                else
-                {
-                    writeDataLen = snprintf( constructString, MAX_STRING_LENGTH, c->presFormat, m.value, m.value, m.value, m.value );
-                }
+    if ( !c->chanFormat )
+    {
+        /* Raw output */
+        memcpy( constructString, &e->m.swMsg.value, sizeof( e->m.swMsg.value ) );
+        return sizeof( e->m.swMsg.value );
+    }
 
-                written = write( opfile, constructString, ( writeDataLen < MAX_STRING_LENGTH ) ? writeDataLen : MAX_STRING_LENGTH );
-            }
-            else
-            {
-                // raw output.
-                written = write( opfile, &w, sizeof ( w ) );
-            }
-        }
-        while ( ( readDataLen > 0 ) && ( written > 0 ) );
+    return chanFormatRun( c->chanFormat, &e->m.swMsg, constructString, MAX_STRING_LENGTH );
+}
+// ====================================================================================================
+static void _startStream( struct Channel *c, int chan )
+
+/* A new reader starts with an empty channel, which for records begins with the stream header */
+
+{
+    struct itmfifoStreamHeader h = { .version = ITMFIFO_RECORD_VERSION, .recordLen = sizeof( struct itmfifoRecord ), .channel = chan };
+
+    if ( c->records )
+    {
+        memcpy( h.magic, ITMFIFO_RECORD_MAGIC, sizeof( h.magic ) );
+        _opPut( c, ( const char * )&h, sizeof( h ) );
+    }
+}
+// ====================================================================================================
+static void _openChannel( struct itmfifosHandle *f, struct Channel *c, uint32_t now )
 
-        close( opfile );
+/* Nobody was listening last time, see if they are now. Fifos can't block on the open */
+
+{
+    if ( ( c->handle >= 0 ) || ( ( int32_t )( now - c->nextOpen ) < 0 ) )
+    {
+        return;
     }
-    while ( readDataLen > 0 );
 
-    pthread_exit( NULL );
+    c->handle = open( c->fifoName, O_WRONLY | O_NONBLOCK );
+    c->nextOpen = now + REOPEN_INTERVAL;
+
+    if ( c->handle >= 0 )
+    {
+        /* Anything left over from a previous reader (perhaps part of a record) goes */
+        c->oprp = c->opwp;
+        _startStream( c, c - f->c );
+    }
 }
 // ====================================================================================================
-static void *_runHWFifo( void *arg )
+static void _flushChannel( struct Channel *c, uint32_t now )
 
-/* This is the control loop for the hardware fifo */
+/* Write as much of the channel's output as the fifo will take in one go */
 
 {
-    struct runThreadParams *params = ( struct runThreadParams * )arg;
-    struct Channel *c = params->c;
-    int opfile;
-    size_t readDataLen = 0, writeDataLen = 0;
-    uint8_t p[MAX_STRING_LENGTH];
+    struct iovec iov[2];
+    uint32_t rp, len, first;
+    ssize_t written;
+
+    if ( c->handle < 0 )
+    {
+        /* Still nobody listening, so throw the output away */
+        c->oprp = c->opwp;
+        return;
+    }
 
-    /* Remove the file if it exists */
-    unlink( c->fifoName );
+    /* Hand the lot to the fifo, in two parts if it wraps */
+    rp = c->oprp;
+    len = c->opwp - rp;
 
-    if ( !params->permafile )
+    if ( !len )
     {
-        /* This is a 'conventional' fifo, so it must be created */
-        if ( mkfifo( c->fifoName, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH ) < 0 )
-        {
-            pthread_exit( NULL );
-        }
+        c->blocked = false;
+        return;
     }
 
-    do
+    first = OP_RING_LEN - ( rp & ( OP_RING_LEN - 1 ) );
+    iov[0].iov_base = &c->op[rp & ( OP_RING_LEN - 1 )];
+    iov[0].iov_len  = ( first < len ) ? first : len;
+    iov[1].iov_base = c->op;
+    iov[1].iov_len  = len - iov[0].iov_len;
+
+    written = writev( c->handle, iov, iov[1].iov_len ? 2 : 1 );
+
+    if ( written < 0 )
     {
-        if ( !params->permafile )
-        {
-            opfile = open( c->fifoName, O_WRONLY );
-        }
-        else
+        if ( ( errno != EAGAIN ) && ( errno != EINTR ) )
         {
-            opfile = open( c->fifoName, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH );
+            /* The reader has gone away, so go back to waiting for another */
+            close( c->handle );
+            c->handle = -1;
+            c->nextOpen = now;
         }
 
-        do
-        {
-            /* ....get the packet, don't worry if it can't be written */
-            readDataLen = read( params->listenHandle, p, MAX_STRING_LENGTH );
+        c->blocked = ( c->handle >= 0 );
+        return;
+    }
 
-            if ( readDataLen > 0 )
-            {
-                writeDataLen = write( opfile, p, readDataLen );
-            }
-        }
-        while ( ( readDataLen > 0 ) && ( writeDataLen > 0 ) );
+    c->oprp = rp + written;
+    c->blocked = ( ( uint32_t )written < len );
+}
+// ====================================================================================================
+static void _output( struct itmfifosHandle *f, struct Channel *c, const char *s, int len )
+
+/* Queue formatted output for a channel. When it's full a permafile is written out to make */
+/* room, but for a fifo the output is lost rather than hold up every other channel.         */
 
-        close( opfile );
+{
+    if ( c->handle < 0 )
+    {
+        return;
     }
-    while ( readDataLen > 0 );
 
-    pthread_exit( NULL );
+    while ( !_opPut( c, s, len ) )
+    {
+        if ( !f->permafile )
+        {
+            c->dropped++;
+            return;
+        }
+
+        _flushChannel( c, genericsTimestampmS() );
+    }
 }
 // ====================================================================================================
-static void _intEINTRHandler( int sig )
+static void _hwOutput( struct itmfifosHandle *f, const char *s, int len )
 
 {
-    pthread_exit( NULL );
+    _output( f, &f->c[HW_CHANNEL], s, len );
 }
 // ====================================================================================================
-// Decoders for each message
+// Formatters for each message
 // ====================================================================================================
 void _handleException( struct excMsg *m, struct itmfifosHandle *f )
 
@@ -267,7 +318,7 @@ void _handleException( struct excMsg *m, struct itmfifosHandle *f )
         opLen = snprintf( outputString, MAX_STRING_LENGTH, "%d,%" PRIu64 ",%s,External,%d" EOL, HWEVENT_EXCEPTION, eventdifftS, exEvent[m->eventType & 0x03], m->exceptionNumber - 16 );
     }
 
-    write( f->c[HW_CHANNEL].handle, outputString, opLen );
+    _hwOutput( f, outputString, opLen );
 }
 // ====================================================================================================
 void _handleDWTEvent( struct dwtMsg *m, struct itmfifosHandle *f )
@@ -299,8 +350,8 @@ void _handleDWTEvent( struct dwtMsg *m, struct itmfifosHandle *f )
         }
     }
 
-    write( f->c[HW_CHANNEL].handle, outputString, opLen );
-    write( f->c[HW_CHANNEL].handle, EOL, strlen( EOL ) );
+    strcpy( &outputString[opLen], EOL );
+    _hwOutput( f, outputString, opLen + strlen( EOL ) );
 }
 // ====================================================================================================
 void _handlePCSample( struct pcSampleMsg *m, struct itmfifosHandle *f )
@@ -324,8 +375,7 @@ void _handlePCSample( struct pcSampleMsg *m, struct itmfifosHandle *f )
         opLen = snprintf( outputString, ( MAX_STRING_LENGTH - 1 ), "%d,%" PRIu64 ",0x%08x" EOL, HWEVENT_PCSample, eventdifftS, m->pc );
     }
 
-    /* We don't need to worry if this write does not succeed, it just means there is no other side of the fifo */
-    write( f->c[HW_CHANNEL].handle, outputString, opLen );
+    _hwOutput( f, outputString, opLen );
 }
 // ====================================================================================================
 void _handleDataRWWP( struct watchMsg *m, struct itmfifosHandle *f )
@@ -340,7 +390,7 @@ void _handleDataRWWP( struct watchMsg *m, struct itmfifosHandle *f )
     f->lastHWExceptionTS = m->ts;
 
     opLen = snprintf( outputString, MAX_STRING_LENGTH, "%d,%" PRIu64 ",%d,%s,0x%x" EOL, HWEVENT_RWWT, eventdifftS, m->comp, m->isWrite ? "Write" : "Read", m->data );
-    write( f->c[HW_CHANNEL].handle, outputString, opLen );
+    _hwOutput( f, outputString, opLen );
 }
 // ====================================================================================================
 void _handleDataAccessWP( struct wptMsg *m, struct itmfifosHandle *f )
@@ -355,7 +405,7 @@ void _handleDataAccessWP( struct wptMsg *m, struct itmfifosHandle *f )
 
     f->lastHWExceptionTS = m->ts;
     opLen = snprintf( outputString, MAX_STRING_LENGTH, "%d,%" PRIu64 ",%d,0x%08x" EOL, HWEVENT_AWP, eventdifftS, m->comp, m->data );
-    write( f->c[HW_CHANNEL].handle, outputString, opLen );
+    _hwOutput( f, outputString, opLen );
 }
 // ====================================================================================================
 void _handleDataOffsetWP( struct oswMsg *m, struct itmfifosHandle *f )
@@ -369,23 +419,30 @@ void _handleDataOffsetWP( struct oswMsg *m, struct itmfifosHandle *f )
 
     f->lastHWExceptionTS = m->ts;
     opLen = snprintf( outputString, MAX_STRING_LENGTH, "%d,%" PRIu64 ",%d,0x%04x" EOL, HWEVENT_OFS, eventdifftS, m->comp, m->offset );
-    write( f->c[HW_CHANNEL].handle, outputString, opLen );
+    _hwOutput( f, outputString, opLen );
 }
 // ====================================================================================================
-void _handleSW( struct swMsg *m, struct itmfifosHandle *f )
+void _handleSW( struct msgBusEntry *e, struct itmfifosHandle *f )
+
+/* Software messages carry the target time with them, so this gets the whole bus entry */
 
 {
-    /* Filter off filewriter packets and let the filewriter module deal with those */
-    if ( ( m->srcAddr == FW_CHANNEL ) && ( f->filewriter ) )
+    char outputString[MAX_STRING_LENGTH];
+    struct swMsg *m = &e->m.swMsg;
+    struct Channel *c;
+
+    /* Filewriter packets are left for the filewriter, which has its own subscription */
+    if ( ( ( m->srcAddr == FW_CHANNEL ) && ( f->filewriter ) ) || ( m->srcAddr >= NUM_CHANNELS ) )
     {
-        filewriterProcess( m );
+        return;
     }
-    else
+
+    /* Don't bother formatting for a channel nobody is reading */
+    c = &f->c[m->srcAddr];
+
+    if ( ( c->enabled ) && ( c->handle >= 0 ) )
     {
-        if ( ( m->srcAddr < NUM_CHANNELS ) && ( f->c[m->srcAddr].handle ) )
-        {
-            write( f->c[m->srcAddr].handle, m, sizeof( struct swMsg ) );
-        }
+        _output( f, c, outputString, _formatSW( c, e, outputString ) );
     }
 }
 // ====================================================================================================
@@ -396,7 +453,7 @@ void _handleNISYNC( struct nisyncMsg *m, struct itmfifosHandle *f )
     int opLen;
 
     opLen = snprintf( outputString, MAX_STRING_LENGTH, "%d,%02x,0x%08x" EOL, HWEVENT_NISYNC, m->type, m->addr );
-    write( f->c[HW_CHANNEL].handle, outputString, opLen );
+    _hwOutput( f, outputString, opLen );
 }
 
 // ====================================================================================================
@@ -409,23 +466,24 @@ void _handleTS( struct TSMsg *m, struct itmfifosHandle *f )
     char outputString[MAX_STRING_LENGTH];
     int opLen;
 
-    f->timeStamp += m->timeInc;
-    f->timeStatus = m->timeStatus;
-
     opLen = snprintf( outputString, MAX_STRING_LENGTH, "%d,%d,%" PRIu32 EOL, HWEVENT_TS, m->timeStatus, m->timeInc );
-    write( f->c[HW_CHANNEL].handle, outputString, opLen );
+    _hwOutput( f, outputString, opLen );
 }
 // ====================================================================================================
-void _itmPumpProcess( struct itmfifosHandle *f, char c )
+// Output thread
+// ====================================================================================================
+static void _consume( struct itmfifosHandle *f )
 
-/* Handle individual characters into the itm decoder */
+/* Format everything published since last time into the output for each channel */
 
 {
-    struct msg decoded;
+    struct msgBusEntry *e;
+    uint32_t n;
 
     typedef void ( *handlers )( void *decoded, struct itmfifosHandle * f );
 
-    /* Handlers for each complete message received */
+    /* Handlers for each message. The message is at the start of its bus entry, so they can */
+    /* take the entry as the message, and software messages can get at the target time too. */
     static const handlers h[MSG_NUM_MSGS] =
     {
         /* MSG_UNKNOWN */         NULL,
@@ -443,6 +501,94 @@ void _itmPumpProcess( struct itmfifosHandle *f, char c )
         /* MSG_TS */              ( handlers )_handleTS
     };
 
+    /* Two runs take everything that was there, even if it wraps round the end of the bus */
+    for ( int run = 0; ( run < 2 ) && ( n = msgBusPull( f->sub, &e ) ); run++ )
+    {
+        for ( uint32_t i = 0; i < n; i++ )
+        {
+            if ( h[e[i].m.genericMsg.msgtype] )
+            {
+                ( h[e[i].m.genericMsg.msgtype] )( &e[i], f );
+            }
+        }
+
+        msgBusRelease( f->sub, n );
+    }
+}
+// ====================================================================================================
+static void *_runOutput( void *arg )
+
+/* This is the control loop for all of the fifos. It sleeps until the decoder has published a batch, */
+/* a fifo it's waiting on becomes writable or the flush interval expires, then formats what has been */
+/* published and flushes every channel.                                                              */
+
+{
+    struct itmfifosHandle *f = ( struct itmfifosHandle * )arg;
+    struct pollfd pfd[NUM_CHANNELS + 2];
+    uint8_t drain[64];
+    uint32_t now;
+    bool ending;
+    int n;
+
+    do
+    {
+        pfd[0].fd = f->wake[0];
+        pfd[0].events = POLLIN;
+        n = 1;
+
+        for ( int t = 0; t < NUM_CHANNELS + 1; t++ )
+        {
+            if ( ( f->c[t].enabled ) && ( f->c[t].blocked ) )
+            {
+                pfd[n].fd = f->c[t].handle;
+                pfd[n++].events = POLLOUT;
+            }
+        }
+
+        ending = __atomic_load_n( &f->ending, __ATOMIC_ACQUIRE );
+
+        if ( ( !ending ) && ( poll( pfd, n, f->flushInterval ) > 0 ) && ( pfd[0].revents & POLLIN ) )
+        {
+            /* Re-arm the wakeup before looking at the bus, so nothing published after this is missed */
+            __atomic_store_n( &f->woken, false, __ATOMIC_RELEASE );
+
+            while ( read( f->wake[0], drain, sizeof( drain ) ) == sizeof( drain ) );
+        }
+
+        now = genericsTimestampmS();
+
+        for ( int t = 0; t < NUM_CHANNELS + 1; t++ )
+        {
+            if ( f->c[t].enabled )
+            {
+                _openChannel( f, &f->c[t], now );
+            }
+        }
+
+        _consume( f );
+
+        for ( int t = 0; t < NUM_CHANNELS + 1; t++ )
+        {
+            if ( f->c[t].enabled )
+            {
+                _flushChannel( &f->c[t], now );
+            }
+        }
+    }
+    while ( !ending );
+
+    return NULL;
+}
+// ====================================================================================================
+// Decoder
+// ====================================================================================================
+void _itmPumpProcess( struct itmfifosHandle *f, char c )
+
+/* Handle individual characters into the itm decoder, publishing each message that comes out */
+
+{
+    struct msg decoded;
+
     switch ( ITMPump( &f->i, c ) )
     {
         // ------------------------------------
@@ -473,13 +619,16 @@ void _itmPumpProcess( struct itmfifosHandle *f, char c )
         case ITM_EV_PACKET_RXED:
             ITMGetDecodedPacket( &f->i, &decoded );
 
-            /* See if we decoded a dispatchable match. genericMsg is just used to access */
-            /* the first two members of the decoded structs in a portable way.           */
-            if ( h[decoded.genericMsg.msgtype] )
+            /* Keep track of target time, so everything is stamped with it as it's published. */
+            /* genericMsg is just used to access the first two members of the decoded structs */
+            /* in a portable way.                                                             */
+            if ( decoded.genericMsg.msgtype == MSG_TS )
             {
-                ( h[decoded.genericMsg.msgtype] )( &decoded, f );
+                f->timeStamp += ( ( struct TSMsg * )&decoded )->timeInc;
+                f->timeStatus = ( ( struct TSMsg * )&decoded )->timeStatus;
             }
 
+            msgBusPublish( &f->bus, &decoded, f->timeStamp, f->timeStatus );
             break;
 
             // ------------------------------------
@@ -567,7 +716,9 @@ void itmfifoSetChanPath( struct itmfifosHandle *f, char *s )
 }
 
 // ====================================================================================================
-void itmfifoSetChannel( struct itmfifosHandle *f, int chan, char *n, char *s )
+bool itmfifoSetChannel( struct itmfifosHandle *f, int chan, char *n, char *s )
+
+/* Set up a channel, returning false if its format can't be used */
 
 {
     assert( chan <= NUM_CHANNELS );
@@ -577,8 +728,32 @@ void itmfifoSetChannel( struct itmfifosHandle *f, int chan, char *n, char *s )
         free( f->c[chan].presFormat );
     }
 
+    chanFormatDelete( f->c[chan].chanFormat );
+
     f->c[chan].chanName = strdup( n );
     f->c[chan].presFormat = s ? strdup( s ) : NULL;
+    f->c[chan].chanFormat = s ? chanFormatCompile( s ) : NULL;
+    f->c[chan].records = false;
+
+    return ( !s ) || ( f->c[chan].chanFormat );
+}
+// ====================================================================================================
+void itmfifoSetChannelRecords( struct itmfifosHandle *f, int chan, char *n )
+
+/* Set up a channel to output binary records (see itmfifoRecord.h) */
+
+{
+    itmfifoSetChannel( f, chan, n, NULL );
+    f->c[chan].records = true;
+}
+// ====================================================================================================
+void itmfifoSetBatch( struct itmfifosHandle *f, int batch, int flushInterval )
+
+/* Set how many messages are queued, or for how long, before they are written out */
+
+{
+    f->batch = batch;
+    f->flushInterval = flushInterval;
 }
 // ====================================================================================================
 void itmfifoSetUseTPIU( struct itmfifosHandle *f, bool s )
@@ -610,7 +785,14 @@ char *itmfifoGetChannelFormat( struct itmfifosHandle *f, int chan )
 
 {
     assert( chan <= NUM_CHANNELS );
-    return f->c[chan].chanName;
+    return f->c[chan].presFormat;
+}
+// ====================================================================================================
+bool itmfifoGetChannelRecords( struct itmfifosHandle *f, int chan )
+
+{
+    assert( chan <= NUM_CHANNELS );
+    return f->c[chan].records;
 }
 // ====================================================================================================
 char *itmfifoGetChanPath( struct itmfifosHandle *f )
@@ -649,6 +831,12 @@ struct ITMDecoderStats *fifoGetITMDecoderStats( struct itmfifosHandle *f )
     return ITMDecoderGetStats( &f->i );
 }
 // ====================================================================================================
+struct msgBus *itmfifoGetBus( struct itmfifosHandle *f )
+
+{
+    return &f->bus;
+}
+// ====================================================================================================
 // Main interface components
 // ====================================================================================================
 void itmfifoProtocolPump( struct itmfifosHandle *f, uint8_t c )
@@ -678,10 +866,11 @@ void itmfifoForceSync( struct itmfifosHandle *f, bool synced )
 // ====================================================================================================
 bool itmfifoCreate( struct itmfifosHandle *f )
 
-/* Create each sub-process that will handle a port */
+/* Create the fifo for each enabled channel, the bus the decoder publishes to and the thread */
+/* that writes them all.                                                                       */
 
 {
-    int fd[2];
+    struct Channel *c;
 
     /* Make sure there's an initial timestamp to work with */
     f->lastHWExceptionTS = genericsTimestampuS();
@@ -693,77 +882,85 @@ bool itmfifoCreate( struct itmfifosHandle *f )
     /* Cycle through channels and create a fifo for each one that is enabled */
     for ( int t = 0; t < ( NUM_CHANNELS + 1 ); t++ )
     {
+        c = &f->c[t];
+        c->handle = -1;
+
         if ( t < NUM_CHANNELS )
         {
-            if ( f->c[t].chanName )
+            if ( !c->chanName )
             {
-                /* This is a live software channel fifo */
-                if ( pipe( fd ) < 0 )
-                {
-                    return false;
-                }
-
-                if ( !f->permafile )
-                {
-                    /* If this is not a permanent file then some data is allowed to get lost */
-                    fcntl( fd[1], F_SETFL, O_NONBLOCK );
-                }
+                continue;
+            }
 
-                f->c[t].handle = fd[1];
+            c->fifoName = ( char * )malloc( strlen( c->chanName ) + strlen( f->chanPath ) + 2 );
+            strcpy( c->fifoName, f->chanPath );
+            strcat( c->fifoName, c->chanName );
+        }
+        else
+        {
+            /* This is the hardware fifo channel */
+            c->fifoName = ( char * )malloc( strlen( HWFIFO_NAME ) + strlen( f->chanPath ) + 2 );
+            strcpy( c->fifoName, f->chanPath );
+            strcat( c->fifoName, HWFIFO_NAME );
+        }
 
-                f->c[t].params.listenHandle = fd[0];
-                f->c[t].params.portNo = t;
-                f->c[t].params.permafile = f->permafile;
-                f->c[t].params.c = &f->c[t];
+        if ( !( c->op = ( char * )malloc( OP_RING_LEN ) ) )
+        {
+            return false;
+        }
 
-                f->c[t].fifoName = ( char * )malloc( strlen( f->c[t].chanName ) + strlen( f->chanPath ) + 2 );
-                strcpy( f->c[t].fifoName, f->chanPath );
-                strcat( f->c[t].fifoName, f->c[t].chanName );
+        /* Remove the file if it exists */
+        unlink( c->fifoName );
 
-                if ( pthread_create( &( f->c[t].thread ), NULL, &_runFifo, &( f->c[t].params ) ) )
-                {
-                    return false;
-                }
+        if ( !f->permafile )
+        {
+            /* This is a 'conventional' fifo, so it must be created. It's opened once a reader turns up */
+            if ( mkfifo( c->fifoName, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH ) < 0 )
+            {
+                return false;
             }
         }
         else
         {
-            /* This is the hardware fifo channel */
-            if ( pipe( fd ) < 0 )
+            if ( ( c->handle = open( c->fifoName, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH ) ) < 0 )
             {
                 return false;
             }
 
-            if ( !f->permafile )
-            {
-                /* If this is not a permanent file then some data is allowed to get lost */
-                fcntl( fd[1], F_SETFL, O_NONBLOCK );
-            }
+            _startStream( c, t );
+        }
 
-            f->c[t].handle = fd[1];
+        c->nextOpen = genericsTimestampmS();
+        c->enabled = true;
+    }
 
-            f->c[t].params.listenHandle = fd[0];
-            f->c[t].params.portNo = t;
-            f->c[t].params.permafile = f->permafile;
-            f->c[t].params.c = &f->c[t];
+    if ( pipe( f->wake ) < 0 )
+    {
+        return false;
+    }
 
-            f->c[t].fifoName = ( char * )malloc( strlen( HWFIFO_NAME ) + strlen( f->chanPath ) + 2 );
-            strcpy( f->c[t].fifoName, f->chanPath );
-            strcat( f->c[t].fifoName, HWFIFO_NAME );
+    fcntl( f->wake[0], F_SETFL, O_NONBLOCK );
+    fcntl( f->wake[1], F_SETFL, O_NONBLOCK );
 
-            if ( pthread_create( &( f->c[t].thread ), NULL, &_runHWFifo, &( f->c[t].params ) ) )
-            {
-                return false;
-            }
-        }
+    /* Decoded messages go on the bus. Permafiles mustn't lose anything, so the decoder waits for room */
+    if ( ( !msgBusInit( &f->bus, BUS_LEN, f->permafile ) ) ||
+            ( !( f->sub = msgBusSubscribe( &f->bus, MSGBUS_ALL_TYPES, f->batch, false, _wake, f ) ) ) )
+    {
+        return false;
     }
 
+    if ( pthread_create( &f->outputThread, NULL, &_runOutput, f ) )
+    {
+        return false;
+    }
+
+    f->outputRunning = true;
     return true;
 }
 // ====================================================================================================
 void itmfifoShutdown( struct itmfifosHandle *f )
 
-/* Destroy the per-port sub-processes. These will terminate when the fifos close */
+/* Flush whatever is queued, then stop the output thread and remove the fifos */
 
 {
     if ( !f )
@@ -771,27 +968,48 @@ void itmfifoShutdown( struct itmfifosHandle *f )
         return;
     }
 
-    /* Firstly go tell everything they're doomed */
-    for ( int t = 0; t < NUM_CHANNELS + 1; t++ )
+    if ( f->outputRunning )
     {
-        if ( f->c[t].handle > 0 )
-        {
-            close( f->c[t].handle );
-            pthread_kill ( f->c[t].thread, EINTR );
-        }
+        __atomic_store_n( &f->ending, true, __ATOMIC_RELEASE );
+        _wake( f );
+        pthread_join( f->outputThread, NULL );
+        close( f->wake[0] );
+        close( f->wake[1] );
     }
 
-    /* ...now clean up */
+    if ( f->filewriter )
+    {
+        filewriterShutdown();
+    }
+
+    if ( f->bus.dropped )
+    {
+        genericsReport( V_INFO, "%" PRIu64 " decoded messages lost waiting for output" EOL, f->bus.dropped );
+    }
+
+    msgBusDelete( &f->bus );
+
     for ( int t = 0; t < NUM_CHANNELS + 1; t++ )
     {
-        if ( f->c[t].handle > 0 )
+        if ( f->c[t].enabled )
         {
-            pthread_join( f->c[t].thread, NULL );
+            if ( f->c[t].dropped )
+            {
+                genericsReport( V_INFO, "%s: %" PRIu64 " messages lost" EOL, f->c[t].fifoName, f->c[t].dropped );
+            }
+
+            if ( f->c[t].handle >= 0 )
+            {
+                close( f->c[t].handle );
+            }
 
             if ( ! f->permafile )
             {
                 unlink( f->c[t].fifoName );
             }
+
+            free( f->c[t].fifoName );
+            free( f->c[t].op );
         }
 
         /* Remove the name string too */
@@ -799,6 +1017,8 @@ void itmfifoShutdown( struct itmfifosHandle *f )
         {
             free( f->c[t].presFormat );
         }
+
+        chanFormatDelete( f->c[t].chanFormat );
     }
 
     free( f );
@@ -807,12 +1027,15 @@ void itmfifoShutdown( struct itmfifosHandle *f )
 
 void itmfifoFilewriter( struct itmfifosHandle *f, bool useFilewriter, char *workingPath )
 
+/* Start the filewriter, which subscribes to the bus so must come after itmfifoCreate */
+
 {
     f->filewriter = useFilewriter;
 
     if ( f->filewriter )
     {
-        filewriterInit( workingPath );
+        assert( f->bus.e );
+        filewriterInit( workingPath, &f->bus );
     }
 }
 
@@ -831,12 +1054,8 @@ struct itmfifosHandle *itmfifoInit( bool forceITMSyncSet, bool useTPIUSet, int T
     f->useTPIU = useTPIUSet;
     f->forceITMSync = forceITMSyncSet;
     f->tpiuITMChannel = TPIUchannelSet;
-
-    /* Trap EINTR so we can use it to interrupt reads/writes in the threads */
-    if ( SIG_ERR == signal( EINTR, _intEINTRHandler ) )
-    {
-        genericsExit( -1, "Failed to establish EINTR handler" EOL );
-    }
+    f->batch = ITMFIFO_DEFAULT_BATCH;
+    f->flushInterval = ITMFIFO_DEFAULT_FLUSH_MS;
 
     return f;
 }
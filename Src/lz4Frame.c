@@ -0,0 +1,521 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * LZ4 frame compression
+ * =====================
+ *
+ * Block and frame layouts are as given in the LZ4 format descriptions. A block is a run of
+ * sequences, each being a token (literal length and match length), the literals, and a match
+ * given as an offset back into what's already been output. The last sequence is only literals.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "generics.h"
+#include "writeBehind.h"
+#include "lz4Frame.h"
+
+#define MINMATCH         (4)                 /* Shortest match that can be encoded */
+#define LASTLITERALS     (5)                 /* The last 5 bytes of a block are always literals */
+#define MFLIMIT          (12)                /* ...and no match can start in the last 12 */
+#define MAX_OFFSET       (65535)             /* Furthest back a match can be */
+#define HASH_LOG         (16)                /* Size of the match finding table */
+#define SKIP_TRIGGER     (6)                 /* Search faster through material that won't compress */
+
+#define FLG_VERSION      (0x40)              /* Frame descriptor flags */
+#define FLG_VERSION_MASK (0xc0)
+#define FLG_B_INDEP      (0x20)
+#define FLG_B_CHECKSUM   (0x10)
+#define FLG_C_SIZE       (0x08)
+#define FLG_DICT_ID      (0x01)
+#define BD_4MB           (0x70)              /* Block descriptor for 4MB blocks */
+
+#define PRIME32_1        (0x9E3779B1U)       /* xxHash32 constants */
+#define PRIME32_2        (0x85EBCA77U)
+#define PRIME32_3        (0xC2B2AE3DU)
+#define PRIME32_4        (0x27D4EB2FU)
+#define PRIME32_5        (0x165667B1U)
+
+#define WRITER_BLOCKS    (4)                 /* Blocks that can be waiting for the compressor */
+
+struct lz4FrameWriter
+{
+    int fd;                                  /* Where the frame goes */
+    struct writebehindHandle *wb;            /* Hands blocks over to the compressing thread */
+    uint32_t *hashTable;                     /* Match finding table, used on that thread */
+    uint8_t *out;                            /* Compressed block, with its size in front */
+    uint64_t written;                        /* Bytes of frame written */
+    bool failed;                             /* A write has failed */
+};
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static inline uint32_t _read32( const uint8_t *p )
+
+{
+    uint32_t v;
+    memcpy( &v, p, sizeof( v ) );
+    return v;
+}
+// ====================================================================================================
+static inline uint32_t _le32( const uint8_t *p )
+
+{
+    return p[0] | ( p[1] << 8 ) | ( p[2] << 16 ) | ( ( uint32_t )p[3] << 24 );
+}
+// ====================================================================================================
+static inline void _putle32( uint8_t *p, uint32_t v )
+
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+// ====================================================================================================
+static inline uint32_t _hash( const uint8_t *p )
+
+/* Hash of the next 5 bytes, which picks better matches in trace than 4 would */
+
+{
+    uint64_t v;
+    memcpy( &v, p, sizeof( v ) );
+    return ( ( v << 24 ) * 889523592379ULL ) >> ( 64 - HASH_LOG );
+}
+// ====================================================================================================
+static uint32_t _xxh32Short( const uint8_t *p, size_t len )
+
+/* xxHash32 with a zero seed, for the handful of bytes in a frame descriptor (less than 16) */
+
+{
+    uint32_t h = PRIME32_5 + len;
+
+    for ( ; len >= 4; len -= 4, p += 4 )
+    {
+        h += _le32( p ) * PRIME32_3;
+        h = ( ( h << 17 ) | ( h >> 15 ) ) * PRIME32_4;
+    }
+
+    for ( ; len; len--, p++ )
+    {
+        h += *p * PRIME32_5;
+        h = ( ( h << 11 ) | ( h >> 21 ) ) * PRIME32_1;
+    }
+
+    h ^= h >> 15;
+    h *= PRIME32_2;
+    h ^= h >> 13;
+    h *= PRIME32_3;
+    h ^= h >> 16;
+    return h;
+}
+// ====================================================================================================
+static uint8_t *_putLength( uint8_t *op, size_t l )
+
+/* Output the continuation bytes for a length that didn't fit in its token nibble */
+
+{
+    for ( ; l >= 255; l -= 255 )
+    {
+        *op++ = 255;
+    }
+
+    *op++ = l;
+    return op;
+}
+// ====================================================================================================
+static uint8_t *_putSequence( uint8_t *op, const uint8_t *anchor, size_t litLen, uint32_t offset, size_t matchLen )
+
+/* Output one sequence; literals then a match (unless this is the last one, when matchLen is 0) */
+
+{
+    uint8_t *token = op++;
+
+    if ( litLen >= 15 )
+    {
+        *token = 15 << 4;
+        op = _putLength( op, litLen - 15 );
+    }
+    else
+    {
+        *token = litLen << 4;
+    }
+
+    memcpy( op, anchor, litLen );
+    op += litLen;
+
+    if ( matchLen )
+    {
+        *op++ = offset;
+        *op++ = offset >> 8;
+        matchLen -= MINMATCH;
+
+        if ( matchLen >= 15 )
+        {
+            *token |= 15;
+            op = _putLength( op, matchLen - 15 );
+        }
+        else
+        {
+            *token |= matchLen;
+        }
+    }
+
+    return op;
+}
+// ====================================================================================================
+static bool _getLength( const uint8_t **ip, const uint8_t *iend, size_t *l )
+
+/* Collect the continuation bytes for a length, making sure they're all there */
+
+{
+    uint8_t b;
+
+    do
+    {
+        if ( *ip >= iend )
+        {
+            return false;
+        }
+
+        b = *( *ip )++;
+        *l += b;
+    }
+    while ( b == 255 );
+
+    return true;
+}
+// ====================================================================================================
+static bool _writeAll( int fd, const uint8_t *b, size_t len )
+
+{
+    ssize_t w;
+
+    while ( len )
+    {
+        if ( ( w = write( fd, b, len ) ) < 0 )
+        {
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+
+            return false;
+        }
+
+        b += w;
+        len -= w;
+    }
+
+    return true;
+}
+// ====================================================================================================
+static bool _compressAndWrite( void *param, const uint8_t *b, size_t len )
+
+/* Called on the writer thread for each block; compress it (if that helps) and write it out */
+
+{
+    struct lz4FrameWriter *w = ( struct lz4FrameWriter * )param;
+    size_t clen = lz4FrameCompressBlock( w->hashTable, b, len, w->out + 4 );
+    bool ok;
+
+    if ( clen >= len )
+    {
+        /* Didn't compress, so it's stored as it is */
+        _putle32( w->out, len | LZ4FRAME_UNCOMPRESSED );
+        w->written += 4 + len;
+        ok = ( _writeAll( w->fd, w->out, 4 ) ) && ( _writeAll( w->fd, b, len ) );
+    }
+    else
+    {
+        _putle32( w->out, clen );
+        w->written += 4 + clen;
+        ok = _writeAll( w->fd, w->out, 4 + clen );
+    }
+
+    if ( !ok )
+    {
+        __atomic_store_n( &w->failed, true, __ATOMIC_RELAXED );
+    }
+
+    return ok;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+size_t lz4FrameBound( size_t len )
+
+/* Worst case size of a compressed block */
+
+{
+    return len + ( len / 255 ) + 16;
+}
+// ====================================================================================================
+size_t lz4FrameCompressBlock( uint32_t *hashTable, const uint8_t *src, size_t len, uint8_t *dst )
+
+/* Compress a block into dst, which must have lz4FrameBound( len ) space, returning its length. */
+/* hashTable is ( 1 << HASH_LOG ) entries of scratch space.                                   */
+
+{
+    const uint8_t *ip = src;
+    const uint8_t *anchor = src;
+    const uint8_t *iend = src + len;
+    const uint8_t *mflimit = iend - MFLIMIT;
+    const uint8_t *matchlimit = iend - LASTLITERALS;
+    const uint8_t *ref;
+    uint8_t *op = dst;
+    uint32_t seq;
+    uint32_t h;
+    uint32_t misses = 0;
+    size_t ml;
+
+    if ( len > MFLIMIT )
+    {
+        memset( hashTable, 0, ( 1 << HASH_LOG ) * sizeof( uint32_t ) );
+        ip++;
+
+        while ( ip < mflimit )
+        {
+            seq = _read32( ip );
+            h = _hash( ip );
+            ref = src + hashTable[h];
+            hashTable[h] = ip - src;
+
+            if ( ( ip - ref > MAX_OFFSET ) || ( ref >= ip ) || ( _read32( ref ) != seq ) )
+            {
+                /* No match, so move on, faster the longer it's been since the last one */
+                ip += 1 + ( misses++ >> SKIP_TRIGGER );
+                continue;
+            }
+
+            misses = 0;
+
+            /* Extend the match backwards over literals we'd otherwise output... */
+            while ( ( ip > anchor ) && ( ref > src ) && ( ip[-1] == ref[-1] ) )
+            {
+                ip--;
+                ref--;
+            }
+
+            /* ...and then forwards as far as it goes */
+            for ( ml = MINMATCH; ( ip + ml < matchlimit ) && ( ip[ml] == ref[ml] ); ml++ );
+
+            op = _putSequence( op, anchor, ip - anchor, ip - ref, ml );
+            ip += ml;
+            anchor = ip;
+
+            if ( ip < mflimit )
+            {
+                hashTable[_hash( ip - 2 )] = ip - 2 - src;
+            }
+        }
+    }
+
+    return _putSequence( op, anchor, iend - anchor, 0, 0 ) - dst;
+}
+// ====================================================================================================
+ssize_t lz4FrameDecompressBlock( const uint8_t *src, size_t len, uint8_t *dst, size_t dstLen )
+
+/* Decompress a block, returning its length, or -1 if it's damaged or won't fit */
+
+{
+    const uint8_t *ip = src;
+    const uint8_t *iend = src + len;
+    const uint8_t *match;
+    uint8_t *op = dst;
+    uint8_t *oend = dst + dstLen;
+    uint8_t token;
+    size_t l;
+    size_t n;
+    uint32_t offset;
+
+    while ( ip < iend )
+    {
+        token = *ip++;
+        l = token >> 4;
+
+        if ( ( ( l == 15 ) && ( !_getLength( &ip, iend, &l ) ) ) || ( l > ( size_t )( iend - ip ) ) || ( l > ( size_t )( oend - op ) ) )
+        {
+            return -1;
+        }
+
+        /* Short runs are copied in one fixed size lump when there's room to overrun */
+        if ( ( l <= 16 ) && ( iend - ip >= 16 ) && ( oend - op >= 16 ) )
+        {
+            memcpy( op, ip, 16 );
+        }
+        else
+        {
+            memcpy( op, ip, l );
+        }
+
+        op += l;
+        ip += l;
+
+        if ( ip == iend )
+        {
+            /* That was the last sequence */
+            break;
+        }
+
+        if ( iend - ip < 2 )
+        {
+            return -1;
+        }
+
+        offset = ip[0] | ( ip[1] << 8 );
+        ip += 2;
+        l = token & 15;
+
+        if ( ( !offset ) || ( offset > op - dst ) || ( ( l == 15 ) && ( !_getLength( &ip, iend, &l ) ) ) )
+        {
+            return -1;
+        }
+
+        l += MINMATCH;
+
+        if ( l > ( size_t )( oend - op ) )
+        {
+            return -1;
+        }
+
+        match = op - offset;
+
+        if ( ( offset >= 8 ) && ( ( size_t )( oend - op ) >= l + 8 ) )
+        {
+            /* Far enough back that it can be copied in lumps, allowing for overrun */
+            for ( n = 0; n < l; n += 8 )
+            {
+                memcpy( op + n, match + n, 8 );
+            }
+
+            op += l;
+            continue;
+        }
+
+        /* The match overlaps what it's producing, so copy in runs no longer than the gap */
+        for ( ; l; l -= n, op += n )
+        {
+            n = op - match;
+            n = ( n < l ) ? n : l;
+            memcpy( op, match, n );
+        }
+    }
+
+    return op - dst;
+}
+// ====================================================================================================
+bool lz4FrameReadHeader( const uint8_t *b, size_t len, struct lz4FrameInfo *i )
+
+/* Check for a frame header that we can deal with, and note what it says */
+
+{
+    uint8_t flg;
+    uint8_t bd;
+
+    if ( ( len < 7 ) || ( _le32( b ) != LZ4FRAME_MAGIC ) )
+    {
+        return false;
+    }
+
+    flg = b[4];
+    bd = b[5];
+    i->headerLen = 7 + ( ( flg & FLG_C_SIZE ) ? 8 : 0 ) + ( ( flg & FLG_DICT_ID ) ? 4 : 0 );
+
+    if ( ( ( flg & FLG_VERSION_MASK ) != FLG_VERSION ) || ( len < i->headerLen ) ||
+            ( b[i->headerLen - 1] != ( ( _xxh32Short( &b[4], i->headerLen - 5 ) >> 8 ) & 0xff ) ) )
+    {
+        genericsReport( V_ERROR, "LZ4 frame header is damaged" EOL );
+        return false;
+    }
+
+    if ( ( !( flg & FLG_B_INDEP ) ) || ( flg & FLG_DICT_ID ) || ( ( ( bd >> 4 ) & 7 ) < 4 ) )
+    {
+        genericsReport( V_ERROR, "Can't read LZ4 frames with linked blocks or a dictionary" EOL );
+        return false;
+    }
+
+    i->blockMax = 1 << ( 2 * ( ( bd >> 4 ) & 7 ) + 8 );
+    i->blockChecksum = ( flg & FLG_B_CHECKSUM ) != 0;
+    return true;
+}
+// ====================================================================================================
+bool lz4FrameWriterWrite( struct lz4FrameWriter *w, const uint8_t *b, size_t len )
+
+/* Queue data to be compressed and written */
+
+{
+    writebehindWrite( w->wb, b, len );
+    return !__atomic_load_n( &w->failed, __ATOMIC_RELAXED );
+}
+// ====================================================================================================
+bool lz4FrameWriterClose( struct lz4FrameWriter *w, uint64_t *written )
+
+/* Compress and write whatever's left, end the frame and release the writer. The fd is left open. */
+
+{
+    uint8_t endMark[4] = { 0 };
+    bool ok;
+
+    writebehindShutdown( w->wb );
+    ok = ( !w->failed ) && ( _writeAll( w->fd, endMark, sizeof( endMark ) ) );
+    w->written += sizeof( endMark );
+
+    if ( written )
+    {
+        *written = w->written;
+    }
+
+    free( w->hashTable );
+    free( w->out );
+    free( w );
+    return ok;
+}
+// ====================================================================================================
+struct lz4FrameWriter *lz4FrameWriterCreate( int fd )
+
+/* Start a frame on fd, with the compressing thread behind it */
+
+{
+    uint8_t h[7];
+    struct lz4FrameWriter *w = ( struct lz4FrameWriter * )calloc( 1, sizeof( struct lz4FrameWriter ) );
+
+    if ( !w )
+    {
+        return NULL;
+    }
+
+    _putle32( h, LZ4FRAME_MAGIC );
+    h[4] = FLG_VERSION | FLG_B_INDEP;
+    h[5] = BD_4MB;
+    h[6] = ( _xxh32Short( &h[4], 2 ) >> 8 ) & 0xff;
+
+    w->fd = fd;
+    w->written = sizeof( h );
+    w->hashTable = ( uint32_t * )malloc( ( 1 << HASH_LOG ) * sizeof( uint32_t ) );
+    w->out = ( uint8_t * )malloc( 4 + lz4FrameBound( LZ4FRAME_BLOCK_SIZE ) );
+
+    if ( ( !w->hashTable ) || ( !w->out ) || ( !_writeAll( fd, h, sizeof( h ) ) ) ||
+            ( !( w->wb = writebehindCreate( LZ4FRAME_BLOCK_SIZE, WRITER_BLOCKS, true, _compressAndWrite, w ) ) ) )
+    {
+        free( w->hashTable );
+        free( w->out );
+        free( w );
+        return NULL;
+    }
+
+    return w;
+}
+// ====================================================================================================
@@ -0,0 +1,219 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Decoded message bus
+ * ===================
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "generics.h"
+#include "msgBus.h"
+
+#define FULL_WAIT_US (100)             /* uS to wait for a subscriber when a lossless bus is full */
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static uint32_t _slowest( struct msgBus *b )
+
+/* Find where the subscriber furthest behind has got to */
+
+{
+    uint32_t wp = b->wp;
+    uint32_t slowest = wp;
+    uint32_t rp;
+
+    for ( int i = 0; i < b->numSubs; i++ )
+    {
+        rp = __atomic_load_n( &b->sub[i].rp, __ATOMIC_ACQUIRE );
+
+        if ( wp - rp > wp - slowest )
+        {
+            slowest = rp;
+        }
+    }
+
+    return slowest;
+}
+// ====================================================================================================
+static void _chivvy( struct msgBus *b, uint32_t wp )
+
+/* Wake anyone who has let half of the ring build up, whether they asked for it or not, since */
+/* they're holding up everybody else. Subscribers only wake for the messages they care about. */
+
+{
+    for ( int i = 0; i < b->numSubs; i++ )
+    {
+        if ( wp - __atomic_load_n( &b->sub[i].rp, __ATOMIC_ACQUIRE ) >= ( b->len >> 1 ) )
+        {
+            b->sub[i].pending = 0;
+            b->sub[i].wake( b->sub[i].ctx );
+        }
+    }
+
+    b->minrp = _slowest( b );
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+bool msgBusPublish( struct msgBus *b, struct msg *m, uint64_t targetTs, uint8_t timeStatus )
+
+/* Put a message on the bus, returning false if it had to be dropped */
+
+{
+    struct msgBusEntry *e;
+    struct msgBusSub *s;
+    uint32_t wp = b->wp;
+
+    /* Nobody wants it, so it doesn't go anywhere */
+    if ( !( b->types & MSGBUS_TYPE( m->genericMsg.msgtype ) ) )
+    {
+        return true;
+    }
+
+    if ( !( wp & ( ( b->len >> 2 ) - 1 ) ) )
+    {
+        _chivvy( b, wp );
+    }
+
+    /* Only look at the subscribers again when the last time we did says we might be full */
+    while ( wp - b->minrp >= b->len )
+    {
+        if ( wp - ( b->minrp = _slowest( b ) ) < b->len )
+        {
+            break;
+        }
+
+        if ( ( !b->lossless ) && ( !( b->losslessTypes & MSGBUS_TYPE( m->genericMsg.msgtype ) ) ) )
+        {
+            b->dropped++;
+            return false;
+        }
+
+        msgBusWakeAll( b );
+        usleep( FULL_WAIT_US );
+    }
+
+    e = &b->e[wp & ( b->len - 1 )];
+    e->m = *m;
+    e->targetTs = targetTs;
+    e->timeStatus = timeStatus;
+    __atomic_store_n( &b->wp, wp + 1, __ATOMIC_RELEASE );
+
+    for ( s = b->sub; s < &b->sub[b->numSubs]; s++ )
+    {
+        if ( ( s->types & MSGBUS_TYPE( m->genericMsg.msgtype ) ) && ( ++s->pending >= s->batch ) )
+        {
+            s->pending = 0;
+            s->wake( s->ctx );
+        }
+    }
+
+    return true;
+}
+// ====================================================================================================
+void msgBusWakeAll( struct msgBus *b )
+
+/* Wake every subscriber, so they take whatever is waiting for them */
+
+{
+    for ( int i = 0; i < b->numSubs; i++ )
+    {
+        b->sub[i].pending = 0;
+        b->sub[i].wake( b->sub[i].ctx );
+    }
+}
+// ====================================================================================================
+uint32_t msgBusPull( struct msgBusSub *s, struct msgBusEntry **e )
+
+/* Return how many entries are waiting to be read in one contiguous run, and where they are */
+
+{
+    struct msgBus *b = s->b;
+    uint32_t rp = s->rp;
+    uint32_t n = __atomic_load_n( &b->wp, __ATOMIC_ACQUIRE ) - rp;
+    uint32_t toEnd = b->len - ( rp & ( b->len - 1 ) );
+
+    *e = &b->e[rp & ( b->len - 1 )];
+    return ( n < toEnd ) ? n : toEnd;
+}
+// ====================================================================================================
+void msgBusRelease( struct msgBusSub *s, uint32_t n )
+
+/* The subscriber is finished with the next n entries, so they can be reused */
+
+{
+    __atomic_store_n( &s->rp, s->rp + n, __ATOMIC_RELEASE );
+}
+// ====================================================================================================
+struct msgBusSub *msgBusSubscribe( struct msgBus *b, uint32_t types, uint32_t batch, bool lossless, msgBusWakeFn wake, void *ctx )
+
+/* Add a subscriber, woken each time batch messages of the given types have been published. If */
+/* it's lossless then the producer waits for room, rather than dropping, for any of those types. */
+
+{
+    struct msgBusSub *s;
+
+    if ( b->numSubs == MSGBUS_MAX_SUBS )
+    {
+        genericsReport( V_ERROR, "Too many subscribers to message bus" EOL );
+        return NULL;
+    }
+
+    s = &b->sub[b->numSubs];
+    s->b = b;
+    s->rp = b->wp;
+    s->types = types;
+    s->lossless = lossless;
+    s->batch = batch ? batch : 1;
+    s->pending = 0;
+    s->wake = wake;
+    s->ctx = ctx;
+
+    b->types |= types;
+
+    if ( lossless )
+    {
+        b->losslessTypes |= types;
+    }
+
+    b->numSubs++;
+    return s;
+}
+// ====================================================================================================
+bool msgBusInit( struct msgBus *b, uint32_t len, bool lossless )
+
+/* Create a bus of len entries, which must be a power of 2 (and at least 4) */
+
+{
+    memset( b, 0, sizeof( struct msgBus ) );
+
+    if ( ( len < 4 ) || ( len & ( len - 1 ) ) )
+    {
+        return false;
+    }
+
+    b->len = len;
+    b->lossless = lossless;
+    return ( NULL != ( b->e = ( struct msgBusEntry * )calloc( len, sizeof( struct msgBusEntry ) ) ) );
+}
+// ====================================================================================================
+void msgBusDelete( struct msgBus *b )
+
+{
+    free( b->e );
+    b->e = NULL;
+}
+// ====================================================================================================
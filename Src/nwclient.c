@@ -45,6 +45,8 @@ struct nwClient
     struct nwClient *nextClient;
     struct nwClient *prevClient;
     bool finish;                              /* Flag indicating it's time to cease operation */
+    uint64_t queued;                          /* Bytes handed over for this client */
+    uint64_t sent;                            /* ...and how many of them have gone out */
 
     /* Parameters used to run the client */
     int portNo;                               /* Port of connection */
@@ -140,6 +142,10 @@ static void *_client( void *args )
 
             c->finish = true;
         }
+        else
+        {
+            __atomic_add_fetch( &c->sent, readDataLen, __ATOMIC_RELEASE );
+        }
     }
 
     close( c->listenHandle );
@@ -240,6 +246,7 @@ void nwclientSend( struct nwclientsHandle *h, uint32_t len, uint8_t *buffer )
         while ( n )
         {
             write( n->handle, buffer, len );
+            n->queued += len;
             n = n->nextClient;
         }
 
@@ -247,6 +254,36 @@ void nwclientSend( struct nwclientsHandle *h, uint32_t len, uint8_t *buffer )
     }
 }
 // ====================================================================================================
+bool nwclientConnected( struct nwclientsHandle *h )
+
+/* Is there anyone to send to? */
+
+{
+    return ( __atomic_load_n( &h->firstClient, __ATOMIC_ACQUIRE ) != NULL );
+}
+// ====================================================================================================
+bool nwclientPending( struct nwclientsHandle *h )
+
+/* Is anything that's been sent still on its way out to a client? */
+
+{
+    const struct timespec ts = {.tv_sec = 1, .tv_nsec = 0};
+    bool pending = false;
+
+    if ( lock_with_timeout( &h->clientList, &ts ) < 0 )
+    {
+        genericsExit( -1, "Failed to acquire mutex" EOL );
+    }
+
+    for ( struct nwClient *n = h->firstClient; ( n ) && ( !pending ); n = n->nextClient )
+    {
+        pending = ( __atomic_load_n( &n->sent, __ATOMIC_ACQUIRE ) != n->queued );
+    }
+
+    pthread_mutex_unlock( &h->clientList );
+    return pending;
+}
+// ====================================================================================================
 struct nwclientsHandle *nwclientStart( int port )
 
 /* Creating the listening server thread */
@@ -0,0 +1,468 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Throughput benchmarks for Orbuculum
+ * ===================================
+ *
+ * Times the decoders, and the path through orbuculum to a client, on synthetic trace from
+ * traceGen. Each stream is generated before the clock starts, and each run is repeated with
+ * the best one reported, so what's measured is the decoder and not the generator or whatever
+ * else the machine happened to be doing. Results go to stdout one JSON object per line;
+ *
+ *   {"bench":"ITMPump","bytes":33554432,"msgs":10173641,"seconds":0.401868,"MBps":79.63,"msgsps":25315877}
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <inttypes.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "generics.h"
+#include "git_version_info.h"
+#include "tpiuDecoder.h"
+#include "itmDecoder.h"
+#include "msgSeq.h"
+#include "etmDecoder.h"
+#include "traceGen.h"
+#include "nw.h"
+
+#define DEFAULT_LEN         (32 * 1024 * 1024)
+#define DEFAULT_REPEATS     (3)
+#define DEFAULT_PORT        (3499)           /* Port orbuculum is told to serve the benchmark on */
+#define MSG_REORDER_BUFLEN  (10)             /* As orbtop */
+#define CONNECT_TIMEOUT     (5000)           /* mS to wait for orbuculum to start listening */
+#define CONNECT_RETRY       (10)             /* ...trying at this interval */
+
+/* ---------- CONFIGURATION ----------------- */
+
+struct                                      /* Record for options, either defaults or from command line */
+{
+    uint64_t seed;                          /* Seed for every stream */
+    size_t len;                             /* Length of each stream */
+    uint32_t repeats;                       /* Runs of each benchmark, the best is reported */
+    char *orbuculum;                        /* orbuculum to use for the pipeline benchmark */
+    int port;                               /* ...and the port to have it listen on */
+} options =
+{
+    .seed = TRACEGEN_DEFAULT_SEED,
+    .len = DEFAULT_LEN,
+    .repeats = DEFAULT_REPEATS,
+    .port = DEFAULT_PORT
+};
+
+/* Results of one run of a benchmark */
+struct result
+{
+    uint64_t bytes;                         /* Bytes put through */
+    uint64_t msgs;                          /* Messages (packets, frames...) that came out */
+    uint64_t elapseduS;                     /* How long it took */
+};
+
+typedef bool ( *benchFn )( const uint8_t *b, size_t len, struct result *r );
+
+enum stream { STREAM_ITM, STREAM_ETM, STREAM_TPIU };
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static uint8_t *_generate( enum stream s, size_t len, uint64_t *packets )
+
+/* Make a stream of the requested kind, with the default mix */
+
+{
+    struct traceGenConfig c;
+    struct traceGen *g;
+    uint8_t *b;
+
+    traceGenDefaultConfig( &c );
+    c.seed = options.seed;
+    c.itm = ( s != STREAM_ETM );
+    c.etm = ( s != STREAM_ITM );
+    c.tpiu = ( s == STREAM_TPIU );
+
+    if ( !( b = ( uint8_t * )malloc( len ) ) )
+    {
+        genericsExit( -1, "Could not allocate stream" EOL );
+    }
+
+    if ( !( g = traceGenCreate( &c ) ) )
+    {
+        genericsExit( -1, "Could not generate stream" EOL );
+    }
+
+    traceGenFill( g, b, len );
+    *packets = traceGenGetStats( g )->itmPackets + traceGenGetStats( g )->etmPackets;
+    traceGenDelete( g );
+
+    return b;
+}
+// ====================================================================================================
+// Decoder benchmarks
+// ====================================================================================================
+static bool _benchTPIU( const uint8_t *b, size_t len, struct result *r )
+
+{
+    struct TPIUDecoder t;
+    struct TPIUPacket p;
+    uint64_t start = genericsTimestampuS();
+
+    TPIUDecoderInit( &t );
+
+    for ( size_t n = 0; n < len; n++ )
+    {
+        if ( ( TPIUPump( &t, b[n] ) == TPIU_EV_RXEDPACKET ) && ( TPIUGetPacket( &t, &p ) ) )
+        {
+            r->msgs++;
+        }
+    }
+
+    r->elapseduS = genericsTimestampuS() - start;
+    return true;
+}
+// ====================================================================================================
+static bool _benchITM( const uint8_t *b, size_t len, struct result *r )
+
+{
+    struct ITMDecoder i;
+    struct ITMPacket p;
+    uint64_t start = genericsTimestampuS();
+
+    ITMDecoderInit( &i, false );
+
+    for ( size_t n = 0; n < len; n++ )
+    {
+        if ( ( ITMPump( &i, b[n] ) == ITM_EV_PACKET_RXED ) && ( ITMGetPacket( &i, &p ) ) )
+        {
+            r->msgs++;
+        }
+    }
+
+    r->elapseduS = genericsTimestampuS() - start;
+    return true;
+}
+// ====================================================================================================
+static bool _benchMSGSeq( const uint8_t *b, size_t len, struct result *r )
+
+{
+    struct ITMDecoder i;
+    struct MSGSeq d;
+    uint64_t start = genericsTimestampuS();
+
+    ITMDecoderInit( &i, false );
+    MSGSeqInit( &d, &i, MSG_REORDER_BUFLEN );
+
+    for ( size_t n = 0; n < len; n++ )
+    {
+        if ( MSGSeqPump( &d, b[n] ) )
+        {
+            while ( MSGSeqGetPacket( &d ) )
+            {
+                r->msgs++;
+            }
+        }
+    }
+
+    r->elapseduS = genericsTimestampuS() - start;
+    free( d.pbuffer );
+    return true;
+}
+// ====================================================================================================
+static void _etmCB( void *d )
+
+{
+    ( *( uint64_t * )d )++;
+}
+// ====================================================================================================
+static bool _benchETM( const uint8_t *b, size_t len, struct result *r )
+
+{
+    struct ETMDecoder i;
+    uint64_t start = genericsTimestampuS();
+
+    ETMDecoderInit( &i, true );
+    ETMDecoderPump( &i, ( uint8_t * )b, len, _etmCB, NULL, &r->msgs );
+
+    r->elapseduS = genericsTimestampuS() - start;
+    return true;
+}
+// ====================================================================================================
+// Pipeline benchmark
+// ====================================================================================================
+static int _connect( int port )
+
+/* Connect to orbuculum, giving it a while to get going */
+
+{
+    struct sockaddr_in addr;
+    uint32_t waited = 0;
+    int fd;
+
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    addr.sin_port = htons( port );
+
+    while ( waited < CONNECT_TIMEOUT )
+    {
+        if ( ( fd = socket( AF_INET, SOCK_STREAM, 0 ) ) < 0 )
+        {
+            return -1;
+        }
+
+        if ( !connect( fd, ( struct sockaddr * )&addr, sizeof( addr ) ) )
+        {
+            return fd;
+        }
+
+        close( fd );
+        usleep( CONNECT_RETRY * 1000 );
+        waited += CONNECT_RETRY;
+    }
+
+    return -1;
+}
+// ====================================================================================================
+static bool _benchOrbuculum( const uint8_t *b, size_t len, struct result *r )
+
+/* Replay the stream from a file through orbuculum as fast as it'll go, into a client here */
+
+{
+    char name[] = "/tmp/orbbenchXXXXXX";
+    char port[16];
+    uint8_t buffer[TRANSFER_SIZE];
+    uint64_t start = 0;
+    ssize_t t;
+    pid_t pid;
+    int fd;
+    int status;
+
+    if ( ( fd = mkstemp( name ) ) < 0 )
+    {
+        genericsReport( V_ERROR, "Could not create replay file" EOL );
+        return false;
+    }
+
+    if ( write( fd, b, len ) != ( ssize_t )len )
+    {
+        genericsReport( V_ERROR, "Could not write replay file" EOL );
+        close( fd );
+        unlink( name );
+        return false;
+    }
+
+    close( fd );
+    snprintf( port, sizeof( port ), "%d", options.port );
+
+    if ( !( pid = fork() ) )
+    {
+        /* Keep its reporting out of the results */
+        fd = open( "/dev/null", O_WRONLY );
+        dup2( fd, STDOUT_FILENO );
+        dup2( fd, STDERR_FILENO );
+        execl( options.orbuculum, options.orbuculum, "-f", name, "-e", "-R", "fast", "-l", port, ( char * )NULL );
+        _exit( 127 );
+    }
+
+    if ( ( pid > 0 ) && ( ( fd = _connect( options.port ) ) >= 0 ) )
+    {
+        /* orbuculum starts the replay once there's a client, so the clock starts here */
+        start = genericsTimestampuS();
+
+        while ( ( t = read( fd, buffer, TRANSFER_SIZE ) ) > 0 )
+        {
+            r->bytes += t;
+        }
+
+        r->elapseduS = genericsTimestampuS() - start;
+        close( fd );
+    }
+
+    if ( pid > 0 )
+    {
+        kill( pid, SIGTERM );
+        waitpid( pid, &status, 0 );
+    }
+
+    unlink( name );
+
+    if ( !start )
+    {
+        genericsReport( V_ERROR, "Could not connect to %s" EOL, options.orbuculum );
+        return false;
+    }
+
+    if ( r->bytes != len )
+    {
+        genericsReport( V_ERROR, "%s delivered %" PRIu64 " bytes out of %zu" EOL, options.orbuculum, r->bytes, len );
+        return false;
+    }
+
+    return true;
+}
+// ====================================================================================================
+static bool _run( const char *name, benchFn fn, enum stream s, bool pipeline )
+
+/* Run a benchmark the requested number of times, and report the best. False if a run failed */
+
+{
+    struct result best = { 0 };
+    struct result r;
+    uint64_t packets;
+    uint8_t *b = _generate( s, options.len, &packets );
+    double secs;
+
+    for ( uint32_t n = 0; n < options.repeats; n++ )
+    {
+        memset( &r, 0, sizeof( r ) );
+        r.bytes = pipeline ? 0 : options.len;
+
+        if ( !fn( b, options.len, &r ) )
+        {
+            fprintf( stdout, "{\"bench\":\"%s\",\"error\":\"failed\"}" EOL, name );
+            free( b );
+            return false;
+        }
+
+        if ( ( !best.elapseduS ) || ( r.elapseduS < best.elapseduS ) )
+        {
+            best = r;
+        }
+    }
+
+    /* The client doesn't decode anything, so count what was generated */
+    if ( pipeline )
+    {
+        best.msgs = packets;
+    }
+
+    secs = ( best.elapseduS ? best.elapseduS : 1 ) / 1000000.0;
+    fprintf( stdout, "{\"bench\":\"%s\",\"bytes\":%" PRIu64 ",\"msgs\":%" PRIu64 ",\"seconds\":%.6f,\"MBps\":%.2f,\"msgsps\":%.0f}" EOL,
+             name, best.bytes, best.msgs, secs, best.bytes / secs / ( 1024 * 1024 ), best.msgs / secs );
+    fflush( stdout );
+    free( b );
+    return true;
+}
+// ====================================================================================================
+static void _printHelp( const char *const progName )
+
+{
+    fprintf( stdout, "Usage: %s [options]" EOL, progName );
+    fprintf( stdout, "       -h: This help" EOL );
+    fprintf( stdout, "       -l: <port> Port for orbuculum to serve the pipeline benchmark on (defaults to %d)" EOL, DEFAULT_PORT );
+    fprintf( stdout, "       -n: <MB> Length of the stream for each benchmark (defaults to %d)" EOL, DEFAULT_LEN / ( 1024 * 1024 ) );
+    fprintf( stdout, "       -r: <count> Runs of each benchmark, the best is reported (defaults to %d)" EOL, DEFAULT_REPEATS );
+    fprintf( stdout, "       -s: <seed> Seed for the generated streams (defaults to %d)" EOL, TRACEGEN_DEFAULT_SEED );
+    fprintf( stdout, "       -u: <path> orbuculum to put through the pipeline benchmark (skipped if not given, an error if not runnable)" EOL );
+    fprintf( stdout, "       -v: <level> Verbose mode 0(errors)..3(debug)" EOL );
+}
+// ====================================================================================================
+static bool _processOptions( int argc, char *argv[] )
+
+{
+    int c;
+
+    while ( ( c = getopt ( argc, argv, "hl:n:r:s:u:v:" ) ) != -1 )
+        switch ( c )
+        {
+            case 'h':
+                _printHelp( argv[0] );
+                return false;
+
+            case 'l':
+                options.port = atoi( optarg );
+                break;
+
+            case 'n':
+                options.len = ( size_t )atoi( optarg ) * 1024 * 1024;
+                break;
+
+            case 'r':
+                options.repeats = atoi( optarg );
+                break;
+
+            case 's':
+                options.seed = strtoull( optarg, NULL, 0 );
+                break;
+
+            case 'u':
+                options.orbuculum = optarg;
+                break;
+
+            case 'v':
+                genericsSetReportLevel( atoi( optarg ) );
+                break;
+
+            case '?':
+                if ( !isprint ( optopt ) )
+                {
+                    genericsReport( V_ERROR, "Unknown option character `\\x%x'." EOL, optopt );
+                }
+
+                return false;
+
+            default:
+                genericsReport( V_ERROR, "Unknown option %c" EOL, optopt );
+                return false;
+        }
+
+    if ( ( !options.len ) || ( !options.repeats ) )
+    {
+        genericsReport( V_ERROR, "Length and number of runs must be at least one" EOL );
+        return false;
+    }
+
+    genericsReport( V_INFO, "orbbench V" VERSION " (Git %08X %s, Built " BUILD_DATE ")" EOL, GIT_HASH, ( GIT_DIRTY ? "Dirty" : "Clean" ) );
+    genericsReport( V_INFO, "Length    : %zuMB" EOL, options.len / ( 1024 * 1024 ) );
+    genericsReport( V_INFO, "Runs      : %d" EOL, options.repeats );
+    genericsReport( V_INFO, "Seed      : %" PRIu64 EOL, options.seed );
+    genericsReport( V_INFO, "orbuculum : %s" EOL, options.orbuculum ? options.orbuculum : "None" );
+
+    return true;
+}
+// ====================================================================================================
+int main( int argc, char *argv[] )
+
+{
+    bool ok = true;
+
+    if ( !_processOptions( argc, argv ) )
+    {
+        exit( -1 );
+    }
+
+    /* Asking for the pipeline benchmark and not getting it is a failure, not something to skip */
+    if ( ( options.orbuculum ) && ( access( options.orbuculum, X_OK ) ) )
+    {
+        genericsExit( -2, "Can't run %s" EOL, options.orbuculum );
+    }
+
+    ok &= _run( "TPIUPump", _benchTPIU, STREAM_TPIU, false );
+    ok &= _run( "ITMPump", _benchITM, STREAM_ITM, false );
+    ok &= _run( "MSGSeq", _benchMSGSeq, STREAM_ITM, false );
+    ok &= _run( "ETMDecoderPump", _benchETM, STREAM_ETM, false );
+
+    if ( options.orbuculum )
+    {
+        ok &= _run( "orbuculum", _benchOrbuculum, STREAM_ITM, true );
+    }
+    else
+    {
+        fprintf( stdout, "{\"bench\":\"orbuculum\",\"skipped\":\"not given\"}" EOL );
+    }
+
+    return ok ? 0 : -3;
+}
+// ====================================================================================================
@@ -26,6 +26,8 @@
 #include "tpiuDecoder.h"
 #include "itmDecoder.h"
 #include "msgDecoder.h"
+#include "chanFormat.h"
+#include "traceFile.h"
 
 #define NUM_CHANNELS  32
 #define HW_CHANNEL    (NUM_CHANNELS)      /* Make the hardware fifo on the end of the software ones */
@@ -43,6 +45,7 @@ struct
 
     /* Sink information */
     char *presFormat[NUM_CHANNELS + 1];
+    struct chanFormat *chanFormat[NUM_CHANNELS + 1];    /* ...and the formats compiled ready for use */
 
     /* Source information */
     int port;
@@ -50,6 +53,7 @@ struct
 
     char *file;                                          /* File host connection */
     bool endTerminate;                                  /* Terminate when file/socket "ends" */
+    char *fileRange;                                     /* Part of the file to be replayed */
 
 } options = {.forceITMSync = true, .tpiuChannel = 1, .port = NWCLIENT_SERVER_PORT, .server = "localhost"};
 
@@ -62,6 +66,8 @@ struct
     struct TPIUPacket p;
     enum timeDelay timeStatus;           /* Indicator of if this time is exact */
     uint64_t timeStamp;                  /* Latest received time */
+
+    char op[MAX_STRING_LENGTH * 4];      /* Formatted software message (which can be run once per byte) */
 } _r;
 // ====================================================================================================
 // ====================================================================================================
@@ -166,32 +172,9 @@ void _handleSW( struct swMsg *m, struct ITMDecoder *i )
 {
     assert( m->msgtype == MSG_SOFTWARE );
 
-    if ( ( m->srcAddr < NUM_CHANNELS ) && ( options.presFormat[m->srcAddr] ) )
+    if ( ( m->srcAddr < NUM_CHANNELS ) && ( options.chanFormat[m->srcAddr] ) )
     {
-        // formatted output....start with specials
-        if ( strstr( options.presFormat[m->srcAddr], "%f" ) )
-        {
-            /* type punning on same host, after correctly building 32bit val
-             * only unsafe on systems where u32/float have diff byte order */
-            float *nastycast = ( float * )&m->value;
-            fprintf( stdout, options.presFormat[m->srcAddr], *nastycast, *nastycast, *nastycast, *nastycast );
-        }
-        else if ( strstr( options.presFormat[m->srcAddr], "%c" ) )
-        {
-            /* Format contains %c, so execute repeatedly for all characters in sent data */
-            uint8_t op[4] = {m->value & 0xff, ( m->value >> 8 ) & 0xff, ( m->value >> 16 ) & 0xff, ( m->value >> 24 ) & 0xff};
-            uint32_t l = 0;
-
-            do
-            {
-                fprintf( stdout, options.presFormat[m->srcAddr], op[l], op[l], op[l] );
-            }
-            while ( ++l < m->len );
-        }
-        else
-        {
-            fprintf( stdout, options.presFormat[m->srcAddr], m->value, m->value, m->value, m->value );
-        }
+        fwrite( _r.op, 1, chanFormatRun( options.chanFormat[m->srcAddr], m, _r.op, sizeof( _r.op ) ), stdout );
     }
 }
 // ====================================================================================================
@@ -339,6 +322,8 @@ void _printHelp( char *progName )
     fprintf( stdout, "      -c: <Number>,<Format> of channel to add into output stream (repeat per channel)" EOL );
     fprintf( stdout, "      -e: Terminate when the file/socket ends/is closed, or attempt to wait for more / reconnect" EOL );
     fprintf( stdout, "      -f: <filename> Take input from specified file" EOL );
+    fprintf( stdout, "      -F: <from>[,<to>] Only replay this part of the input file; byte offsets, <n>s seconds into" EOL );
+    fprintf( stdout, "          an indexed capture, or @<n> wall-clock seconds since the epoch" EOL );
     fprintf( stdout, "      -h: This help" EOL );
     fprintf( stdout, "      -n: Enforce sync requirement for ITM (i.e. ITM needsd to issue syncs)" EOL );
     fprintf( stdout, "      -s: <Server>:<Port> to use" EOL );
@@ -355,7 +340,7 @@ int _processOptions( int argc, char *argv[] )
     char *chanIndex;
 #define DELIMITER ','
 
-    while ( ( c = getopt ( argc, argv, "c:ef:hns:t:v:" ) ) != -1 )
+    while ( ( c = getopt ( argc, argv, "c:ef:F:hns:t:v:" ) ) != -1 )
         switch ( c )
         {
             // ------------------------------------
@@ -373,6 +358,11 @@ int _processOptions( int argc, char *argv[] )
                 options.file = optarg;
                 break;
 
+            // ------------------------------------
+            case 'F':
+                options.fileRange = optarg;
+                break;
+
             // ------------------------------------
             case 'n':
                 options.forceITMSync = false;
@@ -440,6 +430,13 @@ int _processOptions( int argc, char *argv[] )
 
                 *chanIndex++ = 0;
                 options.presFormat[chan] = strdup( genericsUnescape( chanIndex ) );
+
+                if ( !( options.chanFormat[chan] = chanFormatCompile( options.presFormat[chan] ) ) )
+                {
+                    genericsReport( V_ERROR, "Illegal output format for channel %d" EOL, chan );
+                    return false;
+                }
+
                 break;
 
             // ------------------------------------
@@ -485,6 +482,11 @@ int _processOptions( int argc, char *argv[] )
         {
             genericsReport( V_INFO, " (Ongoing read)" EOL );
         }
+
+        if ( options.fileRange )
+        {
+            genericsReport( V_INFO, "Range      : %s" EOL, options.fileRange );
+        }
     }
 
     if ( options.useTPIU )
@@ -513,21 +515,26 @@ int _processOptions( int argc, char *argv[] )
 int fileFeeder( void )
 
 {
-    int f;
+    struct traceFileReader *f;
     unsigned char cbw[TRANSFER_SIZE];
     ssize_t t;
 
-    if ( ( f = open( options.file, O_RDONLY ) ) < 0 )
+    if ( !( f = traceFileOpen( options.file ) ) )
     {
         genericsExit( -4, "Can't open file %s" EOL, options.file );
     }
 
-    while ( ( t = read( f, cbw, TRANSFER_SIZE ) ) >= 0 )
+    if ( ( options.fileRange ) && ( !traceFileSetRange( f, options.fileRange ) ) )
+    {
+        genericsExit( -4, "Can't replay %s from file %s" EOL, options.fileRange, options.file );
+    }
+
+    while ( ( t = traceFileRead( f, cbw, TRANSFER_SIZE ) ) >= 0 )
     {
 
         if ( !t )
         {
-            if ( options.endTerminate )
+            if ( ( options.endTerminate ) || ( traceFileDone( f ) ) )
             {
                 break;
             }
@@ -547,12 +554,12 @@ int fileFeeder( void )
         }
     }
 
-    if ( !options.endTerminate )
+    if ( ( !options.endTerminate ) && ( !traceFileDone( f ) ) )
     {
         genericsReport( V_INFO, "File read error" EOL );
     }
 
-    close( f );
+    traceFileClose( f );
     return true;
 }
 
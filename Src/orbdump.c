@@ -9,6 +9,11 @@
 #include <unistd.h>
 #include <ctype.h>
 #include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <sys/stat.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netdb.h>
@@ -19,6 +24,8 @@
 #include "generics.h"
 #include "tpiuDecoder.h"
 #include "itmDecoder.h"
+#include "traceFile.h"
+#include "lz4Frame.h"
 
 #include "nw.h"
 
@@ -27,6 +34,14 @@
 #define DEFAULT_OUTFILE "/dev/stdout"
 #define DEFAULT_TIMELEN 10000
 
+#define SPLICE_PIPE_SIZE  (1024 * 1024)      /* Size of the pipe that data is spliced through */
+#define SPLICE_CHUNK      (256 * 1024)       /* Most to move in one splice */
+#define SYNC_INTERVAL     (500)              /* mS between fdatasyncs when writing synchronously */
+#define WRITEBEHIND_CHUNK (8 * 1024 * 1024)  /* Output pushed to disk and dropped from the cache in these */
+#define REPORT_INTERVAL   (1000)             /* mS between bandwidth reports */
+#define SEGMENT_SIZE      (1024 * 1024)      /* Largest segment in an indexed capture */
+#define SEGMENT_TIME      (100)              /* ...and longest time (mS) it can span */
+
 /* ---------- CONFIGURATION ----------------- */
 
 struct                                      /* Record for options, either defaults or from command line */
@@ -42,6 +57,15 @@ struct                                      /* Record for options, either defaul
     /* Do we need to write syncronously */
     bool writeSync;
 
+    /* Move data with read and write rather than splice */
+    bool noSplice;
+
+    /* Write a segmented, indexed capture rather than a flat one */
+    bool indexed;
+
+    /* Compress the output */
+    bool compress;
+
     /* How long to dump */
     uint32_t timelen;
 
@@ -67,6 +91,23 @@ struct
     struct ITMPacket h;
     struct TPIUDecoder t;
     struct TPIUPacket p;
+
+    /* Output */
+    int outfd;                              /* Where the dump goes */
+    bool isFile;                            /* ...and if it's a regular file */
+    struct traceFileWriter *tf;             /* Segmented capture being written, if indexed */
+    struct lz4FrameWriter *lz4;             /* Compressor the output goes through, if compressing */
+    int pipe[2];                            /* Pipe for splicing from the socket to the output */
+    bool useSplice;                         /* Are we splicing? */
+    uint64_t captured;                      /* Bytes of trace captured */
+    uint64_t written;                       /* Bytes written to the output, including any segment headers and index */
+    uint64_t writeBehind;                   /* Where write-behind has got to */
+    uint64_t lastSync;                      /* When the output was last made durable */
+
+    /* Bandwidth reporting */
+    uint64_t intervalStart;                 /* Start of this reporting interval */
+    uint64_t intervalWritten;               /* ...and bytes written at that point */
+    double peakRate;                        /* Highest rate seen over an interval */
 } _r;
 
 // ====================================================================================================
@@ -153,19 +194,304 @@ void _protocolPump( uint8_t c )
     }
 }
 // ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Output handling
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static bool _writeOut( const uint8_t *b, size_t len )
+
+/* Write a whole block to the output */
+
+{
+    ssize_t w;
+
+    if ( _r.lz4 )
+    {
+        /* Compression and writing happen on the compressor's own thread */
+        _r.written += len;
+        return lz4FrameWriterWrite( _r.lz4, b, len );
+    }
+
+    while ( len )
+    {
+        if ( ( w = write( _r.outfd, b, len ) ) < 0 )
+        {
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+
+            return false;
+        }
+
+        b += w;
+        len -= w;
+        _r.written += w;
+    }
+
+    return true;
+}
+// ====================================================================================================
+static bool _writeFn( void *param, const uint8_t *b, size_t len )
+
+/* Output routine for the segmented capture writer */
+
+{
+    return _writeOut( b, len );
+}
+// ====================================================================================================
+static bool _writeData( const uint8_t *b, size_t len )
+
+/* Write data that's already been read, wrapping it into segments if we need to */
+
+{
+    uint8_t *space;
+    size_t n;
+
+    _r.captured += len;
+
+    if ( !_r.tf )
+    {
+        return _writeOut( b, len );
+    }
+
+    while ( len )
+    {
+        space = traceFileWriterSpace( _r.tf, &n );
+        n = ( len < n ) ? len : n;
+        memcpy( space, b, n );
+
+        if ( !traceFileWriterCommit( _r.tf, n, genericsTimestampuS() ) )
+        {
+            return false;
+        }
+
+        b += n;
+        len -= n;
+    }
+
+    return true;
+}
+// ====================================================================================================
+static void _datasync( void )
+
+/* Make what's been written so far durable */
+
+{
+#ifdef __linux__
+    fdatasync( _r.outfd );
+#else
+    fsync( _r.outfd );
+#endif
+}
+// ====================================================================================================
+static void _afterWrite( uint64_t now )
+
+/* Housekeeping once data has reached the output; write-behind, durability and reporting */
+
+{
+#ifdef __linux__
+
+    /* Start each chunk of a file on its way to disk as soon as it's complete, then wait for the one */
+    /* before it and drop it from the cache, so a long capture doesn't fill memory with dirty pages. */
+    while ( ( _r.isFile ) && ( !_r.lz4 ) && ( _r.written - _r.writeBehind >= WRITEBEHIND_CHUNK ) )
+    {
+        sync_file_range( _r.outfd, _r.writeBehind, WRITEBEHIND_CHUNK, SYNC_FILE_RANGE_WRITE );
+
+        if ( _r.writeBehind >= WRITEBEHIND_CHUNK )
+        {
+            sync_file_range( _r.outfd, _r.writeBehind - WRITEBEHIND_CHUNK, WRITEBEHIND_CHUNK,
+                             SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER );
+            posix_fadvise( _r.outfd, _r.writeBehind - WRITEBEHIND_CHUNK, WRITEBEHIND_CHUNK, POSIX_FADV_DONTNEED );
+        }
+
+        _r.writeBehind += WRITEBEHIND_CHUNK;
+    }
+
+#endif
+
+    if ( ( options.writeSync ) && ( now - _r.lastSync >= SYNC_INTERVAL ) )
+    {
+        _datasync();
+        _r.lastSync = now;
+    }
+
+    if ( now - _r.intervalStart >= REPORT_INTERVAL )
+    {
+        double rate = ( _r.written - _r.intervalWritten ) * 1000.0 / ( ( now - _r.intervalStart ) * 1024.0 * 1024.0 );
+
+        if ( rate > _r.peakRate )
+        {
+            _r.peakRate = rate;
+        }
+
+        genericsReport( V_DEBUG, "%.2f MB/s" EOL, rate );
+        _r.intervalStart = now;
+        _r.intervalWritten = _r.written;
+    }
+}
+// ====================================================================================================
+static ssize_t _readBlock( int sockfd, uint8_t *cbw )
+
+/* Move a block from the socket to the output through user space */
+
+{
+    ssize_t readLength = read( sockfd, cbw, TRANSFER_SIZE );
+
+    if ( readLength > 0 )
+    {
+        _r.captured += readLength;
+    }
+
+    if ( ( readLength > 0 ) && ( !_writeOut( cbw, readLength ) ) )
+    {
+        genericsReport( V_ERROR, "Failed to write output" EOL );
+        return -1;
+    }
+
+    return readLength;
+}
+// ====================================================================================================
+static ssize_t _readSegment( int sockfd )
+
+/* Read straight into the segment being collected, noting when the data arrived */
+
+{
+    size_t len;
+    uint8_t *space = traceFileWriterSpace( _r.tf, &len );
+    ssize_t readLength = read( sockfd, space, ( len < TRANSFER_SIZE ) ? len : TRANSFER_SIZE );
+
+    if ( readLength > 0 )
+    {
+        _r.captured += readLength;
+    }
+
+    if ( ( readLength > 0 ) && ( !traceFileWriterCommit( _r.tf, readLength, genericsTimestampuS() ) ) )
+    {
+        genericsReport( V_ERROR, "Failed to write output" EOL );
+        return -1;
+    }
+
+    return readLength;
+}
+// ====================================================================================================
+#ifdef __linux__
+static ssize_t _spliceBlock( int sockfd, uint8_t *cbw )
+
+/* Move a block from the socket to the output without it coming into user space. If the output */
+/* turns out not to take splices then what's in the pipe is written out, and we fall back to   */
+/* reading and writing for the rest of the capture.                                           */
+
+{
+    ssize_t n = splice( sockfd, NULL, _r.pipe[1], NULL, SPLICE_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE );
+    ssize_t left = n;
+    ssize_t w;
+
+    if ( n > 0 )
+    {
+        _r.captured += n;
+    }
+
+    while ( left > 0 )
+    {
+        if ( _r.useSplice )
+        {
+            w = splice( _r.pipe[0], NULL, _r.outfd, NULL, left, SPLICE_F_MOVE | SPLICE_F_MORE );
+
+            if ( w > 0 )
+            {
+                left -= w;
+                _r.written += w;
+                continue;
+            }
+
+            if ( ( w < 0 ) && ( errno == EINTR ) )
+            {
+                continue;
+            }
+
+            if ( ( w < 0 ) && ( errno != EINVAL ) )
+            {
+                genericsReport( V_ERROR, "Failed to write output" EOL );
+                return -1;
+            }
+
+            genericsReport( V_INFO, "Output won't take splices, reading and writing instead" EOL );
+            _r.useSplice = false;
+        }
+
+        /* Drain the pipe the slow way */
+        if ( ( ( w = read( _r.pipe[0], cbw, ( left < TRANSFER_SIZE ) ? left : TRANSFER_SIZE ) ) <= 0 ) || ( !_writeOut( cbw, w ) ) )
+        {
+            genericsReport( V_ERROR, "Failed to write output" EOL );
+            return -1;
+        }
+
+        left -= w;
+    }
+
+    if ( ( n < 0 ) && ( errno == EINVAL ) )
+    {
+        /* The socket wouldn't splice, so don't try again */
+        genericsReport( V_INFO, "Source won't splice, reading and writing instead" EOL );
+        _r.useSplice = false;
+        return _readBlock( sockfd, cbw );
+    }
+
+    return n;
+}
+#endif
+// ====================================================================================================
+static bool _openOutput( void )
+
+/* Open the output, and work out how we can write to it */
+
+{
+    struct stat st;
+
+    if ( ( _r.outfd = open( options.outfile, O_WRONLY | O_CREAT | O_TRUNC, 0644 ) ) < 0 )
+    {
+        return false;
+    }
+
+    _r.isFile = ( !fstat( _r.outfd, &st ) ) && ( S_ISREG( st.st_mode ) );
+
+    if ( ( options.compress ) && ( !( _r.lz4 = lz4FrameWriterCreate( _r.outfd ) ) ) )
+    {
+        return false;
+    }
+
+#ifdef __linux__
+
+    /* Segments are collected, and compression is done, in memory so there's nothing to be gained from splicing */
+    if ( ( !options.noSplice ) && ( !options.indexed ) && ( !options.compress ) && ( !pipe( _r.pipe ) ) )
+    {
+        fcntl( _r.pipe[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE );
+        _r.useSplice = true;
+    }
+
+#endif
+    return true;
+}
+// ====================================================================================================
 void _printHelp( char *progName )
 
 {
     fprintf( stdout, "Usage: %s [options]" EOL, progName );
     fprintf( stdout, "       -h: This help" EOL );
+    fprintf( stdout, "       -i: Write an indexed capture, in segments of up to %dKB or %dmS, that can be replayed from any point" EOL, SEGMENT_SIZE / 1024, SEGMENT_TIME );
     fprintf( stdout, "       -l: <timelen> Length of time in ms to record from point of acheiving sync (defaults to %dmS)" EOL, options.timelen );
     fprintf( stdout, "       -n: Enforce sync requirement for ITM (i.e. ITM needs to issue syncs)" EOL );
     fprintf( stdout, "       -o: <filename> to be used for dump file (defaults to %s)" EOL, options.outfile );
     fprintf( stdout, "       -p: <Port> to use" EOL );
+    fprintf( stdout, "       -r: Copy through user space with read and write rather than splicing" EOL );
     fprintf( stdout, "       -s: <Server> to use" EOL );
     fprintf( stdout, "       -t: <channel> Use TPIU decoder on specified channel, normally 1" EOL );
     fprintf( stdout, "       -v: <level> Verbose mode 0(errors)..3(debug)" EOL );
-    fprintf( stdout, "       -w: Write syncronously to the output file after every packet" EOL );
+    fprintf( stdout, "       -w: Write syncronously, flushing the output file to disk every %dmS" EOL, SYNC_INTERVAL );
+    fprintf( stdout, "       -z: Compress the output (LZ4 frame format, readable by the lz4 tools and file replay)" EOL );
 }
 // ====================================================================================================
 int _processOptions( int argc, char *argv[] )
@@ -173,13 +499,17 @@ int _processOptions( int argc, char *argv[] )
 {
     int c;
 
-    while ( ( c = getopt ( argc, argv, "hl:no:p:s:t:v:w" ) ) != -1 )
+    while ( ( c = getopt ( argc, argv, "hil:no:p:rs:t:v:wz" ) ) != -1 )
         switch ( c )
         {
             case 'o':
                 options.outfile = optarg;
                 break;
 
+            case 'i':
+                options.indexed = true;
+                break;
+
             case 'l':
                 options.timelen = atoi( optarg );
                 break;
@@ -192,6 +522,14 @@ int _processOptions( int argc, char *argv[] )
                 options.writeSync = true;
                 break;
 
+            case 'r':
+                options.noSplice = true;
+                break;
+
+            case 'z':
+                options.compress = true;
+                break;
+
             case 'v':
                 genericsSetReportLevel( atoi( optarg ) );
                 break;
@@ -252,6 +590,9 @@ int _processOptions( int argc, char *argv[] )
     }
 
     genericsReport( V_INFO, "Sync Write: %s" EOL, options.writeSync ? "true" : "false" );
+    genericsReport( V_INFO, "Splice    : %s" EOL, ( options.noSplice || options.indexed || options.compress ) ? "false" : "true" );
+    genericsReport( V_INFO, "Indexed   : %s" EOL, options.indexed ? "true" : "false" );
+    genericsReport( V_INFO, "Compress  : %s" EOL, options.compress ? "true" : "false" );
 
     if ( options.useTPIU )
     {
@@ -269,14 +610,12 @@ int main( int argc, char *argv[] )
     struct hostent *server;
     uint8_t cbw[TRANSFER_SIZE];
     uint64_t firstTime = 0;
-    size_t octetsRxed = 0;
-    FILE *opFile;
+    uint64_t compressed = 0;
+    uint64_t now;
 
     ssize_t readLength, t;
     int flag = 1;
 
-    bool haveSynced = false;
-
     if ( !_processOptions( argc, argv ) )
     {
         exit( -1 );
@@ -319,9 +658,7 @@ int main( int argc, char *argv[] )
     }
 
     /* .... and the file to dump it into */
-    opFile = fopen( options.outfile, "wb" );
-
-    if ( !opFile )
+    if ( !_openOutput() )
     {
         genericsReport( V_ERROR, "Could not open output file for writing" EOL );
         return -2;
@@ -329,15 +666,9 @@ int main( int argc, char *argv[] )
 
     genericsReport( V_INFO, "Waiting for sync" EOL );
 
-    /* Start the process of collecting the data */
+    /* Decode only until we have sync, which is when recording starts */
     while ( ( readLength = read( sockfd, cbw, TRANSFER_SIZE ) ) > 0 )
     {
-        if ( ( options.timelen ) && ( ( firstTime != 0 ) && ( ( _timestamp() - firstTime ) > options.timelen ) ) )
-        {
-            /* This packet arrived at the end of the window...finish the write process */
-            break;
-        }
-
         uint8_t *c = cbw;
 
         t = readLength;
@@ -351,39 +682,101 @@ int main( int argc, char *argv[] )
         if ( ITMDecoderGetStats( &_r.i )->tpiuSyncCount )
         {
             genericsReport( V_WARN, "Got a TPIU sync while decoding ITM...did you miss a -t option?" EOL );
+            readLength = 0;
             break;
         }
 
-        /* ... now check if we've acheived sync so can write frames */
-        if ( !haveSynced )
+        if ( ITMDecoderIsSynced( &_r.i ) )
         {
-            if ( !ITMDecoderIsSynced( &_r.i ) )
+            /* Fill in the time to start from */
+            firstTime = _timestamp();
+            _r.intervalStart = _r.lastSync = firstTime;
+            genericsReport( V_INFO, "Started recording" EOL );
+
+            if ( ( options.indexed ) &&
+                    ( !( _r.tf = traceFileWriterCreate( options.useTPIU ? TFF_TPIU : 0, options.tpiuITMChannel, SEGMENT_SIZE, SEGMENT_TIME, _writeFn, NULL ) ) ) )
             {
-                continue;
+                genericsReport( V_ERROR, "Failed to start indexed capture" EOL );
+                readLength = -1;
+                break;
             }
 
-            haveSynced = true;
-            /* Fill in the time to start from */
-            firstTime = _timestamp();
+            if ( !_writeData( cbw, readLength ) )
+            {
+                genericsReport( V_ERROR, "Failed to write output" EOL );
+                readLength = -1;
+            }
 
-            genericsReport( V_INFO, "Started recording" EOL );
+            break;
         }
+    }
 
-        octetsRxed += fwrite( cbw, 1, readLength, opFile );
+    /* ...then everything else goes straight to the output */
+    while ( readLength > 0 )
+    {
+        now = _timestamp();
 
-        if ( !ITMDecoderIsSynced( &_r.i ) )
+        if ( ( options.timelen ) && ( ( now - firstTime ) > options.timelen ) )
         {
-            genericsReport( V_WARN, "Warning:Sync lost while writing output" EOL );
+            /* This packet arrived at the end of the window...finish the write process */
+            break;
         }
 
-        if ( options.writeSync )
+        _afterWrite( now );
+
+#ifdef __linux__
+
+        if ( _r.useSplice )
         {
-            sync();
+            readLength = _spliceBlock( sockfd, cbw );
+            continue;
         }
+
+#endif
+        readLength = ( _r.tf ) ? _readSegment( sockfd ) : _readBlock( sockfd, cbw );
     }
 
     close( sockfd );
-    fclose( opFile );
+
+    if ( ( _r.tf ) && ( !traceFileWriterClose( _r.tf ) ) )
+    {
+        genericsReport( V_ERROR, "Failed to write capture index" EOL );
+    }
+
+    if ( ( _r.lz4 ) && ( !lz4FrameWriterClose( _r.lz4, &compressed ) ) )
+    {
+        genericsReport( V_ERROR, "Failed to write compressed output" EOL );
+    }
+
+    if ( options.writeSync )
+    {
+        _datasync();
+    }
+
+    close( _r.outfd );
+
+    if ( firstTime )
+    {
+        now = _timestamp();
+        genericsReport( V_INFO, "Captured %" PRIu64 " bytes of data in %" PRIu64 ".%03" PRIu64 "s, %.2f MB/s sustained" EOL,
+                        _r.captured, ( now - firstTime ) / 1000, ( now - firstTime ) % 1000,
+                        ( now > firstTime ) ? _r.captured * 1000.0 / ( ( now - firstTime ) * 1024.0 * 1024.0 ) : 0.0 );
+
+        if ( _r.written != _r.captured )
+        {
+            genericsReport( V_INFO, "Wrote %" PRIu64 " bytes, including segment headers and index" EOL, _r.written );
+        }
+
+        if ( _r.peakRate > 0 )
+        {
+            genericsReport( V_INFO, "Peak %.2f MB/s over %dmS" EOL, _r.peakRate, REPORT_INTERVAL );
+        }
+
+        if ( compressed )
+        {
+            genericsReport( V_INFO, "Compressed to %" PRIu64 " bytes (%.1f:1)" EOL, compressed, ( double )_r.written / compressed );
+        }
+    }
 
     if ( readLength <= 0 )
     {
@@ -391,8 +784,6 @@ int main( int argc, char *argv[] )
         return -2;
     }
 
-    genericsReport( V_INFO, "Wrote %ld bytes of data" EOL, octetsRxed );
-
     return 0;
 }
 // ====================================================================================================
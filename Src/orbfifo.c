@@ -37,6 +37,8 @@ struct
     bool filewriter;                    /* Supporting filewriter functionality */
     char *fwbasedir;                    /* Base directory for filewriter output */
     bool permafile;                     /* Use permanent files rather than fifos */
+    int batch;                          /* Messages queued before they're written out */
+    int flushInterval;                  /* ...or longest they wait before being written out */
 
     /* Source information */
     char *file;                         /* File host connection */
@@ -48,7 +50,9 @@ struct
 } options =
 {
     .port = NWCLIENT_SERVER_PORT,
-    .server = "localhost"
+    .server = "localhost",
+    .batch = ITMFIFO_DEFAULT_BATCH,
+    .flushInterval = ITMFIFO_DEFAULT_FLUSH_MS
 };
 
 struct
@@ -80,7 +84,10 @@ static void _printHelp( char *progName )
     genericsPrintf( "       -e When reading from file, terminate at end of file rather than waiting for further input" EOL );
     genericsPrintf( "       -f <filename> Take input from specified file" EOL );
     genericsPrintf( "       -h This help" EOL );
+    genericsPrintf( "       -l <mS> Longest a message waits before being written to its fifo (default %d)" EOL, ITMFIFO_DEFAULT_FLUSH_MS );
+    genericsPrintf( "       -m <Messages> Messages to collect before writing them to the fifos (default %d)" EOL, ITMFIFO_DEFAULT_BATCH );
     genericsPrintf( "       -P Create permanent files rather than fifos" EOL );
+    genericsPrintf( "       -r <Number>,<Name> of channel to populate with timestamped binary records (repeat per channel)" EOL );
     genericsPrintf( "       -t <channel> Use TPIU decoder on specified channel (normally 1)" EOL );
     genericsPrintf( "       -v <level> Verbose mode 0(errors)..3(debug)" EOL );
     genericsPrintf( "       -w <path> Enable filewriter functionality using specified base path" EOL );
@@ -97,7 +104,7 @@ static int _processOptions( int argc, char *argv[] )
     uint chan;
     char *chanIndex;
 
-    while ( ( c = getopt ( argc, argv, "b:c:ef:hn:Pt:v:w:" ) ) != -1 )
+    while ( ( c = getopt ( argc, argv, "b:c:ef:hl:m:n:Pr:t:v:w:" ) ) != -1 )
         switch ( c )
         {
             // ------------------------------------
@@ -125,6 +132,18 @@ static int _processOptions( int argc, char *argv[] )
 
             // ------------------------------------
 
+            case 'l':
+                options.flushInterval = atoi( optarg );
+                break;
+
+            // ------------------------------------
+
+            case 'm':
+                options.batch = atoi( optarg );
+                break;
+
+            // ------------------------------------
+
             case 'n':
                 itmfifoSetForceITMSync( _r.f, false );
                 break;
@@ -137,6 +156,33 @@ static int _processOptions( int argc, char *argv[] )
 
             // ------------------------------------
 
+            case 'r':
+                chan = atoi( optarg );
+                chanName = optarg;
+
+                if ( chan >= NUM_CHANNELS )
+                {
+                    genericsReport( V_ERROR, "Channel index out of range" EOL );
+                    return false;
+                }
+
+                /* Scan for start of filename */
+                while ( ( *chanName ) && ( *chanName != DELIMITER ) )
+                {
+                    chanName++;
+                }
+
+                if ( !*chanName++ )
+                {
+                    genericsReport( V_ERROR, "No filename for channel %d" EOL, chan );
+                    return false;
+                }
+
+                itmfifoSetChannelRecords( _r.f, chan, chanName );
+                break;
+
+            // ------------------------------------
+
             case 't':
                 itmfifoSetUseTPIU( _r.f, true );
                 itmfifoSettpiuITMChannel( _r.f, atoi( optarg ) );
@@ -196,7 +242,12 @@ static int _processOptions( int argc, char *argv[] )
                 }
 
                 *chanIndex++ = 0;
-                itmfifoSetChannel( _r.f, chan, chanName, genericsUnescape( chanIndex ) );
+                if ( !itmfifoSetChannel( _r.f, chan, chanName, genericsUnescape( chanIndex ) ) )
+                {
+                    genericsReport( V_ERROR, "Illegal output format for channel %d" EOL, chan );
+                    return false;
+                }
+
                 break;
 
             // ------------------------------------
@@ -220,11 +271,18 @@ static int _processOptions( int argc, char *argv[] )
                 // ------------------------------------
         }
 
+    if ( ( options.batch < 1 ) || ( options.flushInterval < 1 ) )
+    {
+        genericsReport( V_ERROR, "Illegal output batching" EOL );
+        return false;
+    }
+
     /* ... and dump the config if we're being verbose */
     genericsReport( V_INFO, "%s V" VERSION " (Git %08X %s, Built " BUILD_DATE ")" EOL, argv[0], GIT_HASH, ( GIT_DIRTY ? "Dirty" : "Clean" ) );
     genericsReport( V_INFO, "BasePath    : %s" EOL, itmfifoGetChanPath( _r.f ) );
     genericsReport( V_INFO, "ForceSync   : %s" EOL, itmfifoGetForceITMSync( _r.f ) ? "true" : "false" );
     genericsReport( V_INFO, "Permafile   : %s" EOL, options.permafile ? "true" : "false" );
+    genericsReport( V_INFO, "Batching    : %d messages or %d mS" EOL, options.batch, options.flushInterval );
 
     if ( itmfifoGetUseTPIU( _r.f ) )
     {
@@ -255,7 +313,9 @@ static int _processOptions( int argc, char *argv[] )
     {
         if ( itmfifoGetChannelName( _r.f, g ) )
         {
-            genericsReport( V_INFO, "         %02d [%s] [%s]" EOL, g, genericsEscape( itmfifoGetChannelFormat( _r.f, g ) ? : "RAW" ), itmfifoGetChannelName( _r.f, g ) );
+            genericsReport( V_INFO, "         %02d [%s] [%s]" EOL, g,
+                            itmfifoGetChannelRecords( _r.f, g ) ? "RECORDS" : genericsEscape( itmfifoGetChannelFormat( _r.f, g ) ? : "RAW" ),
+                            itmfifoGetChannelName( _r.f, g ) );
         }
     }
 
@@ -335,6 +395,7 @@ int main( int argc, char *argv[] )
     }
 
     itmfifoUsePermafiles( _r.f, options.permafile );
+    itmfifoSetBatch( _r.f, options.batch, options.flushInterval );
 
     /* Make sure the fifos get removed at the end */
     atexit( _doExit );
@@ -425,7 +486,13 @@ int main( int argc, char *argv[] )
 
             r = t = 0;
 
-            if ( remainTime > 0 )
+            if ( remainTime <= 0 )
+            {
+                /* Start another interval, so we still come round at least once a second */
+                lastTime = genericsTimestampmS();
+                continue;
+            }
+            else
             {
                 tv.tv_sec = remainTime / 1000000;
                 tv.tv_usec  = remainTime % 1000000;
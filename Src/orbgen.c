@@ -0,0 +1,409 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Synthetic trace generator for Orbuculum
+ * =======================================
+ *
+ * Puts out repeatable ITM, ETM or TPIU framed trace from traceGen, to a file or to a
+ * client connecting to it, so the rest of the suite can be driven without a target.
+ * orbuculum -s localhost:<port> will take it as though it came from a debug probe.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <inttypes.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "generics.h"
+#include "git_version_info.h"
+#include "traceGen.h"
+
+#define DEFAULT_OUTFILE  "/dev/stdout"
+#define CHUNK_SIZE       (64 * 1024)         /* Generated and written in lumps of this */
+
+/* ---------- CONFIGURATION ----------------- */
+
+struct                                      /* Record for options, either defaults or from command line */
+{
+    struct traceGenConfig g;                /* What to generate */
+
+    /* How much, and how fast */
+    uint64_t len;                           /* Bytes to put out, 0 for no limit */
+    double rate;                            /* MB/s to put it out at, 0 for flat out */
+
+    /* Where it goes */
+    char *outfile;
+    int port;                               /* Serve it to a client on this port instead */
+} options =
+{
+    .outfile = DEFAULT_OUTFILE
+};
+
+/* ----------- LIVE STATE ----------------- */
+struct
+{
+    struct traceGen *g;                     /* The generator */
+    int outfd;                              /* Where its output goes */
+    uint8_t buffer[CHUNK_SIZE];             /* ...via here */
+} _r;
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static bool _size( const char *s, uint64_t *v )
+
+/* Size, with an optional k, M or G on the end */
+
+{
+    char *e;
+
+    *v = strtoull( s, &e, 0 );
+
+    switch ( toupper( ( unsigned char )*e ) )
+    {
+        case 'G':
+            *v <<= 10;
+
+        /* Fall through */
+        case 'M':
+            *v <<= 10;
+
+        /* Fall through */
+        case 'K':
+            *v <<= 10;
+            e++;
+            break;
+
+        default:
+            break;
+    }
+
+    return ( e != s ) && ( !*e );
+}
+// ====================================================================================================
+static bool _streams( const char *s )
+
+/* TPIU streams for ITM and ETM, either of which can be left out */
+
+{
+    char *e;
+
+    options.g.tpiu = true;
+    options.g.itm = isdigit( ( unsigned char )*s );
+    options.g.itmStream = strtoul( s, &e, 0 );
+
+    if ( *e == ',' )
+    {
+        options.g.etm = true;
+        options.g.etmStream = strtoul( e + 1, &e, 0 );
+    }
+    else
+    {
+        options.g.etm = false;
+    }
+
+    return !*e;
+}
+// ====================================================================================================
+static int _serve( int port )
+
+/* Wait for a client on the port, and hand back the connection to it */
+
+{
+    struct sockaddr_in addr;
+    int flag = 1;
+    int sockfd;
+    int fd;
+
+    if ( ( sockfd = socket( AF_INET, SOCK_STREAM, 0 ) ) < 0 )
+    {
+        genericsReport( V_ERROR, "Error opening socket" EOL );
+        return -1;
+    }
+
+    setsockopt( sockfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof( flag ) );
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons( port );
+
+    if ( ( bind( sockfd, ( struct sockaddr * )&addr, sizeof( addr ) ) < 0 ) || ( listen( sockfd, 1 ) < 0 ) )
+    {
+        genericsReport( V_ERROR, "Error on binding" EOL );
+        close( sockfd );
+        return -1;
+    }
+
+    genericsReport( V_INFO, "Waiting for connection on port %d" EOL, port );
+    fd = accept( sockfd, NULL, NULL );
+    close( sockfd );
+
+    if ( fd < 0 )
+    {
+        genericsReport( V_ERROR, "Error on accept" EOL );
+    }
+
+    return fd;
+}
+// ====================================================================================================
+static void _printHelp( const char *const progName )
+
+{
+    fprintf( stdout, "Usage: %s [options]" EOL, progName );
+    fprintf( stdout, "       -b: <blocks> Basic blocks in the synthetic program for ETM (defaults to %d)" EOL, TRACEGEN_DEFAULT_BLOCKS );
+    fprintf( stdout, "       -B: <bytes> Longest burst from one stream when both are in TPIU frames (defaults to %d)" EOL, TRACEGEN_DEFAULT_BURST );
+    fprintf( stdout, "       -c: <channels> Number of ITM software channels to use (defaults to %d)" EOL, TRACEGEN_DEFAULT_CHANNELS );
+    fprintf( stdout, "       -e: Generate ETM rather than ITM" EOL );
+    fprintf( stdout, "       -h: This help" EOL );
+    fprintf( stdout, "       -l: <port> Serve the stream to a client connecting on this port rather than writing it out" EOL );
+    fprintf( stdout, "       -m: <mix> Proportions of ITM packets, as sw=<n>,pc=<n>,exc=<n>,ts=<n> (defaults to sw=70,pc=10,exc=10,ts=10)" EOL );
+    fprintf( stdout, "       -n: <size> Amount to generate, with optional k, M or G (defaults to no limit)" EOL );
+    fprintf( stdout, "       -o: <filename> to be used for output (defaults to %s)" EOL, options.outfile );
+    fprintf( stdout, "       -r: <MB/s> Rate to generate at (defaults to as fast as possible)" EOL );
+    fprintf( stdout, "       -s: <seed> Seed for the generator, the same seed always gives the same stream (defaults to %d)" EOL, TRACEGEN_DEFAULT_SEED );
+    fprintf( stdout, "       -t: <ITM>[,<ETM>] Put trace in TPIU frames, on these streams. Leave ITM out (-t ,2) for ETM alone" EOL );
+    fprintf( stdout, "       -v: <level> Verbose mode 0(errors)..3(debug)" EOL );
+    fprintf( stdout, "       -x: <branches> Average number of ETM branches between exceptions, 0 for none (defaults to %d)" EOL, options.g.excEvery );
+    fprintf( stdout, "       -y: <bytes> Bytes between syncs from each source (defaults to %d)" EOL, TRACEGEN_DEFAULT_SYNC );
+}
+// ====================================================================================================
+static bool _processOptions( int argc, char *argv[] )
+
+{
+    int c;
+    uint64_t v;
+
+    while ( ( c = getopt ( argc, argv, "b:B:c:ehl:m:n:o:r:s:t:v:x:y:" ) ) != -1 )
+        switch ( c )
+        {
+            case 'b':
+                options.g.blocks = atoi( optarg );
+                break;
+
+            case 'B':
+                options.g.burst = atoi( optarg );
+                break;
+
+            case 'c':
+                options.g.swChannels = atoi( optarg );
+                break;
+
+            case 'e':
+                options.g.itm = false;
+                options.g.etm = true;
+                break;
+
+            case 'h':
+                _printHelp( argv[0] );
+                return false;
+
+            case 'l':
+                options.port = atoi( optarg );
+                break;
+
+            case 'm':
+                if ( !traceGenSetMix( &options.g, optarg ) )
+                {
+                    return false;
+                }
+
+                break;
+
+            case 'n':
+                if ( !_size( optarg, &options.len ) )
+                {
+                    genericsReport( V_ERROR, "Badly formed size %s" EOL, optarg );
+                    return false;
+                }
+
+                break;
+
+            case 'o':
+                options.outfile = optarg;
+                break;
+
+            case 'r':
+                options.rate = atof( optarg );
+                break;
+
+            case 's':
+                options.g.seed = strtoull( optarg, NULL, 0 );
+                break;
+
+            case 't':
+                if ( !_streams( optarg ) )
+                {
+                    genericsReport( V_ERROR, "Badly formed stream list %s" EOL, optarg );
+                    return false;
+                }
+
+                break;
+
+            case 'v':
+                genericsSetReportLevel( atoi( optarg ) );
+                break;
+
+            case 'x':
+                options.g.excEvery = atoi( optarg );
+                break;
+
+            case 'y':
+                if ( ( !_size( optarg, &v ) ) || ( !v ) || ( v > UINT32_MAX ) )
+                {
+                    genericsReport( V_ERROR, "Badly formed sync interval %s" EOL, optarg );
+                    return false;
+                }
+
+                options.g.syncEvery = v;
+                break;
+
+            case '?':
+                if ( !isprint ( optopt ) )
+                {
+                    genericsReport( V_ERROR, "Unknown option character `\\x%x'." EOL, optopt );
+                }
+
+                return false;
+
+            default:
+                genericsReport( V_ERROR, "Unknown option %c" EOL, optopt );
+                return false;
+        }
+
+    genericsReport( V_INFO, "orbgen V" VERSION " (Git %08X %s, Built " BUILD_DATE ")" EOL, GIT_HASH, ( GIT_DIRTY ? "Dirty" : "Clean" ) );
+
+    genericsReport( V_INFO, "Seed      : %" PRIu64 EOL, options.g.seed );
+
+    if ( options.g.itm )
+    {
+        genericsReport( V_INFO, "ITM Mix   : sw=%d,pc=%d,exc=%d,ts=%d over %d channels" EOL,
+                        options.g.swWeight, options.g.pcWeight, options.g.excWeight, options.g.tsWeight, options.g.swChannels );
+    }
+
+    if ( options.g.etm )
+    {
+        genericsReport( V_INFO, "ETM       : %d blocks, exception every %d branches" EOL, options.g.blocks, options.g.excEvery );
+    }
+
+    if ( options.g.tpiu )
+    {
+        genericsReport( V_INFO, "TPIU      : ITM on %d, ETM on %d, bursts up to %d bytes" EOL,
+                        options.g.itm ? options.g.itmStream : 0, options.g.etm ? options.g.etmStream : 0, options.g.burst );
+    }
+
+    genericsReport( V_INFO, "Sync every: %d bytes" EOL, options.g.syncEvery );
+
+    if ( options.len )
+    {
+        genericsReport( V_INFO, "Length    : %" PRIu64 " bytes" EOL, options.len );
+    }
+    else
+    {
+        genericsReport( V_INFO, "Length    : Unlimited" EOL );
+    }
+
+    if ( options.rate )
+    {
+        genericsReport( V_INFO, "Rate      : %.2f MB/s" EOL, options.rate );
+    }
+
+    if ( options.port )
+    {
+        genericsReport( V_INFO, "Serving on: %d" EOL, options.port );
+    }
+    else
+    {
+        genericsReport( V_INFO, "Output    : %s" EOL, options.outfile );
+    }
+
+    return true;
+}
+// ====================================================================================================
+int main( int argc, char *argv[] )
+
+{
+    const struct traceGenStats *s;
+    uint64_t written = 0;
+    uint64_t startTime;
+    uint64_t due;
+    uint64_t now;
+    size_t n;
+
+    traceGenDefaultConfig( &options.g );
+
+    if ( !_processOptions( argc, argv ) )
+    {
+        exit( -1 );
+    }
+
+    if ( !( _r.g = traceGenCreate( &options.g ) ) )
+    {
+        genericsExit( -1, "Could not create generator" EOL );
+    }
+
+    /* A client going away is just the end of the run */
+    signal( SIGPIPE, SIG_IGN );
+
+    if ( options.port )
+    {
+        _r.outfd = _serve( options.port );
+    }
+    else
+    {
+        _r.outfd = open( options.outfile, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    }
+
+    if ( _r.outfd < 0 )
+    {
+        genericsExit( -2, "Could not open output" EOL );
+    }
+
+    startTime = genericsTimestampuS();
+
+    while ( ( !options.len ) || ( written < options.len ) )
+    {
+        n = ( ( options.len ) && ( options.len - written < CHUNK_SIZE ) ) ? options.len - written : CHUNK_SIZE;
+        traceGenFill( _r.g, _r.buffer, n );
+
+        if ( write( _r.outfd, _r.buffer, n ) != ( ssize_t )n )
+        {
+            break;
+        }
+
+        written += n;
+
+        if ( options.rate )
+        {
+            /* Keep to the rate over the whole run, not just this chunk */
+            due = startTime + ( uint64_t )( written / ( options.rate * 1024 * 1024 ) * 1000000 );
+            now = genericsTimestampuS();
+
+            if ( due > now )
+            {
+                usleep( due - now );
+            }
+        }
+    }
+
+    close( _r.outfd );
+
+    s = traceGenGetStats( _r.g );
+    genericsReport( V_INFO, "Generated %" PRIu64 " bytes; %" PRIu64 " ITM packets, %" PRIu64 " ETM packets (%" PRIu64 " atoms), %" PRIu64 " TPIU frames" EOL,
+                    written, s->itmPackets, s->etmPackets, s->etmAtoms, s->tpiuFrames );
+    traceGenDelete( _r.g );
+
+    return 0;
+}
+// ====================================================================================================
@@ -15,7 +15,9 @@
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <stdio.h>
+#include <inttypes.h>
 #include <assert.h>
 #include <signal.h>
 
@@ -26,6 +28,9 @@
 #include "tpiuDecoder.h"
 #include "symbols.h"
 #include "sio.h"
+#include "writeBehind.h"
+#include "mortemFile.h"
+#include "traceFile.h"
 
 #define REMOTE_SERVER       "localhost"
 
@@ -38,6 +43,42 @@
 #define HANG_TIME_MS        (200)       /* Time without a packet after which we dump the buffer */
 #define TICK_TIME_MS        (100)       /* Time intervals for screen updates and keypress check */
 
+#define DEFAULT_STREAM_SEGMENTS (8)     /* Default number of streamed segments to retain */
+#define DEFAULT_STREAM_SEGLEN_K (1024)  /* Default length of each streamed segment */
+#define STREAM_BLOCK_SIZE   (64*1024)   /* Size of blocks handed to the stream writer */
+#define STREAM_NUM_BLOCKS   (64)        /* Number of blocks that can be in flight to the stream writer */
+#define ASYNC_ZEROS         (5)         /* Number of zeros preceding the 0x80 in an ETM A-sync */
+#define ETM_ISYNC_HDR       (0x08)      /* I-sync packet header */
+#define ETM_ISYNC_CC_HDR    (0x70)      /* ...and with cycle count */
+#define CHECKPOINT_SPACING  (4096)      /* Minimum trace bytes between recorded decode checkpoints */
+#define MAX_TRIGGERS        (8)         /* How many trigger conditions we will allow */
+#define TRIGGER_REASON_LEN  (80)        /* Max length of description of a fired trigger */
+
+#define ARENA_CHUNK_SIZE    (256*1024)  /* Size of each chunk of the line text arena (must exceed SCRATCH_STRING_LEN) */
+#define OPTEXT_INITIAL_LINES (4096)     /* Initial number of line slots in an output buffer */
+
+/* Events which produce lines in the output buffer, and thus stop an iteration from being folded */
+#define FOLD_BREAKING_EVENTS ( ( 1 << EV_CH_EX_ENTRY ) | ( 1 << EV_CH_EX_EXIT ) | ( 1 << EV_CH_TSTAMP ) | ( 1 << EV_CH_TRIGGER ) | \
+                               ( 1 << EV_CH_CLOCKSPEED ) | ( 1 << EV_CH_ISLSIP ) | ( 1 << EV_CH_CYCLECOUNT ) | ( 1 << EV_CH_VMID ) | \
+                               ( 1 << EV_CH_CONTEXTID ) | ( 1 << EV_CH_SECURE ) | ( 1 << EV_CH_ALTISA ) | ( 1 << EV_CH_HYP ) | \
+                               ( 1 << EV_CH_JAZELLE ) | ( 1 << EV_CH_THUMB ) )
+#define FOLD_HASH_SEED      (0xcbf29ce484222325ULL)  /* FNV-1a offset basis */
+#define FOLD_HASH_PRIME     (0x100000001b3ULL)       /* FNV-1a prime */
+
+/* Conditions that can trigger a capture window */
+enum triggerType
+{
+    TRIG_ADDR,                          /* Execution of an instruction at an address */
+    TRIG_EXCEPTION,                     /* Entry to an exception */
+    TRIG_ETM,                           /* An ETM trigger packet (e.g. from a DWT comparator) */
+};
+
+struct trigger
+{
+    enum triggerType type;
+    uint32_t value;                     /* Address or exception number to match */
+};
+
 /* Record for options, either defaults or from command line */
 struct Options
 {
@@ -57,13 +98,30 @@ struct Options
     bool noAltAddr;                     /* Flag to *not* use alternate addressing */
     char *openFileCL;                   /* Command line for opening refernced file */
 
+    char *streamFile;                   /* Base name for continuously streamed segment files */
+    int streamSegments;                 /* Number of streamed segments to retain */
+    int streamSegLen;                   /* Length of each streamed segment, in bytes */
+
+    char *exportFile;                   /* File to export a text report to (no interactive session) */
+    char *eventFile;                    /* File to export the event index of a capture to */
+    int startLine;                      /* Rendered line of a capture to start decoding near */
+
+    struct trigger trigger[MAX_TRIGGERS]; /* Conditions to trigger a capture window on */
+    int numTriggers;                    /* ...and how many of them there are */
+    int preWindow;                      /* Bytes to retain up to and including a trigger */
+    int postWindow;                     /* Bytes to collect after a trigger */
+
 } _options =
 {
     .port = NWCLIENT_SERVER_PORT,
     .server = REMOTE_SERVER,
     .demangle = true,
     .channel = 2,
-    .buflen = DEFAULT_PM_BUFLEN_K * 1024
+    .buflen = DEFAULT_PM_BUFLEN_K * 1024,
+    .streamSegments = DEFAULT_STREAM_SEGMENTS,
+    .streamSegLen = DEFAULT_STREAM_SEGLEN_K * 1024,
+    .preWindow = -1,
+    .postWindow = -1
 };
 
 /* A block of received data */
@@ -73,6 +131,78 @@ struct dataBlock
     uint8_t buffer[TRANSFER_SIZE];
 };
 
+/* A chunk of the line text arena */
+struct arenaChunk
+{
+    struct arenaChunk *next;            /* Next chunk in the chain, retained across resets */
+    size_t used;                        /* How much of this chunk is currently occupied */
+    char text[ARENA_CHUNK_SIZE];        /* The text itself */
+};
+
+/* Bump allocator for formatted line text. Lines are never freed individually, the whole */
+/* arena is reset in one go when the buffer they belong to is flushed.                    */
+struct lineArena
+{
+    struct arenaChunk *head;            /* First chunk in the chain */
+    struct arenaChunk *current;         /* Chunk currently being filled */
+};
+
+/* A segment of streamed trace, as recorded in the index */
+struct streamSegment
+{
+    uint32_t number;                    /* Sequence number of this segment */
+    uint64_t timeuS;                    /* Host time at which the segment was started */
+    uint64_t offset;                    /* Offset of the start of this segment in the overall stream */
+    uint64_t len;                       /* Length of this segment so far */
+    int64_t syncOffset;                 /* Offset of the first I-sync following an A-sync in segment, or -1 */
+};
+
+/* Continuous capture of the trace stream to a rotating set of segment files */
+struct streamCapture
+{
+    struct writebehindHandle *wb;       /* Write-behind handler feeding the segment writer */
+    int fd;                             /* Segment currently being written, or -1 */
+    struct streamSegment *seg;          /* Retained segments, oldest first and current last */
+    uint32_t numSegs;                   /* Number of segments currently retained */
+    uint64_t streamOffset;              /* Total bytes written to the stream */
+    uint32_t zeros;                     /* Consecutive zeros seen, for A-sync detection */
+    bool afterASync;                    /* Last byte seen finished an A-sync */
+};
+
+/* A position in the line text arena, for rolling back to */
+struct arenaMark
+{
+    struct arenaChunk *chunk;           /* Chunk that was current */
+    size_t used;                        /* ...and how much of it was used */
+};
+
+/* Materials for folding repeated loop iterations into a single line */
+struct loopFold
+{
+    uint32_t head;                      /* Destination of the last backwards jump, i.e. the loop head */
+    int32_t iterStart;                  /* Line in the output buffer where the current iteration starts */
+    struct arenaMark mark;              /* Arena position at the start of the current iteration */
+    uint64_t hash;                      /* Signature of the current iteration */
+    uint32_t len;                       /* Number of instructions in the current iteration */
+    uint64_t prevHash;                  /* Signature of the previous iteration */
+    uint32_t prevLen;                   /* Number of instructions in the previous iteration */
+    bool prevValid;                     /* Is there a previous iteration to compare against? */
+    int32_t foldLine;                   /* Line carrying the repeat count for this loop, or -1 if none yet */
+};
+
+/* Live decode of incoming trace, looking for a trigger condition */
+struct triggerEngine
+{
+    struct ETMDecoder i;                /* Decoder run over the trace as it arrives */
+    uint32_t workingAddr;               /* The address we're currently in, for address triggers */
+    bool watchAddr;                     /* Are any of the triggers address hits? */
+    bool fired;                         /* A trigger has been matched in this capture */
+    uint32_t postRemaining;             /* Bytes still to be collected after the trigger */
+    bool windowReady;                   /* Window is complete and waiting to be decoded */
+    bool trimmed;                       /* Trace preceding the window was discarded */
+    char reason[TRIGGER_REASON_LEN];    /* Description of what fired */
+};
+
 /* Materials required to be maintained across callbacks for output construction */
 struct opConstruct
 {
@@ -97,26 +227,44 @@ struct RunTime
     uint64_t oldTotalIntervalBytes;     /* Number of bytes transferred in previous interval */
     uint64_t oldTotalHangBytes;         /* Number of bytes transferred in previous hang interval */
 
-    uint8_t *pmBuffer;                  /* The post-mortem buffer */
+    uint8_t *pmBuffer;                  /* The post-mortem buffer (in a saved capture when one is loaded) */
     int wp;                             /* Index pointers for ring buffer */
     int rp;
 
     struct line *opText;                /* Text of the output buffer */
     int32_t numLines;                   /* Number of lines in the output buffer */
+    int32_t maxLines;                   /* Number of lines allocated in the output buffer */
+    struct lineArena opArena;           /* Storage for any formatted (i.e. non-reference) lines */
 
     int32_t diveline;                   /* Line number we're currently diving into */
     char *divefile;                     /* Filename we're currently diving into */
     bool diving;                        /* Flag indicating we're diving into a file at the moment */
     struct line *fileopText;            /* The text lines of the file we're diving into */
     int32_t filenumLines;               /* ...and how many lines of it there are */
+    int32_t filemaxLines;               /* ...and how many are allocated */
+    struct lineArena fileArena;         /* Storage for the text of the file we're diving into */
 
     bool held;                          /* If we are actively collecting data */
 
     struct SIOInstance *sio;            /* Our screen IO instance for managed I/O */
 
     struct dataBlock rawBlock;          /* Datablock received from distribution */
+    struct streamCapture stream;        /* Continuous capture to disk, if requested */
 
     struct opConstruct op;              /* The mechanical elements for creating the output buffer */
+    struct loopFold fold;               /* Folding of repeated loop iterations */
+    bool noFold;                        /* Show every loop iteration in full */
+    struct ETMDecoder dumpStart;        /* Decoder state at start of the last dump, for re-rendering it */
+
+    struct mortemCheckpoint *ckpt;      /* Decode restart points found in the last dump */
+    uint32_t numCkpts;                  /* ...how many of them there are */
+    uint32_t maxCkpts;                  /* ...and how many we have space for */
+    uint32_t ckptZeros;                 /* Consecutive zeros seen, for A-sync detection */
+
+    struct mortemFileHeader *capture;   /* Saved capture we're reading from (mmapped), if any */
+    bool elfMismatch;                   /* Elf file differs from the one the capture was decoded against */
+
+    struct triggerEngine trig;          /* Trigger engine, when triggers are set */
 
     struct Options *options;            /* Our runtime configuration */
 } _r =
@@ -160,22 +308,55 @@ static void _printHelp( struct RunTime *r )
     genericsPrintf( "       -e: <ElfFile> to use for symbols and source" EOL );
     genericsPrintf( "       -E: When reading from file, terminate at end of file rather than waiting for further input" EOL );
     genericsPrintf( "       -f <filename>: Take input from specified file" EOL );
+    genericsPrintf( "       -g: <Line> When the -f input is a capture, start decoding from the checkpoint nearest before this line" EOL );
     genericsPrintf( "       -h: This help" EOL );
+    genericsPrintf( "       -n: <Count> Number of streamed segments to retain (Default %d)" EOL, DEFAULT_STREAM_SEGMENTS );
+    genericsPrintf( "       -o: <Basename> Continuously stream trace to rotating segment files <Basename>.NNNNNN.trace" EOL );
     genericsPrintf( "       -s: <Server>:<Port> to use" EOL );
     genericsPrintf( "       -t <channel>: Use TPIU to strip TPIU on specfied channel" EOL );
+    genericsPrintf( "       -T: <Spec> Trigger on a:<Address>, x:<Exception> or t (ETM trigger). May be repeated" EOL );
     genericsPrintf( "       -v: <level> Verbose mode 0(errors)..3(debug)" EOL );
+    genericsPrintf( "       -w: <Pre>:<Post> Trace to keep either side of a trigger, in KBytes (Default half the buffer each)" EOL );
+    genericsPrintf( "       -x: <filename> Export decoded text report of the -f input to filename, then exit" EOL );
+    genericsPrintf( "       -X: <filename> Export the event lines saved in the -f capture to filename, without decoding, then exit" EOL );
+    genericsPrintf( "       -z: <Length> Length of each streamed segment, in KBytes (Default %d KBytes)" EOL, DEFAULT_STREAM_SEGLEN_K );
     genericsPrintf( EOL "(Will connect one port higher than that set in -s when TPIU is not used)" EOL );
     genericsPrintf( EOL "(this will automatically select the second output stream from orb TPIU.)" EOL );
     genericsPrintf( EOL "Environment Variables;" EOL );
     genericsPrintf( "  OBJDUMP: to use non-standard obbdump binary" EOL );
 }
 // ====================================================================================================
+static bool _parseTrigger( const char *spec, struct trigger *t )
+
+/* Convert a trigger specification from the command line into a trigger */
+
+{
+    char *e;
+
+    if ( !strcmp( spec, "t" ) )
+    {
+        t->type = TRIG_ETM;
+        t->value = 0;
+        return true;
+    }
+
+    if ( ( ( *spec != 'a' ) && ( *spec != 'x' ) ) || ( *( spec + 1 ) != ':' ) || ( !*( spec + 2 ) ) )
+    {
+        return false;
+    }
+
+    t->type = ( *spec == 'a' ) ? TRIG_ADDR : TRIG_EXCEPTION;
+    t->value = strtoul( spec + 2, &e, 0 );
+
+    return ( !*e );
+}
+// ====================================================================================================
 static int _processOptions( int argc, char *argv[], struct RunTime *r )
 
 {
     int c;
 
-    while ( ( c = getopt ( argc, argv, "ab:c:Dd:Ee:f:hs:t:v:" ) ) != -1 )
+    while ( ( c = getopt ( argc, argv, "ab:c:Dd:Ee:f:g:hn:o:s:t:T:v:w:x:X:z:" ) ) != -1 )
         switch ( c )
         {
             // ------------------------------------
@@ -222,12 +403,30 @@ static int _processOptions( int argc, char *argv[], struct RunTime *r )
 
             // ------------------------------------
 
+            case 'g':
+                r->options->startLine = atoi( optarg );
+                break;
+
+            // ------------------------------------
+
             case 'h':
                 _printHelp( r );
                 return false;
 
             // ------------------------------------
 
+            case 'n':
+                r->options->streamSegments = atoi( optarg );
+                break;
+
+            // ------------------------------------
+
+            case 'o':
+                r->options->streamFile = optarg;
+                break;
+
+            // ------------------------------------
+
             case 's':
                 r->options->server = optarg;
 
@@ -261,12 +460,69 @@ static int _processOptions( int argc, char *argv[], struct RunTime *r )
 
             // ------------------------------------
 
+            case 'T':
+                if ( r->options->numTriggers == MAX_TRIGGERS )
+                {
+                    genericsReport( V_ERROR, "Too many triggers (Max %d)" EOL, MAX_TRIGGERS );
+                    return false;
+                }
+
+                if ( !_parseTrigger( optarg, &r->options->trigger[r->options->numTriggers++] ) )
+                {
+                    genericsReport( V_ERROR, "Badly formed trigger '%s'" EOL, optarg );
+                    return false;
+                }
+
+                break;
+
+            // ------------------------------------
+
             case 'v':
                 genericsSetReportLevel( atoi( optarg ) );
                 break;
 
             // ------------------------------------
 
+            case 'w':
+                r->options->preWindow = atoi( optarg ) * 1024;
+
+                // Post window follows the colon
+                char *w = optarg;
+
+                while ( ( *w ) && ( *w != ':' ) )
+                {
+                    w++;
+                }
+
+                if ( *w != ':' )
+                {
+                    genericsReport( V_ERROR, "Trigger window needs both pre and post lengths" EOL );
+                    return false;
+                }
+
+                r->options->postWindow = atoi( ++w ) * 1024;
+                break;
+
+            // ------------------------------------
+
+            case 'x':
+                r->options->exportFile = optarg;
+                break;
+
+            // ------------------------------------
+
+            case 'X':
+                r->options->eventFile = optarg;
+                break;
+
+            // ------------------------------------
+
+            case 'z':
+                r->options->streamSegLen = atoi( optarg ) * 1024;
+                break;
+
+            // ------------------------------------
+
             case '?':
                 if ( optopt == 'b' )
                 {
@@ -299,12 +555,371 @@ static int _processOptions( int argc, char *argv[], struct RunTime *r )
         genericsExit( -1, "Illegal value for Post Mortem Buffer length" EOL );
     }
 
+    if ( ( ( r->options->exportFile ) || ( r->options->eventFile ) ) && ( !r->options->file ) )
+    {
+        genericsExit( -1, "Export needs an input file" EOL );
+    }
+
+    if ( r->options->startLine < 0 )
+    {
+        genericsExit( -1, "Illegal value for start line" EOL );
+    }
+
+    if ( r->options->preWindow < 0 )
+    {
+        /* No window given, so split the buffer between before and after the trigger */
+        r->options->preWindow = r->options->buflen / 2;
+        r->options->postWindow = r->options->buflen / 2 - 1;
+    }
+
+    if ( ( r->options->preWindow < 0 ) || ( r->options->postWindow < 0 ) ||
+            ( r->options->preWindow + r->options->postWindow >= r->options->buflen ) )
+    {
+        genericsExit( -1, "Trigger window must fit inside the Post Mortem Buffer" EOL );
+    }
+
+    if ( ( r->options->streamFile ) && ( ( r->options->streamSegments < 1 ) || ( r->options->streamSegLen < 1 ) ) )
+    {
+        genericsExit( -1, "Illegal value for streamed segment count or length" EOL );
+    }
+
+    return true;
+}
+// ====================================================================================================
+static void _streamWriteIndex( struct RunTime *r )
+
+/* Write the index of retained segments. It's replaced atomically so it's always valid after a crash */
+
+{
+    char fn[SCRATCH_STRING_LEN];
+    char tmpfn[SCRATCH_STRING_LEN];
+    FILE *f;
+
+    snprintf( tmpfn, SCRATCH_STRING_LEN, "%s.index.tmp", r->options->streamFile );
+    snprintf( fn, SCRATCH_STRING_LEN, "%s.index", r->options->streamFile );
+
+    if ( !( f = fopen( tmpfn, "w" ) ) )
+    {
+        return;
+    }
+
+    fprintf( f, "# Segment TimeuS StreamOffset Length ISyncOffset File" EOL );
+
+    for ( uint32_t t = 0; t < r->stream.numSegs; t++ )
+    {
+        struct streamSegment *g = &r->stream.seg[t];
+        fprintf( f, "%u %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRId64 " %s.%06u.trace" EOL,
+                 g->number, g->timeuS, g->offset, g->len, g->syncOffset, genericsBasename( r->options->streamFile ), g->number );
+    }
+
+    fclose( f );
+    rename( tmpfn, fn );
+}
+// ====================================================================================================
+static bool _streamOpenSegment( struct RunTime *r )
+
+/* Start a new segment, retiring the oldest one if we've got as many as we're allowed */
+
+{
+    char fn[SCRATCH_STRING_LEN];
+    struct streamSegment *g;
+    uint32_t number = ( r->stream.numSegs ) ? r->stream.seg[r->stream.numSegs - 1].number + 1 : 0;
+
+    if ( r->stream.numSegs == r->options->streamSegments )
+    {
+        snprintf( fn, SCRATCH_STRING_LEN, "%s.%06u.trace", r->options->streamFile, r->stream.seg[0].number );
+        unlink( fn );
+        memmove( &r->stream.seg[0], &r->stream.seg[1], sizeof( struct streamSegment ) * ( --r->stream.numSegs ) );
+    }
+
+    snprintf( fn, SCRATCH_STRING_LEN, "%s.%06u.trace", r->options->streamFile, number );
+
+    if ( ( r->stream.fd = open( fn, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH ) ) < 0 )
+    {
+        return false;
+    }
+
+    g = &r->stream.seg[r->stream.numSegs++];
+    g->number     = number;
+    g->timeuS     = genericsTimestampuS();
+    g->offset     = r->stream.streamOffset;
+    g->len        = 0;
+    g->syncOffset = -1;
+
+    _streamWriteIndex( r );
+    return true;
+}
+// ====================================================================================================
+static void _streamCloseSegment( struct RunTime *r )
+
+{
+    if ( r->stream.fd >= 0 )
+    {
+        close( r->stream.fd );
+        r->stream.fd = -1;
+        _streamWriteIndex( r );
+    }
+}
+// ====================================================================================================
+static bool _streamWrite( void *param, const uint8_t *buffer, size_t len )
+
+/* Write a block of the stream into the segment files (called on the write-behind thread) */
+
+{
+    struct RunTime *r = ( struct RunTime * )param;
+    struct streamSegment *g;
+    size_t n;
+
+    while ( len )
+    {
+        if ( ( r->stream.fd < 0 ) && ( !_streamOpenSegment( r ) ) )
+        {
+            return false;
+        }
+
+        g = &r->stream.seg[r->stream.numSegs - 1];
+        n = ( len < r->options->streamSegLen - g->len ) ? len : r->options->streamSegLen - g->len;
+
+        /* Look for the first I-sync straight after an A-sync in this segment, that's where decoding */
+        /* it can start from. The scan runs over everything so it stays in step across segments.    */
+        for ( size_t i = 0; i < n; i++ )
+        {
+            if ( ( r->stream.afterASync ) && ( g->syncOffset < 0 ) &&
+                    ( ( buffer[i] == ETM_ISYNC_HDR ) || ( buffer[i] == ETM_ISYNC_CC_HDR ) ) )
+            {
+                g->syncOffset = g->len + i;
+            }
+
+            r->stream.afterASync = ( buffer[i] == 0x80 ) && ( r->stream.zeros >= ASYNC_ZEROS );
+            r->stream.zeros = buffer[i] ? 0 : r->stream.zeros + 1;
+        }
+
+        if ( write( r->stream.fd, buffer, n ) != n )
+        {
+            return false;
+        }
+
+        g->len += n;
+        r->stream.streamOffset += n;
+        buffer += n;
+        len -= n;
+
+        if ( g->len == r->options->streamSegLen )
+        {
+            _streamCloseSegment( r );
+        }
+    }
+
+    return true;
+}
+// ====================================================================================================
+static bool _loadSymbols( struct RunTime *r )
+
+/* Make sure the symbol set is loaded and matches the elf file currently on disk */
+
+{
+    if ( !SymbolSetValid( &r->s, r->options->elffile ) )
+    {
+        if ( !( r->s = SymbolSetCreate( r->options->elffile, r->options->deleteMaterial, r->options->demangle, true, true ) ) )
+        {
+            genericsReport( V_ERROR, "Elf file or symbols in it not found" EOL );
+            return false;
+        }
+        else
+        {
+            genericsReport( V_DEBUG, "Loaded %s" EOL, r->options->elffile );
+        }
+    }
+
     return true;
 }
 // ====================================================================================================
+static void _triggerArm( struct RunTime *r )
+
+/* Get ready to look for a trigger in a fresh capture */
+
+{
+    r->trig.fired = false;
+    r->trig.windowReady = false;
+    r->trig.trimmed = false;
+
+    /* Data will arrive from an arbitrary point, so wait for a sync before believing anything */
+    ETMDecoderForceSync( &r->trig.i, false );
+
+    /* Following the instruction flow needs the assembly for it */
+    if ( r->trig.watchAddr )
+    {
+        _loadSymbols( r );
+    }
+}
+// ====================================================================================================
+static void _triggerCheck( struct RunTime *r, enum triggerType type, uint32_t value )
+
+/* See if this occurance matches any of the triggers, and fire if so */
+
+{
+    for ( int t = 0; ( t < r->options->numTriggers ) && ( !r->trig.fired ); t++ )
+    {
+        if ( ( r->options->trigger[t].type == type ) && ( ( type == TRIG_ETM ) || ( r->options->trigger[t].value == value ) ) )
+        {
+            r->trig.fired = true;
+            r->trig.postRemaining = r->options->postWindow;
+
+            switch ( type )
+            {
+                case TRIG_ADDR:
+                    snprintf( r->trig.reason, TRIGGER_REASON_LEN, "Triggered on address 0x%08x", value );
+                    break;
+
+                case TRIG_EXCEPTION:
+                    snprintf( r->trig.reason, TRIGGER_REASON_LEN, "Triggered on exception %d", value );
+                    break;
+
+                case TRIG_ETM:
+                    snprintf( r->trig.reason, TRIGGER_REASON_LEN, "Triggered on ETM trigger" );
+                    break;
+            }
+
+            genericsReport( V_INFO, "%s" EOL, r->trig.reason );
+        }
+    }
+}
+// ====================================================================================================
+static void _triggerCB( void *d )
+
+/* Callback function for ETM decode of live trace. This follows the instruction flow in the same */
+/* way as _etmCB does, but only far enough to spot a trigger, and without generating any output.  */
+
+{
+    struct RunTime *r = ( struct RunTime * )d;
+    struct ETMCPUState *cpu = ETMCPUState( &r->trig.i );
+    uint32_t incAddr = 0;
+    uint32_t disposition = 0;
+    struct nameEntry n;
+
+    if ( ETMStateChanged( &r->trig.i, EV_CH_TRIGGER ) )
+    {
+        _triggerCheck( r, TRIG_ETM, 0 );
+    }
+
+    if ( ETMStateChanged( &r->trig.i, EV_CH_EX_ENTRY ) )
+    {
+        _triggerCheck( r, TRIG_EXCEPTION, cpu->exception );
+    }
+
+    if ( ( !r->trig.watchAddr ) || ( !r->s ) )
+    {
+        return;
+    }
+
+    if ( ETMStateChanged( &r->trig.i, EV_CH_ADDRESS ) )
+    {
+        r->trig.workingAddr = cpu->addr;
+    }
+
+    if ( ETMStateChanged( &r->trig.i, EV_CH_ENATOMS ) )
+    {
+        incAddr = cpu->eatoms + cpu->natoms;
+        disposition = cpu->disposition;
+    }
+
+    while ( ( incAddr-- ) && ( !r->trig.fired ) )
+    {
+        if ( disposition & 1 )
+        {
+            _triggerCheck( r, TRIG_ADDR, r->trig.workingAddr );
+        }
+
+        if ( ( SymbolLookup( r->s, r->trig.workingAddr, &n ) ) && ( n.assyLine != ASSY_NOT_FOUND ) )
+        {
+            if ( ( n.assy[n.assyLine].isJump || n.assy[n.assyLine].isSubCall ) && ( disposition & 1 ) )
+            {
+                r->trig.workingAddr = n.assy[n.assyLine].jumpdest;
+            }
+            else
+            {
+                r->trig.workingAddr += ( n.assy[n.assyLine].is4Byte ) ? 4 : 2;
+            }
+        }
+        else
+        {
+            r->trig.workingAddr += 2;
+        }
+
+        disposition >>= 1;
+    }
+}
+// ====================================================================================================
+static bool _triggerByte( struct RunTime *r, uint8_t d )
+
+/* Run a newly stored byte past the trigger engine. Once a trigger has fired, collect the post */
+/* trigger window and then discard anything before the pre trigger window and hold the buffer. */
+/* Returns false when the window has closed.                                                   */
+
+{
+    uint32_t stored;
+    uint32_t keep;
+
+    if ( !r->trig.fired )
+    {
+        ETMDecoderPump( &r->trig.i, &d, 1, _triggerCB, NULL, r );
+    }
+    else
+    {
+        r->trig.postRemaining--;
+    }
+
+    if ( ( !r->trig.fired ) || ( r->trig.postRemaining ) )
+    {
+        return true;
+    }
+
+    stored = ( r->wp + r->options->buflen - r->rp ) % r->options->buflen;
+    keep = r->options->preWindow + r->options->postWindow;
+
+    if ( stored > keep )
+    {
+        r->rp = ( r->wp + r->options->buflen - keep ) % r->options->buflen;
+        r->trig.trimmed = true;
+    }
+
+    r->held = true;
+    r->trig.windowReady = true;
+    return false;
+}
+// ====================================================================================================
+static bool _storeByte( struct RunTime *r, uint8_t d )
+
+/* Store a byte into the post-mortem buffer. Returns false if the buffer is now held */
+
+{
+    uint32_t nwp = ( r->wp + 1 ) % r->options->buflen;
+
+    r->pmBuffer[r->wp] = d;
+    r->newTotalBytes++;
+
+    if ( nwp == r->rp )
+    {
+        if ( r->singleShot )
+        {
+            r->held = true;
+            return false;
+        }
+        else
+        {
+            r->rp = ( r->rp + 1 ) % r->options->buflen;
+        }
+    }
+
+    r->wp = nwp;
+
+    return ( r->options->numTriggers ) ? _triggerByte( r, d ) : true;
+}
+// ====================================================================================================
 static void _processBlock( struct RunTime *r )
 
-/* Generic block processor for received data */
+/* Generic block processor for received data. Data are always streamed (if requested), but */
+/* only stored into the post-mortem buffer while we're not held.                            */
 
 {
     uint8_t *c = r->rawBlock.buffer;
@@ -334,6 +949,8 @@ static void _processBlock( struct RunTime *r )
         if ( r->options->useTPIU )
         {
             struct TPIUPacket p;
+            uint8_t stripped[TPIU_PACKET_LEN];
+            uint32_t strippedLen;
 
             while ( y-- )
             {
@@ -345,83 +962,169 @@ static void _processBlock( struct RunTime *r )
                     }
                     else
                     {
+                        strippedLen = 0;
+
                         /* Iterate through the packet, putting bytes for ETM into the processing buffer */
                         for ( uint32_t g = 0; g < p.len; g++ )
                         {
                             if ( r->options->channel == p.packet[g].s )
                             {
-                                r->pmBuffer[r->wp] = p.packet[g].d;
-                                r->newTotalBytes++;
-                                uint32_t nwp = ( r->wp + 1 ) % r->options->buflen;
+                                stripped[strippedLen++] = p.packet[g].d;
+
+                                if ( !r->held )
+                                {
+                                    _storeByte( r, p.packet[g].d );
+                                }
+                            }
+                        }
+
+                        if ( ( r->stream.wb ) && ( strippedLen ) )
+                        {
+                            writebehindWrite( r->stream.wb, stripped, strippedLen );
+                        }
+                    }
+                }
+            }
+        }
+        else
+        {
+            if ( r->stream.wb )
+            {
+                writebehindWrite( r->stream.wb, c, y );
+            }
+
+            if ( r->held )
+            {
+                return;
+            }
+
+            while ( ( y-- ) && ( _storeByte( r, *c++ ) ) );
+        }
+    }
+}
+// ====================================================================================================
+static char *_arenaStore( struct lineArena *a, const char *text, size_t len )
+
+/* Copy text of len characters into the arena, returning its stored (zero terminated) location */
+
+{
+    char *p;
+
+    assert( len < ARENA_CHUNK_SIZE );
+
+    if ( ( !a->current ) || ( a->current->used + len + 1 > ARENA_CHUNK_SIZE ) )
+    {
+        if ( ( a->current ) && ( a->current->next ) )
+        {
+            /* Re-use a chunk that was allocated before the last reset */
+            a->current = a->current->next;
+        }
+        else
+        {
+            struct arenaChunk *c = ( struct arenaChunk * )malloc( sizeof( struct arenaChunk ) );
+
+            if ( !c )
+            {
+                genericsExit( -1, "Out of memory for output text" EOL );
+            }
+
+            c->next = NULL;
+
+            if ( a->current )
+            {
+                a->current->next = c;
+            }
+            else
+            {
+                a->head = c;
+            }
+
+            a->current = c;
+        }
+
+        a->current->used = 0;
+    }
+
+    p = &a->current->text[a->current->used];
+    memcpy( p, text, len );
+    p[len] = 0;
+    a->current->used += len + 1;
+
+    return p;
+}
+// ====================================================================================================
+static void _arenaReset( struct lineArena *a )
+
+/* Release everything in the arena. Chunks are kept for re-use, so this is O(1) */
+
+{
+    a->current = a->head;
+
+    if ( a->current )
+    {
+        a->current->used = 0;
+    }
+}
+// ====================================================================================================
+static void _arenaGetMark( struct lineArena *a, struct arenaMark *m )
+
+/* Record the current arena position */
+
+{
+    m->chunk = a->current;
+    m->used  = ( a->current ) ? a->current->used : 0;
+}
+// ====================================================================================================
+static void _arenaRollback( struct lineArena *a, struct arenaMark *m )
+
+/* Discard everything stored in the arena since the mark was taken */
+
+{
+    a->current = ( m->chunk ) ? m->chunk : a->head;
 
-                                if ( nwp == r->rp )
-                                {
-                                    if ( r->singleShot )
-                                    {
-                                        r->held = true;
-                                        return;
-                                    }
-                                    else
-                                    {
-                                        r->rp = ( r->rp + 1 ) % r->options->buflen;
-                                    }
-                                }
+    if ( a->current )
+    {
+        a->current->used = m->used;
+    }
+}
+// ====================================================================================================
+static struct line *_newLine( struct line **set, int32_t *numLines, int32_t *maxLines )
 
-                                r->wp = nwp;
-                            }
-                        }
-                    }
-                }
-            }
-        }
-        else
-        {
-            r->newTotalBytes += y;
+/* Get the next free line slot in a line set, growing it geometrically if needed */
 
-            while ( y-- )
-            {
-                r->pmBuffer[r->wp] = *c++;
-                uint32_t nwp = ( r->wp + 1 ) % r->options->buflen;
+{
+    int32_t newMax;
+    struct line *n;
 
-                if ( nwp == r->rp )
-                {
-                    if ( r->singleShot )
-                    {
-                        r->held = true;
-                        return;
-                    }
-                    else
-                    {
-                        r->rp = ( r->rp + 1 ) % r->options->buflen;
-                    }
-                }
+    if ( *numLines == *maxLines )
+    {
+        newMax = ( *maxLines ) ? ( *maxLines ) * 2 : OPTEXT_INITIAL_LINES;
 
-                r->wp = nwp;
-            }
+        if ( !( n = ( struct line * )realloc( *set, sizeof( struct line ) * newMax ) ) )
+        {
+            genericsExit( -1, "Out of memory for output lines" EOL );
         }
+
+        *maxLines = newMax;
+        *set = n;
     }
+
+    return &( *set )[( *numLines )++];
 }
 // ====================================================================================================
 static void _flushBuffer( struct RunTime *r )
 
-/* Empty the output buffer, and de-allocate its memory */
+/* Empty the output buffer. Line slots and text storage are retained for the next fill */
 
 {
     /* Tell the UI there's nothing more to show */
-    SIOsetOutputBuffer( r->sio, 0, 0, NULL, false );
-
-    /* Remove all of the recorded lines */
-    while ( r->numLines-- )
+    if ( r->sio )
     {
-        if ( !r->opText[r->numLines].isRef )
-        {
-            free( r->opText[r->numLines].buffer );
-        }
+        SIOsetOutputBuffer( r->sio, 0, 0, NULL, false );
     }
 
-    /* and the opText buffer */
-    free( r->opText );
-    r->opText = NULL;
+    /* All of the formatted text lives in the arena, references point into the symbol table */
+    _arenaReset( &r->opArena );
     r->numLines = 0;
 
     /* ...and the file/line references */
@@ -429,6 +1132,11 @@ static void _flushBuffer( struct RunTime *r )
     r->op.currentFileindex = NO_FILE;
     r->op.currentFunctionindex = NO_FUNCTION;
     r->op.workingAddr = NO_DESTADDRESS;
+
+    /* ...and any loop that was being folded */
+    r->fold.head = NO_DESTADDRESS;
+    r->fold.foldLine = -1;
+    r->fold.prevValid = false;
 }
 // ====================================================================================================
 static void _appendToOPBuffer( struct RunTime *r, int32_t lineno, enum LineType lt, const char *fmt, ... )
@@ -439,6 +1147,7 @@ static void _appendToOPBuffer( struct RunTime *r, int32_t lineno, enum LineType
     char construct[SCRATCH_STRING_LEN];
     va_list va;
     char *p;
+    struct line *l;
 
     va_start( va, fmt );
     vsnprintf( construct, SCRATCH_STRING_LEN, fmt, va );
@@ -447,29 +1156,97 @@ static void _appendToOPBuffer( struct RunTime *r, int32_t lineno, enum LineType
     /* Make sure we didn't accidentially admit a CR or LF */
     for ( p = construct; ( ( *p ) && ( *p != '\n' ) && ( *p != '\r' ) ); p++ );
 
-    *p = 0;
-
-    r->opText = ( struct line * )realloc( r->opText, ( sizeof( struct line ) ) * ( r->numLines + 1 ) );
-    r->opText[r->numLines].buffer = strdup( construct );
-    r->opText[r->numLines].lt     = lt;
-    r->opText[r->numLines].line   = lineno;
-    r->opText[r->numLines].isRef  = false;
-    r->numLines++;
+    l = _newLine( &r->opText, &r->numLines, &r->maxLines );
+    l->buffer = _arenaStore( &r->opArena, construct, p - construct );
+    l->lt     = lt;
+    l->line   = lineno;
 }
 // ====================================================================================================
 static void _appendRefToOPBuffer( struct RunTime *r, int32_t lineno, enum LineType lt, const char *ref )
 
-/* Add line to output buffer, as a reference (which don't be free'd later) */
+/* Add line to output buffer, as a reference (which lives elsewhere, e.g. in the symbol table) */
 
 {
-    r->opText = ( struct line * )realloc( r->opText, ( sizeof( struct line ) ) * ( r->numLines + 1 ) );
+    struct line *l = _newLine( &r->opText, &r->numLines, &r->maxLines );
 
     /* This line removes the 'const', but we know to not mess with this line */
-    r->opText[r->numLines].buffer = ( char * )ref;
-    r->opText[r->numLines].lt     = lt;
-    r->opText[r->numLines].line   = lineno;
-    r->opText[r->numLines].isRef  = true;
-    r->numLines++;
+    l->buffer = ( char * )ref;
+    l->lt     = lt;
+    l->line   = lineno;
+}
+// ====================================================================================================
+static void _foldHash( struct RunTime *r, uint32_t v )
+
+/* Add a value to the signature of the current loop iteration */
+
+{
+    for ( uint32_t b = 0; b < 4; b++ )
+    {
+        r->fold.hash = ( r->fold.hash ^ ( ( v >> ( b * 8 ) ) & 0xff ) ) * FOLD_HASH_PRIME;
+    }
+}
+// ====================================================================================================
+static void _foldStartIteration( struct RunTime *r )
+
+/* A new iteration starts from the current end of the output buffer */
+
+{
+    r->fold.iterStart = r->numLines;
+    _arenaGetMark( &r->opArena, &r->fold.mark );
+    r->fold.hash = FOLD_HASH_SEED;
+    r->fold.len = 0;
+}
+// ====================================================================================================
+static void _foldBreak( struct RunTime *r )
+
+/* Something happened that wasn't just execution, so the loop (if any) cannot be folded any further */
+
+{
+    r->fold.head = NO_DESTADDRESS;
+    r->fold.foldLine = -1;
+    r->fold.prevValid = false;
+}
+// ====================================================================================================
+static void _foldIteration( struct RunTime *r, uint32_t dest )
+
+/* A backwards jump to dest was taken, which closes an iteration of a loop. If it was */
+/* identical to the previous one then remove it and count it on the fold line instead. */
+
+{
+    if ( ( !r->noFold ) && ( dest == r->fold.head ) && ( r->fold.prevValid ) &&
+            ( r->fold.hash == r->fold.prevHash ) && ( r->fold.len == r->fold.prevLen ) )
+    {
+        r->numLines = r->fold.iterStart;
+        _arenaRollback( &r->opArena, &r->fold.mark );
+
+        /* Any restart point inside the iteration that's gone now leads to where it was */
+        for ( uint32_t c = r->numCkpts; ( c ) && ( r->ckpt[c - 1].line > r->numLines ); c-- )
+        {
+            r->ckpt[c - 1].line = r->numLines;
+        }
+
+        if ( r->fold.foldLine < 0 )
+        {
+            /* First repeat of this loop, so it needs a line to carry the count */
+            r->fold.foldLine = r->numLines;
+            _appendRefToOPBuffer( r, 1, LT_LOOP, "" );
+        }
+        else
+        {
+            r->opText[r->fold.foldLine].line++;
+        }
+    }
+    else
+    {
+        /* Either a different loop or a different path through this one...it becomes the reference */
+        r->fold.prevValid = ( dest == r->fold.head );
+        r->fold.prevHash  = r->fold.hash;
+        r->fold.prevLen   = r->fold.len;
+        r->fold.foldLine  = -1;
+        r->fold.head      = dest;
+    }
+
+    _foldStartIteration( r );
 }
 // ====================================================================================================
 static void _etmReport( enum verbLevel l, const char *fmt, ... )
@@ -498,9 +1275,19 @@ static void _etmCB( void *d )
     struct nameEntry n;
     uint32_t disposition;
 
+    /* Anything that will produce event lines means this iteration can't be folded */
+    if ( cpu->changeRecord & FOLD_BREAKING_EVENTS )
+    {
+        _foldBreak( r );
+    }
+
     /* Deal with changes introduced by this event ========================= */
     if ( ETMStateChanged( &r->i, EV_CH_ADDRESS ) )
     {
+        /* The report below depends on both addresses, so they become part of the iteration signature */
+        _foldHash( r, r->op.workingAddr );
+        _foldHash( r, cpu->addr );
+
         /* Make debug report if calculated and reported addresses differ. This is most useful for testing when exhaustive  */
         /* address reporting is switched on. It will give 'false positives' for uncalculable instructions (e.g. bx lr) but */
         /* it's a decent safety net to be sure the jump decoder is working correctly.                                      */
@@ -598,6 +1385,11 @@ static void _etmCB( void *d )
     {
         incAddr--;
 
+        /* Everything this instruction adds to the buffer follows from its address and disposition */
+        _foldHash( r, r->op.workingAddr );
+        _foldHash( r, disposition & 1 );
+        r->fold.len++;
+
         if ( SymbolLookup( r->s, r->op.workingAddr, &n ) )
         {
             /* If we have changed file or function put a header line in */
@@ -660,6 +1452,12 @@ static void _etmCB( void *d )
                 {
                     /* This is a fixed jump that _was_ taken, so update working address */
                     r->op.workingAddr = n.assy[n.assyLine].jumpdest;
+
+                    /* A jump backwards closes an iteration of a loop */
+                    if ( ( n.assy[n.assyLine].isJump ) && ( n.assy[n.assyLine].jumpdest <= n.assy[n.assyLine].addr ) )
+                    {
+                        _foldIteration( r, n.assy[n.assyLine].jumpdest );
+                    }
                 }
                 else
                 {
@@ -683,31 +1481,90 @@ static void _etmCB( void *d )
     }
 }
 // ====================================================================================================
-static void _dumpBuffer( struct RunTime *r )
+static void _pumpWithCheckpoints( struct RunTime *r, uint8_t *buffer, uint32_t len, uint32_t traceOffset )
 
-/* Dump received data buffer into text buffer */
+/* Pump trace through the decoder, recording the rendered line reached at each A-sync along the way */
+/* (at least CHECKPOINT_SPACING apart) so decode can later be restarted from those points.         */
 
 {
-    _flushBuffer( r );
+    uint32_t pumped = 0;
+    uint32_t start;
 
-    if ( !SymbolSetValid( &r->s, r->options->elffile ) )
+    for ( uint32_t i = 0; i < len; i++ )
     {
-        if ( !( r->s = SymbolSetCreate( r->options->elffile, r->options->deleteMaterial, r->options->demangle, true, true ) ) )
+        if ( !buffer[i] )
         {
-            genericsReport( V_ERROR, "Elf file or symbols in it not found" EOL );
-            return;
+            r->ckptZeros++;
+            continue;
         }
-        else
+
+        if ( ( buffer[i] == 0x80 ) && ( r->ckptZeros >= ASYNC_ZEROS ) && ( traceOffset + i >= ASYNC_ZEROS ) )
         {
-            genericsReport( V_DEBUG, "Loaded %s" EOL, r->options->elffile );
+            start = traceOffset + i - ASYNC_ZEROS;
+
+            if ( ( !r->numCkpts ) || ( start - r->ckpt[r->numCkpts - 1].traceOffset >= CHECKPOINT_SPACING ) )
+            {
+                /* Bring the decode up to the start of this sync, then record where we got to */
+                if ( start > traceOffset + pumped )
+                {
+                    ETMDecoderPump( &r->i, &buffer[pumped], start - traceOffset - pumped, _etmCB, _etmReport, r );
+                    pumped = start - traceOffset;
+                }
+
+                if ( r->numCkpts == r->maxCkpts )
+                {
+                    r->maxCkpts = ( r->maxCkpts ) ? r->maxCkpts * 2 : 64;
+
+                    if ( !( r->ckpt = ( struct mortemCheckpoint * )realloc( r->ckpt, sizeof( struct mortemCheckpoint ) * r->maxCkpts ) ) )
+                    {
+                        genericsExit( -1, "Out of memory for checkpoints" EOL );
+                    }
+                }
+
+                r->ckpt[r->numCkpts].traceOffset = start;
+                r->ckpt[r->numCkpts].line = r->numLines;
+                r->numCkpts++;
+            }
         }
+
+        r->ckptZeros = 0;
+    }
+
+    ETMDecoderPump( &r->i, &buffer[pumped], len - pumped, _etmCB, _etmReport, r );
+}
+// ====================================================================================================
+static void _dumpBuffer( struct RunTime *r, bool isRerender )
+
+/* Dump received data buffer into text buffer, or re-do the last dump (e.g. with different folding) */
+
+{
+    _flushBuffer( r );
+
+    /* Decoding must start from the same state each time the same data are dumped */
+    if ( isRerender )
+    {
+        r->i = r->dumpStart;
+    }
+    else
+    {
+        r->dumpStart = r->i;
+    }
+
+    if ( !_loadSymbols( r ) )
+    {
+        return;
     }
 
+    _foldStartIteration( r );
+    r->numCkpts = 0;
+    r->ckptZeros = 0;
+
     /* Pump the received messages through the ETM decoder, it will callback to _etmCB with complete sentences */
     int bytesAvailable = ( ( r->wp + r->options->buflen ) - r->rp ) % r->options->buflen;
 
-    /* If we started wrapping (i.e. the rx ring buffer got full) then any guesses about sync status are invalid */
-    if ( ( bytesAvailable == r->options->buflen - 1 ) && ( !r->singleShot ) )
+    /* If we started wrapping (i.e. the rx ring buffer got full) or the front was cut off a trigger */
+    /* window then any guesses about sync status are invalid                                      */
+    if ( ( ( bytesAvailable == r->options->buflen - 1 ) || ( r->trig.trimmed ) ) && ( !r->singleShot ) )
     {
         ETMDecoderForceSync( &r->i, false );
     }
@@ -715,17 +1572,20 @@ static void _dumpBuffer( struct RunTime *r )
     if ( ( bytesAvailable + r->rp ) > r->options->buflen )
     {
         /* Buffer is wrapped - submit both parts */
-        ETMDecoderPump( &r->i, &r->pmBuffer[r->rp], r->options->buflen - r->rp, _etmCB, _etmReport, r );
-        ETMDecoderPump( &r->i, &r->pmBuffer[0], r->wp, _etmCB, _etmReport, r );
+        _pumpWithCheckpoints( r, &r->pmBuffer[r->rp], r->options->buflen - r->rp, 0 );
+        _pumpWithCheckpoints( r, &r->pmBuffer[0], r->wp, r->options->buflen - r->rp );
     }
     else
     {
         /* Buffer is not wrapped */
-        ETMDecoderPump( &r->i, &r->pmBuffer[r->rp], bytesAvailable, _etmCB, _etmReport, r );
+        _pumpWithCheckpoints( r, &r->pmBuffer[r->rp], bytesAvailable, 0 );
     }
 
     /* Submit this constructed buffer for display */
-    SIOsetOutputBuffer( r->sio, r->numLines, r->numLines - 1, &r->opText, false );
+    if ( r->sio )
+    {
+        SIOsetOutputBuffer( r->sio, r->numLines, r->numLines - 1, &r->opText, false );
+    }
 }
 // ====================================================================================================
 static bool _currentFileAndLine( struct RunTime *r, char **file, int32_t *l )
@@ -827,173 +1687,431 @@ static void _openFileBuffer( struct RunTime *r, int32_t line, char *fileToOpen )
 
 {
     FILE *f;
-    char construct[SCRATCH_STRING_LEN];
-    char *p;
-    int32_t lc = 0;
+    char construct[SCRATCH_STRING_LEN];
+    char *p;
+    int32_t lc = 0;
+    struct line *l;
+
+    f = fopen( fileToOpen, "r" );
+
+    if ( !f )
+    {
+        SIOalert( r->sio, "Couldn't open file" );
+        return;
+    }
+
+    while ( !feof( f ) )
+    {
+        if ( !fgets( construct, SCRATCH_STRING_LEN, f ) )
+        {
+            break;
+        }
+
+        lc++;
+
+        /* Remove and LF/CR */
+        for ( p = construct; ( ( *p ) && ( *p != '\n' ) && ( *p != '\r' ) ); p++ );
+
+        l = _newLine( &r->fileopText, &r->filenumLines, &r->filemaxLines );
+        l->buffer = _arenaStore( &r->fileArena, construct, p - construct );
+        l->lt     = LT_MU_SOURCE;
+        l->line   = lc;
+    }
+
+    fclose( f );
+
+    SIOsetOutputBuffer( r->sio, r->filenumLines, line - 1, &r->fileopText, true );
+    r->diving = true;
+}
+// ====================================================================================================
+static void _doFileOpen( struct RunTime *r, bool isDive )
+
+/* Do actions required to open file to dive into */
+
+{
+    char *p;
+    char *filename;
+    int32_t lineNo;
+    char construct[SCRATCH_STRING_LEN];
+
+    if ( ( r->diving ) || ( !r->numLines ) || ( !r->held ) )
+    {
+        return;
+    }
+
+    /* There should be no file read in at the moment */
+    assert( !r->filenumLines );
+
+
+    if ( !_currentFileAndLine( r, &p, &lineNo ) )
+    {
+        SIOalert( r->sio, "Couldn't get filename/line" );
+        return;
+    }
+
+    filename = strdup( p );
+    p = &filename[strlen( filename )];
+
+    /* Roll back to before the '::' to turn this into a filename */
+    while ( ( p != filename ) && ( *p != ':' ) )
+    {
+        p--;
+    }
+
+    if ( ( p == filename ) || ( *( p - 1 ) != ':' ) )
+    {
+        SIOalert( r->sio, "Couldn't decode filename" );
+        free( filename );
+        return;
+    }
+
+    *( p - 1 ) = 0;
+
+    /* Now create filename including stripped material if need be */
+    snprintf( construct, SCRATCH_STRING_LEN, "%s%s", r->options->deleteMaterial ? r->options->deleteMaterial : "", filename );
+
+    if ( isDive )
+    {
+        _openFileBuffer( r, lineNo, construct );
+    }
+    else
+    {
+        _openFileCommand( r, lineNo, construct );
+    }
+
+    free( filename );
+}
+// ====================================================================================================
+static void _doFilesurface( struct RunTime *r )
+
+/* Come back out of a file we're diving into */
+
+{
+    if ( !r->diving )
+    {
+        return;
+    }
+
+    /* Line slots and the arena are kept for the next dive */
+    _arenaReset( &r->fileArena );
+    r->filenumLines = 0;
+    r->diving = false;
+    SIOsetOutputBuffer( r->sio, r->numLines, r->numLines - 1, &r->opText, false );
+}
+// ====================================================================================================
+static bool _elfIdentity( const char *elffile, struct mortemFileHeader *h )
+
+/* Fill in the identity of the elf file (size, modification time and content hash) */
+
+{
+    struct stat st;
+    uint8_t *m;
+    int fd;
+
+    h->elfHash = FOLD_HASH_SEED;
+    strncpy( h->elfName, elffile, MORTEM_FILE_NAMELEN - 1 );
+
+    if ( ( fd = open( elffile, O_RDONLY ) ) < 0 )
+    {
+        return false;
+    }
+
+    if ( ( fstat( fd, &st ) < 0 ) || ( !st.st_size ) ||
+            ( MAP_FAILED == ( m = ( uint8_t * )mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 ) ) ) )
+    {
+        close( fd );
+        return false;
+    }
+
+    h->elfSize  = st.st_size;
+    h->elfMtime = st.st_mtime;
+
+    for ( off_t i = 0; i < st.st_size; i++ )
+    {
+        h->elfHash = ( h->elfHash ^ m[i] ) * FOLD_HASH_PRIME;
+    }
+
+    munmap( m, st.st_size );
+    close( fd );
+    return true;
+}
+// ====================================================================================================
+static void _padTo( FILE *f, uint64_t offset )
+
+/* Pad output file with zeros up to specified offset */
+
+{
+    while ( ftell( f ) < offset )
+    {
+        fputc( 0, f );
+    }
+}
+// ====================================================================================================
+static bool _writeCapture( struct RunTime *r, const char *fn )
+
+/* Write the buffer, decoder configuration, elf identity and indexes into a single capture file */
+
+{
+    struct mortemFileHeader h = { 0 };
+    struct mortemEvent e;
+    uint32_t bytesAvailable = ( ( r->wp + r->options->buflen ) - r->rp ) % r->options->buflen;
+    uint32_t textOffset = 0;
+    bool ok;
+    FILE *f;
 
-    f = fopen( fileToOpen, "r" );
+    strcpy( h.magic, MORTEM_FILE_MAGIC );
+    h.version        = MORTEM_FILE_VERSION;
+    h.headerLen      = sizeof( struct mortemFileHeader );
+    h.flags          = ( r->options->noAltAddr ? 0 : MFF_ALT_ADDR ) | ( r->options->useTPIU ? MFF_TPIU : 0 ) | ( r->noFold ? 0 : MFF_FOLDED );
+    h.channel        = r->options->channel;
+    h.buflen         = r->options->buflen;
+    h.numCheckpoints = r->numCkpts;
+    h.numLines       = r->numLines;
+    h.saveTimeuS     = genericsTimestampuS();
+
+    for ( int32_t w = 0; w < r->numLines; w++ )
+    {
+        if ( r->opText[w].lt == LT_EVENT )
+        {
+            h.numEvents++;
+            h.eventTextLen += strlen( r->opText[w].buffer ) + 1;
+        }
+    }
 
-    if ( !f )
+    h.traceOffset      = MORTEM_FILE_ALIGN( sizeof( struct mortemFileHeader ) );
+    h.traceLen         = bytesAvailable;
+    h.checkpointOffset = MORTEM_FILE_ALIGN( h.traceOffset + h.traceLen );
+    h.eventOffset      = MORTEM_FILE_ALIGN( h.checkpointOffset + h.numCheckpoints * sizeof( struct mortemCheckpoint ) );
+    h.eventTextOffset  = MORTEM_FILE_ALIGN( h.eventOffset + h.numEvents * sizeof( struct mortemEvent ) );
+
+    if ( !_elfIdentity( r->options->elffile, &h ) )
     {
-        SIOalert( r->sio, "Couldn't open file" );
-        return;
+        genericsReport( V_WARN, "Could not identify elf file %s" EOL, r->options->elffile );
     }
 
-    while ( !feof( f ) )
+    if ( !( f = fopen( fn, "wb" ) ) )
     {
-        if ( !fgets( construct, SCRATCH_STRING_LEN, f ) )
-        {
-            break;
-        }
+        return false;
+    }
 
-        lc++;
-        r->fileopText = ( struct line * )realloc( r->fileopText, ( sizeof( struct line ) ) * ( r->filenumLines + 1 ) );
+    fwrite( &h, sizeof( struct mortemFileHeader ), 1, f );
+    _padTo( f, h.traceOffset );
 
-        /* Remove and LF/CR */
-        for ( p = construct; ( ( *p ) && ( *p != '\n' ) && ( *p != '\r' ) ); p++ );
+    /* The trace, in one or two parts depending on if the ring wrapped */
+    if ( ( bytesAvailable + r->rp ) > r->options->buflen )
+    {
+        fwrite( &r->pmBuffer[r->rp], r->options->buflen - r->rp, 1, f );
+        fwrite( &r->pmBuffer[0], r->wp, 1, f );
+    }
+    else
+    {
+        fwrite( &r->pmBuffer[r->rp], bytesAvailable, 1, f );
+    }
+
+    _padTo( f, h.checkpointOffset );
+    fwrite( r->ckpt, sizeof( struct mortemCheckpoint ), r->numCkpts, f );
+
+    /* Event index, followed by the text it refers to */
+    _padTo( f, h.eventOffset );
+
+    for ( int32_t w = 0; w < r->numLines; w++ )
+    {
+        if ( r->opText[w].lt == LT_EVENT )
+        {
+            e.line = w;
+            e.textOffset = textOffset;
+            fwrite( &e, sizeof( struct mortemEvent ), 1, f );
+            textOffset += strlen( r->opText[w].buffer ) + 1;
+        }
+    }
 
-        *p = 0;
+    _padTo( f, h.eventTextOffset );
 
-        r->fileopText[r->filenumLines].buffer = strdup( construct );
-        r->fileopText[r->filenumLines].lt     = LT_MU_SOURCE;
-        r->fileopText[r->filenumLines].line   = lc;
-        r->fileopText[r->filenumLines].isRef  = false;
-        r->filenumLines++;
+    for ( int32_t w = 0; w < r->numLines; w++ )
+    {
+        if ( r->opText[w].lt == LT_EVENT )
+        {
+            fwrite( r->opText[w].buffer, strlen( r->opText[w].buffer ) + 1, 1, f );
+        }
     }
 
+    ok = !ferror( f );
     fclose( f );
+    return ok;
+}
+// ====================================================================================================
+static bool _sectionFits( uint64_t offset, uint64_t len, uint64_t fileLen )
 
-    SIOsetOutputBuffer( r->sio, r->filenumLines, line - 1, &r->fileopText, true );
-    r->diving = true;
+/* Check a section of a capture lies inside the file, without overflowing on bad values */
+
+{
+    return ( offset <= fileLen ) && ( len <= fileLen - offset );
 }
 // ====================================================================================================
-static void _doFileOpen( struct RunTime *r, bool isDive )
+static void _seekCapture( struct RunTime *r, struct mortemFileHeader *m )
 
-/* Do actions required to open file to dive into */
+/* Start decoding from the last checkpoint at or before the requested line, rather than the start */
 
 {
-    char *p;
-    char *filename;
-    int32_t lineNo;
-    char construct[SCRATCH_STRING_LEN];
+    struct mortemCheckpoint *c = ( struct mortemCheckpoint * )( ( uint8_t * )m + m->checkpointOffset );
+    uint32_t n = 0;
 
-    if ( ( r->diving ) || ( !r->numLines ) || ( !r->held ) )
+    while ( ( n < m->numCheckpoints ) && ( c[n].line <= r->options->startLine ) )
     {
-        return;
+        n++;
     }
 
-    /* There should be no file read in at the moment */
-    assert( !r->fileopText );
-    assert( !r->filenumLines );
-
-
-    if ( !_currentFileAndLine( r, &p, &lineNo ) )
+    if ( !n )
     {
-        SIOalert( r->sio, "Couldn't get filename/line" );
+        genericsReport( V_WARN, "No checkpoint before line %d, decoding from the start" EOL, r->options->startLine );
         return;
     }
 
-    filename = strdup( p );
-    p = &filename[strlen( filename )];
+    if ( ( ( m->flags & MFF_FOLDED ) != 0 ) == r->noFold )
+    {
+        genericsReport( V_WARN, "Capture lines were counted %s folding, so the start line is approximate" EOL, r->noFold ? "with" : "without" );
+    }
 
-    /* Roll back to before the '::' to turn this into a filename */
-    while ( ( p != filename ) && ( *p != ':' ) )
+    r->rp = c[n - 1].traceOffset;
+    genericsReport( V_INFO, "Decoding from trace offset %d (line %d)" EOL, c[n - 1].traceOffset, c[n - 1].line );
+}
+// ====================================================================================================
+static bool _loadCapture( struct RunTime *r )
+
+/* If the input file is a saved capture then map it in and use it in place. Returns false if */
+/* it isn't a capture file (i.e. it's raw trace), and exits if it's a corrupt one.           */
+
+{
+    struct mortemFileHeader h;
+    struct mortemFileHeader *m;
+    struct stat st;
+    int fd;
+
+    if ( ( fd = open( r->options->file, O_RDONLY ) ) < 0 )
     {
-        p--;
+        genericsExit( -1, "Can't open file %s" EOL, r->options->file );
     }
 
-    if ( ( p == filename ) || ( *( p - 1 ) != ':' ) )
+    if ( ( read( fd, &h, sizeof( h ) ) != sizeof( h ) ) || ( strcmp( h.magic, MORTEM_FILE_MAGIC ) ) )
     {
-        SIOalert( r->sio, "Couldn't decode filename" );
-        free( filename );
-        return;
+        close( fd );
+        return false;
     }
 
-    *( p - 1 ) = 0;
+    if ( ( h.version != MORTEM_FILE_VERSION ) || ( h.headerLen != sizeof( struct mortemFileHeader ) ) )
+    {
+        genericsExit( -1, "Unsupported capture file version" EOL );
+    }
 
-    /* Now create filename including stripped material if need be */
-    snprintf( construct, SCRATCH_STRING_LEN, "%s%s", r->options->deleteMaterial ? r->options->deleteMaterial : "", filename );
+    if ( fstat( fd, &st ) < 0 )
+    {
+        genericsExit( -1, "Can't stat capture file" EOL );
+    }
 
-    if ( isDive )
+    /* Every section has to be inside the file before anything in it can be used */
+    if ( ( !h.traceLen ) || ( h.traceLen >= INT32_MAX ) ||
+            ( !_sectionFits( h.traceOffset, h.traceLen, st.st_size ) ) ||
+            ( !_sectionFits( h.checkpointOffset, ( uint64_t )h.numCheckpoints * sizeof( struct mortemCheckpoint ), st.st_size ) ) ||
+            ( !_sectionFits( h.eventOffset, ( uint64_t )h.numEvents * sizeof( struct mortemEvent ), st.st_size ) ) ||
+            ( !_sectionFits( h.eventTextOffset, h.eventTextLen, st.st_size ) ) ||
+            ( h.eventTextLen >= UINT32_MAX ) || ( ( h.numEvents ) && ( !h.eventTextLen ) ) )
     {
-        _openFileBuffer( r, lineNo, construct );
+        genericsExit( -1, "Corrupt capture file" EOL );
     }
-    else
+
+    /* Private writable mapping, so the trace can be used in place as the post-mortem buffer */
+    m = ( struct mortemFileHeader * )mmap( NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+    close( fd );
+
+    if ( MAP_FAILED == m )
     {
-        _openFileCommand( r, lineNo, construct );
+        genericsExit( -1, "Can't map capture file" EOL );
     }
 
-    free( filename );
-}
-// ====================================================================================================
-static void _doFilesurface( struct RunTime *r )
+    /* ...and the indexes have to point inside the sections they refer to */
+    for ( uint32_t c = 0; c < m->numCheckpoints; c++ )
+    {
+        struct mortemCheckpoint *k = ( struct mortemCheckpoint * )( ( uint8_t * )m + m->checkpointOffset ) + c;
 
-/* Come back out of a file we're diving into */
+        if ( ( k->traceOffset >= m->traceLen ) || ( k->line > m->numLines ) )
+        {
+            genericsExit( -1, "Corrupt capture file checkpoint index" EOL );
+        }
+    }
 
-{
-    if ( !r->diving )
+    for ( uint32_t e = 0; e < m->numEvents; e++ )
     {
-        return;
+        struct mortemEvent *v = ( struct mortemEvent * )( ( uint8_t * )m + m->eventOffset ) + e;
+
+        if ( ( v->textOffset >= m->eventTextLen ) || ( v->line >= m->numLines ) )
+        {
+            genericsExit( -1, "Corrupt capture file event index" EOL );
+        }
     }
 
-    while ( r->filenumLines )
+    if ( ( m->eventTextLen ) && ( *( ( char * )m + m->eventTextOffset + m->eventTextLen - 1 ) ) )
     {
-        free( r->fileopText[--r->filenumLines].buffer );
+        genericsExit( -1, "Corrupt capture file event text" EOL );
     }
 
-    r->fileopText = NULL;
-    r->diving = false;
-    SIOsetOutputBuffer( r->sio, r->numLines, r->numLines - 1, &r->opText, false );
-}
-// ====================================================================================================
-static void _doSave( struct RunTime *r )
+    r->capture  = m;
+    r->pmBuffer = ( uint8_t * )m + m->traceOffset;
+    r->rp       = 0;
+    r->wp       = m->traceLen;
 
-/* Save buffer in both raw and processed formats */
+    /* The trace was captured with this configuration, and it's already out of any TPIU framing */
+    r->options->buflen    = m->traceLen + 1;
+    r->options->noAltAddr = !( m->flags & MFF_ALT_ADDR );
+    r->options->useTPIU   = false;
 
-{
-    FILE *f;
-    char fn[SCRATCH_STRING_LEN];
-    uint32_t w;
-    char *p;
+    _elfIdentity( r->options->elffile, &h );
+    r->elfMismatch = ( h.elfSize != m->elfSize ) || ( h.elfHash != m->elfHash );
 
-    snprintf( fn, SCRATCH_STRING_LEN, "%s.trace", SIOgetSaveFilename( r->sio ) );
-    f = fopen( fn, "wb" );
+    genericsReport( V_INFO, "Loaded capture of %" PRIu64 " bytes (%d checkpoints, %d events) decoded against %s" EOL,
+                    m->traceLen, m->numCheckpoints, m->numEvents, m->elfName );
 
-    if ( !f )
+    if ( r->elfMismatch )
     {
-        SIOalert( r->sio, "Save Trace Failed" );
-        return;
+        genericsReport( V_WARN, "Elf file differs from the one used at capture (%s)" EOL, m->elfName );
     }
 
-    w = r->rp;
-
-    while ( w != r->wp )
+    if ( r->options->startLine )
     {
-        fwrite( &r->pmBuffer[w], 1, 1, f );
-        w = ( w + 1 ) % r->options->buflen;
+        _seekCapture( r, m );
     }
 
-    fclose( f );
+    return true;
+}
+// ====================================================================================================
+static bool _writeReport( struct RunTime *r, const char *fn )
 
-    snprintf( fn, SCRATCH_STRING_LEN, "%s.report", SIOgetSaveFilename( r->sio ) );
-    f = fopen( fn, "wb" );
+/* Write the rendered buffer as a text report */
 
-    if ( !f )
+{
+    FILE *f;
+    char *p;
+    bool ok;
+
+    if ( !( f = fopen( fn, "wb" ) ) )
     {
-        SIOalert( r->sio, "Save Report Failed" );
-        return;
+        return false;
     }
 
-    w = 0;
-
-    while ( w != r->numLines )
+    for ( int32_t w = 0; w < r->numLines; w++ )
     {
         p = r->opText[w].buffer;
 
+        if ( r->opText[w].lt == LT_LOOP )
+        {
+            /* Folded loop, the count is carried in the line number */
+            fprintf( f, LOOP_FOLD_FMT EOL, r->opText[w].line, ( r->opText[w].line == 1 ) ? "" : "s" );
+            continue;
+        }
+
         if ( ( r->opText[w].lt == LT_SOURCE ) || ( r->opText[w].lt == LT_MU_SOURCE ) )
         {
             /* Need a line number on this */
-            fwrite( fn, sprintf( fn, "%5d ", r->opText[w].line ), 1, f );
+            fprintf( f, "%5d ", r->opText[w].line );
         }
 
         if ( r->opText[w].lt == LT_NASSEMBLY )
@@ -1017,12 +2135,100 @@ static void _doSave( struct RunTime *r )
         }
 
         fwrite( EOL, strlen( EOL ), 1, f );
-        w++;
     }
 
+    ok = !ferror( f );
+    fclose( f );
+    return ok;
+}
+// ====================================================================================================
+static void _doSave( struct RunTime *r )
+
+/* Save buffer as a capture file, which can be reopened with -f (and exported to text with -x) */
+
+{
+    char fn[SCRATCH_STRING_LEN];
+
+    snprintf( fn, SCRATCH_STRING_LEN, "%s" MORTEM_FILE_EXT, SIOgetSaveFilename( r->sio ) );
+    SIOalert( r->sio, _writeCapture( r, fn ) ? "Save Complete" : "Save Failed" );
+}
+// ====================================================================================================
+static int _doExport( struct RunTime *r )
+
+/* Decode the input file and write it out as a text report, without any interaction */
+
+{
+    struct traceFileReader *f;
+
+    if ( !r->capture )
+    {
+        /* Raw trace, so read it through the normal path into the post-mortem buffer */
+        if ( !( f = traceFileOpen( r->options->file ) ) )
+        {
+            genericsExit( -1, "Can't open file %s" EOL, r->options->file );
+        }
+
+        /* ...stopping early if a trigger window closes */
+        while ( ( !r->held ) && ( ( r->rawBlock.fillLevel = traceFileRead( f, r->rawBlock.buffer, TRANSFER_SIZE ) ) > 0 ) )
+        {
+            _processBlock( r );
+        }
+
+        traceFileClose( f );
+    }
+
+    _dumpBuffer( r, false );
+
+    if ( !_writeReport( r, r->options->exportFile ) )
+    {
+        genericsReport( V_ERROR, "Failed to write report %s" EOL, r->options->exportFile );
+        return -2;
+    }
+
+    genericsReport( V_INFO, "Wrote %d lines to %s" EOL, r->numLines, r->options->exportFile );
+    return OK;
+}
+// ====================================================================================================
+static int _doEventExport( struct RunTime *r )
+
+/* Write out the pre-rendered event lines of a capture, with their line numbers, without decoding anything */
+
+{
+    struct mortemEvent *e;
+    const char *text;
+    FILE *f;
+    bool ok;
+
+    if ( !r->capture )
+    {
+        genericsExit( -1, "Event export needs a capture file" EOL );
+    }
+
+    if ( !( f = fopen( r->options->eventFile, "wb" ) ) )
+    {
+        genericsReport( V_ERROR, "Failed to write events %s" EOL, r->options->eventFile );
+        return -2;
+    }
+
+    e    = ( struct mortemEvent * )( ( uint8_t * )r->capture + r->capture->eventOffset );
+    text = ( const char * )r->capture + r->capture->eventTextOffset;
+
+    for ( uint32_t i = 0; i < r->capture->numEvents; i++ )
+    {
+        fprintf( f, "%6d %s" EOL, e[i].line, &text[e[i].textOffset] );
+    }
+
+    ok = !ferror( f );
     fclose( f );
 
-    SIOalert( r->sio, "Save Complete" );
+    if ( !ok )
+    {
+        genericsReport( V_ERROR, "Failed to write events %s" EOL, r->options->eventFile );
+        return -2;
+    }
+
+    genericsReport( V_INFO, "Wrote %d events to %s" EOL, r->capture->numEvents, r->options->eventFile );
+    return OK;
 }
 // ====================================================================================================
 static void _doExit( void )
@@ -1031,6 +2237,25 @@ static void _doExit( void )
 
 {
     _r.ending = true;
+
+    /* Get anything that's still in flight onto the disk */
+    if ( _r.stream.wb )
+    {
+        struct writebehindStats s;
+
+        writebehindFlush( _r.stream.wb );
+        writebehindGetStats( _r.stream.wb, &s );
+
+        if ( s.bytesDropped )
+        {
+            genericsReport( V_WARN, "Stream writer fell behind, %" PRIu64 " bytes were not saved" EOL, s.bytesDropped );
+        }
+
+        writebehindShutdown( _r.stream.wb );
+        _r.stream.wb = NULL;
+        _streamCloseSegment( &_r );
+    }
+
     /* Give them a bit of time, then we're leaving anyway */
     usleep( 200 );
     SIOterminate( _r.sio );
@@ -1040,6 +2265,7 @@ int main( int argc, char *argv[] )
 
 {
     int sourcefd;
+    struct traceFileReader *f = NULL;
     struct sockaddr_in serv_addr;
     struct hostent *server;
     int flag = 1;
@@ -1058,15 +2284,6 @@ int main( int argc, char *argv[] )
         genericsExit( -1, "" EOL );
     }
 
-    /* Make sure the fifos get removed at the end */
-    atexit( _doExit );
-
-    /* Create a screen and interaction handler */
-    _r.sio = SIOsetup( _r.progName, _r.options->elffile, ( _r.options->file != NULL ) );
-
-    /* Fill in a time to start from */
-    lastHTime = lastTTime = lastTSTime = genericsTimestampmS();
-
     /* This ensures the atexit gets called */
     if ( SIG_ERR == signal( SIGINT, _intHandler ) )
     {
@@ -1079,8 +2296,22 @@ int main( int argc, char *argv[] )
         genericsExit( -1, "Failed to ignore SIGPIPEs" EOL );
     }
 
-    /* Create the buffer memory */
-    _r.pmBuffer = ( uint8_t * )calloc( 1, _r.options->buflen );
+    /* A saved capture brings its own buffer (and configuration) with it, otherwise create the buffer memory */
+    if ( ( !_r.options->file ) || ( !_loadCapture( &_r ) ) )
+    {
+        _r.pmBuffer = ( uint8_t * )calloc( 1, _r.options->buflen );
+    }
+
+    if ( _r.options->eventFile )
+    {
+        /* Everything needed is already in the capture */
+        return _doEventExport( &_r );
+    }
+
+    if ( ( _r.options->startLine ) && ( !_r.capture ) )
+    {
+        genericsExit( -1, "A start line needs a capture file" EOL );
+    }
 
     ETMDecoderInit( &_r.i, !( _r.options->noAltAddr ) );
 
@@ -1089,6 +2320,49 @@ int main( int argc, char *argv[] )
         TPIUDecoderInit( &_r.t );
     }
 
+    if ( _r.options->numTriggers )
+    {
+        ETMDecoderInit( &_r.trig.i, !( _r.options->noAltAddr ) );
+
+        for ( int t = 0; t < _r.options->numTriggers; t++ )
+        {
+            _r.trig.watchAddr |= ( _r.options->trigger[t].type == TRIG_ADDR );
+        }
+
+        _triggerArm( &_r );
+    }
+
+    if ( _r.options->exportFile )
+    {
+        /* No interaction needed, just convert to text and leave */
+        return _doExport( &_r );
+    }
+
+    if ( _r.options->streamFile )
+    {
+        _r.stream.fd = -1;
+        _r.stream.seg = ( struct streamSegment * )calloc( _r.options->streamSegments, sizeof( struct streamSegment ) );
+
+        if ( !( _r.stream.wb = writebehindCreate( STREAM_BLOCK_SIZE, STREAM_NUM_BLOCKS, false, _streamWrite, &_r ) ) )
+        {
+            genericsExit( -1, "Failed to start stream writer" EOL );
+        }
+    }
+
+    /* Make sure the fifos get removed at the end */
+    atexit( _doExit );
+
+    /* Create a screen and interaction handler */
+    _r.sio = SIOsetup( _r.progName, _r.options->elffile, ( _r.options->file != NULL ) );
+
+    if ( _r.elfMismatch )
+    {
+        SIOalert( _r.sio, "Elf file differs from capture" );
+    }
+
+    /* Fill in a time to start from */
+    lastHTime = lastTTime = lastTSTime = genericsTimestampmS();
+
     while ( !_r.ending )
     {
         if ( !_r.options->file )
@@ -1136,13 +2410,19 @@ int main( int argc, char *argv[] )
                 continue;
             }
         }
+        else if ( _r.capture )
+        {
+            /* Everything is already in the buffer, there's nothing to read */
+            sourcefd = 0;
+        }
         else
         {
-
-            if ( ( sourcefd = open( _r.options->file, O_RDONLY ) ) < 0 )
+            if ( !( f = traceFileOpen( _r.options->file ) ) )
             {
-                genericsExit( sourcefd, "Can't open file %s" EOL, _r.options->file );
+                genericsExit( -ENOENT, "Can't open file %s" EOL, _r.options->file );
             }
+
+            sourcefd = traceFileFd( f );
         }
 
         FD_ZERO( &readfds );
@@ -1174,20 +2454,31 @@ int main( int argc, char *argv[] )
             if ( sourcefd && FD_ISSET( sourcefd, &readfds ) )
             {
                 /* We always read the data, even if we're held, to keep the socket alive */
-                _r.rawBlock.fillLevel = read( sourcefd, _r.rawBlock.buffer, TRANSFER_SIZE );
+                _r.rawBlock.fillLevel = f ? traceFileRead( f, _r.rawBlock.buffer, TRANSFER_SIZE ) :
+                                        read( sourcefd, _r.rawBlock.buffer, TRANSFER_SIZE );
 
                 if ( ( _r.rawBlock.fillLevel <= 0 ) && _r.options->file )
                 {
                     /* Read from file is complete, remove fd */
-                    close( sourcefd );
+                    traceFileClose( f );
+                    f = NULL;
                     sourcefd = 0;
                 }
 
-                if ( !_r.held )
+                if ( ( !_r.held ) || ( _r.stream.wb ) )
                 {
                     /* Pump all of the data through the protocol handler */
                     _processBlock( &_r );
                 }
+
+                if ( _r.trig.windowReady )
+                {
+                    /* A trigger window just closed, so show it */
+                    _r.trig.windowReady = false;
+                    _dumpBuffer( &_r, false );
+                    SIOheld( _r.sio, _r.held );
+                    SIOalert( _r.sio, _r.trig.reason );
+                }
             }
 
             /* Update the outputs and deal with any keys that made it up this high */
@@ -1202,6 +2493,11 @@ int main( int argc, char *argv[] )
                         {
                             _r.wp = _r.rp = 0;
 
+                            if ( _r.options->numTriggers )
+                            {
+                                _triggerArm( &_r );
+                            }
+
                             if ( _r.diving )
                             {
                                 _doFilesurface( &_r );
@@ -1240,6 +2536,17 @@ int main( int argc, char *argv[] )
                     _doFilesurface( &_r );
                     break;
 
+                case SIO_EV_FOLD:
+                    _r.noFold = !_r.noFold;
+
+                    if ( ( _r.held ) && ( _r.numLines ) && ( !_r.diving ) )
+                    {
+                        _dumpBuffer( &_r, true );
+                    }
+
+                    SIOalert( _r.sio, _r.noFold ? "Loops unfolded" : "Loops folded" );
+                    break;
+
                 case SIO_EV_QUIT:
                     _r.ending = true;
                     break;
@@ -1259,7 +2566,7 @@ int main( int argc, char *argv[] )
                     )
                )
             {
-                _dumpBuffer( &_r );
+                _dumpBuffer( &_r, false );
                 _r.held = true;
                 SIOheld( _r.sio, _r.held );
             }
@@ -1274,6 +2581,12 @@ int main( int argc, char *argv[] )
             if ( ( genericsTimestampmS() - lastTTime ) > TICK_TIME_MS )
             {
                 lastTTime = genericsTimestampmS();
+
+                /* Bound the time that streamed data can sit in memory before it heads to disk */
+                if ( _r.stream.wb )
+                {
+                    writebehindFlush( _r.stream.wb );
+                }
             }
 
             if ( ( genericsTimestampmS() - lastTSTime ) > INTERVAL_TIME_MS )
@@ -1288,7 +2601,12 @@ int main( int argc, char *argv[] )
         /* End of main loop ... we get here because something forced us out              */
         /* ----------------------------------------------------------------------------- */
 
-        if ( sourcefd )
+        if ( f )
+        {
+            traceFileClose( f );
+            f = NULL;
+        }
+        else if ( sourcefd )
         {
             close( sourcefd );
         }
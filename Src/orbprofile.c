@@ -9,6 +9,7 @@
 #include <ctype.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <signal.h>
@@ -16,6 +17,7 @@
 #include <netinet/in.h>
 #include <netdb.h>
 #include <semaphore.h>
+#include <errno.h>
 #include <pthread.h>
 #include <assert.h>
 
@@ -26,23 +28,68 @@
 #include "symbols.h"
 #include "nw.h"
 #include "ext_fileformats.h"
+#include "blockQueue.h"
+#include "callStack.h"
+#include "cct.h"
+#include "traceLog.h"
+#include "traceFile.h"
 
 #define TICK_TIME_MS        (1)          /* Time intervals for checks */
 #define DEFAULT_DURATION_MS (1000)       /* Default time to sample, in mS */
 #define HANDLE_MASK         (0xFFFFFF)   /* cachegrind cannot cope with large file handle numbers */
 
-/* How many transfer buffers from the source to allocate */
-#define NUM_RAW_BLOCKS (1000)
+/* Flags for decoded attributes of an instruction in the instruction table */
+#define IF_DECODED          (1<<0)       /* Attributes have been filled in from the symbols */
+#define IF_JUMP             (1<<1)       /* This is a jump instruction */
+#define IF_SUBCALL          (1<<2)       /* This is a subroutine call (BL/BLX) */
+#define IF_RETURN           (1<<3)       /* This is a return */
+#define IF_4BYTE            (1<<4)       /* This is a 4 byte instruction */
 
-#define DBG_OUT(...) printf(__VA_ARGS__)
-//#define DBG_OUT(...)
+#define NO_INST             (0xffffffff) /* No instruction table index */
 
-struct _subcallAccount
+/* Default maximum number of transfer buffers queued between the source and the decoder */
+#define DEFAULT_INGEST_BLOCKS (32)
+
+/* Parallel replay of a file is split at an A-sync (at least 5 zeros then 0x80) followed by an I-sync */
+#define ASYNC_ZEROS         (5)
+#define ASYNC_END           (0x80)
+#define ISYNC_HDR           (0x08)
+#define ISYNC_CC_HDR        (0x70)
+#define REPLAY_CHUNK        (1024*1024)  /* Amount of a segment fed to the decoder at a time */
+
+#define SNAPSHOT_NAME_LEN   (1024)       /* Max length of a snapshot filename */
+
+/* Events recorded in the trace log (debug builds only) */
+enum traceEvent
 {
-    struct subcallSig sig;
-    uint64_t inTicks;
+    TL_CALL,
+    TL_RETURN,
+    TL_STACK_EMPTY,
+    TL_INITIAL_ADDR,
+    TL_CANCELLED,
+    TL_PENDING_INST,
+    TL_NEW_ADDR,
+    TL_INTERRUPT,
+    TL_ADDR,
+    TL_ATOMS,
+    TL_NUM_EVENTS
 };
 
+#ifdef DEBUG
+static const char *const _traceFmt[TL_NUM_EVENTS] =
+{
+    [TL_CALL]            = "INC:%3d %08x -> %08x",
+    [TL_RETURN]          = " DEC:%3d %08x",
+    [TL_STACK_EMPTY]     = "OUT OF STACK (wanted %08x)",
+    [TL_INITIAL_ADDR]    = "Got initial address %08x",
+    [TL_CANCELLED]       = "CANCELLED",
+    [TL_PENDING_INST]    = "***",
+    [TL_NEW_ADDR]        = "New addr %08x",
+    [TL_INTERRUPT]       = "INTERRUPT!! %08x -> %08x",
+    [TL_ADDR]            = "A:%08x",
+    [TL_ATOMS]           = "E:%d N:%d"
+};
+#endif
 
 /* ---------- CONFIGURATION ----------------- */
 struct Options                           /* Record for options, either defaults or from command line */
@@ -58,6 +105,10 @@ struct Options                           /* Record for options, either defaults
 
     char *dotfile;                       /* File to output dot information */
     char *profile;                       /* File to output profile information */
+    char *pproffile;                     /* File to output pprof profile */
+    char *tracefile;                     /* File to output trace-event stream of calls */
+    char *foldedfile;                    /* File to output folded stacks for flame graphs */
+    int  maxContexts;                    /* Maximum number of nodes in calling context tree */
     int  sampleDuration;                 /* How long we are going to sample for */
 
     bool noaltAddr;                      /* Dont use alternate addressing */
@@ -67,20 +118,46 @@ struct Options                           /* Record for options, either defaults
     int  port;                           /* Source information for where to connect to */
     char *server;
 
+    int  ingestBlocks;                   /* Maximum number of transfer buffers waiting to be decoded */
+    int  maxStack;                       /* Maximum depth of call stack */
+
+    bool parallel;                       /* Replay the file in segments in parallel */
+    int  threads;                        /* ...over this many threads (0 for one per processor) */
+
+    int  snapshotInterval;               /* Write a snapshot of the profile this often (mS) */
+    bool snapshotDelta;                  /* ...containing only what happened since the last one */
+
 } _options =
 {
     .demangle       = true,
+    .ingestBlocks   = DEFAULT_INGEST_BLOCKS,
+    .maxStack       = CALLSTACK_DEFAULT_MAX_DEPTH,
+    .maxContexts    = CCT_DEFAULT_MAX_NODES,
     .sampleDuration = DEFAULT_DURATION_MS,
     .port           = NWCLIENT_SERVER_PORT,
     .server         = "localhost"
 };
 
+/* Per-instruction attributes for the whole text segment, as flat arrays indexed by (addr - base) >> 1. */
+/* Attributes are decoded from the symbols the first time an instruction is executed and don't        */
+/* change after that. The counters, which change on every execution, belong to each replay and are    */
+/* indexed the same way, so the replay loop only touches the few cache lines it needs.                */
+struct instTable
+{
+    uint32_t base;                       /* Lowest address covered by the table */
+    uint32_t slots;                      /* Number of halfword slots in the table */
+
+    uint8_t  *flags;                     /* IF_xxx flags */
+    uint32_t *jumpdest;                  /* Destination for a jump, if it's taken */
+    uint32_t *line;                      /* Line number in identified file */
+    uint32_t *functionindex;             /* Function index (from symbols.c) */
+};
+
 /* State of routine tracking, maintained across ETM callbacks to reconstruct program flow */
 struct opConstruct
 {
-    struct execEntryHash *h;             /* The exec entry we were in last (file, function, line, addr etc) */
-    struct execEntryHash *oldh;          /* The exec entry we're currently in (file, function, line, addr etc) */
-    struct execEntryHash *inth;          /* Fake exec entry for an interrupt source */
+    uint32_t h;                          /* Instruction table index of the instruction we're currently in */
+    uint32_t oldh;                       /* Instruction table index of the instruction we were in last */
     uint32_t workingAddr;                /* The address we're currently in */
     uint32_t nextAddr;                   /* The address we will next be accessing (if known) */
     uint32_t lastfn;                     /* The function of the last instruction carried out */
@@ -92,11 +169,58 @@ struct opConstruct
     bool isException;                    /* Is this flagged as an exception? */
 };
 
-/* A block of received data */
-struct dataBlock
+/* A return seen in a segment of a parallel replay with nothing left on the segment's own call stack */
+struct unwoundReturn
+{
+    uint32_t to;                         /* Address returned to */
+    uint64_t tstamp;                     /* Instruction count when it happened */
+};
+
+/* What a replay accumulates. These can be swapped out from under a running replay for a snapshot */
+struct counters
 {
-    ssize_t fillLevel;
-    uint8_t buffer[TRANSFER_SIZE];
+    uint64_t *count;                     /* Instruction level count, indexed as the instruction table */
+    uint64_t *scount;                    /* Source level count (applied to first instruction of a new source line) */
+    struct subcall *subhead;             /* Calls construct data */
+};
+
+/* Counters swapped out of the live replay, for writing in the background */
+struct snapshot
+{
+    struct counters c;                   /* The counters (which become the spare set when written) */
+    uint64_t timelen;                    /* Time the snapshot covers */
+    uint32_t seq;                        /* Sequence number of this snapshot */
+};
+
+/* One decode of a stream of trace and everything it has accumulated. Live and serial file decode use */
+/* a single replay, a parallel file replay uses one per segment and merges them into that one.        */
+struct replay
+{
+    struct RunTime *r;                   /* Owner, for symbols, instruction attributes and options */
+
+    struct ETMDecoder i;                 /* Decoder for this stream */
+    struct opConstruct op;               /* The mechanical elements for reconstructing program flow */
+    struct callStack stack;              /* Calls in progress */
+    struct counters c;                   /* What has been seen */
+    struct cct *cct;                     /* Calling contexts, if they're being tracked */
+
+    bool     sampling;                   /* Are we actively sampling at the moment */
+    uint32_t starttime;                  /* At what time did we start sampling? */
+    uint32_t incAddr;                    /* Number of atoms still to be actioned from the last batch */
+    uint32_t disposition;                /* ...and whether each of them was executed */
+
+    /* Only used by segments of a parallel replay */
+    bool isSegment;                      /* This is a segment of a parallel replay */
+    const uint8_t *start;                /* Start of this segment */
+    size_t len;                          /* Length of this segment */
+    size_t overrun;                      /* Length of material following it */
+    bool flushing;                       /* Decoding past the end to complete the last instruction */
+    bool flushed;                        /* ...which has now been done */
+    uint32_t firsth;                     /* Instruction table index of the first instruction in the segment */
+    struct unwoundReturn *ret;           /* Returns to calls made before this segment started */
+    uint32_t retCount;                   /* ...how many there are */
+    uint32_t retAllocated;               /* ...and how many there is space for */
+    pthread_t thread;                    /* Thread doing the decode */
 };
 
 /* ----------- LIVE STATE ----------------- */
@@ -106,17 +230,12 @@ struct RunTime
     const char *progName;                       /* Name by which this program was called */
 
     /* Subsystem data support */
-    struct ETMDecoder i;
     struct SymbolSet *s;                        /* Symbols read from elf */
 
     /* Calls related info */
     struct edge *calls;                         /* Call data table */
-    struct subcall *subhead;                    /* Calls onstruct data */
-    struct execEntryHash *insthead;             /* Exec table handle for hash */
-
-    /* Subroutine related info...the call stack and its length */
-    struct _subcallAccount *substack;           /* Calls stack data */
-    uint32_t substacklen;                       /* Calls stack length */
+    struct execEntryHash *insthead;             /* Exec table handle for hash, built from inst for output */
+    struct instTable inst;                      /* Per-instruction attributes for the text segment */
 
     /* Stats about the run */
     int instCount;                              /* Number of instruction locations */
@@ -124,21 +243,30 @@ struct RunTime
     uint64_t intervalBytes;                     /* Number of bytes transferred in current interval */
 
     /* State of the target tracker */
-    struct opConstruct op;                      /* The mechanical elements for creating the output buffer */
+    struct replay replay;                       /* Decode of the trace, or merge of the segments of it */
 
     /* Subprocess control and interworking */
     pthread_t processThread;                    /* Thread handling received data flow */
-    sem_t     dataForClients;                   /* Semaphore counting data for clients */
 
-    /* Ring buffer for samples ... this 'pads' the rate data arrive and how fast they can be processed */
-    int wp;                                     /* Read and write pointers into transfer buffers */
-    int rp;
-    struct dataBlock rawBlock[NUM_RAW_BLOCKS];  /* Transfer buffers from the receiver */
+    /* Queue of samples ... this 'pads' the rate data arrive and how fast they can be processed */
+    struct blockqueueHandle *ingest;            /* Transfer buffers from the receiver */
+
+    struct ext_ff_trace *trace;                 /* Trace-event stream of calls, if one is being written */
+    struct cct cct;                             /* Calling context tree of a serial decode */
+
+    /* Rolling snapshots */
+    struct snapshot snap;                       /* Counters being written, or spare ones waiting for the next swap */
+    struct counters total;                      /* Everything seen so far, when snapshots aren't deltas */
+    uint32_t snapshotsAsked;                    /* Number of snapshots the receiver has asked for */
+    uint32_t snapshotsTaken;                    /* Number of snapshots the decoder has taken */
+    uint64_t snapshotFrom;                      /* Time the current snapshot interval started */
+    bool snapshotDue;                           /* Receiver wants the decoder to take a snapshot */
+    bool snapshotBusy;                          /* Writer has the spare counters */
+    sem_t snapshotReady;                        /* Posted when a snapshot is handed to the writer */
+    pthread_t snapshotThread;                   /* Thread writing snapshots */
 
     /* State info */
     volatile bool ending;                       /* Flag indicating app is terminating */
-    bool     sampling;                          /* Are we actively sampling at the moment */
-    uint32_t starttime;                         /* At what time did we start sampling? */
 
     /* Turn addresses into files and routines tags */
     uint32_t nameCount;
@@ -158,137 +286,432 @@ struct RunTime
 // ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
-static void _callEvent( struct RunTime *r, uint32_t retAddr, uint32_t to )
+static struct subcall *_subcallFind( struct subcall **head, struct subcallSig *sig )
 
-/* This is a call or a return, manipulate stack tracking appropriately */
+/* Find the record for this source/dest pair, creating it if it doesn't exist */
 
 {
-    struct ETMCPUState *cpu = ETMCPUState( &r->i );
     struct subcall *s;
 
-    /* ...add it to the call stack */
-    r->substack = ( struct _subcallAccount * )realloc( r->substack, ( r->substacklen + 1 ) * sizeof( struct _subcallAccount ) );
-
-    /* This is a call */
-    r->substack[r->substacklen].sig.src     = retAddr;
-    r->substack[r->substacklen].sig.dst     = to;
-    r->substack[r->substacklen].inTicks     = cpu->instCount;
-
-    /* Find a record for this source/dest pair */
-    HASH_FIND( hh, r->subhead, &r->substack[r->substacklen].sig, sizeof( struct subcallSig ), s );
+    HASH_FIND( hh, *head, sig, sizeof( struct subcallSig ), s );
 
     if ( !s )
     {
         /* This call entry doesn't exist (i.e. it's the first time this from/to pair have been seen...let's create it */
         s = ( struct subcall * )calloc( 1, sizeof( struct subcall ) );
-        memcpy( &s->sig, &r->substack[r->substacklen].sig, sizeof( struct subcallSig ) );
-        HASH_ADD( hh, r->subhead, sig, sizeof( struct subcallSig ), s );
+        memcpy( &s->sig, sig, sizeof( struct subcallSig ) );
+        HASH_ADD( hh, *head, sig, sizeof( struct subcallSig ), s );
+    }
+
+    return s;
+}
+// ====================================================================================================
+static const char *_functionName( struct RunTime *r, uint32_t addr )
+
+/* Name of the function containing addr, for output that's written as it happens */
+
+{
+    struct nameEntry n;
+    uint32_t idx = ( addr - r->inst.base ) >> 1;
+
+    if ( ( addr >= r->inst.base ) && ( idx < r->inst.slots ) && ( r->inst.flags[idx] & IF_DECODED ) )
+    {
+        return SymbolFunction( r->s, r->inst.functionindex[idx] );
+    }
+
+    return SymbolLookup( r->s, addr, &n ) ? SymbolFunction( r->s, n.functionindex ) : SymbolFunction( r->s, NO_FUNCTION );
+}
+// ====================================================================================================
+static void _callEvent( struct replay *p, uint32_t retAddr, uint32_t to, bool isException )
+
+/* This is a call or a return, manipulate stack tracking appropriately */
+
+{
+    struct ETMCPUState *cpu = ETMCPUState( &p->i );
+    struct subcallSig sig = { .src = retAddr, .dst = to };
+    struct callFrame *f = callStackTop( &p->stack );
+    uint32_t parent = f ? f->node : CCT_ROOT;
+
+    /* Add it to the call stack, along with the record so the return doesn't need to find it again */
+    f = callStackPush( &p->stack );
+    f->s       = _subcallFind( &p->c.subhead, &sig );
+    f->inTicks = cpu->instCount;
+    f->node    = p->cct ? cctCall( p->cct, parent, to ) : CCT_ROOT;
+
+    if ( p->r->trace )
+    {
+        ext_ff_traceBegin( p->r->trace, p->stack.depth, _functionName( p->r, to ), isException, cpu->instCount );
     }
 
-    r->substacklen++;
+    TRACE_LOG( TL_CALL, p->stack.depth, retAddr, to );
+}
+// ====================================================================================================
+static void _unwoundReturn( struct replay *p, uint32_t to, uint64_t tstamp )
+
+/* Record a return in a segment that belongs to a call made before the segment started */
 
-    for ( uint32_t g = 0; g < r->substacklen; g++ )
+{
+    if ( p->retCount == p->retAllocated )
     {
-        putchar( ' ' );
+        p->retAllocated = p->retAllocated ? p->retAllocated * 2 : 64;
+        p->ret = ( struct unwoundReturn * )realloc( p->ret, p->retAllocated * sizeof( struct unwoundReturn ) );
+
+        if ( !p->ret )
+        {
+            genericsExit( -1, "Failed to allocate segment returns" EOL );
+        }
     }
 
-    DBG_OUT( "INC:%3d %08x -> %08x" EOL, r->substacklen, retAddr, to );
+    p->ret[p->retCount].to       = to;
+    p->ret[p->retCount++].tstamp = tstamp;
 }
 // ====================================================================================================
-static void _returnEvent( struct RunTime *r, uint32_t to )
+static void _returnEvent( struct replay *p, uint32_t to, uint64_t tstamp )
 
 /* This is a return, manipulate stack tracking appropriately */
 
 {
-    struct ETMCPUState *cpu = ETMCPUState( &r->i );
-    struct subcall *s;
-    uint32_t orig = r->substacklen;
+    struct callFrame *f;
 
     /* Cover the startup case that we happen to hit a return before a call */
-    if ( !r->substack )
+    if ( !p->stack.depth )
     {
+        /* ...but in a segment the call might just have been in an earlier one */
+        if ( p->isSegment )
+        {
+            _unwoundReturn( p, to, tstamp );
+        }
+
         return;
     }
 
-    /* Check we've got a valid stack entry to match to */
+    /* Unwind until we find the frame this returns to */
     do
     {
-        if ( !r->substacklen )
+        if ( !( f = callStackPop( &p->stack ) ) )
         {
-            DBG_OUT( "OUT OUT OF STACK ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^" EOL );
+            if ( p->isSegment )
+            {
+                /* Carry on unwinding the stack of earlier segments when they're merged */
+                _unwoundReturn( p, to, tstamp );
+                break;
+            }
+
+            /* It wasn't there, so we've lost track (probably because trace went missing) */
+            TRACE_LOG( TL_STACK_EMPTY, to, 0, 0 );
+            callStackResync( &p->stack );
             break;
         }
 
-        /* The -1th entry was the last written, so see if that is back far enough */
-        r->substacklen--;
+        TRACE_LOG( TL_RETURN, p->stack.depth + 1, f->s->sig.src, 0 );
 
-        for ( uint32_t g = 0; g < r->substacklen + 1; g++ )
+        f->s->myCost += tstamp - f->inTicks;
+        f->s->count++;
+
+        if ( p->cct )
         {
-            putchar( ' ' );
+            cctReturn( p->cct, f->node, p->stack.depth ? callStackTop( &p->stack )->node : CCT_ROOT, tstamp - f->inTicks );
         }
+    }
+    while ( to != f->s->sig.src );
 
-        DBG_OUT( " DEC:%3d %08x " EOL, r->substacklen + 1, r->substack[r->substacklen].sig.src );
-        HASH_FIND( hh, r->subhead, &r->substack[r->substacklen].sig, sizeof( struct subcallSig ), s );
-        assert( s );
-
-        /* We don't bother deallocating memory here cos it'll be done the next time we make a call */
-        s->myCost += cpu->instCount - r->substack[r->substacklen].inTicks;
-        s->count++;
+    if ( p->r->trace )
+    {
+        ext_ff_traceEnd( p->r->trace, p->stack.depth, tstamp );
     }
-    while ( to != r->substack[r->substacklen].sig.src );
+}
+// ====================================================================================================
+static void _instTableCreate( struct RunTime *r )
 
-    /* Check function we popped back to matches where we think we should be */
-    if ( to != r->substack[r->substacklen].sig.src )
+/* Size and allocate the instruction table to cover all of the code in the symbol set */
+
+{
+    uint32_t lowAddr = UINT32_MAX;
+    uint32_t highAddr = 0;
+
+    for ( uint32_t i = 0; i < r->s->sourceCount; i++ )
     {
-        for ( uint32_t ty = 0; ty < orig; ty++ )
+        if ( r->s->sources[i].assyLines )
         {
-            DBG_OUT( "%d:%08X ", ty, r->substack[ty].sig.src );
+            lowAddr = ( r->s->sources[i].startAddr < lowAddr ) ? r->s->sources[i].startAddr : lowAddr;
+            highAddr = ( r->s->sources[i].endAddr > highAddr ) ? r->s->sources[i].endAddr : highAddr;
         }
+    }
 
-        DBG_OUT( "(wanted %08x, got %08x)" EOL, to, r->substack[r->substacklen].sig.src );
+    if ( lowAddr > highAddr )
+    {
+        /* Nothing to cover, any instruction that turns up will be reported as having no symbol */
+        genericsReport( V_WARN, "No code found in elf file" EOL );
+        lowAddr = highAddr = 0;
+    }
+
+    /* The last address is the start of the last instruction, which could be 4 bytes long */
+    r->inst.base  = lowAddr & ~1;
+    r->inst.slots = ( ( highAddr - r->inst.base ) >> 1 ) + 2;
+
+    free( r->inst.flags );
+    free( r->inst.jumpdest );
+    free( r->inst.line );
+    free( r->inst.functionindex );
+
+    r->inst.flags         = ( uint8_t * )calloc( r->inst.slots, sizeof( uint8_t ) );
+    r->inst.jumpdest      = ( uint32_t * )calloc( r->inst.slots, sizeof( uint32_t ) );
+    r->inst.line          = ( uint32_t * )calloc( r->inst.slots, sizeof( uint32_t ) );
+    r->inst.functionindex = ( uint32_t * )calloc( r->inst.slots, sizeof( uint32_t ) );
+
+    if ( ( !r->inst.flags ) || ( !r->inst.jumpdest ) || ( !r->inst.line ) || ( !r->inst.functionindex ) )
+    {
+        genericsExit( -1, "Failed to allocate instruction table for %d instructions" EOL, r->inst.slots );
     }
+
+    genericsReport( V_DEBUG, "Instruction table covers %08x-%08x" EOL, r->inst.base, r->inst.base + ( r->inst.slots << 1 ) );
 }
 // ====================================================================================================
-static void _hashFindOrCreate( struct RunTime *r, uint32_t addr, struct execEntryHash **h )
+static bool _instDecode( struct RunTime *r, uint32_t idx, uint32_t addr )
+
+/* Fill in the attributes of the instruction at addr from the symbols, if they can be found */
+
 {
     struct nameEntry n;
 
-    HASH_FIND_INT( r->insthead, &addr, *h );
+    if ( ( !SymbolLookup( r->s, addr, &n ) ) || ( n.assyLine == ASSY_NOT_FOUND ) )
+    {
+        return false;
+    }
+
+    r->inst.flags[idx] = IF_DECODED |
+                         ( n.assy[n.assyLine].isJump    ? IF_JUMP    : 0 ) |
+                         ( n.assy[n.assyLine].isSubCall ? IF_SUBCALL : 0 ) |
+                         ( n.assy[n.assyLine].isReturn  ? IF_RETURN  : 0 ) |
+                         ( n.assy[n.assyLine].is4Byte   ? IF_4BYTE   : 0 );
+    r->inst.jumpdest[idx]      = n.assy[n.assyLine].jumpdest;
+    r->inst.line[idx]          = n.line;
+    r->inst.functionindex[idx] = n.functionindex;
+    return true;
+}
+// ====================================================================================================
+static void _instTableDecodeAll( struct RunTime *r )
+
+/* Decode every instruction in the symbols up front, so the table is only read from then on */
+
+{
+    uint32_t addr;
 
-    if ( !( *h ) )
+    for ( uint32_t i = 0; i < r->s->sourceCount; i++ )
     {
-        /* We don't have this address captured yet, do it now */
-        if ( SymbolLookup( r->s, r->op.workingAddr, &n ) )
+        for ( uint32_t j = 0; j < r->s->sources[i].assyLines; j++ )
         {
-            if ( n.assyLine == ASSY_NOT_FOUND )
+            addr = r->s->sources[i].assy[j].addr;
+
+            if ( ( addr >= r->inst.base ) && ( ( ( addr - r->inst.base ) >> 1 ) < r->inst.slots ) )
             {
-                genericsExit( -1, "No assembly for function at address %08x, %s" EOL, r->op.workingAddr, SymbolFunction( r->s, n.functionindex ) );
+                _instDecode( r, ( addr - r->inst.base ) >> 1, addr );
             }
+        }
+    }
+}
+// ====================================================================================================
+static uint32_t _instFind( struct replay *p, uint32_t addr )
 
-            *h = calloc( 1, sizeof( struct execEntryHash ) );
+/* Return the instruction table index for addr, decoding its attributes if it's not been seen before */
 
-            ( *h )->addr          = r->op.workingAddr;
-            ( *h )->fileindex     = n.fileindex;
-            ( *h )->line          = n.line;
-            ( *h )->functionindex = n.functionindex;
-            ( *h )->isJump        = n.assy[n.assyLine].isJump;
-            ( *h )->isSubCall     = n.assy[n.assyLine].isSubCall;
-            ( *h )->isReturn      = n.assy[n.assyLine].isReturn;
-            ( *h )->jumpdest      = n.assy[n.assyLine].jumpdest;
-            ( *h )->is4Byte       = n.assy[n.assyLine].is4Byte;
-            ( *h )->codes         = n.assy[n.assyLine].codes;
-            ( *h )->assyText      = n.assy[n.assyLine].lineText;
+{
+    struct RunTime *r = p->r;
+    struct nameEntry n;
+    uint32_t idx = ( addr - r->inst.base ) >> 1;
+
+    if ( ( addr < r->inst.base ) || ( idx >= r->inst.slots ) )
+    {
+        genericsExit( -1, "No symbol for address %08x" EOL, addr );
+    }
+
+    /* Segments don't decode, anything that could be was decoded before they started */
+    if ( ( !( r->inst.flags[idx] & IF_DECODED ) ) && ( ( p->isSegment ) || ( !_instDecode( r, idx, addr ) ) ) )
+    {
+        if ( !SymbolLookup( r->s, addr, &n ) )
+        {
+            genericsExit( -1, "No symbol for address %08x" EOL, addr );
         }
-        else
+
+        genericsExit( -1, "No assembly for function at address %08x, %s" EOL, addr, SymbolFunction( r->s, n.functionindex ) );
+    }
+
+    return idx;
+}
+// ====================================================================================================
+static struct execEntryHash *_instEntry( struct RunTime *r, struct execEntryHash **insthead, uint32_t addr )
+
+/* Find or create the exec entry for addr in an output table */
+
+{
+    struct execEntryHash *h;
+    struct nameEntry n;
+
+    HASH_FIND_INT( *insthead, &addr, h );
+
+    if ( !h )
+    {
+        h = ( struct execEntryHash * )calloc( 1, sizeof( struct execEntryHash ) );
+        h->addr = addr;
+        h->fileindex = h->functionindex = h->line = NO_LINE;
+
+        if ( ( SymbolLookup( r->s, addr, &n ) ) && ( n.assyLine != ASSY_NOT_FOUND ) )
+        {
+            h->fileindex     = n.fileindex;
+            h->line          = n.line;
+            h->functionindex = n.functionindex;
+            h->isJump        = n.assy[n.assyLine].isJump;
+            h->isSubCall     = n.assy[n.assyLine].isSubCall;
+            h->isReturn      = n.assy[n.assyLine].isReturn;
+            h->jumpdest      = n.assy[n.assyLine].jumpdest;
+            h->is4Byte       = n.assy[n.assyLine].is4Byte;
+            h->codes         = n.assy[n.assyLine].codes;
+            h->assyText      = n.assy[n.assyLine].lineText;
+        }
+
+        HASH_ADD_INT( *insthead, addr, h );
+    }
+
+    return h;
+}
+// ====================================================================================================
+static void _countersClear( struct counters *c, uint32_t slots )
+
+/* Empty a set of counters of slots entries (just the calls if slots is zero) */
+
+{
+    struct subcall *s;
+    struct subcall *t;
+
+    HASH_ITER( hh, c->subhead, s, t )
+    {
+        HASH_DEL( c->subhead, s );
+        free( s );
+    }
+
+    if ( slots )
+    {
+        memset( c->count, 0, slots * sizeof( uint64_t ) );
+        memset( c->scount, 0, slots * sizeof( uint64_t ) );
+    }
+}
+// ====================================================================================================
+static void _instTableToHash( struct RunTime *r, struct execEntryHash **insthead, struct counters *c, bool withInterrupt )
+
+/* Convert the executed part of a set of counters into exec entries for the output writers, */
+/* and link the calls to the entries at either end of them.                                 */
+
+{
+    struct execEntryHash *h;
+    struct subcall *s;
+
+    /* Create false entry for an interrupt source */
+    if ( withInterrupt )
+    {
+        h = calloc( 1, sizeof( struct execEntryHash ) );
+        h->addr          = INTERRUPT;
+        h->fileindex     = INTERRUPT;
+        h->line          = NO_LINE;
+        h->count         = NO_LINE;
+        h->functionindex = INTERRUPT;
+        HASH_ADD_INT( *insthead, addr, h );
+    }
+
+    for ( uint32_t idx = 0; idx < r->inst.slots; idx++ )
+    {
+        if ( c->count[idx] )
         {
-            genericsExit( -1, "No symbol for address %08x" EOL, r->op.workingAddr );
+            h = _instEntry( r, insthead, r->inst.base + ( idx << 1 ) );
+            h->count  = c->count[idx];
+            h->scount = c->scount[idx];
         }
+    }
+
+    for ( s = c->subhead; s; s = s->hh.next )
+    {
+        s->srch = _instEntry( r, insthead, s->sig.src );
+        s->dsth = _instEntry( r, insthead, s->sig.dst );
+    }
+}
+// ====================================================================================================
+static bool _countersSize( struct counters *c, uint32_t slots )
+
+/* (Re)allocate a set of counters to match an instruction table of slots entries, leaving them empty */
+
+{
+    _countersClear( c, 0 );
+    free( c->count );
+    free( c->scount );
+
+    c->count  = ( uint64_t * )calloc( slots, sizeof( uint64_t ) );
+    c->scount = ( uint64_t * )calloc( slots, sizeof( uint64_t ) );
+
+    return ( c->count ) && ( c->scount );
+}
+// ====================================================================================================
+static void _countersAdd( struct counters *to, struct counters *from, uint32_t slots )
+
+/* Add one set of counters into another */
 
-        HASH_ADD_INT( r->insthead, addr, ( *h ) );
+{
+    struct subcall *s;
+    struct subcall *ts;
+
+    for ( uint32_t idx = 0; idx < slots; idx++ )
+    {
+        to->count[idx]  += from->count[idx];
+        to->scount[idx] += from->scount[idx];
     }
+
+    for ( s = from->subhead; s; s = s->hh.next )
+    {
+        ts = _subcallFind( &to->subhead, &s->sig );
+        ts->myCost += s->myCost;
+        ts->count  += s->count;
+    }
+}
+// ====================================================================================================
+static void _countersDelete( struct counters *c )
+
+{
+    _countersClear( c, 0 );
+    free( c->count );
+    free( c->scount );
+    c->count = c->scount = NULL;
+}
+// ====================================================================================================
+static bool _replayInit( struct RunTime *r, struct replay *p )
+
+/* Set up a replay with an empty call stack and a fresh decoder */
+
+{
+    memset( p, 0, sizeof( struct replay ) );
+    p->r = r;
+    p->op.h = p->op.oldh = p->firsth = NO_INST;
+    ETMDecoderInit( &p->i, !r->options->noaltAddr );
+    return callStackInit( &p->stack, r->options->maxStack );
 }
 // ====================================================================================================
-static void _handleInstruction( struct RunTime *r, bool actioned )
+static bool _replaySizeCounts( struct replay *p )
+
+/* (Re)allocate the counters of a replay to match the instruction table */
+
+{
+    p->op.h = p->op.oldh = NO_INST;
+    return _countersSize( &p->c, p->r->inst.slots );
+}
+// ====================================================================================================
+static void _replayDelete( struct replay *p )
+
+/* Release everything a replay holds */
+
+{
+    callStackDelete( &p->stack );
+    _countersDelete( &p->c );
+    free( p->ret );
+}
+// ====================================================================================================
+static void _handleInstruction( struct replay *p, bool actioned )
 
 {
     /* ------------------------------------------------------------------------------------*/
@@ -296,50 +719,57 @@ static void _handleInstruction( struct RunTime *r, bool actioned )
     /* Let's find the local hash record for this address, or create it if it doesn't exist */
     /* ------------------------------------------------------------------------------------*/
 
-    r->op.oldh = r->op.h;
-    _hashFindOrCreate( r, r->op.workingAddr, &r->op.h );
+    struct instTable *inst = &p->r->inst;
+    uint32_t h;
 
-    //    if ( r->op.oldh ) DBG_OUT( "%4d,%4d %4d %s%s%c %s", r->op.h->functionindex, ( r->op.h ? r->op.oldh->functionindex : 0 ),  r->op.h->fileindex,
-    //                               ( r->op.h->isJump ) ? "J" : " ", ( r->op.h->isSubCall ) ? "S" : r->op.h->isReturn ? "R" : " ", ( actioned ) ? ( r->op.h->is4Byte ? 'X' : 'x' ) : '-',
-    //                               r->op.h->assyText );
+    p->op.oldh = p->op.h;
+    p->op.h = h = _instFind( p, p->op.workingAddr );
+
+    if ( p->firsth == NO_INST )
+    {
+        p->firsth = h;
+    }
 
     /* OK, by hook or by crook we've got an address entry now, so increment the number of executions */
-    r->op.h->count++;
+    p->c.count[h]++;
 
     /* If source postion changed then update source code line visitation counts too */
-    if ( ( r->op.oldh ) && ( ( r->op.h->line != r->op.oldh->line ) || ( r->op.h->functionindex != r->op.oldh->functionindex ) ) )
+    if ( ( p->op.oldh != NO_INST ) && ( ( inst->line[h] != inst->line[p->op.oldh] ) || ( inst->functionindex[h] != inst->functionindex[p->op.oldh] ) ) )
     {
-        r->op.h->scount++;
+        p->c.scount[h]++;
     }
 
     /* If this is a computable destination then action it */
-    if ( ( actioned ) && ( ( r->op.h->isJump ) || ( r->op.h->isSubCall ) ) )
+    if ( ( actioned ) && ( inst->flags[h] & ( IF_JUMP | IF_SUBCALL ) ) )
     {
         /* Take this call ... note that the jumpdest may not be known at this point */
-        r->op.workingAddr = r->op.h->jumpdest;
+        p->op.workingAddr = inst->jumpdest[h];
     }
     else
     {
         /* If it wasn't a jump or subroutine then increment the address */
-        r->op.workingAddr += ( r->op.h->is4Byte ) ? 4 : 2;
+        p->op.workingAddr += ( inst->flags[h] & IF_4BYTE ) ? 4 : 2;
     }
 }
 
 // ====================================================================================================
-static void _checkJumps( struct RunTime *r )
+static void _checkJumps( struct replay *p )
 
 {
-    if ( r->op.h )
+    struct instTable *inst = &p->r->inst;
+    uint32_t h = p->op.h;
+
+    if ( h != NO_INST )
     {
 
-        if ( ( ETMStateChanged( &r->i, EV_CH_EX_EXIT ) ) || ( r->op.h->isReturn ) )
+        if ( ( ETMStateChanged( &p->i, EV_CH_EX_EXIT ) ) || ( inst->flags[h] & IF_RETURN ) )
         {
-            _returnEvent( r, r->op.workingAddr );
+            _returnEvent( p, p->op.workingAddr, ETMCPUState( &p->i )->instCount );
         }
 
-        if ( r->op.h->isSubCall )
+        if ( inst->flags[h] & IF_SUBCALL )
         {
-            _callEvent( r, r->op.h->addr + ( ( r->op.h->is4Byte ) ? 4 : 2 ), r->op.workingAddr );
+            _callEvent( p, inst->base + ( h << 1 ) + ( ( inst->flags[h] & IF_4BYTE ) ? 4 : 2 ), p->op.workingAddr, false );
         }
     }
 }
@@ -349,146 +779,391 @@ static void _etmCB( void *d )
 /* Callback function for when valid ETM decode is detected */
 
 {
-    struct RunTime *r       = ( struct RunTime * )d;
-    struct ETMCPUState *cpu = ETMCPUState( &r->i );
-    static uint32_t incAddr        = 0;
-    static uint32_t disposition    = 0;
+    struct replay *p        = ( struct replay * )d;
+    struct ETMCPUState *cpu = ETMCPUState( &p->i );
 
     /* This routine gets called when valid data are available */
     /* if these are the first data, then reset counters etc.  */
-    if ( !r->sampling )
+    if ( !p->sampling )
     {
-        r->op.firsttstamp = cpu->instCount;
-        genericsReport( V_INFO, "Sampling" EOL );
-        /* Fill in a time to start from */
-        r->starttime = genericsTimestampmS();
+        p->op.firsttstamp = cpu->instCount;
 
-        if ( ETMStateChanged( &r->i, EV_CH_ADDRESS ) )
+        if ( !p->isSegment )
         {
-            r->op.workingAddr = cpu->addr;
-            printf( "Got initial address %08x" EOL, r->op.workingAddr );
-            r->sampling  = true;
+            genericsReport( V_INFO, "Sampling" EOL );
         }
 
-        /* Create false entry for an interrupt source */
-        r->op.inth = calloc( 1, sizeof( struct execEntryHash ) );
-        r->op.inth->addr          = INTERRUPT;
-        r->op.inth->fileindex     = INTERRUPT;
-        r->op.inth->line          = NO_LINE;
-        r->op.inth->count         = NO_LINE;
-        r->op.inth->functionindex = INTERRUPT;
-        HASH_ADD_INT( r->insthead, addr, r->op.inth );
+        /* Fill in a time to start from */
+        p->starttime = genericsTimestampmS();
+
+        if ( ETMStateChanged( &p->i, EV_CH_ADDRESS ) )
+        {
+            p->op.workingAddr = cpu->addr;
+            TRACE_LOG( TL_INITIAL_ADDR, p->op.workingAddr, 0, 0 );
+            p->sampling  = true;
+        }
     }
 
-    r->op.lasttstamp = cpu->instCount;
+    p->op.lasttstamp = cpu->instCount;
 
     /* Pull changes introduced by this event ============================== */
 
-    if ( ETMStateChanged( &r->i, EV_CH_ENATOMS ) )
+    if ( ETMStateChanged( &p->i, EV_CH_ENATOMS ) )
     {
         /* We are going to execute some instructions. Check if the last of the old batch of    */
         /* instructions was cancelled and, if it wasn't and it's still outstanding, action it. */
-        if ( ETMStateChanged( &r->i, EV_CH_CANCELLED ) )
+        if ( ETMStateChanged( &p->i, EV_CH_CANCELLED ) )
         {
-            printf( "CANCELLED" EOL );
+            TRACE_LOG( TL_CANCELLED, 0, 0, 0 );
         }
         else
         {
-            if ( incAddr )
+            if ( p->incAddr )
             {
-                printf( "***" EOL );
-                _handleInstruction( r, disposition & 1 );
+                TRACE_LOG( TL_PENDING_INST, 0, 0, 0 );
+                _handleInstruction( p, p->disposition & 1 );
 
-                if ( ( r->op.h->isJump ) || ( r->op.h->isSubCall ) || ( r->op.h->isReturn ) )
+                if ( p->r->inst.flags[p->op.h] & ( IF_JUMP | IF_SUBCALL | IF_RETURN ) )
                 {
-                    if ( ETMStateChanged( &r->i, EV_CH_ADDRESS ) )
+                    if ( ETMStateChanged( &p->i, EV_CH_ADDRESS ) )
                     {
-                        printf( "New addr %08x" EOL, cpu->addr );
-                        r->op.workingAddr = cpu->addr;
+                        TRACE_LOG( TL_NEW_ADDR, cpu->addr, 0, 0 );
+                        p->op.workingAddr = cpu->addr;
                     }
 
-                    _checkJumps( r );
+                    _checkJumps( p );
                 }
             }
         }
 
-        if ( ETMStateChanged( &r->i, EV_CH_ADDRESS ) )
+        if ( p->flushing )
+        {
+            /* The last instruction of the segment is done, everything else belongs to the next one */
+            p->flushed = true;
+            return;
+        }
+
+        if ( ETMStateChanged( &p->i, EV_CH_ADDRESS ) )
         {
-            if ( ETMStateChanged( &r->i, EV_CH_EX_ENTRY ) )
+            if ( ETMStateChanged( &p->i, EV_CH_EX_ENTRY ) )
             {
-                printf( "INTERRUPT!!" EOL );
-                _callEvent( r, r->op.workingAddr, cpu->addr );
+                TRACE_LOG( TL_INTERRUPT, p->op.workingAddr, cpu->addr, 0 );
+                _callEvent( p, p->op.workingAddr, cpu->addr, true );
             }
 
-            r->op.workingAddr = cpu->addr;
-            printf( "A:%08x" EOL, cpu->addr );
+            p->op.workingAddr = cpu->addr;
+            TRACE_LOG( TL_ADDR, cpu->addr, 0, 0 );
         }
 
         /* ================================================ */
         /* OK, now collect the next iterations worth of fun */
         /* ================================================ */
-        incAddr     = cpu->eatoms + cpu->natoms;
-        disposition = cpu->disposition;
-        printf( "E:%d N:%d" EOL, cpu->eatoms, cpu->natoms );
+        p->incAddr     = cpu->eatoms + cpu->natoms;
+        p->disposition = cpu->disposition;
+        TRACE_LOG( TL_ATOMS, cpu->eatoms, cpu->natoms, 0 );
 
         /* Action those changes, except the last one */
-        while ( incAddr > 1 )
+        while ( p->incAddr > 1 )
         {
-            incAddr--;
-            _handleInstruction( r, disposition & 1 );
-            _checkJumps( r );
-            disposition >>= 1;
+            p->incAddr--;
+            _handleInstruction( p, p->disposition & 1 );
+            _checkJumps( p );
+            p->disposition >>= 1;
         }
     }
 }
-
 // ====================================================================================================
-static void _intHandler( int sig )
+static size_t _findSegmentStart( const uint8_t *b, size_t len, size_t from )
+
+/* Return the offset of the first A-sync followed by an I-sync at or after from, or len if there is none */
 
-/* Catch CTRL-C so things can be cleaned up properly via atexit functions */
 {
-    /* CTRL-C exit is not an error... */
-    exit( 0 );
+    uint32_t zeros = 0;
+
+    for ( size_t i = from; i + 1 < len; i++ )
+    {
+        if ( !b[i] )
+        {
+            zeros++;
+            continue;
+        }
+
+        if ( ( zeros >= ASYNC_ZEROS ) && ( b[i] == ASYNC_END ) && ( ( b[i + 1] == ISYNC_HDR ) || ( b[i + 1] == ISYNC_CC_HDR ) ) )
+        {
+            return i - ASYNC_ZEROS;
+        }
+
+        zeros = 0;
+    }
+
+    return len;
 }
 // ====================================================================================================
-static void _printHelp( struct RunTime *r )
+static void *_replaySegment( void *params )
+
+/* Decode one segment of a parallel replay. This runs in its own thread and only writes to its own replay. */
 
 {
-    genericsPrintf( "Usage: %s [options]" EOL, r->progName );
-    genericsPrintf( "       -a: Switch off alternate address decoding (on by default)" EOL );
-    genericsPrintf( "       -D: Switch off C++ symbol demangling" EOL );
-    genericsPrintf( "       -d: <String> Material to delete off front of filenames" EOL );
-    genericsPrintf( "       -E: When reading from file, terminate at end of file rather than waiting for further input" EOL );
-    genericsPrintf( "       -e: <ElfFile> to use for symbols" EOL );
-    genericsPrintf( "       -f <filename>: Take input from specified file" EOL );
-    genericsPrintf( "       -h: This help" EOL );
-    genericsPrintf( "       -I <Interval>: Time to sample (in mS)" EOL );
-    genericsPrintf( "       -s: <Server>:<Port> to use" EOL );
-    //genericsPrintf( "       -t <channel>: Use TPIU to strip TPIU on specfied channel (defaults to 2)" EOL );
-    genericsPrintf( "       -T: truncate -d material off all references (i.e. make output relative)" EOL );
-    genericsPrintf( "       -v: <level> Verbose mode 0(errors)..3(debug)" EOL );
-    genericsPrintf( "       -y: <Filename> dotty filename for structured callgraph output" EOL );
-    genericsPrintf( "       -z: <Filename> profile filename for kcachegrind output" EOL );
-    genericsPrintf( EOL "(Will connect one port higher than that set in -s when TPIU is not used)" EOL );
+    struct replay *p = ( struct replay * )params;
+    const uint8_t *c = p->start;
+    size_t remaining = p->len;
+    size_t chunk;
+    uint64_t lasttstamp;
+
+    while ( remaining )
+    {
+        chunk = ( remaining > REPLAY_CHUNK ) ? REPLAY_CHUNK : remaining;
+        ETMDecoderPump( &p->i, ( uint8_t * )c, chunk, _etmCB, NULL, p );
+        c += chunk;
+        remaining -= chunk;
+    }
+
+    /* The last instruction is only actioned by the next batch of atoms, which are in the next segment. */
+    /* The time those take is accounted to the next segment too.                                        */
+    p->flushing = true;
+    remaining = p->overrun;
+    lasttstamp = p->op.lasttstamp;
+
+    while ( ( remaining-- ) && ( !p->flushed ) )
+    {
+        ETMDecoderPump( &p->i, ( uint8_t * )c++, 1, _etmCB, NULL, p );
+    }
+
+    p->op.lasttstamp = lasttstamp;
+
+    return NULL;
 }
 // ====================================================================================================
-static bool _processOptions( int argc, char *argv[], struct RunTime *r )
+static void _replayMerge( struct replay *m, struct replay *p, uint64_t offset )
+
+/* Merge a segment into the replay of everything before it. Times in the segment are made */
+/* absolute by adding offset, the time at which it started.                               */
 
 {
-    int c;
+    struct callFrame *f;
+    struct callFrame *nf;
+    struct instTable *inst = &m->r->inst;
 
-    while ( ( c = getopt ( argc, argv, "aDd:Ee:f:hI:s:Tv:y:z:" ) ) != -1 )
+    /* Instruction counts and completed calls just add up... */
+    _countersAdd( &m->c, &p->c, inst->slots );
 
-        switch ( c )
-        {
-            // ------------------------------------
-            case 'a':
-                r->options->noaltAddr = true;
-                break;
+    /* ...apart from the first instruction of the segment, which couldn't see the one before it */
+    if ( ( m->op.h != NO_INST ) && ( p->firsth != NO_INST ) &&
+            ( ( inst->line[p->firsth] != inst->line[m->op.h] ) || ( inst->functionindex[p->firsth] != inst->functionindex[m->op.h] ) ) )
+    {
+        m->c.scount[p->firsth]++;
+    }
 
-            // ------------------------------------
-            case 'd':
-                r->options->deleteMaterial = optarg;
+    if ( p->op.h != NO_INST )
+    {
+        m->op.h = p->op.h;
+    }
+
+    /* Returns which ran off the start of the segment unwind the calls still open from earlier ones... */
+    for ( uint32_t i = 0; i < p->retCount; i++ )
+    {
+        _returnEvent( m, p->ret[i].to, offset + p->ret[i].tstamp - p->op.firsttstamp );
+    }
+
+    /* ...and the calls still open at the end of the segment are carried on to later ones */
+    for ( uint32_t i = 0; i < p->stack.depth; i++ )
+    {
+        f = &p->stack.frame[i];
+        nf = callStackPush( &m->stack );
+        nf->s = _subcallFind( &m->c.subhead, &f->s->sig );
+        nf->inTicks = offset + f->inTicks - p->op.firsttstamp;
+        nf->node    = CCT_ROOT;
+    }
+
+    m->stack.resyncs += p->stack.resyncs;
+    m->stack.highWater = ( p->stack.highWater > m->stack.highWater ) ? p->stack.highWater : m->stack.highWater;
+}
+// ====================================================================================================
+static void _snapshotWrite( struct RunTime *r, struct counters *c, uint64_t timelen, uint32_t seq )
+
+/* Write one set of counters out to the numbered snapshot files */
+
+{
+    char fn[SNAPSHOT_NAME_LEN];
+    struct execEntryHash *insthead = NULL;
+    struct execEntryHash *h;
+    struct execEntryHash *t;
+
+    _instTableToHash( r, &insthead, c, true );
+
+    if ( r->options->dotfile )
+    {
+        snprintf( fn, SNAPSHOT_NAME_LEN, "%s.%06u", r->options->dotfile, seq );
+
+        if ( !ext_ff_outputDot( fn, c->subhead, r->s ) )
+        {
+            genericsReport( V_WARN, "Failed to write %s" EOL, fn );
+        }
+    }
+
+    if ( r->options->profile )
+    {
+        snprintf( fn, SNAPSHOT_NAME_LEN, "%s.%06u", r->options->profile, seq );
+
+        if ( !ext_ff_outputProfile( fn, r->options->elffile,
+                                    r->options->truncateDeleteMaterial ? r->options->deleteMaterial : NULL,
+                                    true, timelen, insthead, c->subhead, r->s ) )
+        {
+            genericsReport( V_WARN, "Failed to write %s" EOL, fn );
+        }
+    }
+
+    if ( r->options->pproffile )
+    {
+        snprintf( fn, SNAPSHOT_NAME_LEN, "%s.%06u", r->options->pproffile, seq );
+
+        if ( !ext_ff_outputPprof( fn, r->options->elffile,
+                                  r->options->truncateDeleteMaterial ? r->options->deleteMaterial : NULL,
+                                  timelen, insthead, c->subhead, NULL, r->s ) )
+        {
+            genericsReport( V_WARN, "Failed to write %s" EOL, fn );
+        }
+    }
+
+    HASH_ITER( hh, insthead, h, t )
+    {
+        HASH_DEL( insthead, h );
+        free( h );
+    }
+}
+// ====================================================================================================
+static void *_snapshotWriter( void *params )
+
+/* Write out each snapshot the decoder hands over, then empty its counters ready for the next swap */
+
+{
+    struct RunTime *r = ( struct RunTime * )params;
+    uint32_t startTime;
+
+    while ( true )
+    {
+        while ( ( sem_wait( &r->snapshotReady ) < 0 ) && ( errno == EINTR ) );
+
+        startTime = genericsTimestampmS();
+
+        if ( r->options->snapshotDelta )
+        {
+            _snapshotWrite( r, &r->snap.c, r->snap.timelen, r->snap.seq );
+        }
+        else
+        {
+            _countersAdd( &r->total, &r->snap.c, r->inst.slots );
+            _snapshotWrite( r, &r->total, r->snap.timelen, r->snap.seq );
+        }
+
+        _countersClear( &r->snap.c, r->inst.slots );
+        genericsReport( V_INFO, "Snapshot %d written in %d mS" EOL, r->snap.seq, genericsTimestampmS() - startTime );
+
+        __atomic_store_n( &r->snapshotBusy, false, __ATOMIC_RELEASE );
+    }
+
+    return NULL;
+}
+// ====================================================================================================
+static bool _snapshotTake( struct RunTime *r )
+
+/* Swap the live replay onto the spare counters and hand the ones it was using to the writer. Must */
+/* only be called by whichever thread is decoding. Returns false if the writer is still busy.      */
+
+{
+    struct replay *p = &r->replay;
+    struct counters t;
+
+    if ( __atomic_load_n( &r->snapshotBusy, __ATOMIC_ACQUIRE ) )
+    {
+        return false;
+    }
+
+    t = p->c;
+    p->c = r->snap.c;
+    r->snap.c = t;
+
+    /* Calls in progress need records in the new counters to return to */
+    for ( uint32_t i = 0; i < p->stack.depth; i++ )
+    {
+        p->stack.frame[i].s = _subcallFind( &p->c.subhead, &p->stack.frame[i].s->sig );
+    }
+
+    if ( !r->snapshotsTaken )
+    {
+        r->snapshotFrom = p->op.firsttstamp;
+    }
+
+    r->snap.timelen = p->op.lasttstamp - ( r->options->snapshotDelta ? r->snapshotFrom : p->op.firsttstamp );
+    r->snap.seq = r->snapshotsTaken++;
+    r->snapshotFrom = p->op.lasttstamp;
+
+    __atomic_store_n( &r->snapshotDue, false, __ATOMIC_RELEASE );
+    __atomic_store_n( &r->snapshotBusy, true, __ATOMIC_RELEASE );
+    sem_post( &r->snapshotReady );
+    return true;
+}
+// ====================================================================================================
+static void _intHandler( int sig )
+
+/* Catch CTRL-C so things can be cleaned up properly via atexit functions */
+{
+    /* CTRL-C exit is not an error... */
+    exit( 0 );
+}
+// ====================================================================================================
+static void _printHelp( struct RunTime *r )
+
+{
+    genericsPrintf( "Usage: %s [options]" EOL, r->progName );
+    genericsPrintf( "       -a: Switch off alternate address decoding (on by default)" EOL );
+    genericsPrintf( "       -C: <Filename> Chrome/Perfetto trace-event filename for call and exception slices" EOL );
+    genericsPrintf( "       -D: Switch off C++ symbol demangling" EOL );
+    genericsPrintf( "       -d: <String> Material to delete off front of filenames" EOL );
+    genericsPrintf( "       -E: When reading from file, terminate at end of file rather than waiting for further input" EOL );
+    genericsPrintf( "       -e: <ElfFile> to use for symbols" EOL );
+    genericsPrintf( "       -F: <Filename> folded stacks filename for flame graph output" EOL );
+    genericsPrintf( "       -f <filename>: Take input from specified file" EOL );
+    genericsPrintf( "       -h: This help" EOL );
+    genericsPrintf( "       -I <Interval>: Time to sample (in mS)" EOL );
+    genericsPrintf( "       -j <Threads>: Replay whole of file (-f) split over this many threads (0 for one per processor)" EOL );
+    genericsPrintf( "       -M <Nodes>: Maximum number of calling contexts tracked for -F and -P (Default %d)" EOL, CCT_DEFAULT_MAX_NODES );
+    genericsPrintf( "       -P: <Filename> pprof filename for gzipped profile output" EOL );
+    genericsPrintf( "       -r <Interval>: Write a numbered snapshot of the profile every Interval mS" EOL );
+    genericsPrintf( "       -R: Snapshots only contain what changed since the previous one" EOL );
+    genericsPrintf( "       -q <Depth>: Maximum number of %d KByte blocks waiting to be decoded (Default %d)" EOL, TRANSFER_SIZE / 1024, DEFAULT_INGEST_BLOCKS );
+    genericsPrintf( "       -s: <Server>:<Port> to use" EOL );
+    genericsPrintf( "       -S <Depth>: Maximum call stack depth (Default %d)" EOL, CALLSTACK_DEFAULT_MAX_DEPTH );
+    //genericsPrintf( "       -t <channel>: Use TPIU to strip TPIU on specfied channel (defaults to 2)" EOL );
+    genericsPrintf( "       -T: truncate -d material off all references (i.e. make output relative)" EOL );
+    genericsPrintf( "       -v: <level> Verbose mode 0(errors)..3(debug)" EOL );
+    genericsPrintf( "       -y: <Filename> dotty filename for structured callgraph output" EOL );
+    genericsPrintf( "       -z: <Filename> profile filename for kcachegrind output" EOL );
+    genericsPrintf( EOL "(Will connect one port higher than that set in -s when TPIU is not used)" EOL );
+}
+// ====================================================================================================
+static bool _processOptions( int argc, char *argv[], struct RunTime *r )
+
+{
+    int c;
+
+    while ( ( c = getopt ( argc, argv, "aC:Dd:Ee:F:f:hI:j:M:P:q:r:Rs:S:Tv:y:z:" ) ) != -1 )
+
+        switch ( c )
+        {
+            // ------------------------------------
+            case 'a':
+                r->options->noaltAddr = true;
+                break;
+
+            // ------------------------------------
+            case 'C':
+                r->options->tracefile = optarg;
+                break;
+
+            // ------------------------------------
+            case 'd':
+                r->options->deleteMaterial = optarg;
                 break;
 
             // ------------------------------------
@@ -506,6 +1181,11 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
                 r->options->elffile = optarg;
                 break;
 
+            // ------------------------------------
+            case 'F':
+                r->options->foldedfile = optarg;
+                break;
+
             // ------------------------------------
             case 'f':
                 r->options->file = optarg;
@@ -521,6 +1201,42 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
                 r->options->sampleDuration = atoi( optarg );
                 break;
 
+            // ------------------------------------
+            case 'j':
+                r->options->parallel = true;
+                r->options->threads = atoi( optarg );
+                break;
+
+            // ------------------------------------
+            case 'M':
+                r->options->maxContexts = atoi( optarg );
+                break;
+
+            // ------------------------------------
+            case 'P':
+                r->options->pproffile = optarg;
+                break;
+
+            // ------------------------------------
+            case 'q':
+                r->options->ingestBlocks = atoi( optarg );
+                break;
+
+            // ------------------------------------
+            case 'r':
+                r->options->snapshotInterval = atoi( optarg );
+                break;
+
+            // ------------------------------------
+            case 'R':
+                r->options->snapshotDelta = true;
+                break;
+
+            // ------------------------------------
+            case 'S':
+                r->options->maxStack = atoi( optarg );
+                break;
+
             // ------------------------------------
             case 's':
                 r->options->server = optarg;
@@ -596,12 +1312,95 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
         genericsExit( -2, "Illegal sample duration" EOL );
     }
 
+    if ( r->options->ingestBlocks < 1 )
+    {
+        genericsExit( -2, "Illegal ingest queue depth" EOL );
+    }
+
+    if ( r->options->maxStack < 1 )
+    {
+        genericsExit( -2, "Illegal call stack depth" EOL );
+    }
+
+    if ( r->options->maxContexts < 1 )
+    {
+        genericsExit( -2, "Illegal number of calling contexts" EOL );
+    }
+
+    if ( r->options->snapshotInterval < 0 )
+    {
+        genericsExit( -2, "Illegal snapshot interval" EOL );
+    }
+
+    if ( ( r->options->foldedfile ) && ( r->options->snapshotInterval ) )
+    {
+        genericsExit( -2, "Folded stacks can't be written with snapshots" EOL );
+    }
+
+    if ( ( r->options->snapshotDelta ) && ( !r->options->snapshotInterval ) )
+    {
+        genericsExit( -2, "Delta snapshots need a snapshot interval" EOL );
+    }
+
+    if ( r->options->parallel )
+    {
+        if ( r->options->snapshotInterval )
+        {
+            genericsExit( -2, "Snapshots can't be taken during a parallel replay" EOL );
+        }
+
+        if ( r->options->tracefile )
+        {
+            genericsExit( -2, "Trace events can't be written during a parallel replay" EOL );
+        }
+
+        if ( r->options->foldedfile )
+        {
+            genericsExit( -2, "Folded stacks can't be written during a parallel replay" EOL );
+        }
+
+        if ( r->options->pproffile )
+        {
+            genericsExit( -2, "pprof profiles can't be written during a parallel replay" EOL );
+        }
+
+        if ( !r->options->file )
+        {
+            genericsExit( -2, "Parallel replay needs a file to replay" EOL );
+        }
+
+        if ( r->options->threads < 0 )
+        {
+            genericsExit( -2, "Illegal number of replay threads" EOL );
+        }
+
+        if ( !r->options->threads )
+        {
+            r->options->threads = sysconf( _SC_NPROCESSORS_ONLN );
+        }
+    }
+
     genericsReport( V_INFO, "%s V" VERSION " (Git %08X %s, Built " BUILD_DATE ")" EOL, r->progName, GIT_HASH, ( GIT_DIRTY ? "Dirty" : "Clean" ) );
     genericsReport( V_INFO, "Server          : %s:%d" EOL, r->options->server, r->options->port );
     genericsReport( V_INFO, "Delete Material : %s" EOL, r->options->deleteMaterial ? r->options->deleteMaterial : "None" );
     genericsReport( V_INFO, "Elf File        : %s (%s Names)" EOL, r->options->elffile, r->options->truncateDeleteMaterial ? "Truncate" : "Don't Truncate" );
     genericsReport( V_INFO, "DOT file        : %s" EOL, r->options->dotfile ? r->options->dotfile : "None" );
+    genericsReport( V_INFO, "pprof file      : %s" EOL, r->options->pproffile ? r->options->pproffile : "None" );
+    genericsReport( V_INFO, "Trace file      : %s" EOL, r->options->tracefile ? r->options->tracefile : "None" );
+    genericsReport( V_INFO, "Folded file     : %s" EOL, r->options->foldedfile ? r->options->foldedfile : "None" );
+    genericsReport( V_INFO, "Max Contexts    : %d" EOL, r->options->maxContexts );
     genericsReport( V_INFO, "Sample Duration : %d mS" EOL, r->options->sampleDuration );
+    genericsReport( V_INFO, "Ingest Queue    : %d blocks" EOL, r->options->ingestBlocks );
+
+    if ( r->options->parallel )
+    {
+        genericsReport( V_INFO, "Replay Threads  : %d" EOL, r->options->threads );
+    }
+
+    if ( r->options->snapshotInterval )
+    {
+        genericsReport( V_INFO, "Snapshots       : Every %d mS%s" EOL, r->options->snapshotInterval, r->options->snapshotDelta ? " (Delta)" : "" );
+    }
 
     return true;
 }
@@ -625,51 +1424,270 @@ static void *_processBlocks( void *params )
 {
     struct RunTime *r = ( struct RunTime * )params;
 
+    uint8_t *buffer;
+    size_t len;
+
     while ( true )
     {
-        sem_wait( &r->dataForClients );
+        buffer = blockqueueGetReadBlock( r->ingest, &len );
+        genericsReport( V_DEBUG, "RXED Packet of %zu bytes" EOL, len );
 
-        if ( r->rp != ( volatile int )r->wp )
+        /* Check to see if we've finished (a zero length packet */
+        if ( !len )
         {
-            genericsReport( V_DEBUG, "RXED Packet of %d bytes" EOL, r->rawBlock[r->rp].fillLevel );
-
-            /* Check to see if we've finished (a zero length packet */
-            if ( !r->rawBlock[r->rp].fillLevel )
-            {
-                break;
-            }
+            blockqueueRelease( r->ingest );
+            break;
+        }
 
 #ifdef DUMP_BLOCK
-            uint8_t *c = r->rawBlock[r->rp].buffer;
-            uint32_t y = r->rawBlock[r->rp].fillLevel;
+        uint8_t *c = buffer;
+        uint32_t y = len;
 
-            fprintf( stderr, EOL );
+        fprintf( stderr, EOL );
 
-            while ( y-- )
-            {
-                fprintf( stderr, "%02X ", *c++ );
+        while ( y-- )
+        {
+            fprintf( stderr, "%02X ", *c++ );
 
-                if ( !( y % 16 ) )
-                {
-                    fprintf( stderr, EOL );
-                }
+            if ( !( y % 16 ) )
+            {
+                fprintf( stderr, EOL );
             }
+        }
 
 #endif
-            /* Pump all of the data through the protocol handler */
-            ETMDecoderPump( &r->i, r->rawBlock[r->rp].buffer, r->rawBlock[r->rp].fillLevel, _etmCB, genericsReport, &_r );
+        /* Pump all of the data through the protocol handler */
+        ETMDecoderPump( &r->replay.i, buffer, len, _etmCB, genericsReport, &r->replay );
 
-            r->rp = ( r->rp + 1 ) % NUM_RAW_BLOCKS;
+        blockqueueRelease( r->ingest );
+
+        /* If the writer is still busy with the last snapshot this one waits until the next block */
+        if ( __atomic_load_n( &r->snapshotDue, __ATOMIC_ACQUIRE ) )
+        {
+            _snapshotTake( r );
         }
     }
 
     return NULL;
 }
 // ====================================================================================================
+static void _loadSymbols( struct RunTime *r )
+
+/* Make sure the symbols are loaded and current, rebuilding the instruction table if they weren't */
+
+{
+    bool idle = false;
+
+    if ( r->options->snapshotInterval )
+    {
+        /* The writer uses the symbols and the instruction table, so wait for it to finish any */
+        /* snapshot it has, and hold it as busy so no new one can be handed over meanwhile.    */
+        while ( !__atomic_compare_exchange_n( &r->snapshotBusy, &idle, true, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED ) )
+        {
+            idle = false;
+            usleep( 1000 );
+        }
+    }
+
+    if ( !SymbolSetValid( &r->s, r->options->elffile ) )
+    {
+        if ( !( r->s = SymbolSetCreate( r->options->elffile, r->options->deleteMaterial, r->options->demangle, true, true ) ) )
+        {
+            genericsExit( -1, "Elf file or symbols in it not found" EOL );
+        }
+        else
+        {
+            genericsReport( V_DEBUG, "Loaded %s" EOL, r->options->elffile );
+        }
+
+        /* New symbols, so the instruction table needs to be built to match them */
+        _instTableCreate( r );
+
+        if ( !_replaySizeCounts( &r->replay ) )
+        {
+            genericsExit( -1, "Failed to allocate instruction counts" EOL );
+        }
+
+        /* The writer's counters have to match the new table too */
+        if ( ( r->options->snapshotInterval ) &&
+                ( ( !_countersSize( &r->snap.c, r->inst.slots ) ) || ( !_countersSize( &r->total, r->inst.slots ) ) ) )
+        {
+            genericsExit( -1, "Failed to allocate snapshot counts" EOL );
+        }
+    }
+
+    if ( r->options->snapshotInterval )
+    {
+        __atomic_store_n( &r->snapshotBusy, false, __ATOMIC_RELEASE );
+    }
+}
+// ====================================================================================================
+static uint8_t *_replayUnpack( struct traceFileReader *f, size_t *len )
+
+/* Pull the whole of the trace out of a compressed or segmented capture into memory */
+
+{
+    size_t size = TRANSFER_SIZE;
+    uint8_t *b = ( uint8_t * )malloc( size );
+    ssize_t t;
+
+    *len = 0;
+
+    while ( ( b ) && ( ( t = traceFileRead( f, &b[*len], size - *len ) ) > 0 ) )
+    {
+        *len += t;
+
+        if ( *len == size )
+        {
+            size *= 2;
+            b = ( uint8_t * )realloc( b, size );
+        }
+    }
+
+    return b;
+}
+// ====================================================================================================
+static void _replayParallel( struct RunTime *r )
+
+/* Replay the whole of the file in one go. It's split into segments at sync points, each of which is */
+/* decoded by its own thread from the mapped file, and the results are then merged in file order.    */
+
+{
+    struct traceFileReader *f;
+    bool mapped;
+    struct stat st;
+    uint8_t *b;
+    size_t len;
+    size_t start;
+    size_t next;
+    struct replay *seg;
+    uint32_t numSegs = 0;
+    uint64_t offset = 0;
+    uint32_t startTime = genericsTimestampmS();
+
+    if ( !( f = traceFileOpen( r->options->file ) ) )
+    {
+        genericsExit( -ENOENT, "Can't open file %s" EOL, r->options->file );
+    }
+
+    /* The threads can only read the instruction table, so it's filled in completely before they start */
+    _loadSymbols( r );
+    _instTableDecodeAll( r );
+
+    /* A flat file is mapped as it is, anything else has to be unpacked first */
+    mapped = ( !traceFileIsCompressed( f ) ) && ( !traceFileIsIndexed( f ) );
+
+    if ( mapped )
+    {
+        if ( fstat( traceFileFd( f ), &st ) < 0 )
+        {
+            genericsExit( -1, "Can't stat file %s" EOL, r->options->file );
+        }
+
+        len = st.st_size;
+        b = len ? ( uint8_t * )mmap( NULL, len, PROT_READ, MAP_PRIVATE, traceFileFd( f ), 0 ) : NULL;
+    }
+    else
+    {
+        b = _replayUnpack( f, &len );
+    }
+
+    traceFileClose( f );
+    r->intervalBytes = len;
+
+    if ( mapped ? ( b == MAP_FAILED ) : ( !b ) )
+    {
+        genericsExit( -1, "Can't %s file %s" EOL, mapped ? "map" : "unpack", r->options->file );
+    }
+
+    if ( !len )
+    {
+        if ( !mapped )
+        {
+            free( b );
+        }
+
+        return;
+    }
+
+    if ( mapped )
+    {
+        madvise( b, len, MADV_SEQUENTIAL );
+    }
+
+    if ( !( seg = ( struct replay * )calloc( r->options->threads, sizeof( struct replay ) ) ) )
+    {
+        genericsExit( -1, "Failed to allocate replay segments" EOL );
+    }
+
+    /* Each segment runs from the first sync point in its share of the file to the start of the next one */
+    for ( start = 0; start < len; start = next )
+    {
+        next = len;
+
+        if ( numSegs + 1 < ( uint32_t )r->options->threads )
+        {
+            next = ( ( numSegs + 1 ) * ( uint64_t )len ) / r->options->threads;
+            next = _findSegmentStart( b, len, ( next > start ) ? next : start + 1 );
+        }
+
+        if ( ( !_replayInit( r, &seg[numSegs] ) ) || ( !_replaySizeCounts( &seg[numSegs] ) ) )
+        {
+            genericsExit( -1, "Failed to create replay segment" EOL );
+        }
+
+        seg[numSegs].isSegment = true;
+        seg[numSegs].start     = b + start;
+        seg[numSegs].len       = next - start;
+        seg[numSegs].overrun   = len - next;
+
+        genericsReport( V_DEBUG, "Segment %d is %zu bytes from %zu" EOL, numSegs, next - start, start );
+
+        if ( pthread_create( &seg[numSegs].thread, NULL, &_replaySegment, &seg[numSegs] ) )
+        {
+            genericsExit( -1, "Failed to create replay thread" EOL );
+        }
+
+        numSegs++;
+    }
+
+    /* Calls open at the end of one segment may complete in any later one, so merge in order */
+    for ( uint32_t i = 0; i < numSegs; i++ )
+    {
+        pthread_join( seg[i].thread, NULL );
+
+        if ( seg[i].sampling )
+        {
+            _replayMerge( &r->replay, &seg[i], offset );
+            offset += seg[i].op.lasttstamp - seg[i].op.firsttstamp;
+            r->replay.sampling = true;
+        }
+
+        _replayDelete( &seg[i] );
+    }
+
+    r->replay.op.firsttstamp = 0;
+    r->replay.op.lasttstamp  = offset;
+
+    genericsReport( V_INFO, "Replayed %zu bytes in %d segments in %d mS" EOL, len, numSegs, genericsTimestampmS() - startTime );
+
+    free( seg );
+
+    if ( mapped )
+    {
+        munmap( b, len );
+    }
+    else
+    {
+        free( b );
+    }
+}
+// ====================================================================================================
 int main( int argc, char *argv[] )
 
 {
     int sourcefd;
+    struct traceFileReader *f = NULL;
     struct sockaddr_in serv_addr;
     struct hostent *server;
     int flag = 1;
@@ -677,6 +1695,10 @@ int main( int argc, char *argv[] )
     int r;
     struct timeval tv;
     fd_set readfds;
+    uint8_t *rxBuffer;
+    ssize_t rxLen;
+    struct blockqueueStats *qs;
+    bool processing = false;
 
     /* Have a basic name and search string set up */
     _r.progName = genericsBasename( argv[0] );
@@ -702,162 +1724,253 @@ int main( int argc, char *argv[] )
         genericsExit( -1, "Failed to ignore SIGPIPEs" EOL );
     }
 
-    ETMDecoderInit( &_r.i, !_r.options->noaltAddr );
+    if ( !_replayInit( &_r, &_r.replay ) )
+    {
+        genericsExit( -1, "Failed to create call stack" EOL );
+    }
 
-    while ( !_r.ending )
+    if ( _r.options->parallel )
     {
-        if ( !_r.options->file )
+        _replayParallel( &_r );
+    }
+    else
+    {
+        if ( ( _r.options->tracefile ) && ( !( _r.trace = ext_ff_traceOpen( _r.options->tracefile ) ) ) )
         {
-            /* Get the socket open */
-            sourcefd = socket( AF_INET, SOCK_STREAM, 0 );
-            setsockopt( sourcefd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof( flag ) );
-
-            if ( sourcefd < 0 )
-            {
-                perror( "Error creating socket\n" );
-                return -EIO;
-            }
+            genericsExit( -1, "Failed to open trace file %s" EOL, _r.options->tracefile );
+        }
 
-            if ( setsockopt( sourcefd, SOL_SOCKET, SO_REUSEADDR, &( int )
+        /* Snapshots' pprof files are built from call edges only, so the tree isn't needed for them */
+        if ( ( _r.options->foldedfile ) || ( ( _r.options->pproffile ) && ( !_r.options->snapshotInterval ) ) )
         {
-            1
-        }, sizeof( int ) ) < 0 )
+            if ( !cctInit( &_r.cct, _r.options->maxContexts ) )
             {
-                perror( "setsockopt(SO_REUSEADDR) failed" );
-                return -EIO;
+                genericsExit( -1, "Failed to create calling context tree" EOL );
             }
 
-            /* Now open the network connection */
-            bzero( ( char * ) &serv_addr, sizeof( serv_addr ) );
-            server = gethostbyname( _r.options->server );
+            _r.replay.cct = &_r.cct;
+        }
 
-            if ( !server )
-            {
-                perror( "Cannot find host" );
-                return -EIO;
-            }
+        /* Memory for the blocks is only taken as the queue deepens */
+        if ( !( _r.ingest = blockqueueCreate( TRANSFER_SIZE, _r.options->ingestBlocks ) ) )
+        {
+            genericsExit( -1, "Failed to create ingest queue" EOL );
+        }
 
-            serv_addr.sin_family = AF_INET;
-            bcopy( ( char * )server->h_addr,
-                   ( char * )&serv_addr.sin_addr.s_addr,
-                   server->h_length );
-            serv_addr.sin_port = htons( _r.options->port + ( _r.options->useTPIU ? 0 : 1 ) );
+        if ( _r.options->snapshotInterval )
+        {
+            sem_init( &_r.snapshotReady, 0, 0 );
 
-            if ( connect( sourcefd, ( struct sockaddr * ) &serv_addr, sizeof( serv_addr ) ) < 0 )
+            if ( pthread_create( &_r.snapshotThread, NULL, &_snapshotWriter, &_r ) )
             {
-                perror( "Could not connect" );
-                close( sourcefd );
-                usleep( 1000000 );
-                continue;
+                genericsExit( -1, "Failed to create snapshot writer" EOL );
             }
         }
-        else
+
+        while ( !_r.ending )
         {
-            if ( ( sourcefd = open( _r.options->file, O_RDONLY ) ) < 0 )
+            if ( !_r.options->file )
             {
-                genericsExit( sourcefd, "Can't open file %s" EOL, _r.options->file );
-            }
-        }
+                /* Get the socket open */
+                sourcefd = socket( AF_INET, SOCK_STREAM, 0 );
+                setsockopt( sourcefd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof( flag ) );
 
-        /* We need symbols constantly while running ... lets get them */
-        if ( !SymbolSetValid( &_r.s, _r.options->elffile ) )
-        {
-            if ( !( _r.s = SymbolSetCreate( _r.options->elffile, _r.options->deleteMaterial, _r.options->demangle, true, true ) ) )
+                if ( sourcefd < 0 )
+                {
+                    perror( "Error creating socket\n" );
+                    return -EIO;
+                }
+
+                if ( setsockopt( sourcefd, SOL_SOCKET, SO_REUSEADDR, &( int )
             {
-                genericsExit( -1, "Elf file or symbols in it not found" EOL );
+                1
+            }, sizeof( int ) ) < 0 )
+                {
+                    perror( "setsockopt(SO_REUSEADDR) failed" );
+                    return -EIO;
+                }
+
+                /* Now open the network connection */
+                bzero( ( char * ) &serv_addr, sizeof( serv_addr ) );
+                server = gethostbyname( _r.options->server );
+
+                if ( !server )
+                {
+                    perror( "Cannot find host" );
+                    return -EIO;
+                }
+
+                serv_addr.sin_family = AF_INET;
+                bcopy( ( char * )server->h_addr,
+                       ( char * )&serv_addr.sin_addr.s_addr,
+                       server->h_length );
+                serv_addr.sin_port = htons( _r.options->port + ( _r.options->useTPIU ? 0 : 1 ) );
+
+                if ( connect( sourcefd, ( struct sockaddr * ) &serv_addr, sizeof( serv_addr ) ) < 0 )
+                {
+                    perror( "Could not connect" );
+                    close( sourcefd );
+                    usleep( 1000000 );
+                    continue;
+                }
             }
             else
             {
-                genericsReport( V_DEBUG, "Loaded %s" EOL, _r.options->elffile );
-            }
-        }
-
-        _r.intervalBytes = 0;
-
-        /* Now start the result processing task */
-        pthread_create( &_r.processThread, NULL, &_processBlocks, &_r );
+                if ( !( f = traceFileOpen( _r.options->file ) ) )
+                {
+                    genericsExit( -ENOENT, "Can't open file %s" EOL, _r.options->file );
+                }
 
-        /* ----------------------------------------------------------------------------- */
-        /* This is the main active loop...only break out of this when ending or on error */
-        /* ----------------------------------------------------------------------------- */
-        FD_ZERO( &readfds );
+                sourcefd = traceFileFd( f );
+            }
 
-        while ( !_r.ending )
-        {
-            /* Each time segment is restricted */
-            tv.tv_sec = 0;
-            tv.tv_usec  = TICK_TIME_MS * 1000;
+            /* We need symbols constantly while running ... lets get them */
+            _loadSymbols( &_r );
 
-            FD_SET( sourcefd, &readfds );
-            FD_SET( STDIN_FILENO, &readfds );
-            r = select( sourcefd + 1, &readfds, NULL, NULL, &tv );
+            _r.intervalBytes = 0;
 
-            if ( r < 0 )
+            /* Now start the result processing task */
+            if ( pthread_create( &_r.processThread, NULL, &_processBlocks, &_r ) )
             {
-                /* Something went wrong in the select */
-                break;
+                genericsExit( -1, "Failed to create processing thread" EOL );
             }
 
-            struct dataBlock *rxBlock = &_r.rawBlock[_r.wp];
+            processing = true;
+
+            /* ----------------------------------------------------------------------------- */
+            /* This is the main active loop...only break out of this when ending or on error */
+            /* ----------------------------------------------------------------------------- */
+            FD_ZERO( &readfds );
 
-            if ( FD_ISSET( sourcefd, &readfds ) )
+            while ( !_r.ending )
             {
-                /* We always read the data, even if we're held, to keep the socket alive */
-                rxBlock->fillLevel = read( sourcefd, rxBlock->buffer, TRANSFER_SIZE );
+                /* Each time segment is restricted */
+                tv.tv_sec = 0;
+                tv.tv_usec  = TICK_TIME_MS * 1000;
+
+                FD_SET( sourcefd, &readfds );
+                FD_SET( STDIN_FILENO, &readfds );
+                r = select( sourcefd + 1, &readfds, NULL, NULL, &tv );
 
-                if ( rxBlock->fillLevel <= 0 )
+                if ( r < 0 )
                 {
-                    /* We are at EOF (Probably the descriptor closed) */
+                    /* Something went wrong in the select */
                     break;
                 }
 
-                /* ...record the fact that we received some data */
-                _r.intervalBytes += rxBlock->fillLevel;
+                if ( FD_ISSET( sourcefd, &readfds ) )
+                {
+                    /* This waits if the decoder has fallen too far behind, pushing back on the source */
+                    if ( !( rxBuffer = blockqueueGetWriteBlock( _r.ingest ) ) )
+                    {
+                        genericsExit( -1, "Out of memory for ingest queue" EOL );
+                    }
 
+                    rxLen = f ? traceFileRead( f, rxBuffer, TRANSFER_SIZE ) : read( sourcefd, rxBuffer, TRANSFER_SIZE );
 
-                int nwp = ( _r.wp + 1 ) % NUM_RAW_BLOCKS;
+                    if ( rxLen <= 0 )
+                    {
+                        /* We are at EOF (Probably the descriptor closed) */
+                        break;
+                    }
+
+                    /* ...record the fact that we received some data */
+                    _r.intervalBytes += rxLen;
+                    blockqueueCommit( _r.ingest, rxLen );
+                }
 
-                if ( nwp == ( volatile int )_r.rp )
+                /* Ask the decoder for a snapshot when the next one is due */
+                if ( ( _r.options->snapshotInterval ) && ( ( volatile bool ) _r.replay.sampling ) &&
+                        ( ( genericsTimestampmS() - ( volatile uint32_t )_r.replay.starttime ) > ( _r.snapshotsAsked + 1 ) * ( uint32_t )_r.options->snapshotInterval ) )
                 {
-                    genericsExit( -1, "Overflow" EOL );
+                    _r.snapshotsAsked++;
+                    __atomic_store_n( &_r.snapshotDue, true, __ATOMIC_RELEASE );
                 }
 
-                _r.wp = nwp;
-                sem_post( &_r.dataForClients );
+                /* Update the intervals */
+                if ( ( ( volatile bool ) _r.replay.sampling ) && ( ( genericsTimestampmS() - ( volatile uint32_t )_r.replay.starttime ) > _r.options->sampleDuration ) )
+                {
+                    _r.ending = true;
+
+                    /* Post an empty data packet to flag to packet processor that it's done */
+                    blockqueueGetWriteBlock( _r.ingest );
+                    blockqueueCommit( _r.ingest, 0 );
+                }
+            }
+
+            if ( f )
+            {
+                traceFileClose( f );
+                f = NULL;
+            }
+            else
+            {
+                close( sourcefd );
             }
 
-            /* Update the intervals */
-            if ( ( ( volatile bool ) _r.sampling ) && ( ( genericsTimestampmS() - ( volatile uint32_t )_r.starttime ) > _r.options->sampleDuration ) )
+            /* The next connection reloads the symbols, so this one's processing has to be done first */
+            if ( !_r.ending )
             {
-                _r.ending = true;
+                blockqueueGetWriteBlock( _r.ingest );
+                blockqueueCommit( _r.ingest, 0 );
+                pthread_join( _r.processThread, NULL );
+                processing = false;
+            }
+        }
 
-                /* Post an empty data packet to flag to packet processor that it's done */
-                int nwp = ( _r.wp + 1 ) % NUM_RAW_BLOCKS;
+        /* Wait for data processing to be completed */
+        if ( processing )
+        {
+            pthread_join( _r.processThread, NULL );
+        }
 
-                if ( nwp == ( volatile int )_r.rp )
-                {
-                    genericsExit( -1, "Overflow" EOL );
-                }
+        if ( _r.options->snapshotInterval )
+        {
+            /* Whatever arrived since the last snapshot goes in a final one */
+            while ( !_snapshotTake( &_r ) )
+            {
+                usleep( 1000 );
+            }
 
-                _r.rawBlock[_r.wp].fillLevel = 0;
-                _r.wp = nwp;
-                sem_post( &_r.dataForClients );
+            while ( __atomic_load_n( &_r.snapshotBusy, __ATOMIC_ACQUIRE ) )
+            {
+                usleep( 1000 );
             }
         }
 
-        close( sourcefd );
+        if ( ( _r.trace ) && ( !ext_ff_traceClose( _r.trace ) ) )
+        {
+            genericsReport( V_ERROR, "Failed to write trace file" EOL );
+        }
+
+        qs = blockqueueGetStats( _r.ingest );
+        genericsReport( V_INFO, "Ingest queue max depth %d of %d blocks (%d allocated), reader stalled %d times for %" PRIu64 " mS" EOL,
+                        qs->maxDepth, _r.options->ingestBlocks, qs->blocksAllocated, qs->stalls, qs->stallTimeuS / 1000 );
     }
 
-    /* Wait for data processing to be completed */
-    pthread_join( _r.processThread, NULL );
+    TRACE_DUMP( _traceFmt, TL_NUM_EVENTS );
+    genericsReport( V_INFO, "Call stack reached depth %d, resynced %" PRIu64 " times" EOL, _r.replay.stack.highWater, _r.replay.stack.resyncs );
+
+    if ( _r.replay.cct )
+    {
+        genericsReport( V_INFO, "Calling context tree %u nodes (%zu KBytes), %" PRIu64 " calls truncated" EOL,
+                        _r.cct.nodes, cctMemory( &_r.cct ) / 1024, _r.cct.truncated );
+    }
+
+    if ( _r.options->snapshotInterval )
+    {
+        /* Everything has already been written out in the snapshots */
+        return OK;
+    }
 
     /* Data are collected, now process and report */
+    _instTableToHash( &_r, &_r.insthead, &_r.replay.c, _r.replay.sampling );
     genericsReport( V_INFO, "Received %d raw sample bytes, %ld function changes, %ld distinct addresses" EOL,
-                    _r.intervalBytes, HASH_COUNT( _r.subhead ), HASH_COUNT( _r.insthead ) );
+                    _r.intervalBytes, HASH_COUNT( _r.replay.c.subhead ), HASH_COUNT( _r.insthead ) );
 
-    if ( HASH_COUNT( _r.subhead ) )
+    if ( HASH_COUNT( _r.replay.c.subhead ) )
     {
-        if ( ext_ff_outputDot( _r.options->dotfile, _r.subhead, _r.s ) )
+        if ( ext_ff_outputDot( _r.options->dotfile, _r.replay.c.subhead, _r.s ) )
         {
             genericsReport( V_INFO, "Output DOT" EOL );
         }
@@ -872,9 +1985,9 @@ int main( int argc, char *argv[] )
         if ( ext_ff_outputProfile( _r.options->profile, _r.options->elffile,
                                    _r.options->truncateDeleteMaterial ? _r.options->deleteMaterial : NULL,
                                    true,
-                                   _r.op.lasttstamp - _r.op.firsttstamp,
+                                   _r.replay.op.lasttstamp - _r.replay.op.firsttstamp,
                                    _r.insthead,
-                                   _r.subhead,
+                                   _r.replay.c.subhead,
                                    _r.s ) )
         {
             genericsReport( V_INFO, "Output Profile" EOL );
@@ -886,6 +1999,36 @@ int main( int argc, char *argv[] )
                 genericsExit( -1, "Failed to output profile" EOL );
             }
         }
+
+        if ( ext_ff_outputPprof( _r.options->pproffile, _r.options->elffile,
+                                 _r.options->truncateDeleteMaterial ? _r.options->deleteMaterial : NULL,
+                                 _r.replay.op.lasttstamp - _r.replay.op.firsttstamp,
+                                 _r.insthead,
+                                 _r.replay.c.subhead,
+                                 _r.replay.cct,
+                                 _r.s ) )
+        {
+            genericsReport( V_INFO, "Output pprof" EOL );
+        }
+        else
+        {
+            if ( _r.options->pproffile )
+            {
+                genericsExit( -1, "Failed to output pprof" EOL );
+            }
+        }
+
+        if ( ext_ff_outputFolded( _r.options->foldedfile, _r.replay.cct, _r.insthead, _r.s ) )
+        {
+            genericsReport( V_INFO, "Output folded stacks" EOL );
+        }
+        else
+        {
+            if ( _r.options->foldedfile )
+            {
+                genericsExit( -1, "Failed to output folded stacks" EOL );
+            }
+        }
     }
 
     return OK;
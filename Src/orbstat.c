@@ -26,20 +26,34 @@
 #include "symbols.h"
 #include "nw.h"
 #include "ext_fileformats.h"
+#include "callStack.h"
+#include "cct.h"
+#include "traceLog.h"
+#include "orbstatProtocol.h"
 
 #define TICK_TIME_MS        (1)          /* Time intervals for checks */
 #define DEFAULT_DURATION_MS (1000)       /* Default time to sample, in mS */
 
-#define DEFAULT_TRACE_CHANNEL  30        /* ITM Channel that we expect trace data to arrive on */
+#define DEFAULT_TRACE_CHANNEL  OS_CHANNEL /* ITM Channel that we expect trace data to arrive on */
 #define DEFAULT_FILE_CHANNEL   29        /* ITM Channel that we expect file data to arrive on */
 
-/* Interface to/from target */
-#define COMMS_MASK (0xF0000000)
-#define IN_EVENT   (0x40000000)
-#define OUT_EVENT  (0x50000000)
+#define ENTRY_CACHE_SIZE    (1024)       /* Recently used exec entries, looked up by address (power of 2) */
+#define CALL_CACHE_SIZE     (1024)       /* Recently used calls, looked up by source and dest (power of 2) */
+
+/* Events recorded in the trace log (debug builds only) */
+enum traceEvent
+{
+    TL_EXCEPTION_CALL,
+    TL_NUM_EVENTS
+};
+
+#ifdef DEBUG
+static const char *const _traceFmt[TL_NUM_EVENTS] =
+{
+    [TL_EXCEPTION_CALL] = "Exception %08x -> %08x (Function index %d)"
+};
+#endif
 
-/* States for sample reception state machine */
-enum CDState { CD_waitinout, CD_waitsrc, CD_waitdst };
 
 /* ---------- CONFIGURATION ----------------- */
 struct Options                           /* Record for options, either defaults or from command line */
@@ -58,6 +72,9 @@ struct Options                           /* Record for options, either defaults
 
     char *dotfile;                       /* File to output dot information */
     char *profile;                       /* File to output profile information */
+    char *pproffile;                     /* File to output pprof profile */
+    char *tracefile;                     /* File to output trace-event stream of calls */
+    char *foldedfile;                    /* File to output folded stacks for flame graphs */
     uint32_t sampleDuration;             /* How long we are going to sample for */
     bool forceITMSync;                   /* Do we assume ITM starts synced? */
 
@@ -67,6 +84,9 @@ struct Options                           /* Record for options, either defaults
     int port;                            /* Source information for where to connect to */
     char *server;
 
+    int maxStack;                        /* Maximum depth of call stack */
+    int maxContexts;                     /* Maximum number of nodes in calling context tree */
+
 } _options =
 {
     .demangle       = true,
@@ -75,7 +95,9 @@ struct Options                           /* Record for options, either defaults
     .traceChannel   = DEFAULT_TRACE_CHANNEL,
     .fileChannel    = DEFAULT_FILE_CHANNEL,
     .forceITMSync   = true,
-    .server         = "localhost"
+    .server         = "localhost",
+    .maxStack       = CALLSTACK_DEFAULT_MAX_DEPTH,
+    .maxContexts    = CCT_DEFAULT_MAX_NODES
 };
 
 /* A block of received data */
@@ -99,14 +121,15 @@ struct RunTime
     uint64_t intervalBytes;             /* Number of bytes transferred in current interval */
 
     /* Calls related info */
-    enum CDState CDState;               /* State of the call data machine */
     struct edge *calls;                 /* Call data table */
 
     struct subcall *subhead;            /* Calls onstruct data */
-    struct subcall **substack;          /* Calls stack data */
-    uint32_t substacklen;               /* Calls stack length */
+    struct callStack stack;             /* Calls in progress */
+    struct cct cct;                     /* Calling contexts, if they're being tracked */
+    bool useCct;                        /* ...and if they are */
 
     struct execEntryHash *insthead;     /* Exec table handle for hash */
+    struct ext_ff_trace *trace;         /* Trace-event stream of calls, if one is being written */
 
     struct SymbolSet *s;                /* Symbols read from elf */
     struct Options *options;            /* Our runtime configuration */
@@ -116,13 +139,18 @@ struct RunTime
     bool sampling;                      /* Are we actively sampling at the moment */
     uint32_t starttime;                 /* At what time did we start sampling? */
 
-    /* Turn addresses into files and routines tags */
-    struct execEntryHash *from;         /* Where the call was from */
-    struct execEntryHash *to;           /* Where the call was to */
+    /* Record being received from the target */
+    uint32_t recType;                   /* Type of record (0 when waiting for one to start) */
+    uint32_t recWords;                  /* Number of words of it received so far */
+    uint32_t rec[2];                    /* ...and the words themselves */
+    uint32_t recArg;                    /* Call site offset or EXC_RETURN from a short header */
+    uint64_t recLost;                   /* Records that were cut short */
+
+    /* Lookups that are likely to be repeated soon */
+    struct execEntryHash *entryCache[ENTRY_CACHE_SIZE];
+    struct subcall *callCache[CALL_CACHE_SIZE];
 
     /* Used for stretching number of bits in target timer */
-    uint32_t oldt;                      /* Last received timestamp */
-    uint64_t highOrdert;                /* High order bits */
     uint64_t tcount;                    /* Constructed current count */
     uint64_t starttcount;               /* Count at which we started */
 } _r =
@@ -137,185 +165,311 @@ struct RunTime
 // ====================================================================================================
 // ====================================================================================================
 // ====================================================================================================
+static struct execEntryHash *_execEntry( struct RunTime *r, uint32_t addr )
 
+/* Find, or create, the exec entry for addr. Returns NULL if there's no symbol for it */
 
+{
+    struct execEntryHash **c = &r->entryCache[( addr >> 1 ) & ( ENTRY_CACHE_SIZE - 1 )];
+    struct execEntryHash *e;
+    struct nameEntry n;
+
+    if ( ( *c ) && ( ( *c )->addr == addr ) )
+    {
+        return *c;
+    }
+
+    HASH_FIND_INT( r->insthead, &addr, e );
+
+    if ( !e )
+    {
+        if ( !SymbolLookup( r->s, addr, &n ) )
+        {
+            genericsReport( V_ERROR, "No symbol for address %08x" EOL, addr );
+            return NULL;
+        }
+
+        e = calloc( 1, sizeof( struct execEntryHash ) );
+
+        e->addr          = addr;
+        e->fileindex     = n.fileindex;
+        e->line          = n.line;
+        e->functionindex = n.functionindex;
+
+        HASH_ADD_INT( r->insthead, addr, e );
+    }
+
+    *c = e;
+    return e;
+}
 // ====================================================================================================
-// Callback function for trace messages from the target CPU (via ITM channel)
-// ====================================================================================================
-static void _handleSW( struct RunTime *r )
+static struct subcall *_subcallEntry( struct RunTime *r, struct execEntryHash *from, struct execEntryHash *to )
+
+/* Find, or create, the record of calls from one place to another */
 
 {
-    struct nameEntry n;
-    struct subcallSig sig;
+    struct subcall **c = &r->callCache[( ( from->addr >> 1 ) ^ ( ( to->addr * 0x9e3779b1 ) >> 20 ) ) & ( CALL_CACHE_SIZE - 1 )];
+    struct subcallSig sig = { .src = from->addr, .dst = to->addr };
     struct subcall *s;
-    static bool isIn;
-    uint32_t addr;
 
-    struct swMsg *m = ( struct swMsg * )&r->m;
+    if ( ( *c ) && ( ( *c )->sig.src == sig.src ) && ( ( *c )->sig.dst == sig.dst ) )
+    {
+        return *c;
+    }
+
+    HASH_FIND( hh, r->subhead, &sig, sizeof( struct subcallSig ), s );
+
+    if ( !s )
+    {
+        /* This entry doesn't exist...let's create it */
+        s = ( struct subcall * )calloc( 1, sizeof( struct subcall ) );
+        memcpy( &s->sig, &sig, sizeof( struct subcallSig ) );
+        s->srch = from;
+        s->dsth = to;
+        HASH_ADD( hh, r->subhead, sig, sizeof( struct subcallSig ), s );
+    }
+
+    *c = s;
+    return s;
+}
+// ====================================================================================================
+static void _updateTime( struct RunTime *r, uint32_t t, uint32_t bits )
+
+/* Extend the bits of target time we got to the full count. This survives the target timer */
+/* wrapping, so long as events are closer together than the range of the bits sent.        */
+
+{
+    r->tcount += ( t - ( uint32_t )r->tcount ) & ( ( 1UL << bits ) - 1 );
+
+    /* Finally, if we're not sampling, then start sampling */
+    if ( !r->sampling )
+    {
+        genericsReport( V_WARN, "Sampling" EOL );
+        /* Fill in a time to start from */
+        r->starttime     = genericsTimestampmS();
+        r->intervalBytes = 0;
+        r->starttcount   = r->tcount;
+        r->sampling      = true;
+    }
+}
+// ====================================================================================================
+static void _callRecord( struct RunTime *r, uint32_t fromAddr, uint32_t toAddr )
+
+/* A call has been made from the call site fromAddr to the function toAddr */
+
+{
+    struct execEntryHash *from;
+    struct execEntryHash *to;
+    struct subcall *s;
+    struct callFrame *f = callStackTop( &r->stack );
+    uint32_t parent = f ? f->node : CCT_ROOT;
 
-    if ( m->srcAddr == r->options->traceChannel )
+    if ( ( !( from = _execEntry( r, fromAddr ) ) ) || ( !( to = _execEntry( r, toAddr ) ) ) )
     {
-        switch ( r->CDState )
+        /* Still stack a frame, with no call record, so the return that matches it has something to pop */
+        f = callStackPush( &r->stack );
+        f->s       = NULL;
+        f->inTicks = r->tcount;
+        f->node    = parent;
+
+        if ( r->trace )
         {
-            // -------------------- Reporting the time stamp and if it's an In or Out event
-            case CD_waitinout:
-                if ( ( m->value & COMMS_MASK ) == IN_EVENT )
-                {
-                    isIn = true;
-                    r->CDState = CD_waitsrc;
-                }
+            ext_ff_traceBegin( r->trace, r->stack.depth, "Unknown", ( fromAddr > 0xfffffff0 ), r->tcount );
+        }
 
-                if ( ( m->value & COMMS_MASK ) == OUT_EVENT )
-                {
-                    isIn = false;
-                    r->CDState = CD_waitsrc;
-                }
+        return;
+    }
 
-                if ( r->CDState != CD_waitinout )
-                {
-                    /* Time is encoded in lowest three octets ...accomodate rollover */
-                    uint32_t t = m->value & 0xFFFFFF;
+    if ( from->addr > 0xfffffff0 )
+    {
+        TRACE_LOG( TL_EXCEPTION_CALL, from->addr, to->addr, to->functionindex );
+    }
 
-                    if ( t < _r.oldt )
-                    {
-                        r->highOrdert++;
-                    }
+    from->count++;
+    to->count++;
 
-                    r->oldt = t;
-                    r->tcount = ( _r.highOrdert << 24 ) | t;
+    /* However we got here, we've got a subcall record, so record it with its starting ticks */
+    s = _subcallEntry( r, from, to );
+    s->count++;
 
-                    /* Finally, if we're not sampling, then start sampling */
-                    if ( !r->sampling )
-                    {
-                        genericsReport( V_WARN, "Sampling" EOL );
-                        /* Fill in a time to start from */
-                        r->starttime     = genericsTimestampmS();
-                        r->intervalBytes = 0;
-                        r->starttcount   = r->tcount;
-                        r->sampling      = true;
-                    }
-                }
+    /* ...and add it to the call stack */
+    f = callStackPush( &r->stack );
+    f->s       = s;
+    f->inTicks = r->tcount;
+    f->node    = r->useCct ? cctCall( &r->cct, parent, to->addr ) : CCT_ROOT;
 
-                break;
+    if ( r->trace )
+    {
+        ext_ff_traceBegin( r->trace, r->stack.depth, SymbolFunction( r->s, to->functionindex ),
+                           ( from->addr > 0xfffffff0 ), r->tcount );
+    }
+}
+// ====================================================================================================
+static void _returnRecord( struct RunTime *r, uint32_t fromAddr, uint32_t toAddr, bool knowAddrs )
 
-            // -------------------- Reporting the source address
-            case CD_waitsrc:
-                /* Source address is the address of the _return_, so subtract 4 */
-                addr = ( m->value - 4 );
-                r->CDState = CD_waitdst;
-                HASH_FIND_INT( r->insthead, &addr, r->from );
+/* A return has been made from the function toAddr to the call site fromAddr (if we know them) */
 
-                if ( !r->from )
-                {
-                    if ( SymbolLookup( r->s, addr, &n ) )
-                    {
-                        r->from = calloc( 1, sizeof( struct execEntryHash ) );
+{
+    struct callFrame *f;
+    struct subcall *s;
 
-                        r->from->addr          = addr;
-                        r->from->fileindex     = n.fileindex;
-                        r->from->line          = n.line;
-                        r->from->functionindex = n.functionindex;
-                    }
-                    else
-                    {
-                        genericsReport( V_ERROR, "No symbol for address %08x" EOL, addr );
-                        r->CDState = CD_waitinout;
-                        return;
-                    }
+    /* We've come out, though there's nothing to account if we never knew where the call went */
+    if ( ( f = callStackPop( &r->stack ) ) && ( f->s ) )
+    {
+        s = f->s;
 
-                    HASH_ADD_INT( r->insthead, addr, ( r->from ) );
-                }
+        if ( ( knowAddrs ) && ( ( s->sig.src != fromAddr ) || ( s->sig.dst != toAddr ) ) )
+        {
+            /* Stack is out of step with the target, so start again */
+            genericsReport( V_WARN, "Address mismatch" EOL );
+            callStackResync( &r->stack );
+        }
+        else
+        {
+            s->srch->count++;
+            s->dsth->count++;
+            s->myCost += ( r->tcount - f->inTicks );
 
-                r->from->count++;
-                break;
+            if ( r->useCct )
+            {
+                cctReturn( &r->cct, f->node, r->stack.depth ? callStackTop( &r->stack )->node : CCT_ROOT, r->tcount - f->inTicks );
+            }
+        }
+    }
 
-            // -------------------- Reporting the return address
-            case CD_waitdst:
-                addr = m->value;
-                r->CDState = CD_waitinout;
+    if ( r->trace )
+    {
+        ext_ff_traceEnd( r->trace, r->stack.depth, r->tcount );
+    }
+}
+// ====================================================================================================
+// ====================================================================================================
+// Callback function for trace messages from the target CPU (via ITM channel)
+// ====================================================================================================
+static void _handleSW( struct RunTime *r )
 
-                HASH_FIND_INT( r->insthead, &addr, r->to );
+{
+    struct swMsg *m = ( struct swMsg * )&r->m;
 
-                if ( !r->to )
-                {
-                    if ( SymbolLookup( r->s, addr, &n ) )
-                    {
-                        r->to = calloc( 1, sizeof( struct execEntryHash ) );
+    if ( m->srcAddr != r->options->traceChannel )
+    {
+        return;
+    }
 
-                        r->to->addr          = addr;
-                        r->to->fileindex     = n.fileindex;
-                        r->to->line          = n.line;
-                        r->to->functionindex = n.functionindex;
-                    }
-                    else
-                    {
-                        genericsReport( V_ERROR, "No symbol for address %08x" EOL, addr );
-                        r->CDState = CD_waitinout;
-                        return;
-                    }
+    /* A half word write is a complete Short Return all by itself */
+    if ( m->len == 2 )
+    {
+        if ( r->recType )
+        {
+            r->recLost++;
+            r->recType = 0;
+        }
 
-                    HASH_ADD_INT( r->insthead, addr, ( r->to ) );
-                }
+        _updateTime( r, m->value, OS_SHORT_RET_BITS );
+        _returnRecord( r, 0, 0, false );
+        return;
+    }
 
-                if ( r->from->addr > 0xfffffff0 )
-                {
-                    printf( "%s" EOL, SymbolFunction( r->s, r->to->functionindex ) );
-                }
+    /* A header starts a new record, unless it's really an address in an original format one */
+    if ( ( OS_IS_HEADER( m->value ) ) &&
+            ( ( !r->recType ) || ( ( r->recType != OS_REC_IN ) && ( r->recType != OS_REC_OUT ) ) ) )
+    {
+        if ( r->recType )
+        {
+            r->recLost++;
+        }
 
-                r->to->count++;
+        r->recType  = m->value & OS_REC_MASK;
+        r->recWords = 0;
 
-                /* ----------------------------------------------------------------------------------------------------------*/
-                /* We have everything. Record calls between functions. These are flagged via isIn true/false for call/return */
-                /* ----------------------------------------------------------------------------------------------------------*/
-                if ( isIn )
-                {
-                    /* Now make calling record */
-                    sig.src = r->from->addr;
-                    sig.dst = r->to->addr;
+        switch ( r->recType )
+        {
+            case OS_REC_IN:
+            case OS_REC_OUT:
+                _updateTime( r, m->value & OS_IN_OUT_TIME_MASK, OS_IN_OUT_TIME_BITS );
+                break;
 
-                    /* Find, or create, the call record */
-                    HASH_FIND( hh, r->subhead, &sig, sizeof( struct subcallSig ), s );
+            case OS_REC_CALL:
+            case OS_REC_EXCEPTION:
+                _updateTime( r, m->value & OS_TIME_MASK, OS_TIME_BITS );
+                break;
 
-                    if ( !s )
-                    {
-                        /* This entry doesn't exist...let's create it */
-                        s = ( struct subcall * )calloc( 1, sizeof( struct subcall ) );
-                        memcpy( &s->sig, &sig, sizeof( struct subcallSig ) );
-                        s->srch = r->from;
-                        s->dsth = r->to;
-                        HASH_ADD( hh, r->subhead, sig, sizeof( struct subcallSig ), s );
-                    }
+            case OS_REC_SHORT_CALL:
+            case OS_REC_SHORT_EXC:
+                _updateTime( r, ( m->value & OS_SHORT_TIME_MASK ) >> OS_SHORT_TIME_SHIFT, OS_SHORT_TIME_BITS );
+                r->recArg = m->value & OS_SHORT_ARG_MASK;
+                break;
 
+            case OS_REC_RETURN:
+                /* Nothing follows a return */
+                _updateTime( r, m->value & OS_TIME_MASK, OS_TIME_BITS );
+                _returnRecord( r, 0, 0, false );
+                r->recType = 0;
+                break;
 
-                    /* Now handle calling/return stack */
-                    /* However we got here, we've got a subcall record, so initialise its starting ticks */
-                    s->inTicks = r->tcount;
-                    s->count++;
+            default:
+                /* Nothing we understand, so wait for the next record */
+                r->recType = 0;
+                break;
+        }
 
-                    /* ...and add it to the call stack */
-                    r->substack = ( struct subcall ** )realloc( r->substack, ( r->substacklen + 1 ) * sizeof( struct subcall * ) );
-                    r->substack[r->substacklen++] = s;
+        return;
+    }
+
+    if ( !r->recType )
+    {
+        return;
+    }
+
+    r->rec[r->recWords++] = m->value;
+
+    switch ( r->recType )
+    {
+        case OS_REC_IN:
+        case OS_REC_OUT:
+            if ( r->recWords == 2 )
+            {
+                /* Source address is the address of the _return_, so subtract 4 */
+                if ( r->recType == OS_REC_IN )
+                {
+                    _callRecord( r, r->rec[0] - 4, r->rec[1] );
                 }
                 else
                 {
-                    /* We've come out */
-                    if ( r->substacklen )
-                    {
-                        /* We don't bother deallocating memory here cos it'll be done on the next isSubCall */
-                        s = r->substack[--r->substacklen];
+                    _returnRecord( r, r->rec[0] - 4, r->rec[1], true );
+                }
 
-                        if ( ( s->sig.src != r->from->addr ) || ( s->sig.dst != r->to->addr ) )
-                        {
-                            genericsReport( V_WARN, "Address mismatch" EOL );
-                        }
+                r->recType = 0;
+            }
 
-                        s->myCost = ( r->tcount - s->inTicks );
-                    }
+            break;
+
+        case OS_REC_CALL:
+        case OS_REC_EXCEPTION:
+            if ( r->recWords == 2 )
+            {
+                if ( r->recType == OS_REC_EXCEPTION )
+                {
+                    r->rec[0] |= OS_EXC_RETURN_BITS;
                 }
 
-                break;
-                // --------------------
-        }
+                /* As above, and the addresses may carry the Thumb bit */
+                _callRecord( r, ( r->rec[0] & ~1 ) - 4, r->rec[1] & ~1 );
+                r->recType = 0;
+            }
+
+            break;
+
+        case OS_REC_SHORT_CALL:
+            /* The call site is relative to the function, in halfwords */
+            _callRecord( r, ( r->rec[0] & ~1 ) + ( int16_t )r->recArg * 2 - 4, r->rec[0] & ~1 );
+            r->recType = 0;
+            break;
+
+        case OS_REC_SHORT_EXC:
+            _callRecord( r, ( ( r->recArg | OS_SHORT_EXC_BITS ) & ~1 ) - 4, r->rec[0] & ~1 );
+            r->recType = 0;
+            break;
     }
 }
 
@@ -466,16 +620,21 @@ static void _printHelp( struct RunTime *r )
 
 {
     genericsPrintf( "Usage: %s [options]" EOL, r->progName );
+    genericsPrintf( "       -C: <Filename> Chrome/Perfetto trace-event filename for call and exception slices" EOL );
     genericsPrintf( "       -D: Switch off C++ symbol demangling" EOL );
     genericsPrintf( "       -d: <String> Material to delete off front of filenames" EOL );
     genericsPrintf( "       -E: When reading from file, terminate at end of file rather than waiting for further input" EOL );
     genericsPrintf( "       -e: <ElfFile> to use for symbols" EOL );
+    genericsPrintf( "       -F: <Filename> folded stacks filename for flame graph output" EOL );
     genericsPrintf( "       -f <filename>: Take input from specified file" EOL );
     genericsPrintf( "       -g: <TraceChannel> for trace output (default %d)" EOL, r->options->traceChannel );
     genericsPrintf( "       -h: This help" EOL );
     genericsPrintf( "       -I <Interval>: Time to sample (in mS)" EOL );
+    genericsPrintf( "       -M <Nodes>: Maximum number of calling contexts tracked for -F and -P (Default %d)" EOL, CCT_DEFAULT_MAX_NODES );
     genericsPrintf( "       -n: Enforce sync requirement for ITM (i.e. ITM needs to issue syncs)" EOL );
+    genericsPrintf( "       -P: <Filename> pprof filename for gzipped profile output" EOL );
     genericsPrintf( "       -s: <Server>:<Port> to use" EOL );
+    genericsPrintf( "       -S <Depth>: Maximum call stack depth (Default %d)" EOL, CALLSTACK_DEFAULT_MAX_DEPTH );
     genericsPrintf( "       -t <channel>: Use TPIU to strip TPIU on specfied channel (defaults to 1)" EOL );
     genericsPrintf( "       -T: truncate -d material off all references (i.e. make output relative)" EOL );
     genericsPrintf( "       -v: <level> Verbose mode 0(errors)..3(debug)" EOL );
@@ -490,7 +649,7 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
 {
     int c;
 
-    while ( ( c = getopt ( argc, argv, "Dd:Ee:f:g:hI:n:s:Tt:v:y:z:" ) ) != -1 )
+    while ( ( c = getopt ( argc, argv, "C:Dd:Ee:F:f:g:hI:M:n:P:s:S:Tt:v:y:z:" ) ) != -1 )
         switch ( c )
         {
             // ------------------------------------
@@ -498,6 +657,11 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
                 r->options->deleteMaterial = optarg;
                 break;
 
+            // ------------------------------------
+            case 'C':
+                r->options->tracefile = optarg;
+                break;
+
             // ------------------------------------
             case 'D':
                 r->options->demangle = false;
@@ -513,6 +677,11 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
                 r->options->elffile = optarg;
                 break;
 
+            // ------------------------------------
+            case 'F':
+                r->options->foldedfile = optarg;
+                break;
+
             // ------------------------------------
             case 'f':
                 r->options->file = optarg;
@@ -533,11 +702,26 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
                 r->options->sampleDuration = atoi( optarg );
                 break;
 
+            // ------------------------------------
+            case 'M':
+                r->options->maxContexts = atoi( optarg );
+                break;
+
             // ------------------------------------
             case 'n':
                 r->options->forceITMSync = false;
                 break;
 
+            // ------------------------------------
+            case 'P':
+                r->options->pproffile = optarg;
+                break;
+
+            // ------------------------------------
+            case 'S':
+                r->options->maxStack = atoi( optarg );
+                break;
+
             // ------------------------------------
             case 's':
                 r->options->server = optarg;
@@ -621,11 +805,27 @@ static bool _processOptions( int argc, char *argv[], struct RunTime *r )
         exit( -2 );
     }
 
+    if ( r->options->maxStack < 1 )
+    {
+        genericsReport( V_ERROR, "Illegal call stack depth" EOL );
+        exit( -2 );
+    }
+
+    if ( r->options->maxContexts < 1 )
+    {
+        genericsReport( V_ERROR, "Illegal number of calling contexts" EOL );
+        exit( -2 );
+    }
+
     genericsReport( V_INFO, "%s V" VERSION " (Git %08X %s, Built " BUILD_DATE ")" EOL, r->progName, GIT_HASH, ( GIT_DIRTY ? "Dirty" : "Clean" ) );
     genericsReport( V_INFO, "Server          : %s:%d" EOL, r->options->server, r->options->port );
     genericsReport( V_INFO, "Delete Material : %s" EOL, r->options->deleteMaterial ? r->options->deleteMaterial : "None" );
     genericsReport( V_INFO, "Elf File        : %s %s" EOL, r->options->elffile, r->options->truncateDeleteMaterial ? "(Truncate)" : "(Don't Truncate)" );
     genericsReport( V_INFO, "DOT file        : %s" EOL, r->options->dotfile ? r->options->dotfile : "None" );
+    genericsReport( V_INFO, "pprof file      : %s" EOL, r->options->pproffile ? r->options->pproffile : "None" );
+    genericsReport( V_INFO, "Trace file      : %s" EOL, r->options->tracefile ? r->options->tracefile : "None" );
+    genericsReport( V_INFO, "Folded file     : %s" EOL, r->options->foldedfile ? r->options->foldedfile : "None" );
+    genericsReport( V_INFO, "Max Contexts    : %d" EOL, r->options->maxContexts );
     genericsReport( V_INFO, "ForceSync       : %s" EOL, r->options->forceITMSync ? "true" : "false" );
     genericsReport( V_INFO, "Trace Channel   : %d" EOL, r->options->traceChannel );
     genericsReport( V_INFO, "Sample Duration : %d mS" EOL, r->options->sampleDuration );
@@ -684,6 +884,26 @@ int main( int argc, char *argv[] )
     TPIUDecoderInit( &_r.t );
     ITMDecoderInit( &_r.i, _r.options->forceITMSync );
 
+    if ( !callStackInit( &_r.stack, _r.options->maxStack ) )
+    {
+        genericsExit( -1, "Failed to create call stack" EOL );
+    }
+
+    if ( ( _r.options->tracefile ) && ( !( _r.trace = ext_ff_traceOpen( _r.options->tracefile ) ) ) )
+    {
+        genericsExit( -1, "Failed to open trace file %s" EOL, _r.options->tracefile );
+    }
+
+    if ( ( _r.options->foldedfile ) || ( _r.options->pproffile ) )
+    {
+        if ( !cctInit( &_r.cct, _r.options->maxContexts ) )
+        {
+            genericsExit( -1, "Failed to create calling context tree" EOL );
+        }
+
+        _r.useCct = true;
+    }
+
     while ( !_r.ending )
     {
         if ( !_r.options->file )
@@ -813,7 +1033,21 @@ int main( int argc, char *argv[] )
         close( sourcefd );
     }
 
+    if ( ( _r.trace ) && ( !ext_ff_traceClose( _r.trace ) ) )
+    {
+        genericsReport( V_ERROR, "Failed to write trace file" EOL );
+    }
+
     /* Data are collected, now process and report */
+    TRACE_DUMP( _traceFmt, TL_NUM_EVENTS );
+    genericsReport( V_WARN, "Call stack reached depth %d, resynced %" PRIu64 " times, %" PRIu64 " records cut short" EOL, _r.stack.highWater, _r.stack.resyncs, _r.recLost );
+
+    if ( _r.useCct )
+    {
+        genericsReport( V_WARN, "Calling context tree %u nodes (%zu KBytes), %" PRIu64 " calls truncated" EOL,
+                        _r.cct.nodes, cctMemory( &_r.cct ) / 1024, _r.cct.truncated );
+    }
+
     genericsReport( V_WARN, "Received %d raw sample bytes, %ld function changes, %ld distinct addresses" EOL, _r.intervalBytes, HASH_COUNT( _r.subhead ), HASH_COUNT( _r.insthead ) );
 
     if ( HASH_COUNT( _r.subhead ) )
@@ -828,6 +1062,17 @@ int main( int argc, char *argv[] )
         {
             genericsReport( V_WARN, "Output Profile" EOL );
         }
+
+        if ( ext_ff_outputPprof( _r.options->pproffile, _r.options->elffile, _r.options->truncateDeleteMaterial ? _r.options->deleteMaterial : NULL,
+                                 _r.tcount - _r.starttcount, _r.insthead, _r.subhead, _r.useCct ? &_r.cct : NULL, _r.s ) )
+        {
+            genericsReport( V_WARN, "Output pprof" EOL );
+        }
+
+        if ( ext_ff_outputFolded( _r.options->foldedfile, &_r.cct, _r.insthead, _r.s ) )
+        {
+            genericsReport( V_WARN, "Output folded stacks" EOL );
+        }
     }
 
     return OK;
@@ -27,6 +27,7 @@
 #include "symbols.h"
 #include "msgSeq.h"
 #include "nw.h"
+#include "traceFile.h"
 
 #define CUTOFF              (10)             /* Default cutoff at 0.1% */
 #define TOP_UPDATE_INTERVAL (1000)           /* Interval between each on screen update */
@@ -1094,6 +1095,7 @@ int main( int argc, char *argv[] )
 
 {
     int sourcefd;
+    struct traceFileReader *f = NULL;
     struct sockaddr_in serv_addr;
     struct hostent *server;
     uint8_t cbw[TRANSFER_SIZE];
@@ -1201,11 +1203,12 @@ int main( int argc, char *argv[] )
         }
         else
         {
-            if ( ( sourcefd = open( options.file, O_RDONLY ) ) < 0 )
+            if ( !( f = traceFileOpen( options.file ) ) )
             {
-                genericsExit( sourcefd, "Can't open file %s" EOL, options.file );
+                genericsExit( -ENOENT, "Can't open file %s" EOL, options.file );
             }
 
+            sourcefd = traceFileFd( f );
         }
 
         if ( ( !options.json ) || ( options.json[0] != '-' ) )
@@ -1241,7 +1244,7 @@ int main( int argc, char *argv[] )
 
             if ( r > 0 )
             {
-                t = read( sourcefd, cbw, TRANSFER_SIZE );
+                t = f ? traceFileRead( f, cbw, TRANSFER_SIZE ) : read( sourcefd, cbw, TRANSFER_SIZE );
 
                 if ( t <= 0 )
                 {
@@ -1319,7 +1322,15 @@ int main( int argc, char *argv[] )
             }
         }
 
-        close( sourcefd );
+        if ( f )
+        {
+            traceFileClose( f );
+            f = NULL;
+        }
+        else
+        {
+            close( sourcefd );
+        }
     }
 
     if ( ( !ITMDecoderGetStats( &_r.i )->tpiuSyncCount ) )
@@ -17,6 +17,7 @@
 #include <strings.h>
 #include <string.h>
 #include <pthread.h>
+#include <inttypes.h>
 #if defined OSX
     #include <sys/ioctl.h>
     #include <libusb.h>
@@ -44,6 +45,8 @@
 #include "tpiuDecoder.h"
 
 #include "nwclient.h"
+#include "traceFile.h"
+#include "lz4Frame.h"
 
 #define SEGGER_HOST "localhost"               /* Address to connect to SEGGER */
 #define SEGGER_PORT (2332)
@@ -75,6 +78,18 @@ static const struct deviceList
 /* Interval between blocks for timeouts..smaller means smoother, but higher CPU load */
 #define BLOCK_TIMEOUT_INTERVAL_MS (50)
 
+/* Longest a plain (not -R) file replay waits for the clients to take data before giving up */
+#define CLIENT_TIMEOUT_MS (1000)
+
+/* How a file is replayed */
+enum replayMode
+{
+    REPLAY_NORMAL,                                       /* Read it as it comes */
+    REPLAY_FAST,                                         /* As fast as the clients will take it, and say how fast that was */
+    REPLAY_RATE,                                         /* At a fixed data rate */
+    REPLAY_TIMED                                         /* At the rate it was captured, from the times in an indexed capture */
+};
+
 /* Record for options, either defaults or from command line */
 struct Options
 {
@@ -90,7 +105,11 @@ struct Options
     uint32_t dataSpeed;                                  /* Effective data speed (can be less than link speed!) */
     char *file;                                          /* File host connection */
     bool fileTerminate;                                  /* Terminate when file read isn't successful */
+    char *fileRange;                                     /* Part of the file to be replayed */
+    enum replayMode replay;                              /* How fast to replay it */
+    double replayRate;                                   /* ...in MB/s, for REPLAY_RATE */
     char *outfile;                                       /* Output file for raw data dumping */
+    bool compressOutput;                                 /* ...and if it's to be compressed */
 
     uint32_t intervalReportTime;                         /* If we want interval reports about performance */
 
@@ -128,10 +147,13 @@ struct RunTime
     pthread_t intervalThread;                                                /* Thread reporting on intervals */
     pthread_t processThread;                                                 /* Thread distributing to clients */
     sem_t     dataForClients;                                                /* Semaphore counting data for clients */
+    sem_t     blocksFree;                                                    /* ...and the space left for a file to be read into */
     bool      ending;                                                        /* Flag indicating app is terminating */
     int f;                                                                   /* File handle to data source */
 
     int opFileHandle;                                                         /* Handle if we're writing orb output locally */
+    struct lz4FrameWriter *opCompress;                                       /* Compressor for it, if it's being compressed */
+    pthread_mutex_t opLock;                                                  /* Keeps writes away from the compressor closing */
     struct Options *options;                                                 /* Command line options (reference to above) */
 
     uint8_t wp;                                                              /* Read and write pointers into transfer buffers */
@@ -256,6 +278,15 @@ static void _doExit( void )
     /* Give them a bit of time, then we're leaving anyway */
     usleep( 200 );
 
+    if ( _r.opCompress )
+    {
+        /* Finish the compressed frame, so it can be read back */
+        pthread_mutex_lock( &_r.opLock );
+        lz4FrameWriterClose( _r.opCompress, NULL );
+        _r.opCompress = NULL;
+        pthread_mutex_unlock( &_r.opLock );
+    }
+
     if ( _r.opFileHandle )
     {
         close( _r.opFileHandle );
@@ -269,14 +300,19 @@ void _printHelp( char *progName )
     genericsPrintf( "       -a: <serialSpeed> to use" EOL );
     genericsPrintf( "       -e: When reading from file, terminate at end of file" EOL );
     genericsPrintf( "       -f: <filename> Take input from specified file" EOL );
+    genericsPrintf( "       -F: <from>[,<to>] Only replay this part of the input file; byte offsets, <n>s seconds into" EOL );
+    genericsPrintf( "           an indexed capture, or @<n> wall-clock seconds since the epoch" EOL );
     genericsPrintf( "       -h: This help" EOL );
     genericsPrintf( "       -l: <port> Listen port for the incoming connections (defaults to %d)" EOL, NWCLIENT_SERVER_PORT );
     genericsPrintf( "       -m: <interval> Output monitor information about the link at <interval>ms" EOL );
     genericsPrintf( "       -o: <filename> to be used for dump file" EOL );
     genericsPrintf( "       -p: <serialPort> to use" EOL );
+    genericsPrintf( "       -R: <fast|real|n> Replay the input file as fast as the clients take it, at the rate an indexed" EOL );
+    genericsPrintf( "           capture was received, or at n MB/s, and report the throughput. Waits for a client first" EOL );
     genericsPrintf( "       -s: <Server>:<Port> to use" EOL );
     genericsPrintf( "       -t: <Channel , ...> Use TPIU channels (and strip TIPU framing from output flows)" EOL );
     genericsPrintf( "       -v: <level> Verbose mode 0(errors)..3(debug)" EOL );
+    genericsPrintf( "       -z: Compress the dump file (LZ4 frame format, readable by the lz4 tools and file replay)" EOL );
 }
 // ====================================================================================================
 int _processOptions( int argc, char *argv[], struct RunTime *r )
@@ -285,7 +321,9 @@ int _processOptions( int argc, char *argv[], struct RunTime *r )
     int c;
 #define DELIMITER ','
 
-    while ( ( c = getopt ( argc, argv, "a:ef:hl:m:no:p:s:t:v:" ) ) != -1 )
+    char *e;
+
+    while ( ( c = getopt ( argc, argv, "a:ef:F:hl:m:no:p:R:s:t:v:z" ) ) != -1 )
         switch ( c )
         {
             // ------------------------------------
@@ -305,6 +343,11 @@ int _processOptions( int argc, char *argv[], struct RunTime *r )
                 r->options->file = optarg;
                 break;
 
+            // ------------------------------------
+            case 'F':
+                r->options->fileRange = optarg;
+                break;
+
             // ------------------------------------
             case 'h':
                 _printHelp( argv[0] );
@@ -336,6 +379,29 @@ int _processOptions( int argc, char *argv[], struct RunTime *r )
 
             // ------------------------------------
 
+            case 'R':
+                if ( !strcmp( optarg, "fast" ) )
+                {
+                    r->options->replay = REPLAY_FAST;
+                }
+                else if ( !strcmp( optarg, "real" ) )
+                {
+                    r->options->replay = REPLAY_TIMED;
+                }
+                else if ( ( ( r->options->replayRate = strtod( optarg, &e ) ) > 0 ) && ( !*e ) )
+                {
+                    r->options->replay = REPLAY_RATE;
+                }
+                else
+                {
+                    genericsReport( V_ERROR, "Replay speed must be fast, real or a rate in MB/s" EOL );
+                    return false;
+                }
+
+                break;
+
+            // ------------------------------------
+
             case 's':
                 r->options->seggerHost = optarg;
 
@@ -371,6 +437,11 @@ int _processOptions( int argc, char *argv[], struct RunTime *r )
                 genericsSetReportLevel( atoi( optarg ) );
                 break;
 
+            // ------------------------------------
+            case 'z':
+                r->options->compressOutput = true;
+                break;
+
             // ------------------------------------
 
             case '?':
@@ -417,7 +488,7 @@ int _processOptions( int argc, char *argv[], struct RunTime *r )
 
     if ( r->options->outfile )
     {
-        genericsReport( V_INFO, "Raw Output file: %s" EOL, r->options->outfile );
+        genericsReport( V_INFO, "Raw Output file: %s%s" EOL, r->options->outfile, r->options->compressOutput ? " (Compressed)" : "" );
     }
 
     if ( r->options->seggerPort )
@@ -446,6 +517,35 @@ int _processOptions( int argc, char *argv[], struct RunTime *r )
         {
             genericsReport( V_INFO, " (Ongoing read)" EOL );
         }
+
+        if ( r->options->fileRange )
+        {
+            genericsReport( V_INFO, "Replay Range  : %s" EOL, r->options->fileRange );
+        }
+
+        switch ( r->options->replay )
+        {
+            case REPLAY_FAST:
+                genericsReport( V_INFO, "Replay Speed  : As fast as possible" EOL );
+                break;
+
+            case REPLAY_RATE:
+                genericsReport( V_INFO, "Replay Speed  : %.2f MB/s" EOL, r->options->replayRate );
+                break;
+
+            case REPLAY_TIMED:
+                genericsReport( V_INFO, "Replay Speed  : As captured" EOL );
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    if ( ( r->options->replay != REPLAY_NORMAL ) && ( !r->options->file ) )
+    {
+        genericsReport( V_ERROR, "Replay speed can only be set for a file" EOL );
+        return false;
     }
 
     if ( ( r->options->file ) && ( ( r->options->port ) || ( r->options->seggerPort ) ) )
@@ -619,6 +719,30 @@ static void _stripTPIU( struct RunTime *r, uint8_t *c, int bytes )
     }
 }
 // ====================================================================================================
+static bool _writeOutput( const uint8_t *b, size_t len )
+
+/* Write raw data to the dump file, through the compressor if there is one */
+
+{
+    bool ok = true;
+
+    if ( !_r.options->compressOutput )
+    {
+        return ( write( _r.opFileHandle, b, len ) >= 0 );
+    }
+
+    /* Once the compressor has been closed on the way out, anything else is dropped */
+    pthread_mutex_lock( &_r.opLock );
+
+    if ( _r.opCompress )
+    {
+        ok = lz4FrameWriterWrite( _r.opCompress, b, len );
+    }
+
+    pthread_mutex_unlock( &_r.opLock );
+    return ok;
+}
+// ====================================================================================================
 static void *_processBlocks( void *params )
 /* Generic block processor for received data */
 
@@ -658,7 +782,7 @@ static void *_processBlocks( void *params )
 
                 if ( _r.opFileHandle )
                 {
-                    if ( write( _r.opFileHandle, r->rawBlock[r->rp].buffer, r->rawBlock[r->rp].fillLevel ) < 0 )
+                    if ( !_writeOutput( r->rawBlock[r->rp].buffer, r->rawBlock[r->rp].fillLevel ) )
                     {
                         genericsExit( -3, "Writing to file failed" EOL );
                     }
@@ -678,6 +802,12 @@ static void *_processBlocks( void *params )
             }
 
             r->rp = ( r->rp + 1 ) % NUM_RAW_BLOCKS;
+
+            if ( r->options->file )
+            {
+                /* A file waits for space rather than overwriting what's not been sent yet */
+                sem_post( &r->blocksFree );
+            }
         }
     }
 
@@ -697,7 +827,7 @@ static void _usb_callback( struct libusb_transfer *t )
 
         if ( _r.opFileHandle )
         {
-            if ( write( _r.opFileHandle, t->buffer, t->actual_length ) < 0 )
+            if ( !_writeOutput( t->buffer, t->actual_length ) )
             {
                 genericsExit( -4, "Writing to file failed (%s)" EOL, strerror( errno ) );
             }
@@ -1014,22 +1144,172 @@ int serialFeeder( struct RunTime *r )
     return 0;
 }
 // ====================================================================================================
+static bool _clientsConnected( struct RunTime *r )
+
+/* Is anyone connected to any of the outputs? */
+
+{
+    if ( r->n )
+    {
+        return nwclientConnected( r->n );
+    }
+
+    for ( int i = 0; i < r->numHandlers; i++ )
+    {
+        if ( nwclientConnected( r->handler[i].n ) )
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+// ====================================================================================================
+static bool _clientsPending( struct RunTime *r )
+
+/* Is anything still on its way out to a client? */
+
+{
+    if ( r->n )
+    {
+        return nwclientPending( r->n );
+    }
+
+    for ( int i = 0; i < r->numHandlers; i++ )
+    {
+        if ( nwclientPending( r->handler[i].n ) )
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+// ====================================================================================================
+static void _replayPace( struct RunTime *r, uint64_t dueuS, uint64_t *lateuS )
+
+/* Hold the replay back until the next block is due, keeping track of how far behind it gets */
+
+{
+    uint64_t nowuS = genericsTimestampuS();
+
+    if ( ( nowuS > dueuS ) && ( nowuS - dueuS > *lateuS ) )
+    {
+        *lateuS = nowuS - dueuS;
+    }
+
+    /* Sleep in short steps, there could be a long gap in a capture */
+    while ( ( !r->ending ) && ( nowuS < dueuS ) )
+    {
+        usleep( ( dueuS - nowuS > 100000 ) ? 100000 : dueuS - nowuS );
+        nowuS = genericsTimestampuS();
+    }
+}
+// ====================================================================================================
+static bool _waitForClients( struct RunTime *r, bool drain )
+
+/* Wait for a block to become free (or for everything to have gone, if draining). A replay run with */
+/* -R is about how the clients cope, so it waits as long as they take. Otherwise a client that     */
+/* has stopped reading is reported, and with -e it is given up on rather than never finishing.    */
+
+{
+    uint32_t startmS = genericsTimestampmS();
+    bool warned = false;
+
+    if ( ( !drain ) && ( r->options->replay != REPLAY_NORMAL ) )
+    {
+        sem_wait( &r->blocksFree );
+        return true;
+    }
+
+    while ( !r->ending )
+    {
+        if ( ( drain ) ? ( ( r->rp == r->wp ) && ( !_clientsPending( r ) ) ) : ( !sem_trywait( &r->blocksFree ) ) )
+        {
+            return true;
+        }
+
+        if ( ( r->options->replay == REPLAY_NORMAL ) && ( !warned ) && ( genericsTimestampmS() - startmS >= CLIENT_TIMEOUT_MS ) )
+        {
+            if ( r->options->fileTerminate )
+            {
+                genericsReport( V_WARN, "Clients stopped taking data" EOL );
+                return false;
+            }
+
+            /* Could just be paused (e.g. in a debugger), so keep going once they pick up again */
+            genericsReport( V_WARN, "Clients stopped taking data, waiting for them" EOL );
+            warned = true;
+        }
+
+        usleep( 1000 );
+    }
+
+    return false;
+}
+// ====================================================================================================
 int fileFeeder( struct RunTime *r )
 
 {
-    if ( ( r->f = open( r->options->file, O_RDONLY ) ) < 0 )
+    struct traceFileReader *tf;
+    uint64_t startuS;
+    uint64_t elapseduS;
+    uint64_t firstTimeuS = 0;
+    uint64_t timeuS;
+    uint64_t bytes = 0;
+    uint64_t blocks = 0;
+    uint64_t lateuS = 0;
+    bool stalled = false;
+
+    if ( !( tf = traceFileOpen( r->options->file ) ) )
     {
         genericsExit( -4, "Can't open file %s" EOL, r->options->file );
     }
 
+    if ( ( r->options->fileRange ) && ( !traceFileSetRange( tf, r->options->fileRange ) ) )
+    {
+        genericsExit( -4, "Can't replay %s from file %s" EOL, r->options->fileRange, r->options->file );
+    }
+
+    if ( ( r->options->replay == REPLAY_TIMED ) && ( !traceFileTimed( tf ) ) )
+    {
+        genericsExit( -4, "%s isn't an indexed capture, so it can't be replayed as captured" EOL, r->options->file );
+    }
+
+    if ( r->options->replay != REPLAY_NORMAL )
+    {
+        /* This is for seeing how the clients cope, so make sure there's one there from the start */
+        genericsReport( V_INFO, "Waiting for a client to connect" EOL );
+
+        while ( ( !r->ending ) && ( !_clientsConnected( r ) ) )
+        {
+            usleep( 10000 );
+        }
+    }
+
+    startuS = genericsTimestampuS();
+
     while ( !r->ending )
     {
         struct dataBlock *rxBlock = &r->rawBlock[r->wp];
-        rxBlock->fillLevel = read( r->f, rxBlock->buffer, TRANSFER_SIZE );
+
+        /* Don't read into a block until the clients have had what was in it */
+        if ( !_waitForClients( r, false ) )
+        {
+            stalled = true;
+            break;
+        }
+
+        if ( ( rxBlock->fillLevel = traceFileRead( tf, rxBlock->buffer, TRANSFER_SIZE ) ) < 0 )
+        {
+            break;
+        }
 
         if ( !rxBlock->fillLevel )
         {
-            if ( r->options->fileTerminate )
+            sem_post( &r->blocksFree );
+
+            if ( ( r->options->fileTerminate ) || ( traceFileDone( tf ) ) )
             {
                 break;
             }
@@ -1041,16 +1321,62 @@ int fileFeeder( struct RunTime *r )
             }
         }
 
+        switch ( r->options->replay )
+        {
+            case REPLAY_RATE:
+                _replayPace( r, startuS + bytes * 1000000.0 / ( r->options->replayRate * 1024 * 1024 ), &lateuS );
+                break;
+
+            case REPLAY_TIMED:
+                timeuS = traceFileReadTimeuS( tf );
+
+                if ( !blocks )
+                {
+                    firstTimeuS = timeuS;
+                }
+
+                _replayPace( r, startuS + ( ( timeuS > firstTimeuS ) ? timeuS - firstTimeuS : 0 ), &lateuS );
+                break;
+
+            default:
+                break;
+        }
+
+        bytes += rxBlock->fillLevel;
+        blocks++;
+
         r->wp = ( r->wp + 1 ) % NUM_RAW_BLOCKS;
         sem_post( &r->dataForClients );
     }
 
-    if ( !r->options->fileTerminate )
+    if ( ( !stalled ) && ( !r->options->fileTerminate ) && ( !traceFileDone( tf ) ) )
     {
         genericsReport( V_INFO, "File read error" EOL );
     }
 
-    close( r->f );
+    traceFileClose( tf );
+
+    /* Let the clients have everything before leaving, or saying how long it took */
+    if ( !stalled )
+    {
+        _waitForClients( r, true );
+    }
+
+    if ( r->options->replay != REPLAY_NORMAL )
+    {
+        elapseduS = genericsTimestampuS() - startuS;
+        genericsPrintf( "Replayed %" PRIu64 " bytes in %" PRIu64 " blocks in %" PRIu64 ".%03" PRIu64 "s, %.2f MB/s",
+                        bytes, blocks, elapseduS / 1000000, ( elapseduS / 1000 ) % 1000,
+                        elapseduS ? bytes * 1000000.0 / ( elapseduS * 1024.0 * 1024.0 ) : 0.0 );
+
+        if ( r->options->replay != REPLAY_FAST )
+        {
+            genericsPrintf( ", up to %" PRIu64 " mS behind", lateuS / 1000 );
+        }
+
+        genericsPrintf( EOL );
+    }
+
     return true;
 }
 // ====================================================================================================
@@ -1060,6 +1386,8 @@ int main( int argc, char *argv[] )
     /* Setup TPIU in case we call it into service later */
     TPIUDecoderInit( &_r.t );
     sem_init( &_r.dataForClients, 0, 0 );
+    sem_init( &_r.blocksFree, 0, NUM_RAW_BLOCKS - 1 );
+    pthread_mutex_init( &_r.opLock, NULL );
 
     if ( !_processOptions( argc, argv, &_r ) )
     {
@@ -1148,6 +1476,12 @@ int main( int argc, char *argv[] )
             genericsReport( V_ERROR, "Could not open output file for writing" EOL );
             return -2;
         }
+
+        if ( ( _r.options->compressOutput ) && ( !( _r.opCompress = lz4FrameWriterCreate( _r.opFileHandle ) ) ) )
+        {
+            genericsReport( V_ERROR, "Could not start compressing output file" EOL );
+            return -2;
+        }
     }
 
     if ( _r.options->seggerPort )
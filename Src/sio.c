@@ -16,7 +16,7 @@
 #include "sio.h"
 
 /* Colours for output */
-enum CP { CP_NONE, CP_EVENT, CP_NORMAL, CP_FILEFUNCTION, CP_LINENO, CP_EXECASSY, CP_NEXECASSY, CP_BASELINE, CP_BASELINETEXT, CP_SEARCH, CP_DEBUG };
+enum CP { CP_NONE, CP_EVENT, CP_NORMAL, CP_FILEFUNCTION, CP_LINENO, CP_EXECASSY, CP_NEXECASSY, CP_BASELINE, CP_BASELINETEXT, CP_SEARCH, CP_DEBUG, CP_LOOP };
 
 /* Search types */
 enum SRCH { SRCH_OFF, SRCH_FORWARDS, SRCH_BACKWARDS };
@@ -157,6 +157,7 @@ static void _outputHelp( struct SIOInstance *sio )
     wattrset( sio->outputWindow, A_BOLD | COLOR_PAIR( CP_NORMAL ) );
     wprintw( sio->outputWindow, EOL "  Important Keys..." EOL EOL );
     wprintw( sio->outputWindow, "       H: Hold or resume sampling" EOL );
+    wprintw( sio->outputWindow, "       L: Fold or unfold repeated loop iterations" EOL );
     wprintw( sio->outputWindow, "       M: Mark a location in the sample buffer, followed by 0..%d" EOL, MAX_TAGS - 1 );
     wprintw( sio->outputWindow, "       S: Save current buffer to file" EOL );
     wprintw( sio->outputWindow, "       Q: Quit the application" EOL );
@@ -506,6 +507,7 @@ static bool _displayLine( struct SIOInstance *sio, int32_t lineNum, int32_t scre
     short pair;
     char *ssp;                  /* Position in search match string */
     char *u;
+    char loopText[80];          /* Constructed text for a folded loop */
 
     /* Make sure this line is valid */
     if ( ( lineNum < 0 ) || ( lineNum >= sio->opTextWline ) )
@@ -553,6 +555,12 @@ static bool _displayLine( struct SIOInstance *sio, int32_t lineNum, int32_t scre
             wattrset( sio->outputWindow, ( highlight ? A_STANDOUT : 0 ) | COLOR_PAIR( CP_DEBUG ) );
             break;
 
+        case LT_LOOP:
+            snprintf( loopText, sizeof( loopText ), LOOP_FOLD_FMT, ( *sio->opText )[lineNum].line, ( ( *sio->opText )[lineNum].line == 1 ) ? "" : "s" );
+            u = loopText;
+            wattrset( sio->outputWindow, ( highlight ? A_STANDOUT : 0 ) | A_BOLD | COLOR_PAIR( CP_LOOP ) );
+            break;
+
         default:
             wattrset( sio->outputWindow, ( highlight ? A_STANDOUT : 0 ) | COLOR_PAIR( CP_NORMAL ) );
             break;
@@ -859,6 +867,7 @@ struct SIOInstance *SIOsetup( const char *progname, const char *elffile, bool is
         init_pair( CP_BASELINETEXT, COLOR_YELLOW, COLOR_BLACK );
         init_pair( CP_SEARCH, COLOR_GREEN, COLOR_BLACK );
         init_pair( CP_DEBUG, COLOR_MAGENTA, COLOR_BLACK );
+        init_pair( CP_LOOP, COLOR_GREEN, COLOR_BLACK );
     }
 
     sio->outputWindow = newwin( OUTPUT_WINDOW_L, OUTPUT_WINDOW_W, 0, 0 );
@@ -1007,6 +1016,11 @@ enum SIOEvent SIOHandler( struct SIOInstance *sio, bool isTick, uint64_t oldinte
                     op = SIO_EV_HOLD;
                     break;
 
+                case 'l':
+                case 'L':
+                    op = SIO_EV_FOLD;
+                    break;
+
                 case 261:
                     op = SIO_EV_DIVE;
                     break;
@@ -0,0 +1,896 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Segmented, indexed trace capture files
+ * ======================================
+ *
+ * The writer collects each segment behind space for its header, so the whole thing goes out in
+ * one write once it's complete, and keeps the index in memory until the capture is closed. The
+ * reader walks segment headers as it goes, so it can follow a capture that's still being
+ * written, and only loads the index when it's asked to start part way through. Compressed files
+ * are decompressed a block at a time underneath all of that; going backwards in one means
+ * starting again from the top.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+
+#include "generics.h"
+#include "lz4Frame.h"
+#include "traceFile.h"
+
+#define ITM_SYNC_LEAD  (5)                   /* ITM sync is (at least) 5 zeros then 0x80 */
+#define TPIU_SYNC_LEAD (3)                   /* TPIU full sync is 0xff 0xff 0xff 0x7f */
+
+struct traceFileWriter
+{
+    uint8_t *buffer;                         /* Segment header followed by its payload */
+    struct traceFileSegment *seg;            /* ...the header part of it */
+    uint32_t segSize;                        /* Most payload a segment can hold */
+    uint64_t segTimeuS;                      /* ...and longest time it can span */
+
+    uint64_t offset;                         /* Stream offset of the next byte */
+    uint64_t fileOffset;                     /* File offset of the next segment */
+
+    uint8_t syncLead;                        /* Byte a sync starts with */
+    uint8_t syncEnd;                         /* ...the one that ends it */
+    uint32_t syncLen;                        /* ...and how many leading bytes it needs */
+    uint32_t run;                            /* Leading bytes at the end of the last commit */
+
+    struct traceFileIndexEntry *index;       /* Segments written so far */
+    uint32_t numSegments;                    /* ...how many of them */
+    uint32_t maxSegments;                    /* ...and how many there's room for */
+
+    traceFileWriteFn fn;                     /* Output routine */
+    void *param;                             /* ...and its parameter */
+};
+
+struct traceFileReader
+{
+    int fd;                                  /* File being read */
+    bool seekable;                           /* It's a regular file, so we can move around in it */
+    bool indexed;                            /* It's a segmented capture rather than a flat file */
+    bool done;                               /* Nothing more will come from it */
+    struct traceFileHeader h;                /* Capture header, if indexed */
+
+    /* Decompression, when the file is compressed. Offsets below are then in the decompressed file */
+    bool compressed;                         /* File is an LZ4 frame */
+    struct lz4FrameInfo z;                   /* ...what its header said */
+    uint8_t *zin;                            /* Compressed block */
+    uint8_t *zout;                           /* ...and what it decompressed to */
+    size_t zoutLen;                          /* ...its length */
+    uint64_t zpos;                           /* Decompressed offset of the start of it */
+    uint64_t zfileOffset;                    /* File offset of the next block */
+    bool zend;                               /* The end of the frame has been reached */
+
+    struct traceFileIndexEntry *index;       /* Segments in the capture, once they're needed */
+    uint32_t numSegments;                    /* ...and how many of them there are */
+
+    uint64_t fileOffset;                     /* File offset of the next byte to read */
+    uint64_t offset;                         /* Stream offset of that byte */
+    uint32_t segLeft;                        /* Payload left in the current segment */
+    uint64_t end;                            /* Stream offset to stop replaying at */
+
+    /* When what's being read was received, for pacing a replay */
+    uint32_t seg;                            /* Index entry for the current segment, if the index is loaded */
+    uint64_t segTimeuS;                      /* Host time the current segment was started */
+    uint64_t segOffset;                      /* ...its stream offset */
+    uint32_t segLen;                         /* ...and its length */
+    uint64_t readTimeuS;                     /* Host time the start of the last read was received */
+};
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static void _findSync( struct traceFileWriter *w, const uint8_t *b, size_t len )
+
+/* Look for the first sync completed in this part of the segment, and note where it starts */
+
+{
+    const uint8_t *p = b;
+    const uint8_t *end = b + len;
+    uint32_t n;
+
+    while ( ( p < end ) && ( p = ( const uint8_t * )memchr( p, w->syncEnd, end - p ) ) )
+    {
+        /* Count the leading bytes before it, carrying on into what came before if need be */
+        for ( n = 0; ( n < w->syncLen ) && ( p - n > b ) && ( p[-1 - ( int )n] == w->syncLead ); n++ );
+
+        if ( p - n == b )
+        {
+            n += w->run;
+        }
+
+        if ( n >= w->syncLen )
+        {
+            w->seg->syncOffset = w->offset + ( p - b ) - w->syncLen;
+            return;
+        }
+
+        p++;
+    }
+}
+// ====================================================================================================
+static void _trailingRun( struct traceFileWriter *w, const uint8_t *b, size_t len )
+
+/* Count the leading bytes at the end of this part, in case a sync is completed in the next one */
+
+{
+    uint32_t n;
+
+    for ( n = 0; ( n < w->syncLen ) && ( n < len ) && ( b[len - 1 - n] == w->syncLead ); n++ );
+
+    if ( n == len )
+    {
+        n += w->run;
+    }
+
+    w->run = ( n < w->syncLen ) ? n : w->syncLen;
+}
+// ====================================================================================================
+static bool _flushSegment( struct traceFileWriter *w )
+
+/* Write out the segment that's been collected and note it in the index */
+
+{
+    struct traceFileIndexEntry *e;
+    size_t len = sizeof( struct traceFileSegment ) + w->seg->len;
+
+    if ( w->numSegments == w->maxSegments )
+    {
+        w->maxSegments = w->maxSegments ? w->maxSegments * 2 : 64;
+        w->index = ( struct traceFileIndexEntry * )realloc( w->index, w->maxSegments * sizeof( struct traceFileIndexEntry ) );
+
+        if ( !w->index )
+        {
+            genericsReport( V_ERROR, "No memory for capture index" EOL );
+            return false;
+        }
+    }
+
+    e = &w->index[w->numSegments++];
+    e->timeuS = w->seg->timeuS;
+    e->offset = w->seg->offset;
+    e->syncOffset = w->seg->syncOffset;
+    e->fileOffset = w->fileOffset;
+    e->len = w->seg->len;
+    e->spare = 0;
+
+    w->fileOffset += len;
+
+    if ( !w->fn( w->param, w->buffer, len ) )
+    {
+        return false;
+    }
+
+    w->seg->len = 0;
+    return true;
+}
+// ====================================================================================================
+static int _zblock( struct traceFileReader *r )
+
+/* Decompress the next block of a compressed file; 1 if there was one, 0 if there isn't yet */
+
+{
+    uint8_t b[4];
+    uint32_t size;
+    ssize_t n;
+
+    if ( ( r->zend ) || ( pread( r->fd, b, sizeof( b ), r->zfileOffset ) != sizeof( b ) ) )
+    {
+        return 0;
+    }
+
+    size = b[0] | ( b[1] << 8 ) | ( b[2] << 16 ) | ( ( uint32_t )b[3] << 24 );
+
+    if ( !size )
+    {
+        r->zend = true;
+        return 0;
+    }
+
+    if ( ( size & ~LZ4FRAME_UNCOMPRESSED ) > r->z.blockMax )
+    {
+        genericsReport( V_ERROR, "Compressed file is damaged at offset %" PRIu64 EOL, r->zfileOffset );
+        return -1;
+    }
+
+    /* A block that's still being written will be complete next time */
+    if ( pread( r->fd, r->zin, size & ~LZ4FRAME_UNCOMPRESSED, r->zfileOffset + 4 ) != ( ssize_t )( size & ~LZ4FRAME_UNCOMPRESSED ) )
+    {
+        return 0;
+    }
+
+    if ( size & LZ4FRAME_UNCOMPRESSED )
+    {
+        n = size & ~LZ4FRAME_UNCOMPRESSED;
+        memcpy( r->zout, r->zin, n );
+    }
+    else if ( ( n = lz4FrameDecompressBlock( r->zin, size, r->zout, r->z.blockMax ) ) < 0 )
+    {
+        genericsReport( V_ERROR, "Compressed block is damaged at offset %" PRIu64 EOL, r->zfileOffset );
+        return -1;
+    }
+
+    r->zpos += r->zoutLen;
+    r->zoutLen = n;
+    r->zfileOffset += 4 + ( size & ~LZ4FRAME_UNCOMPRESSED ) + ( r->z.blockChecksum ? 4 : 0 );
+    return 1;
+}
+// ====================================================================================================
+static ssize_t _source( struct traceFileReader *r, void *b, size_t len, uint64_t fileOffset )
+
+/* Read what there is from a particular place in the (decompressed) file */
+
+{
+    int rc;
+
+    if ( !r->compressed )
+    {
+        return ( r->seekable ) ? pread( r->fd, b, len, fileOffset ) : read( r->fd, b, len );
+    }
+
+    if ( fileOffset < r->zpos )
+    {
+        /* There's no going back in a compressed file, so start again from the top */
+        r->zfileOffset = r->z.headerLen;
+        r->zpos = r->zoutLen = 0;
+        r->zend = false;
+    }
+
+    while ( fileOffset >= r->zpos + r->zoutLen )
+    {
+        if ( ( rc = _zblock( r ) ) <= 0 )
+        {
+            return rc;
+        }
+    }
+
+    if ( len > r->zpos + r->zoutLen - fileOffset )
+    {
+        len = r->zpos + r->zoutLen - fileOffset;
+    }
+
+    memcpy( b, &r->zout[fileOffset - r->zpos], len );
+    return len;
+}
+// ====================================================================================================
+static ssize_t _fill( struct traceFileReader *r, void *b, size_t len, uint64_t fileOffset )
+
+/* Read as much as there is of len bytes from a particular place in the file */
+
+{
+    size_t got = 0;
+    ssize_t n = 0;
+
+    while ( ( got < len ) && ( ( n = _source( r, ( uint8_t * )b + got, len - got, fileOffset + got ) ) > 0 ) )
+    {
+        got += n;
+    }
+
+    return ( ( !got ) && ( n < 0 ) ) ? n : ( ssize_t )got;
+}
+// ====================================================================================================
+static bool _readAt( struct traceFileReader *r, void *b, size_t len, uint64_t fileOffset )
+
+/* Read something complete from a particular place in the file */
+
+{
+    return ( _fill( r, b, len, fileOffset ) == ( ssize_t )len );
+}
+// ====================================================================================================
+static bool _loadIndex( struct traceFileReader *r )
+
+/* Get the list of segments, from the index if there is one, otherwise by walking the file */
+
+{
+    struct traceFileIndex head;
+    struct traceFileIndex tail;
+    struct traceFileSegment s;
+    struct stat st;
+    uint64_t o;
+    uint32_t maxSegments = 0;
+
+    if ( r->index )
+    {
+        return true;
+    }
+
+    /* The end of a compressed file can only be found by decompressing it, so walk it instead */
+    if ( ( !r->compressed ) && ( !fstat( r->fd, &st ) ) && ( st.st_size >= ( off_t )( r->h.headerLen + 2 * sizeof( struct traceFileIndex ) ) ) &&
+            ( _readAt( r, &tail, sizeof( tail ), st.st_size - sizeof( tail ) ) ) && ( tail.magic == TRACEFILE_INDEX_MAGIC ) &&
+            ( _readAt( r, &head, sizeof( head ), tail.indexOffset ) ) && ( !memcmp( &head, &tail, sizeof( head ) ) ) )
+    {
+        r->numSegments = head.numSegments;
+        r->index = ( struct traceFileIndexEntry * )malloc( ( r->numSegments + 1 ) * sizeof( struct traceFileIndexEntry ) );
+
+        if ( ( r->index ) && ( _readAt( r, r->index, r->numSegments * sizeof( struct traceFileIndexEntry ), head.indexOffset + sizeof( head ) ) ) )
+        {
+            return true;
+        }
+
+        genericsReport( V_WARN, "Capture index is damaged, walking the capture instead" EOL );
+        free( r->index );
+        r->index = NULL;
+    }
+
+    /* No index (the capture was cut short, or is still being written) so find the segments ourselves */
+    r->numSegments = 0;
+
+    for ( o = r->h.headerLen; ( _readAt( r, &s, sizeof( s ), o ) ) && ( s.magic == TRACEFILE_SEG_MAGIC ); o += sizeof( s ) + s.len )
+    {
+        if ( r->numSegments == maxSegments )
+        {
+            maxSegments = maxSegments ? maxSegments * 2 : 64;
+
+            if ( !( r->index = ( struct traceFileIndexEntry * )realloc( r->index, maxSegments * sizeof( struct traceFileIndexEntry ) ) ) )
+            {
+                genericsReport( V_ERROR, "No memory for capture index" EOL );
+                return false;
+            }
+        }
+
+        r->index[r->numSegments].timeuS = s.timeuS;
+        r->index[r->numSegments].offset = s.offset;
+        r->index[r->numSegments].syncOffset = s.syncOffset;
+        r->index[r->numSegments].fileOffset = o;
+        r->index[r->numSegments].len = s.len;
+        r->numSegments++;
+    }
+
+    return true;
+}
+// ====================================================================================================
+static uint32_t _segmentAt( struct traceFileReader *r, uint64_t offset )
+
+/* Find the last segment starting at or before a stream offset */
+
+{
+    uint32_t lo = 0;
+    uint32_t hi = r->numSegments;
+    uint32_t mid;
+
+    while ( hi - lo > 1 )
+    {
+        mid = ( lo + hi ) / 2;
+
+        if ( r->index[mid].offset <= offset )
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+// ====================================================================================================
+static uint32_t _segmentAtTime( struct traceFileReader *r, uint64_t timeuS )
+
+/* Find the first segment received after a host time (numSegments if there isn't one) */
+
+{
+    uint32_t lo = 0;
+    uint32_t hi = r->numSegments;
+    uint32_t mid;
+
+    while ( lo < hi )
+    {
+        mid = ( lo + hi ) / 2;
+
+        if ( r->index[mid].timeuS <= timeuS )
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+// ====================================================================================================
+static void _enterSegment( struct traceFileReader *r, uint64_t timeuS, uint64_t offset, uint32_t len )
+
+/* Note the segment that reading has moved into */
+
+{
+    r->segTimeuS = timeuS;
+    r->segOffset = offset;
+    r->segLen = len;
+
+    if ( r->index )
+    {
+        r->seg = _segmentAt( r, offset );
+    }
+}
+// ====================================================================================================
+static uint64_t _timeAt( struct traceFileReader *r, uint64_t offset )
+
+/* Host time a byte of the current segment was received. When the index says when the next one */
+/* was started, the segment is taken to have arrived evenly over the time in between.           */
+
+{
+    uint64_t nextTimeuS;
+
+    if ( ( !r->index ) || ( r->seg + 1 >= r->numSegments ) || ( !r->segLen ) )
+    {
+        return r->segTimeuS;
+    }
+
+    nextTimeuS = r->index[r->seg + 1].timeuS;
+
+    if ( nextTimeuS <= r->segTimeuS )
+    {
+        return r->segTimeuS;
+    }
+
+    return r->segTimeuS + ( nextTimeuS - r->segTimeuS ) * ( offset - r->segOffset ) / r->segLen;
+}
+// ====================================================================================================
+static void _seek( struct traceFileReader *r, uint64_t offset )
+
+/* Arrange for reading to carry on from a stream offset */
+
+{
+    struct traceFileIndexEntry *e;
+
+    r->offset = offset;
+
+    if ( ( !r->indexed ) || ( !r->numSegments ) )
+    {
+        return;
+    }
+
+    e = &r->index[_segmentAt( r, offset )];
+
+    if ( offset < e->offset )
+    {
+        offset = e->offset;
+    }
+
+    if ( offset > e->offset + e->len )
+    {
+        /* Beyond the end of the capture, so there'll be nothing to read */
+        offset = e->offset + e->len;
+    }
+
+    r->offset = offset;
+    r->fileOffset = e->fileOffset + sizeof( struct traceFileSegment ) + ( offset - e->offset );
+    r->segLeft = e->len - ( offset - e->offset );
+    _enterSegment( r, e->timeuS, e->offset, e->len );
+}
+// ====================================================================================================
+static bool _parsePoint( struct traceFileReader *r, const char *s, bool isEnd, uint64_t *offset )
+
+/* Turn a point in the capture into a stream offset. Plain numbers are byte offsets, <n>s is a */
+/* number of seconds into the capture and @<n> is a wall-clock time in seconds since the epoch. */
+
+{
+    char *e;
+    double secs;
+    uint64_t timeuS;
+    uint32_t seg;
+
+    if ( !*s )
+    {
+        *offset = isEnd ? TRACEFILE_NO_END : 0;
+        return true;
+    }
+
+    if ( ( *s != '@' ) && ( !strchr( s, 's' ) ) )
+    {
+        *offset = strtoull( s, &e, 0 );
+        return ( !*e );
+    }
+
+    secs = strtod( ( *s == '@' ) ? s + 1 : s, &e );
+
+    if ( ( secs < 0 ) || ( ( *s == '@' ) ? *e : strcmp( e, "s" ) ) )
+    {
+        return false;
+    }
+
+    if ( !r->indexed )
+    {
+        genericsReport( V_ERROR, "Times can only be used with indexed captures" EOL );
+        return false;
+    }
+
+    if ( !_loadIndex( r ) )
+    {
+        return false;
+    }
+
+    timeuS = ( uint64_t )( secs * 1000000 ) + ( ( *s == '@' ) ? 0 : r->h.startTimeuS );
+    seg = _segmentAtTime( r, timeuS );
+
+    if ( isEnd )
+    {
+        /* Stop at the first segment that arrived after this time */
+        *offset = ( seg < r->numSegments ) ? r->index[seg].offset : TRACEFILE_NO_END;
+    }
+    else if ( seg )
+    {
+        /* Start at the first sync in the segment that was arriving at this time */
+        seg--;
+        *offset = ( r->index[seg].syncOffset != TRACEFILE_NO_SYNC ) ? r->index[seg].syncOffset : r->index[seg].offset;
+    }
+    else
+    {
+        *offset = 0;
+    }
+
+    return true;
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+uint8_t *traceFileWriterSpace( struct traceFileWriter *w, size_t *len )
+
+/* Return where the next data should go, and how much of it there's room for */
+
+{
+    *len = w->segSize - w->seg->len;
+    return w->buffer + sizeof( struct traceFileSegment ) + w->seg->len;
+}
+// ====================================================================================================
+bool traceFileWriterCommit( struct traceFileWriter *w, size_t len, uint64_t timeuS )
+
+/* Add len bytes, received at timeuS, that have been put in the space offered */
+
+{
+    uint8_t *b = w->buffer + sizeof( struct traceFileSegment ) + w->seg->len;
+
+    if ( !len )
+    {
+        return true;
+    }
+
+    if ( !w->seg->len )
+    {
+        w->seg->timeuS = timeuS;
+        w->seg->offset = w->offset;
+        w->seg->syncOffset = TRACEFILE_NO_SYNC;
+    }
+
+    if ( w->seg->syncOffset == TRACEFILE_NO_SYNC )
+    {
+        _findSync( w, b, len );
+    }
+
+    _trailingRun( w, b, len );
+    w->seg->len += len;
+    w->offset += len;
+
+    if ( ( w->seg->len == w->segSize ) || ( timeuS - w->seg->timeuS >= w->segTimeuS ) )
+    {
+        return _flushSegment( w );
+    }
+
+    return true;
+}
+// ====================================================================================================
+bool traceFileWriterClose( struct traceFileWriter *w )
+
+/* Write out whatever's left, followed by the index, and release the writer */
+
+{
+    struct traceFileIndex i =
+    {
+        .magic = TRACEFILE_INDEX_MAGIC
+    };
+    bool ok = true;
+
+    if ( w->seg->len )
+    {
+        ok = _flushSegment( w );
+    }
+
+    i.numSegments = w->numSegments;
+    i.indexOffset = w->fileOffset;
+
+    ok = ok && w->fn( w->param, ( uint8_t * )&i, sizeof( i ) );
+    ok = ok && ( ( !w->numSegments ) || ( w->fn( w->param, ( uint8_t * )w->index, w->numSegments * sizeof( struct traceFileIndexEntry ) ) ) );
+    ok = ok && w->fn( w->param, ( uint8_t * )&i, sizeof( i ) );
+
+    free( w->index );
+    free( w->buffer );
+    free( w );
+    return ok;
+}
+// ====================================================================================================
+struct traceFileWriter *traceFileWriterCreate( uint32_t flags, uint32_t channel, uint32_t segSize, uint32_t segTimemS,
+        traceFileWriteFn fn, void *param )
+
+/* Start a capture, cut into segments of at most segSize bytes spanning at most segTimemS */
+
+{
+    struct traceFileHeader h =
+    {
+        .magic       = TRACEFILE_MAGIC,
+        .version     = TRACEFILE_VERSION,
+        .headerLen   = sizeof( struct traceFileHeader ),
+        .flags       = flags,
+        .channel     = channel,
+        .startTimeuS = genericsTimestampuS()
+    };
+    struct traceFileWriter *w = ( struct traceFileWriter * )calloc( 1, sizeof( struct traceFileWriter ) );
+
+    if ( ( !w ) || ( !( w->buffer = ( uint8_t * )malloc( sizeof( struct traceFileSegment ) + segSize ) ) ) )
+    {
+        free( w );
+        return NULL;
+    }
+
+    w->seg = ( struct traceFileSegment * )w->buffer;
+    w->seg->magic = TRACEFILE_SEG_MAGIC;
+    w->seg->len = 0;
+    w->segSize = segSize;
+    w->segTimeuS = segTimemS * 1000ULL;
+    w->syncLead = ( flags & TFF_TPIU ) ? 0xff : 0x00;
+    w->syncEnd = ( flags & TFF_TPIU ) ? 0x7f : 0x80;
+    w->syncLen = ( flags & TFF_TPIU ) ? TPIU_SYNC_LEAD : ITM_SYNC_LEAD;
+    w->fn = fn;
+    w->param = param;
+    w->fileOffset = sizeof( h );
+
+    if ( !fn( param, ( uint8_t * )&h, sizeof( h ) ) )
+    {
+        free( w->buffer );
+        free( w );
+        return NULL;
+    }
+
+    return w;
+}
+// ====================================================================================================
+ssize_t traceFileRead( struct traceFileReader *r, uint8_t *buffer, size_t len )
+
+/* Read the next part of the stream, returning 0 when there's nothing more for now */
+
+{
+    struct traceFileSegment s;
+    ssize_t n;
+
+    if ( ( r->done ) || ( r->offset >= r->end ) )
+    {
+        r->done = true;
+        return 0;
+    }
+
+    if ( len > r->end - r->offset )
+    {
+        len = r->end - r->offset;
+    }
+
+    if ( r->indexed )
+    {
+        /* Move on to the next segment, if it's arrived yet */
+        while ( !r->segLeft )
+        {
+            if ( ( n = _fill( r, &s, sizeof( s ), r->fileOffset ) ) < 0 )
+            {
+                return n;
+            }
+
+            if ( ( n >= ( ssize_t )sizeof( uint32_t ) ) && ( s.magic == TRACEFILE_INDEX_MAGIC ) )
+            {
+                r->done = true;
+                return 0;
+            }
+
+            if ( n < ( ssize_t )sizeof( s ) )
+            {
+                return 0;
+            }
+
+            if ( s.magic != TRACEFILE_SEG_MAGIC )
+            {
+                genericsReport( V_ERROR, "Capture is damaged at offset %" PRIu64 EOL, r->fileOffset );
+                return -1;
+            }
+
+            r->fileOffset += sizeof( s );
+            r->segLeft = s.len;
+            r->offset = s.offset;
+            _enterSegment( r, s.timeuS, s.offset, s.len );
+        }
+
+        if ( len > r->segLeft )
+        {
+            len = r->segLeft;
+        }
+
+        r->readTimeuS = _timeAt( r, r->offset );
+
+        if ( ( n = _source( r, buffer, len, r->fileOffset ) ) > 0 )
+        {
+            r->fileOffset += n;
+            r->segLeft -= n;
+            r->offset += n;
+        }
+
+        return n;
+    }
+
+    if ( ( n = _source( r, buffer, len, r->offset ) ) > 0 )
+    {
+        r->offset += n;
+    }
+
+    r->done = ( !n ) && ( r->zend );
+    return n;
+}
+// ====================================================================================================
+bool traceFileDone( struct traceFileReader *r )
+
+/* Has the end of the capture, or the range asked for, been reached? */
+
+{
+    return r->done;
+}
+// ====================================================================================================
+bool traceFileIsIndexed( struct traceFileReader *r )
+
+{
+    return r->indexed;
+}
+// ====================================================================================================
+bool traceFileIsCompressed( struct traceFileReader *r )
+
+{
+    return r->compressed;
+}
+// ====================================================================================================
+bool traceFileTimed( struct traceFileReader *r )
+
+/* Get ready to say when each read was received. The index is needed to spread each segment */
+/* over the time it took to arrive, so this can take a while for a compressed capture.       */
+
+{
+    if ( ( !r->indexed ) || ( !_loadIndex( r ) ) )
+    {
+        return false;
+    }
+
+    r->seg = _segmentAt( r, r->segOffset );
+    return true;
+}
+// ====================================================================================================
+uint64_t traceFileReadTimeuS( struct traceFileReader *r )
+
+/* Host time the first byte of the last read was received */
+
+{
+    return r->readTimeuS;
+}
+// ====================================================================================================
+bool traceFileSetRange( struct traceFileReader *r, const char *range )
+
+/* Only replay part of the stream, given as <from>[,<to>] */
+
+{
+    char from[64];
+    const char *to = strchr( range, ',' );
+    size_t len = to ? ( size_t )( to - range ) : strlen( range );
+    uint64_t start;
+
+    if ( len >= sizeof( from ) )
+    {
+        return false;
+    }
+
+    memcpy( from, range, len );
+    from[len] = 0;
+
+    if ( ( !_parsePoint( r, from, false, &start ) ) || ( !_parsePoint( r, to ? to + 1 : "", true, &r->end ) ) || ( start > r->end ) )
+    {
+        genericsReport( V_ERROR, "Badly formed replay range %s" EOL, range );
+        return false;
+    }
+
+    if ( start )
+    {
+        if ( !r->seekable )
+        {
+            genericsReport( V_ERROR, "Can't seek in this input" EOL );
+            return false;
+        }
+
+        if ( ( r->indexed ) && ( !_loadIndex( r ) ) )
+        {
+            return false;
+        }
+
+        _seek( r, start );
+    }
+
+    genericsReport( V_INFO, "Replaying from offset %" PRIu64 EOL, r->offset );
+    return true;
+}
+// ====================================================================================================
+int traceFileFd( struct traceFileReader *r )
+
+/* The file underneath, for anyone who wants to wait on it */
+
+{
+    return r->fd;
+}
+// ====================================================================================================
+void traceFileClose( struct traceFileReader *r )
+
+{
+    close( r->fd );
+    free( r->index );
+    free( r->zin );
+    free( r->zout );
+    free( r );
+}
+// ====================================================================================================
+struct traceFileReader *traceFileOpen( const char *name )
+
+/* Open a file for replay, working out whether it's compressed, and whether it's a segmented */
+/* capture or a flat one.                                                                    */
+
+{
+    struct traceFileReader *r = ( struct traceFileReader * )calloc( 1, sizeof( struct traceFileReader ) );
+    uint8_t zh[LZ4FRAME_MAX_HEADER];
+    struct stat st;
+    ssize_t n;
+
+    if ( !r )
+    {
+        return NULL;
+    }
+
+    if ( ( r->fd = open( name, O_RDONLY ) ) < 0 )
+    {
+        free( r );
+        return NULL;
+    }
+
+    r->end = TRACEFILE_NO_END;
+    r->seekable = ( !fstat( r->fd, &st ) ) && ( S_ISREG( st.st_mode ) );
+
+    /* Only regular files are checked, anything else can't be put back if it turns out not to be */
+    if ( ( r->seekable ) && ( pread( r->fd, zh, 4, 0 ) == 4 ) &&
+            ( ( zh[0] | ( zh[1] << 8 ) | ( zh[2] << 16 ) | ( ( uint32_t )zh[3] << 24 ) ) == LZ4FRAME_MAGIC ) )
+    {
+        if ( ( ( n = pread( r->fd, zh, sizeof( zh ), 0 ) ) < 0 ) || ( !lz4FrameReadHeader( zh, n, &r->z ) ) ||
+                ( !( r->zin = ( uint8_t * )malloc( r->z.blockMax ) ) ) || ( !( r->zout = ( uint8_t * )malloc( r->z.blockMax ) ) ) )
+        {
+            traceFileClose( r );
+            return NULL;
+        }
+
+        r->compressed = true;
+        r->zfileOffset = r->z.headerLen;
+        genericsReport( V_INFO, "Input is compressed" EOL );
+    }
+
+    if ( ( r->seekable ) && ( _readAt( r, &r->h, sizeof( r->h ), 0 ) ) && ( !memcmp( r->h.magic, TRACEFILE_MAGIC, sizeof( r->h.magic ) ) ) )
+    {
+        r->indexed = true;
+        r->fileOffset = r->h.headerLen;
+        genericsReport( V_INFO, "Input is an indexed capture" EOL );
+    }
+
+    return r;
+}
+// ====================================================================================================
@@ -0,0 +1,767 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Synthetic trace generator
+ * =========================
+ *
+ * Each source builds a packet (or a few, when atoms have to be flushed ahead of an address)
+ * at a time, and hands it out a byte at a time. Packet formats are those the decoders here
+ * accept; see itmDecoder.c, etmDecoder.c (alternative branch address encoding, Thumb state,
+ * no cycle accuracy) and tpiuDecoder.c.
+ *
+ * In the TPIU framer an ID change in an even slot either takes effect immediately, in which
+ * case the odd byte after it belongs to the new stream, or after the odd byte, which lets the
+ * last byte of a burst share a slot pair with the change to the next one.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "generics.h"
+#include "traceGen.h"
+
+#define PKT_MAX          (32)                /* Longest a source ever builds in one go */
+#define OUT_MAX          (32)                /* ...and the longest unit handed out */
+#define TPIU_FRAME_LEN   (16)
+#define NO_STREAM        (0xff)              /* No stream has been set in the frames yet */
+#define MAX_STREAM       (0x7e)              /* 0x7f is reserved for null data */
+#define MAX_EATOMS       (15)                /* Most E atoms a format 1 P-header can carry */
+#define FIRST_EXCEPTION  (15)                /* Range of exceptions taken (SysTick and IRQs) */
+#define NUM_EXCEPTIONS   (33)
+#define TARGET_SPREAD    (16)                /* Direct branches go at most this many blocks away */
+
+/* ITM packets */
+#define ITM_SW_HDR(ch, s) ( ( ( ch ) << 3 ) | ( s ) )
+#define ITM_PC_SAMPLE    (0x17)              /* DWT ID 2, four bytes */
+#define ITM_EXC_TRACE    (0x0e)              /* DWT ID 1, two bytes */
+#define ITM_LTS1         (0xc0)              /* Local timestamp, format 1, in sync */
+#define ITM_EXC_ENTER    (1)
+#define ITM_EXC_EXIT     (2)
+#define ITM_EXC_RESUME   (3)
+
+/* ETM packets */
+#define ETM_ISYNC        (0x08)
+#define ETM_PHDR1(e, n)  ( 0x80 | ( ( n ) << 6 ) | ( ( e ) << 2 ) )
+
+static const uint8_t _itmSync[] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x80 };
+static const uint8_t _etmASync[] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x80 };
+static const uint8_t _tpiuSync[] = { 0xff, 0xff, 0xff, 0x7f };
+
+enum blockEnd { END_COND, END_DIRECT, END_INDIRECT };
+
+struct block
+{
+    uint32_t addr;                           /* First instruction */
+    uint32_t len;                            /* Instructions, including the branch that ends it */
+    enum blockEnd end;                       /* What that branch is */
+    uint32_t taken;                          /* Chance, out of 256, a conditional branch is taken */
+    uint32_t target;                         /* Block a direct or conditional branch goes to */
+};
+
+struct source
+{
+    uint8_t pkt[PKT_MAX];                    /* Packet(s) being handed out */
+    uint32_t len;                            /* ...how much there is */
+    uint32_t pos;                            /* ...and how much has gone */
+    uint32_t sinceSync;                      /* Bytes built since the last sync */
+    uint8_t stream;                          /* TPIU stream it goes out on */
+};
+
+struct traceGen
+{
+    struct traceGenConfig c;                 /* What we were asked for */
+    struct traceGenStats stats;              /* What we've done */
+    uint64_t rng;                            /* State of the random number generator */
+
+    /* ITM */
+    struct source itm;
+    uint32_t mixTotal;                       /* Sum of the packet type weights */
+    uint32_t excStep;                        /* Where we are in enter, exit, resume */
+    uint32_t excNum;                         /* ...and for which exception */
+
+    /* ETM */
+    struct source etm;
+    struct block *cfg;                       /* The synthetic program */
+    uint32_t blk;                            /* Block being executed */
+    uint32_t left;                           /* Instructions left in it */
+    uint32_t addr;                           /* Last address the decoder was given */
+    uint32_t eatoms;                         /* E atoms not yet put in a P-header */
+
+    /* TPIU */
+    struct source *src;                      /* Source a burst is being taken from */
+    uint32_t burstLeft;                      /* ...and how much more of it there is */
+    bool haveAhead[2];                       /* Bytes taken early to look ahead of the framer */
+    uint8_t ahead[2];                        /* ... */
+    struct source *aheadSrc[2];              /* ... */
+    uint8_t stream;                          /* Stream the frames are currently on */
+    uint32_t sinceSync;                      /* Bytes of frames since the last sync */
+
+    /* What's being handed out */
+    uint8_t out[OUT_MAX];
+    uint32_t outLen;
+    uint32_t outPos;
+};
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static uint32_t _rand( struct traceGen *g )
+
+/* xorshift64*, plenty good enough for this and quick */
+
+{
+    g->rng ^= g->rng >> 12;
+    g->rng ^= g->rng << 25;
+    g->rng ^= g->rng >> 27;
+    return ( g->rng * 0x2545F4914F6CDD1DULL ) >> 32;
+}
+// ====================================================================================================
+static void _seed( struct traceGen *g, uint64_t seed )
+
+/* Spread the seed with a round of splitmix64, so that neighbouring seeds give unrelated streams */
+
+{
+    uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+    z = ( z ^ ( z >> 30 ) ) * 0xBF58476D1CE4E5B9ULL;
+    z = ( z ^ ( z >> 27 ) ) * 0x94D049BB133111EBULL;
+    g->rng = ( z ^ ( z >> 31 ) ) ? : 1;
+}
+// ====================================================================================================
+static inline void _put( struct source *s, uint8_t c )
+
+{
+    s->pkt[s->len++] = c;
+}
+// ====================================================================================================
+static void _putn( struct source *s, const uint8_t *b, uint32_t n )
+
+{
+    memcpy( &s->pkt[s->len], b, n );
+    s->len += n;
+}
+// ====================================================================================================
+// ITM source
+// ====================================================================================================
+static void _itmPacket( struct traceGen *g )
+
+/* Build the next ITM packet according to the mix */
+
+{
+    struct source *s = &g->itm;
+    uint32_t r;
+
+    s->len = 0;
+    g->stats.itmPackets++;
+
+    if ( s->sinceSync >= g->c.syncEvery )
+    {
+        _putn( s, _itmSync, sizeof( _itmSync ) );
+        s->sinceSync = 0;
+        return;
+    }
+
+    r = _rand( g ) % g->mixTotal;
+
+    if ( r < g->c.swWeight )
+    {
+        /* Software packet of 1, 2 or 4 bytes */
+        uint32_t size = 1 + _rand( g ) % 3;
+        uint32_t v = _rand( g );
+
+        _put( s, ITM_SW_HDR( _rand( g ) % g->c.swChannels, size ) );
+
+        for ( uint32_t i = 0; i < ( 1U << ( size - 1 ) ); i++ )
+        {
+            _put( s, v >> ( 8 * i ) );
+        }
+
+        g->stats.itmSW++;
+    }
+    else if ( ( r -= g->c.swWeight ) < g->c.pcWeight )
+    {
+        /* PC sample, somewhere in the program */
+        uint32_t pc = TRACEGEN_CODE_BASE + ( ( _rand( g ) % ( g->c.blocks * 16 ) ) & ~1 );
+
+        _put( s, ITM_PC_SAMPLE );
+
+        for ( uint32_t i = 0; i < 4; i++ )
+        {
+            _put( s, pc >> ( 8 * i ) );
+        }
+    }
+    else if ( ( r -= g->c.pcWeight ) < g->c.excWeight )
+    {
+        /* Exception trace; each exception is entered, exited and then thread mode resumed */
+        uint32_t fn = ITM_EXC_ENTER + g->excStep;
+        uint32_t exc;
+
+        if ( !g->excStep )
+        {
+            g->excNum = FIRST_EXCEPTION + _rand( g ) % NUM_EXCEPTIONS;
+        }
+
+        exc = ( fn == ITM_EXC_RESUME ) ? 0 : g->excNum;
+        g->excStep = ( g->excStep + 1 ) % 3;
+
+        _put( s, ITM_EXC_TRACE );
+        _put( s, exc & 0xff );
+        _put( s, ( fn << 4 ) | ( ( exc >> 8 ) & 1 ) );
+    }
+    else
+    {
+        /* Local timestamp, mostly the short single byte form */
+        r = _rand( g );
+
+        if ( r & 3 )
+        {
+            _put( s, ( 1 + ( r >> 2 ) % 6 ) << 4 );
+        }
+        else
+        {
+            uint32_t n = 1 + ( r >> 2 ) % 4;
+
+            _put( s, ITM_LTS1 );
+
+            while ( n-- )
+            {
+                _put( s, ( ( r >> ( 4 + n * 7 ) ) & 0x7f ) | ( n ? 0x80 : 0 ) );
+            }
+        }
+    }
+}
+// ====================================================================================================
+// ETM source
+// ====================================================================================================
+static void _buildProgram( struct traceGen *g )
+
+/* Lay out the synthetic program as a run of basic blocks. Conditional and direct branches */
+/* mostly stay near by, indirect ones (returns, calls through pointers) go anywhere.       */
+
+{
+    uint32_t addr = TRACEGEN_CODE_BASE;
+
+    for ( uint32_t i = 0; i < g->c.blocks; i++ )
+    {
+        struct block *b = &g->cfg[i];
+        uint32_t r = _rand( g ) % 100;
+
+        b->addr = addr;
+        b->len = 2 + _rand( g ) % 11;
+        b->end = ( r < 45 ) ? END_COND : ( r < 75 ) ? END_DIRECT : END_INDIRECT;
+        b->taken = _rand( g ) % 256;
+        b->target = ( i + g->c.blocks + ( _rand( g ) % ( 2 * TARGET_SPREAD + 1 ) ) - TARGET_SPREAD ) % g->c.blocks;
+        addr += b->len * 2;
+    }
+}
+// ====================================================================================================
+static void _etmAtoms( struct traceGen *g, bool n )
+
+/* Put out the E atoms collected so far, followed by an N atom if there's one */
+
+{
+    if ( ( g->eatoms ) || ( n ) )
+    {
+        _put( &g->etm, ETM_PHDR1( g->eatoms, n ? 1 : 0 ) );
+        g->stats.etmPackets++;
+        g->stats.etmAtoms += g->eatoms + ( n ? 1 : 0 );
+        g->eatoms = 0;
+    }
+}
+// ====================================================================================================
+static void _etmBranch( struct traceGen *g, uint32_t to, uint32_t exc )
+
+/* Branch address packet, sending only as many low order bits as have changed, followed by */
+/* the exception that caused it if there was one.                                          */
+
+{
+    struct source *s = &g->etm;
+    uint32_t diff = ( to ^ g->addr ) & ~1;
+    uint32_t n;
+
+    if ( ( !exc ) && ( diff < ( 1 << 7 ) ) )
+    {
+        n = 1;
+    }
+    else
+    {
+        n = ( diff < ( 1 << 13 ) ) ? 2 : ( diff < ( 1 << 20 ) ) ? 3 : ( diff < ( 1 << 27 ) ) ? 4 : 5;
+    }
+
+    _put( s, 1 | ( to & 0x7e ) | ( ( n > 1 ) ? 0x80 : 0 ) );
+
+    for ( uint32_t k = 1; k < n; k++ )
+    {
+        if ( k < n - 1 )
+        {
+            _put( s, 0x80 | ( ( to >> ( 7 * k ) ) & 0x7f ) );
+        }
+        else
+        {
+            _put( s, ( ( to >> ( 7 * k ) ) & 0x3f ) | ( exc ? 0x40 : 0 ) );
+        }
+    }
+
+    if ( exc )
+    {
+        _put( s, ( ( exc & 0x0f ) << 1 ) | ( ( exc >> 4 ) ? 0x80 : 0 ) );
+
+        if ( exc >> 4 )
+        {
+            _put( s, 0x80 | ( ( exc >> 4 ) & 0x1f ) );
+        }
+    }
+
+    g->addr = to;
+    g->stats.etmPackets++;
+}
+// ====================================================================================================
+static void _etmEnter( struct traceGen *g, uint32_t blk )
+
+{
+    g->blk = blk;
+    g->left = g->cfg[blk].len;
+}
+// ====================================================================================================
+static void _etmPacket( struct traceGen *g )
+
+/* Run the program until there's something to put out */
+
+{
+    struct source *s = &g->etm;
+    struct block *b;
+
+    s->len = 0;
+
+    while ( !s->len )
+    {
+        b = &g->cfg[g->blk];
+
+        if ( s->sinceSync >= g->c.syncEvery )
+        {
+            /* A-Sync then I-Sync for the next instruction to be executed, in Thumb state */
+            uint32_t at = b->addr + ( b->len - g->left ) * 2;
+
+            _etmAtoms( g, false );
+            _putn( s, _etmASync, sizeof( _etmASync ) );
+            _put( s, ETM_ISYNC );
+            _put( s, 0 );
+
+            for ( uint32_t i = 0; i < 4; i++ )
+            {
+                _put( s, ( at | 1 ) >> ( 8 * i ) );
+            }
+
+            g->addr = at;
+            g->stats.etmPackets += 2;
+            s->sinceSync = 0;
+            break;
+        }
+
+        if ( g->left > 1 )
+        {
+            /* Straight line code, one E atom per instruction */
+            uint32_t n = MAX_EATOMS - g->eatoms;
+
+            n = ( g->left - 1 < n ) ? g->left - 1 : n;
+            g->eatoms += n;
+            g->left -= n;
+        }
+        else if ( ( g->c.excEvery ) && ( !( _rand( g ) % g->c.excEvery ) ) )
+        {
+            /* Exception taken before the branch, straight to a handler somewhere */
+            uint32_t to = _rand( g ) % g->c.blocks;
+
+            _etmAtoms( g, false );
+            _etmBranch( g, g->cfg[to].addr, FIRST_EXCEPTION + _rand( g ) % NUM_EXCEPTIONS );
+            _etmEnter( g, to );
+        }
+        else
+        {
+            switch ( b->end )
+            {
+                case END_COND:
+                    if ( _rand( g ) % 256 < b->taken )
+                    {
+                        g->eatoms++;
+                        _etmEnter( g, b->target );
+                    }
+                    else
+                    {
+                        _etmAtoms( g, true );
+                        _etmEnter( g, ( g->blk + 1 ) % g->c.blocks );
+                    }
+
+                    break;
+
+                case END_DIRECT:
+                    g->eatoms++;
+                    _etmEnter( g, b->target );
+                    break;
+
+                case END_INDIRECT:
+                {
+                    /* The address goes before the P-header holding the atom for the branch */
+                    uint32_t to = _rand( g ) % g->c.blocks;
+
+                    _etmAtoms( g, false );
+                    _etmBranch( g, g->cfg[to].addr, 0 );
+                    g->eatoms++;
+                    _etmEnter( g, to );
+                }
+                break;
+            }
+        }
+
+        if ( g->eatoms == MAX_EATOMS )
+        {
+            _etmAtoms( g, false );
+        }
+    }
+}
+// ====================================================================================================
+// Framing
+// ====================================================================================================
+static void _sourcePacket( struct traceGen *g, struct source *s )
+
+{
+    if ( s == &g->itm )
+    {
+        _itmPacket( g );
+    }
+    else
+    {
+        _etmPacket( g );
+    }
+
+    s->sinceSync += s->len;
+    s->pos = 0;
+}
+// ====================================================================================================
+static uint8_t _sourceByte( struct traceGen *g, struct source *s )
+
+{
+    if ( s->pos == s->len )
+    {
+        _sourcePacket( g, s );
+    }
+
+    return s->pkt[s->pos++];
+}
+// ====================================================================================================
+static void _ahead( struct traceGen *g, uint32_t n )
+
+/* Make sure the next n bytes for the frames are known, taking them in bursts from each source */
+
+{
+    for ( uint32_t i = 0; i < n; i++ )
+    {
+        if ( g->haveAhead[i] )
+        {
+            continue;
+        }
+
+        if ( !g->burstLeft )
+        {
+            if ( ( g->c.itm ) && ( g->c.etm ) )
+            {
+                g->src = ( g->src == &g->itm ) ? &g->etm : &g->itm;
+            }
+
+            g->burstLeft = 1 + _rand( g ) % g->c.burst;
+        }
+
+        g->burstLeft--;
+        g->aheadSrc[i] = g->src;
+        g->ahead[i] = _sourceByte( g, g->src );
+        g->haveAhead[i] = true;
+    }
+}
+// ====================================================================================================
+static uint8_t _take( struct traceGen *g )
+
+{
+    uint8_t c = g->ahead[0];
+
+    g->ahead[0] = g->ahead[1];
+    g->aheadSrc[0] = g->aheadSrc[1];
+    g->haveAhead[0] = g->haveAhead[1];
+    g->haveAhead[1] = false;
+    return c;
+}
+// ====================================================================================================
+static void _tpiuFrame( struct traceGen *g, uint8_t *f )
+
+{
+    uint8_t aux = 0;
+    uint8_t c;
+
+    for ( uint32_t i = 0; i < TPIU_FRAME_LEN; i += 2 )
+    {
+        bool last = ( i == TPIU_FRAME_LEN - 2 );
+
+        _ahead( g, last ? 1 : 2 );
+
+        if ( g->aheadSrc[0]->stream != g->stream )
+        {
+            /* Immediate change, so the odd byte (if there is one) is on the new stream */
+            g->stream = g->aheadSrc[0]->stream;
+            f[i] = ( g->stream << 1 ) | 1;
+
+            if ( !last )
+            {
+                f[i + 1] = _take( g );
+            }
+        }
+        else if ( ( !last ) && ( g->aheadSrc[1]->stream != g->stream ) )
+        {
+            /* Change after the odd byte, which finishes off the old stream */
+            f[i] = ( g->aheadSrc[1]->stream << 1 ) | 1;
+            aux |= 1 << ( i / 2 );
+            f[i + 1] = _take( g );
+            g->stream = g->aheadSrc[0]->stream;
+        }
+        else
+        {
+            /* Data in both, with the low bit of the even one in the aux byte */
+            c = _take( g );
+            f[i] = c & 0xfe;
+            aux |= ( c & 1 ) << ( i / 2 );
+
+            if ( !last )
+            {
+                f[i + 1] = _take( g );
+            }
+        }
+    }
+
+    f[TPIU_FRAME_LEN - 1] = aux;
+    g->stats.tpiuFrames++;
+}
+// ====================================================================================================
+static void _refill( struct traceGen *g )
+
+/* Make the next unit to be handed out; a packet, or a TPIU frame with a sync in front of it if */
+/* one is due.                                                                                   */
+
+{
+    struct source *s;
+
+    g->outLen = g->outPos = 0;
+
+    if ( g->c.tpiu )
+    {
+        if ( g->sinceSync >= g->c.syncEvery )
+        {
+            memcpy( g->out, _tpiuSync, sizeof( _tpiuSync ) );
+            g->outLen = sizeof( _tpiuSync );
+            g->sinceSync = 0;
+        }
+
+        _tpiuFrame( g, &g->out[g->outLen] );
+        g->outLen += TPIU_FRAME_LEN;
+        g->sinceSync += TPIU_FRAME_LEN;
+    }
+    else
+    {
+        s = g->c.itm ? &g->itm : &g->etm;
+        _sourcePacket( g, s );
+        memcpy( g->out, s->pkt, s->len );
+        g->outLen = s->len;
+    }
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+void traceGenDefaultConfig( struct traceGenConfig *c )
+
+{
+    memset( c, 0, sizeof( struct traceGenConfig ) );
+    c->seed = TRACEGEN_DEFAULT_SEED;
+    c->itm = true;
+    c->swWeight = 70;
+    c->pcWeight = 10;
+    c->excWeight = 10;
+    c->tsWeight = 10;
+    c->swChannels = TRACEGEN_DEFAULT_CHANNELS;
+    c->blocks = TRACEGEN_DEFAULT_BLOCKS;
+    c->excEvery = 1000;
+    c->itmStream = 1;
+    c->etmStream = 2;
+    c->burst = TRACEGEN_DEFAULT_BURST;
+    c->syncEvery = TRACEGEN_DEFAULT_SYNC;
+}
+// ====================================================================================================
+bool traceGenSetMix( struct traceGenConfig *c, const char *mix )
+
+/* Set the ITM mix from a list like sw=70,pc=10,exc=10,ts=10. Anything not mentioned is left out */
+
+{
+    static const char *names[] = { "sw", "pc", "exc", "ts" };
+    uint32_t *weights[] = { &c->swWeight, &c->pcWeight, &c->excWeight, &c->tsWeight };
+    uint32_t w[4] = { 0 };
+    const char *p = mix;
+    char *e;
+    uint32_t n;
+
+    while ( *p )
+    {
+        for ( n = 0; n < 4; n++ )
+        {
+            size_t l = strlen( names[n] );
+
+            if ( ( !strncmp( p, names[n], l ) ) && ( p[l] == '=' ) )
+            {
+                break;
+            }
+        }
+
+        if ( ( n == 4 ) || ( !isdigit( ( unsigned char )p[strlen( names[n] ) + 1] ) ) )
+        {
+            genericsReport( V_ERROR, "Badly formed mix %s" EOL, mix );
+            return false;
+        }
+
+        w[n] = strtoul( p + strlen( names[n] ) + 1, &e, 10 );
+        p = e;
+
+        if ( *p == ',' )
+        {
+            p++;
+        }
+        else if ( *p )
+        {
+            genericsReport( V_ERROR, "Badly formed mix %s" EOL, mix );
+            return false;
+        }
+    }
+
+    if ( !( w[0] + w[1] + w[2] + w[3] ) )
+    {
+        genericsReport( V_ERROR, "Mix %s has nothing in it" EOL, mix );
+        return false;
+    }
+
+    for ( n = 0; n < 4; n++ )
+    {
+        *weights[n] = w[n];
+    }
+
+    return true;
+}
+// ====================================================================================================
+void traceGenFill( struct traceGen *g, uint8_t *b, size_t len )
+
+{
+    size_t n;
+
+    g->stats.bytes += len;
+
+    while ( len )
+    {
+        if ( g->outPos == g->outLen )
+        {
+            _refill( g );
+        }
+
+        n = g->outLen - g->outPos;
+        n = ( n < len ) ? n : len;
+        memcpy( b, &g->out[g->outPos], n );
+        g->outPos += n;
+        b += n;
+        len -= n;
+    }
+}
+// ====================================================================================================
+const struct traceGenStats *traceGenGetStats( struct traceGen *g )
+
+{
+    return &g->stats;
+}
+// ====================================================================================================
+void traceGenDelete( struct traceGen *g )
+
+{
+    if ( g )
+    {
+        free( g->cfg );
+        free( g );
+    }
+}
+// ====================================================================================================
+struct traceGen *traceGenCreate( const struct traceGenConfig *c )
+
+{
+    struct traceGen *g;
+
+    if ( ( !c->itm ) && ( !c->etm ) )
+    {
+        genericsReport( V_ERROR, "Nothing to generate" EOL );
+        return NULL;
+    }
+
+    if ( ( c->itm ) && ( c->etm ) && ( !c->tpiu ) )
+    {
+        genericsReport( V_ERROR, "ITM and ETM together need TPIU framing" EOL );
+        return NULL;
+    }
+
+    if ( ( c->tpiu ) &&
+            ( ( ( c->itm ) && ( ( !c->itmStream ) || ( c->itmStream > MAX_STREAM ) ) ) ||
+              ( ( c->etm ) && ( ( !c->etmStream ) || ( c->etmStream > MAX_STREAM ) ) ) ||
+              ( ( c->itm ) && ( c->etm ) && ( c->itmStream == c->etmStream ) ) ) )
+    {
+        genericsReport( V_ERROR, "TPIU streams must be different and in the range 1..%d" EOL, MAX_STREAM );
+        return NULL;
+    }
+
+    if ( ( !c->swChannels ) || ( c->swChannels > 32 ) || ( c->blocks < 2 ) || ( !c->burst ) || ( !c->syncEvery ) ||
+            ( !( c->swWeight + c->pcWeight + c->excWeight + c->tsWeight ) ) )
+    {
+        genericsReport( V_ERROR, "Bad trace generator configuration" EOL );
+        return NULL;
+    }
+
+    g = ( struct traceGen * )calloc( 1, sizeof( struct traceGen ) );
+
+    if ( !g )
+    {
+        return NULL;
+    }
+
+    g->c = *c;
+    _seed( g, c->seed );
+    g->mixTotal = c->swWeight + c->pcWeight + c->excWeight + c->tsWeight;
+
+    if ( c->etm )
+    {
+        g->cfg = ( struct block * )calloc( c->blocks, sizeof( struct block ) );
+
+        if ( !g->cfg )
+        {
+            free( g );
+            return NULL;
+        }
+
+        _buildProgram( g );
+        _etmEnter( g, 0 );
+    }
+
+    /* Everything starts with its sync */
+    g->itm.sinceSync = g->etm.sinceSync = g->sinceSync = c->syncEvery;
+    g->itm.stream = c->itmStream;
+    g->etm.stream = c->etmStream;
+    g->src = c->itm ? &g->itm : &g->etm;
+    g->stream = NO_STREAM;
+
+    return g;
+}
+// ====================================================================================================
@@ -0,0 +1,80 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Trace level instrumentation
+ * ===========================
+ *
+ */
+
+#ifdef DEBUG
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "generics.h"
+#include "traceLog.h"
+
+#define TRACELOG_ENTRIES    (65536)    /* Number of records retained (must be power of 2) */
+#define TRACELOG_LINE_LEN   (256)      /* Max length of a formatted record */
+
+struct traceLogRecord
+{
+    uint32_t ev;                        /* Event, indexing the format table */
+    uint32_t a, b, c;                   /* ...and its parameters */
+};
+
+static struct
+{
+    struct traceLogRecord r[TRACELOG_ENTRIES];
+    uint64_t count;                     /* Total number of records ever logged */
+} _log;
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+void traceLogAdd( uint32_t ev, uint32_t a, uint32_t b, uint32_t c )
+
+/* Record an event, overwriting the oldest if the ring is full */
+
+{
+    struct traceLogRecord *t = &_log.r[__atomic_fetch_add( &_log.count, 1, __ATOMIC_RELAXED ) & ( TRACELOG_ENTRIES - 1 )];
+
+    t->ev = ev;
+    t->a  = a;
+    t->b  = b;
+    t->c  = c;
+}
+// ====================================================================================================
+void traceLogDump( const char *const *fmts, uint32_t numFmts )
+
+/* Format and report the retained records, oldest first, at debug level */
+
+{
+    char op[TRACELOG_LINE_LEN];
+    uint64_t i = ( _log.count > TRACELOG_ENTRIES ) ? _log.count - TRACELOG_ENTRIES : 0;
+    struct traceLogRecord *t;
+
+    genericsReport( V_DEBUG, "Trace log: %" PRIu64 " events, last %" PRIu64 " follow" EOL, _log.count, _log.count - i );
+
+    while ( i < _log.count )
+    {
+        t = &_log.r[i & ( TRACELOG_ENTRIES - 1 )];
+
+        if ( t->ev < numFmts )
+        {
+            snprintf( op, TRACELOG_LINE_LEN, fmts[t->ev], t->a, t->b, t->c );
+        }
+        else
+        {
+            snprintf( op, TRACELOG_LINE_LEN, "Event %d: %08x %08x %08x", t->ev, t->a, t->b, t->c );
+        }
+
+        genericsReport( V_DEBUG, "%10" PRIu64 " %s" EOL, i++, op );
+    }
+}
+// ====================================================================================================
+#endif
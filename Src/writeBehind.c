@@ -0,0 +1,271 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+/*
+ * Write-behind buffering
+ * ======================
+ *
+ * A ring of blocks is shared between a producer and a writer thread. The producer fills the
+ * block at wp and submits it when it's full (or when flushed), the writer thread consumes blocks
+ * from rp. The lock is only held for pointer updates, never while copying or writing.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+
+#include "generics.h"
+#include "writeBehind.h"
+
+struct wbBlock
+{
+    size_t fillLevel;                         /* How much of this block is occupied */
+    uint8_t *buffer;                          /* The data in this block */
+};
+
+struct writebehindHandle
+{
+    struct wbBlock *block;                    /* Ring of blocks */
+    uint32_t numBlocks;                       /* ...and how many of them there are */
+    size_t blockSize;                         /* Size of each block */
+    uint32_t wp;                              /* Block being filled by the producer */
+    uint32_t rp;                              /* Next block to be written by the writer */
+
+    bool lossless;                            /* Wait for space rather than dropping data */
+    bool ending;                              /* Flag indicating it's time to leave */
+
+    writebehindCB cb;                         /* Output routine, called on the writer thread */
+    void *param;                              /* ...and its parameter */
+
+    pthread_t thread;                         /* The writer thread */
+    pthread_mutex_t lock;                     /* Lock protecting rp/wp */
+    pthread_cond_t dataAvailable;             /* Signalled when a block is submitted */
+    pthread_cond_t spaceAvailable;            /* Signalled when a block has been written */
+
+    struct writebehindStats stats;            /* Record of activity */
+};
+
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Internal routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+static void *_writer( void *args )
+
+/* Write out blocks as they arrive */
+
+{
+    struct writebehindHandle *h = ( struct writebehindHandle * )args;
+    struct wbBlock *b;
+    bool ok;
+
+    pthread_mutex_lock( &h->lock );
+
+    while ( true )
+    {
+        while ( ( h->rp == h->wp ) && ( !h->ending ) )
+        {
+            pthread_cond_wait( &h->dataAvailable, &h->lock );
+        }
+
+        if ( h->rp == h->wp )
+        {
+            /* Ending and nothing left to write */
+            break;
+        }
+
+        b = &h->block[h->rp];
+        pthread_mutex_unlock( &h->lock );
+
+        ok = h->cb( h->param, b->buffer, b->fillLevel );
+
+        pthread_mutex_lock( &h->lock );
+        h->stats.writeFailed |= !ok;
+        h->stats.bytesWritten += b->fillLevel;
+        h->stats.blocksWritten++;
+        h->rp = ( h->rp + 1 ) % h->numBlocks;
+        pthread_cond_signal( &h->spaceAvailable );
+    }
+
+    pthread_mutex_unlock( &h->lock );
+    return NULL;
+}
+// ====================================================================================================
+static void _submit( struct writebehindHandle *h )
+
+/* Pass the block currently being filled over to the writer */
+
+{
+    uint32_t depth;
+
+    pthread_mutex_lock( &h->lock );
+
+    while ( ( ( h->wp + 1 ) % h->numBlocks ) == h->rp )
+    {
+        if ( !h->lossless )
+        {
+            /* No room, and we're not allowed to wait, so this block is lost */
+            h->stats.bytesDropped += h->block[h->wp].fillLevel;
+            h->block[h->wp].fillLevel = 0;
+            pthread_mutex_unlock( &h->lock );
+            return;
+        }
+
+        pthread_cond_wait( &h->spaceAvailable, &h->lock );
+    }
+
+    h->wp = ( h->wp + 1 ) % h->numBlocks;
+    h->block[h->wp].fillLevel = 0;
+
+    depth = ( h->wp + h->numBlocks - h->rp ) % h->numBlocks;
+
+    if ( depth > h->stats.maxQueueDepth )
+    {
+        h->stats.maxQueueDepth = depth;
+    }
+
+    pthread_cond_signal( &h->dataAvailable );
+    pthread_mutex_unlock( &h->lock );
+}
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+// Externally available routines
+// ====================================================================================================
+// ====================================================================================================
+// ====================================================================================================
+bool writebehindWrite( struct writebehindHandle *h, const uint8_t *buffer, size_t len )
+
+/* Queue data for writing. Returns false if anything had to be dropped. bytesDropped is only */
+/* changed on this (the producer's) side, so it can be looked at here without the lock.     */
+
+{
+    uint64_t dropped = h->stats.bytesDropped;
+    struct wbBlock *b;
+    size_t n;
+
+    while ( len )
+    {
+        b = &h->block[h->wp];
+        n = ( len < h->blockSize - b->fillLevel ) ? len : h->blockSize - b->fillLevel;
+        memcpy( &b->buffer[b->fillLevel], buffer, n );
+        b->fillLevel += n;
+        buffer += n;
+        len -= n;
+
+        if ( b->fillLevel == h->blockSize )
+        {
+            _submit( h );
+        }
+    }
+
+    return ( dropped == h->stats.bytesDropped );
+}
+// ====================================================================================================
+void writebehindFlush( struct writebehindHandle *h )
+
+/* Submit any partially filled block, so the latency of data getting to the writer is bounded */
+
+{
+    if ( h->block[h->wp].fillLevel )
+    {
+        _submit( h );
+    }
+}
+// ====================================================================================================
+void writebehindGetStats( struct writebehindHandle *h, struct writebehindStats *s )
+
+/* Take a consistent copy of the stats, which the writer thread is updating */
+
+{
+    pthread_mutex_lock( &h->lock );
+    *s = h->stats;
+    pthread_mutex_unlock( &h->lock );
+}
+// ====================================================================================================
+void writebehindShutdown( struct writebehindHandle *h )
+
+/* Write out everything that's pending, then stop the writer and release all resources */
+
+{
+    if ( !h )
+    {
+        return;
+    }
+
+    writebehindFlush( h );
+
+    pthread_mutex_lock( &h->lock );
+    h->ending = true;
+    pthread_cond_signal( &h->dataAvailable );
+    pthread_mutex_unlock( &h->lock );
+
+    pthread_join( h->thread, NULL );
+
+    for ( uint32_t t = 0; t < h->numBlocks; t++ )
+    {
+        free( h->block[t].buffer );
+    }
+
+    pthread_cond_destroy( &h->dataAvailable );
+    pthread_cond_destroy( &h->spaceAvailable );
+    pthread_mutex_destroy( &h->lock );
+    free( h->block );
+    free( h );
+}
+// ====================================================================================================
+struct writebehindHandle *writebehindCreate( size_t blockSize, uint32_t numBlocks, bool lossless, writebehindCB cb, void *param )
+
+/* Create a write-behind instance with its writer thread. One block is always being filled, */
+/* so at most numBlocks-1 can be waiting to be written.                                     */
+
+{
+    struct writebehindHandle *h;
+
+    assert( cb );
+    assert( blockSize );
+    assert( numBlocks > 1 );
+
+    h = ( struct writebehindHandle * )calloc( 1, sizeof( struct writebehindHandle ) );
+
+    if ( !h )
+    {
+        return NULL;
+    }
+
+    h->block = ( struct wbBlock * )calloc( numBlocks, sizeof( struct wbBlock ) );
+
+    for ( uint32_t t = 0; t < numBlocks; t++ )
+    {
+        h->block[t].buffer = ( uint8_t * )malloc( blockSize );
+    }
+
+    h->numBlocks = numBlocks;
+    h->blockSize = blockSize;
+    h->lossless  = lossless;
+    h->cb        = cb;
+    h->param     = param;
+
+    pthread_mutex_init( &h->lock, NULL );
+    pthread_cond_init( &h->dataAvailable, NULL );
+    pthread_cond_init( &h->spaceAvailable, NULL );
+
+    if ( pthread_create( &h->thread, NULL, &_writer, h ) )
+    {
+        genericsReport( V_ERROR, "Failed to create writer thread" EOL );
+
+        for ( uint32_t t = 0; t < numBlocks; t++ )
+        {
+            free( h->block[t].buffer );
+        }
+
+        free( h->block );
+        free( h );
+        return NULL;
+    }
+
+    return h;
+}
+// ====================================================================================================
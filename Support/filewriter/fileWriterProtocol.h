@@ -13,16 +13,44 @@
 // NN CCC FFF
 //
 // NN  - Number of bytes following in this frame (0,1 or 2)
-//       NN=3 is reserved
+//       (3 is also used, for a frame carrying three bytes)
 // CCC - Command
 // FFF - File Number
 //
+// Bursts (protocol version 2)
+// ---------------------------
+// A burst carries a whole command in one header word followed by its payload packed four bytes
+// to a word (the last word padded with zeros) and then a trailer word, so more of each ITM frame
+// is payload and a write of any length is one command. The header word is;
+//
+// LLLLLLLLLLLL KKKK IIIIIIII 00 111 CCC
+//
+// 111 - Command 7, which no single frame command uses, marks the word as a burst header
+// CCC - Command, as above. For open and erase the payload is the filename (a terminating zero
+//       is optional), for write it is the data and for close there is none.
+// I   - File number (0 to FW2_MAX_FILES-1, of which the first FW_MAX_FILES are shared with the
+//       single frame commands)
+// K   - Check, the xor of the other seven nibbles of the header
+// L   - Number of payload bytes that follow (0 to FW2_MAX_BURST)
+//
+// The trailer is a check over the header and every payload word, built up with FW2_SUM starting
+// from FW2_SUM_INIT(header). A burst is only acted on when its trailer matches, so one that lost
+// words (or picked up words that weren't its own) is dropped rather than partly carried out.
+//
+// Once a receiver has seen a burst header it takes the client to be using bursts and ignores
+// anything that isn't part of a burst, so after a burst has been dropped it waits for the next
+// valid header rather than taking stray payload words for single frame commands. A single frame
+// open is the exception; it means the target has restarted without bursts, and puts the
+// receiver back to taking single frame commands.
 
 #define FW_CHANNEL    (29)   // ITM Channel to be used
 #define FW_MAX_FILES  (8)    // Number of files we support
 
 #define FW_MAX_SEND   (3)    // Maximum number of bytes in a single ITM frame
 
+#define FW2_MAX_FILES (64)   // Number of files we support with bursts
+#define FW2_MAX_BURST (4095) // Maximum number of payload bytes in a burst
+
 /* Masks and shifts to get the correct bits out of the command word */
 #define FW_FILEID(x)  ((x)&7)
 #define FW_GET_FILEID(x) FW_FILEID(x)
@@ -41,4 +69,23 @@
 #define FW_CMD_ERASE  FW_COMMAND(4)
 #define FW_CMD_WRITE  FW_COMMAND(5)
 
+/* Burst headers */
+#define FW_CMD_BURST         FW_COMMAND(7)
+#define FW_IS_BURST(x)       (((x)&(FW_BYTES(3)|FW_COMMAND(7)))==FW_CMD_BURST)
+#define FW2_COMMAND(x)       (((x)&FW_COMMAND(7))>>3)
+#define FW2_GET_COMMAND(x)   (((x)&7)<<3)
+#define FW2_FILEID(x)        (((x)&0xff)<<8)
+#define FW2_GET_FILEID(x)    (((x)>>8)&0xff)
+#define FW2_CHECK(x)         (((x)&0xf)<<16)
+#define FW2_GET_CHECK(x)     (((x)>>16)&0xf)
+#define FW2_LEN(x)           (((x)&0xfff)<<20)
+#define FW2_GET_LEN(x)       (((x)>>20)&0xfff)
+
+/* Check nibble for a header with its check field zero */
+#define FW2_CALC_CHECK(x)    (((x)^((x)>>4)^((x)>>8)^((x)>>12)^((x)>>20)^((x)>>24)^((x)>>28))&0xf)
+
+/* Trailer check, over the header and then each payload word in turn */
+#define FW2_SUM_INIT(h)      (~(uint32_t)(h))
+#define FW2_SUM(s,w)         (((((uint32_t)(s))<<5)|(((uint32_t)(s))>>27))^(uint32_t)(w))
+
 #endif
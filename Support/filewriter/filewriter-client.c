@@ -9,7 +9,15 @@
 #include "filewriter-client.h"
 #include "fileWriterProtocol.h"
 
-static bool isInUse[FW_MAX_FILES];
+/* Define FW_SINGLE_FRAME to use the original one command per frame protocol, for an */
+/* Orbuculum at the other end that doesn't understand bursts.                         */
+#ifdef FW_SINGLE_FRAME
+#define FW_CLIENT_FILES FW_MAX_FILES
+#else
+#define FW_CLIENT_FILES FW2_MAX_FILES
+#endif
+
+static bool isInUse[FW_CLIENT_FILES];
 static bool _initialised;
 // ============================================================================================
 // ============================================================================================
@@ -24,9 +32,13 @@ int32_t _getHandle(void)
 
 {
     uint32_t t;
-    for ( t=0; ((t<FW_MAX_FILES) && (isInUse[t])); t++) {}
+    for ( t=0; ((t<FW_CLIENT_FILES) && (isInUse[t])); t++) {}
 
-    return (t<FW_MAX_FILES)?t:-1;
+    if (t>=FW_CLIENT_FILES)
+	return -1;
+
+    isInUse[t]=true;
+    return t;
 }
 // ============================================================================================
 void _releaseHandle(uint32_t h)
@@ -34,19 +46,17 @@ void _releaseHandle(uint32_t h)
 /* Release a handle that is in use */
 
 {
-    if (h<FW_MAX_FILES)
+    if (h<FW_CLIENT_FILES)
 	isInUse[h]=false;
 }
+static bool _portEnabled(void);
 // ============================================================================================
 void _sendMsg(uint32_t cmd, uint32_t id, uint32_t *len, const uint8_t *d)
 
 /* Send a message to the Orbuculum session */
 
 {
-    if (!((CoreDebug->DEMCR & CoreDebug_DEMCR_TRCENA_Msk) && /* Trace enabled */
-         (ITM->TCR & ITM_TCR_ITMENA_Msk) && /* ITM enabled */
-         (ITM->TER & (1ul << FW_CHANNEL) ) /* ITM Port c enabled */
-        ))
+    if (!_portEnabled())
 	return;
 
     uint32_t c=0;
@@ -74,6 +84,53 @@ void _sendMsg(uint32_t cmd, uint32_t id, uint32_t *len, const uint8_t *d)
     ITM->PORT[FW_CHANNEL].u32 = (c<<8)|cmd; // Write data
 }
 // ============================================================================================
+static bool _portEnabled(void)
+
+/* Check that the trace port will take our output */
+
+{
+    return ((CoreDebug->DEMCR & CoreDebug_DEMCR_TRCENA_Msk) && /* Trace enabled */
+	    (ITM->TCR & ITM_TCR_ITMENA_Msk) && /* ITM enabled */
+	    (ITM->TER & (1ul << FW_CHANNEL) ) /* ITM Port c enabled */
+	);
+}
+// ============================================================================================
+void _sendBurst(uint32_t cmd, uint32_t id, uint32_t len, const uint8_t *d)
+
+/* Send a complete command as bursts, the header followed by payload four bytes to a word */
+/* and then the trailer that lets the receiver check it got all of it.                    */
+
+{
+    if (!_portEnabled())
+	return;
+
+    do
+	{
+	    uint32_t l=(len>FW2_MAX_BURST)?FW2_MAX_BURST:len;
+	    uint32_t h=FW_CMD_BURST|FW2_COMMAND(cmd)|FW2_FILEID(id)|FW2_LEN(l);
+	    uint32_t s;
+
+	    h|=FW2_CHECK(FW2_CALC_CHECK(h));
+	    s=FW2_SUM_INIT(h);
+	    while (ITM->PORT[FW_CHANNEL].u32 == 0); // Port available?
+	    ITM->PORT[FW_CHANNEL].u32 = h;
+
+	    len-=l;
+	    while (l)
+		{
+		    uint32_t c=0;
+		    for (uint32_t b=0; ((b<4) && (l)); b++, l--) c|=(*d++)<<(b*8);
+		    s=FW2_SUM(s,c);
+		    while (ITM->PORT[FW_CHANNEL].u32 == 0);
+		    ITM->PORT[FW_CHANNEL].u32 = c;
+		}
+
+	    while (ITM->PORT[FW_CHANNEL].u32 == 0);
+	    ITM->PORT[FW_CHANNEL].u32 = s;
+	}
+    while (len && (cmd==FW_CMD_WRITE)); // Only writes can be split across bursts
+}
+// ============================================================================================
 // ============================================================================================
 // ============================================================================================
 // Externally Available Routines
@@ -92,6 +149,9 @@ uint8_t fwOpenFile(const char *n, bool forAppend)
 
     uint32_t l=strlen(n)+1;  // +1 ensures terminating 0 is sent
 
+#ifndef FW_SINGLE_FRAME
+    _sendBurst(forAppend?FW_CMD_OPENA:FW_CMD_OPENE, handle, l, (const uint8_t *)n);
+#else
     /* Send indication that we're opening a file */
     _sendMsg(forAppend?FW_CMD_OPENA:FW_CMD_OPENE, handle, &l, n);
 
@@ -101,6 +161,7 @@ uint8_t fwOpenFile(const char *n, bool forAppend)
 	    n+=FW_MAX_SEND;
 	    _sendMsg(FW_CMD_WRITE, handle, &l, n);
 	}
+#endif
 	}
     return handle;
 }
@@ -112,12 +173,16 @@ uint32_t fwWrite(const char *ptr, size_t size, uint32_t nmemb, uint32_t h)
 {
   nmemb*=size;
   uint32_t r = nmemb;
-  
+
+#ifndef FW_SINGLE_FRAME
+    _sendBurst(FW_CMD_WRITE, h, nmemb, (const uint8_t *)ptr);
+#else
     while (nmemb)
 	{
-	    _sendMsg(FW_CMD_WRITE, 0, &nmemb, ptr);
+	    _sendMsg(FW_CMD_WRITE, h, &nmemb, ptr);
 	    ptr+=FW_MAX_SEND;
 	}
+#endif
     return r;
 }
 // ============================================================================================
@@ -126,10 +191,15 @@ uint32_t fwClose(uint32_t h)
 /* Close an open file */
 
 {
-    if (h>=FW_MAX_FILES)
+    if (h>=FW_CLIENT_FILES)
 	return false;
 
-    _sendMsg(FW_CMD_CLOSE, h, 0, NULL);
+#ifndef FW_SINGLE_FRAME
+    _sendBurst(FW_CMD_CLOSE, h, 0, NULL);
+#else
+    uint32_t l=0;
+    _sendMsg(FW_CMD_CLOSE, h, &l, NULL);
+#endif
     _releaseHandle(h);
 
     return true;
@@ -148,6 +218,9 @@ bool fwDeleteFile(const char *ptr)
 	}
     uint32_t l=strlen(ptr)+1;  // +1 ensures terminating 0 is sent
 
+#ifndef FW_SINGLE_FRAME
+    _sendBurst(FW_CMD_ERASE, handle, l, (const uint8_t *)ptr);
+#else
     /* Send indication that we're deleting a file */
     _sendMsg(FW_CMD_ERASE, handle, &l, ptr);
 
@@ -157,9 +230,10 @@ bool fwDeleteFile(const char *ptr)
 	    ptr+=FW_MAX_SEND;
 	    _sendMsg(FW_CMD_WRITE, handle, &l, ptr);
 	}
+#endif
 
     _releaseHandle(handle);
-    return 0;
+    return true;
 }
 // ============================================================================================
 void fwInit(void)
@@ -168,7 +242,7 @@ void fwInit(void)
 
 {
     /* Make sure everything is closed at the other end */
-    for (uint32_t t=0; t<FW_MAX_FILES; t++) fwClose(t);
+    for (uint32_t t=0; t<FW_CLIENT_FILES; t++) fwClose(t);
     _initialised=true;
 }
 // ============================================================================================
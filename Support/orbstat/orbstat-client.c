@@ -0,0 +1,164 @@
+/*
+ * Function entry and exit hooks sending call records to orbstat.
+ *
+ * Build the code to be profiled with -finstrument-functions. Calls and returns are then
+ * reported to orbstat as they happen, timed by the DWT cycle counter.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "stm32f4xx.h"
+#include "orbstat-client.h"
+#include "orbstatProtocol.h"
+
+#define NO_INSTRUMENT __attribute__((no_instrument_function))
+
+static uint32_t _lastTime;                  /* Cycle count sent in the previous record */
+
+// ============================================================================================
+// ============================================================================================
+// ============================================================================================
+// Internal Routines
+// ============================================================================================
+// ============================================================================================
+// ============================================================================================
+static NO_INSTRUMENT bool _enabled(void)
+
+/* Is there anyone listening? */
+
+{
+    return ((CoreDebug->DEMCR & CoreDebug_DEMCR_TRCENA_Msk) && /* Trace enabled */
+            (ITM->TCR & ITM_TCR_ITMENA_Msk) && /* ITM enabled */
+            (ITM->TER & (1ul << OS_CHANNEL) ) /* ITM Port c enabled */
+           );
+}
+// ============================================================================================
+static inline NO_INSTRUMENT void _send(uint32_t w)
+
+/* Send one word of a record */
+
+{
+    while (ITM->PORT[OS_CHANNEL].u32 == 0); // Port available?
+    ITM->PORT[OS_CHANNEL].u32 = w;          // Write data
+}
+// ============================================================================================
+static inline NO_INSTRUMENT void _send16(uint16_t h)
+
+/* Send a half word, which is only ever a Short Return */
+
+{
+    while (ITM->PORT[OS_CHANNEL].u32 == 0);
+    ITM->PORT[OS_CHANNEL].u16 = h;
+}
+// ============================================================================================
+static inline NO_INSTRUMENT uint32_t _since(uint32_t *now)
+
+/* Take the time for this record, returning how long it is since the last one */
+
+{
+    uint32_t gap;
+
+    *now = DWT->CYCCNT;
+    gap = *now - _lastTime;
+    _lastTime = *now;
+    return gap;
+}
+// ============================================================================================
+// ============================================================================================
+// ============================================================================================
+// Externally Available Routines
+// ============================================================================================
+// ============================================================================================
+// ============================================================================================
+void NO_INSTRUMENT __cyg_profile_func_enter(void *this_fn, void *call_site)
+
+/* Called on entry to every instrumented function */
+
+{
+    uint32_t site = (uint32_t)call_site;
+    uint32_t fn = (uint32_t)this_fn;
+    int32_t offset = (int32_t)((site & ~1) - (fn & ~1)) / 2;
+    uint32_t primask;
+    uint32_t now;
+    bool near;
+
+    if (!_enabled())
+	return;
+
+    /* The words of a record must not be split by one from an interrupt */
+    primask = __get_PRIMASK();
+    __disable_irq();
+
+    near = (_since(&now) < (1ul << OS_SHORT_TIME_BITS));
+
+    if (site >= OS_EXC_RETURN_BITS)
+	{
+	    /* Called on exception entry, so the call site is an EXC_RETURN value */
+	    if (near && ((site & OS_SHORT_EXC_BITS) == OS_SHORT_EXC_BITS))
+		{
+		    _send(OS_REC_SHORT_EXC | ((now << OS_SHORT_TIME_SHIFT) & OS_SHORT_TIME_MASK) | (site & OS_SHORT_ARG_MASK));
+		}
+	    else
+		{
+		    _send(OS_REC_EXCEPTION | (now & OS_TIME_MASK));
+		    _send(site & ~OS_EXC_RETURN_BITS);
+		}
+	}
+    else
+	{
+	    /* Call sites are usually close to what they call, so send them relative to it */
+	    if (near && (offset >= INT16_MIN) && (offset <= INT16_MAX))
+		{
+		    _send(OS_REC_SHORT_CALL | ((now << OS_SHORT_TIME_SHIFT) & OS_SHORT_TIME_MASK) | (offset & OS_SHORT_ARG_MASK));
+		}
+	    else
+		{
+		    _send(OS_REC_CALL | (now & OS_TIME_MASK));
+		    _send(site);
+		}
+	}
+
+    _send(fn);
+    __set_PRIMASK(primask);
+}
+// ============================================================================================
+void NO_INSTRUMENT __cyg_profile_func_exit(void *this_fn, void *call_site)
+
+/* Called on exit from every instrumented function. The receiver knows what is being */
+/* returned from, so only the time is sent.                                          */
+
+{
+    uint32_t primask;
+    uint32_t now;
+
+    (void)this_fn;
+    (void)call_site;
+
+    if (!_enabled())
+	return;
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+
+    if (_since(&now) < (1ul << OS_SHORT_RET_BITS))
+	{
+	    _send16(now);
+	}
+    else
+	{
+	    _send(OS_REC_RETURN | (now & OS_TIME_MASK));
+	}
+
+    __set_PRIMASK(primask);
+}
+// ============================================================================================
+void osInit(void)
+
+/* Start the cycle counter that times the records. ITM setup is left to the debugger */
+
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+// ============================================================================================
@@ -0,0 +1,14 @@
+#ifndef ORBSTAT_CLIENT_H_
+#define ORBSTAT_CLIENT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// ============================================================================================
+void osInit(void);
+
+void __cyg_profile_func_enter(void *this_fn, void *call_site) __attribute__((no_instrument_function));
+void __cyg_profile_func_exit(void *this_fn, void *call_site) __attribute__((no_instrument_function));
+// ============================================================================================
+
+#endif /* ORBSTAT_CLIENT_H_ */